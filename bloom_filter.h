@@ -0,0 +1,257 @@
+#ifndef TABLE_BLOOM_FILTER_H
+#define TABLE_BLOOM_FILTER_H
+
+// 计数布隆过滤器，放在 Table::get 前面，不存在的 key 大多不用去跳表里查
+// 1. 每个位置是一个 4 bit 的计数器，add 加一、remove 减一，所以 del 之后也能把 key 去掉；
+//    计数器加到 15 就不再变了，宁可多报也不能漏报
+// 2. 分块：一个 key 的所有计数器都在同一个 64 字节的块里，查一次只有一次 cache miss
+// 3. 计数器 16 个一组放在 std::atomic<uint64_t> 里，用 CAS 修改，可以和跳表一样多线程并发调用
+// 4. 可以保存到文件，文件头里记下对应的数据文件大小和 key 数，打开表的时候对不上就重新建
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <stdint.h>
+#include "byte_array.h"
+
+namespace table {
+
+#define     FILTER_FILE_EXT     ".filter"
+
+// 过滤器的统计：lookups 是查过滤器的次数，negatives 是过滤器判断不存在、省掉跳表查找的次数，
+// false_positives 是过滤器说可能存在、跳表里却没有的次数
+struct FilterStats {
+    uint64_t lookups = 0 ;
+    uint64_t negatives = 0 ;
+    uint64_t false_positives = 0 ;
+} ;
+
+class CountingBloomFilter {
+public :
+    // 预计放 expected_keys 个 key，每个 key 平均 counters_per_key 个计数器
+    CountingBloomFilter(size_t expected_keys , size_t counters_per_key) ;
+    ~CountingBloomFilter() ;
+
+    bool may_contain(const ByteArray& key) const ;
+
+    void add(const ByteArray& key) ;
+
+    // 只能去掉之前 add 过的 key
+    void remove(const ByteArray& key) ;
+
+    // 所有计数器清零
+    void clear() ;
+
+    // 记一次查询的结果，found 是跳表里到底有没有
+    void record(bool maybe , bool found) ;
+
+    FilterStats stats() const ;
+
+    // data_size 和 keys 写进文件头，load 的时候数据文件大小一样才算加载成功，
+    // keys 返回文件头里的 key 数，调用的人自己检查和加载的 key 数是不是一样
+    bool save(const char *fileName , uint64_t data_size , uint64_t keys) const ;
+    bool load(const char *fileName , uint64_t data_size , uint64_t *keys) ;
+
+    // Non-copying
+    CountingBloomFilter(const CountingBloomFilter&) = delete ;
+    CountingBloomFilter& operator=(const CountingBloomFilter&) = delete ;
+
+private :
+    static const uint64_t MAGIC = 0x31544c4946425443ULL ; // "CTBFILT1"
+    static const int WORDS_PER_BLOCK = 8 ;      // 一块 64 字节
+    static const int COUNTERS_PER_WORD = 16 ;
+    static const int NUM_PROBES = 6 ;           // 每个 key 在块里的计数器个数
+    static const int STAT_STRIPES = 16 ;        // 统计按线程分散到几个 cache line 上，避免多个核抢同一个计数器
+
+    struct alignas(64) Block {
+        std::atomic<uint64_t> words[WORDS_PER_BLOCK] ;
+    } ;
+
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> lookups ;
+        std::atomic<uint64_t> negatives ;
+        std::atomic<uint64_t> false_positives ;
+    } ;
+
+    size_t _num_blocks ;
+    Block *_blocks ;
+    Stripe _stats[STAT_STRIPES] ;
+
+    static uint64_t hash(const ByteArray& key) ;
+
+    // 第 i 个计数器在块里的下标，每个占 7 bit
+    static int probe(uint64_t h , int i) { return (h >> (i * 7)) & (WORDS_PER_BLOCK * COUNTERS_PER_WORD - 1) ; }
+
+    const Block& block_of(uint64_t h) const { return this->_blocks[h % this->_num_blocks] ; }
+
+    // 给一个计数器加 delta(1 或者 -1)，到了 15 就不再变
+    static void update(std::atomic<uint64_t>& word , int shift , int delta) ;
+
+    static Stripe& stripe(const Stripe *stats) ;
+} ;
+
+CountingBloomFilter::CountingBloomFilter(size_t expected_keys , size_t counters_per_key) {
+    size_t counters = expected_keys * counters_per_key ;
+    size_t per_block = WORDS_PER_BLOCK * COUNTERS_PER_WORD ;
+    this->_num_blocks = counters / per_block + 1 ;
+    this->_blocks = new Block[this->_num_blocks] ;
+    this->clear() ;
+    for(int i = 0 ; i < STAT_STRIPES ; ++i) {
+        this->_stats[i].lookups.store(0 , std::memory_order_relaxed) ;
+        this->_stats[i].negatives.store(0 , std::memory_order_relaxed) ;
+        this->_stats[i].false_positives.store(0 , std::memory_order_relaxed) ;
+    }
+}
+
+CountingBloomFilter::~CountingBloomFilter() {
+    delete[] this->_blocks ;
+}
+
+inline uint64_t CountingBloomFilter::hash(const ByteArray& key) {
+    // FNV-1a 再用 splitmix64 的收尾打散，块号用低位取模，块里的下标用高位
+    uint64_t h = 14695981039346656037ULL ;
+    for(size_t i = 0 ; i < key.size() ; ++i) {
+        h ^= static_cast<uint8_t>(key.data()[i]) ;
+        h *= 1099511628211ULL ;
+    }
+    h ^= h >> 33 ;
+    h *= 0xff51afd7ed558ccdULL ;
+    h ^= h >> 33 ;
+    h *= 0xc4ceb9fe1a85ec53ULL ;
+    h ^= h >> 33 ;
+    return h ;
+}
+
+bool CountingBloomFilter::may_contain(const ByteArray& key) const {
+    uint64_t h = hash(key) ;
+    const Block &block = this->block_of(h) ;
+    uint64_t bits = h >> 20 ;
+    for(int i = 0 ; i < NUM_PROBES ; ++i) {
+        int c = probe(bits , i) ;
+        uint64_t word = block.words[c / COUNTERS_PER_WORD].load(std::memory_order_acquire) ;
+        if(((word >> ((c % COUNTERS_PER_WORD) * 4)) & 0xf) == 0) {
+            return false ;
+        }
+    }
+    return true ;
+}
+
+void CountingBloomFilter::update(std::atomic<uint64_t>& word , int shift , int delta) {
+    uint64_t old = word.load(std::memory_order_relaxed) ;
+    while(true) {
+        uint64_t count = (old >> shift) & 0xf ;
+        if(count == 0xf || (count == 0 && delta < 0)) {
+            return ;
+        }
+        uint64_t now = delta > 0 ? old + (1ULL << shift) : old - (1ULL << shift) ;
+        if(word.compare_exchange_weak(old , now , std::memory_order_acq_rel)) {
+            return ;
+        }
+    }
+}
+
+void CountingBloomFilter::add(const ByteArray& key) {
+    uint64_t h = hash(key) ;
+    Block &block = this->_blocks[h % this->_num_blocks] ;
+    uint64_t bits = h >> 20 ;
+    for(int i = 0 ; i < NUM_PROBES ; ++i) {
+        int c = probe(bits , i) ;
+        update(block.words[c / COUNTERS_PER_WORD] , (c % COUNTERS_PER_WORD) * 4 , 1) ;
+    }
+}
+
+void CountingBloomFilter::remove(const ByteArray& key) {
+    uint64_t h = hash(key) ;
+    Block &block = this->_blocks[h % this->_num_blocks] ;
+    uint64_t bits = h >> 20 ;
+    for(int i = 0 ; i < NUM_PROBES ; ++i) {
+        int c = probe(bits , i) ;
+        update(block.words[c / COUNTERS_PER_WORD] , (c % COUNTERS_PER_WORD) * 4 , -1) ;
+    }
+}
+
+void CountingBloomFilter::clear() {
+    for(size_t i = 0 ; i < this->_num_blocks ; ++i) {
+        for(int j = 0 ; j < WORDS_PER_BLOCK ; ++j) {
+            this->_blocks[i].words[j].store(0 , std::memory_order_relaxed) ;
+        }
+    }
+}
+
+inline CountingBloomFilter::Stripe& CountingBloomFilter::stripe(const Stripe *stats) {
+    static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % STAT_STRIPES ;
+    return const_cast<Stripe&>(stats[index]) ;
+}
+
+void CountingBloomFilter::record(bool maybe , bool found) {
+    Stripe &s = stripe(this->_stats) ;
+    s.lookups.fetch_add(1 , std::memory_order_relaxed) ;
+    if(!maybe) {
+        s.negatives.fetch_add(1 , std::memory_order_relaxed) ;
+    } else if(!found) {
+        s.false_positives.fetch_add(1 , std::memory_order_relaxed) ;
+    }
+}
+
+FilterStats CountingBloomFilter::stats() const {
+    FilterStats result ;
+    for(int i = 0 ; i < STAT_STRIPES ; ++i) {
+        result.lookups += this->_stats[i].lookups.load(std::memory_order_relaxed) ;
+        result.negatives += this->_stats[i].negatives.load(std::memory_order_relaxed) ;
+        result.false_positives += this->_stats[i].false_positives.load(std::memory_order_relaxed) ;
+    }
+    return result ;
+}
+
+// +-------------------------------文件格式--------------------------------+
+// | MAGIC | 块数 | 数据文件大小 | key 数 | 块 0 | 块 1 | ... (每块 64 字节) |
+// +-----------------------------------------------------------------------+
+bool CountingBloomFilter::save(const char *fileName , uint64_t data_size , uint64_t keys) const {
+    std::ofstream outfile(fileName , std::ios::binary | std::ios::trunc) ;
+    if(outfile.is_open() == false) {
+        return false ;
+    }
+    uint64_t header[4] = {MAGIC , this->_num_blocks , data_size , keys} ;
+    outfile.write(reinterpret_cast<const char*>(header) , sizeof(header)) ;
+    for(size_t i = 0 ; i < this->_num_blocks ; ++i) {
+        uint64_t words[WORDS_PER_BLOCK] ;
+        for(int j = 0 ; j < WORDS_PER_BLOCK ; ++j) {
+            words[j] = this->_blocks[i].words[j].load(std::memory_order_relaxed) ;
+        }
+        outfile.write(reinterpret_cast<const char*>(words) , sizeof(words)) ;
+    }
+    outfile.close() ;
+    return outfile.good() ;
+}
+
+bool CountingBloomFilter::load(const char *fileName , uint64_t data_size , uint64_t *keys) {
+    std::ifstream infile(fileName , std::ios::binary) ;
+    if(infile.is_open() == false) {
+        return false ;
+    }
+    uint64_t header[4] ;
+    if(!infile.read(reinterpret_cast<char*>(header) , sizeof(header))) {
+        return false ;
+    }
+    // 大小改过的过滤器，或者不是和这份数据文件一起保存的，都不能用
+    if(header[0] != MAGIC || header[1] != this->_num_blocks || header[2] != data_size) {
+        return false ;
+    }
+    for(size_t i = 0 ; i < this->_num_blocks ; ++i) {
+        uint64_t words[WORDS_PER_BLOCK] ;
+        if(!infile.read(reinterpret_cast<char*>(words) , sizeof(words))) {
+            this->clear() ;
+            return false ;
+        }
+        for(int j = 0 ; j < WORDS_PER_BLOCK ; ++j) {
+            this->_blocks[i].words[j].store(words[j] , std::memory_order_relaxed) ;
+        }
+    }
+    *keys = header[3] ;
+    return true ;
+}
+
+} // namespace table
+
+#endif
@@ -0,0 +1,1082 @@
+#ifndef TABLE_BTREE_H
+#define TABLE_BTREE_H
+
+// B+ 树内存表，和 SkipList 实现同一个 Memtable 接口
+// 1. 内部节点和叶子都是定长数组，key 的前 8 个字节(大端序)单独放一个数组，节点里二分查找时大部分比较只看这个数组，
+//    一次查找只有 O(log_32 n) 个节点的 cache miss，跳表每往前走一步都可能是一次 cache miss；也不需要每个 key 都带 next 指针数组
+// 2. 叶子之间是双向链表，迭代器顺着叶子走；往最右边的叶子追加的时候不对半分裂，顺序加载的叶子是满的
+// 3. 并发：一把读写锁，读(get/multi_get/迭代器的每一步)拿共享锁，写拿独占锁；Writer 每写一个 key 拿一次独占锁，
+//    一批写共用一个序列号，Writer 析构的时候才发布，读不用等整批写完，也看不到写了一半的一批
+// 4. 多版本和跳表一样：每个 key 一条按序列号从新到旧的版本链，删除加一个 tombstone；写的时候顺手摘掉最老的快照也看不到的版本，
+//    tombstone 谁都能看到以后把 key 从树里删掉，节点太空的时候和兄弟节点合并或者借几个 key。
+//    这些都在独占锁里做，读者都拿着共享锁，摘下来的内存可以马上还给内存池，不需要 epoch
+// 5. 迭代器不一直拿着锁：每一步拿一次共享锁，树的结构没有变过(_version 没变)就从上次的叶子和下标接着走，变过就按当前 key 重新定位
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <set>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include "memory_pool.h"
+#include "memtable.h"
+#include "byte_array.h"
+
+namespace table {
+
+class BTree : public Memtable {
+private :
+    static const int LEAF_SLOTS = 32 ;
+    static const int INNER_SLOTS = 32 ;
+    static const int MAX_DEPTH = 32 ;           // 每个节点至少 1/4 满，32 层远远够用
+    static const uint64_t NO_SNAPSHOT = UINT64_MAX ;
+    static const size_t COLLECT_BATCH = 65536 ; // 攒了这么多个回收不掉的旧版本以后扫一遍整棵树
+
+    // 一个版本，链上的版本按序列号从大到小排，deleted 为 true 的是 tombstone
+    struct Value {
+        uint64_t seq ;
+        Value *older ;
+        uint32_t size ;
+        bool deleted ;
+        char data[1] ;
+    } ;
+
+    // 叶子里的一个 key：key 的字节和版本链的头
+    struct Entry {
+        Value *head ;
+        uint32_t key_size ;
+        char key[1] ;
+
+        ByteArray key_bytes() const     { return ByteArray(this->key , this->key_size) ; }
+    } ;
+
+    // 内部节点里的分隔 key，单独拷贝一份，叶子里的 key 删掉了也不影响它
+    struct Key {
+        uint32_t size ;
+        char data[1] ;
+    } ;
+
+    struct Node {
+        bool leaf ;
+        uint16_t count ;
+    } ;
+
+    // prefix[i] 是 entries[i] 的 key 的前 8 个字节
+    struct Leaf : Node {
+        uint64_t prefix[LEAF_SLOTS] ;
+        Entry *entries[LEAF_SLOTS] ;
+        Leaf *prev ;
+        Leaf *next ;
+    } ;
+
+    // children[i] 里的 key 都小于 keys[i]，children[i + 1] 里的 key 都不小于 keys[i]
+    struct Inner : Node {
+        uint64_t prefix[INNER_SLOTS] ;
+        Key *keys[INNER_SLOTS] ;
+        Node *children[INNER_SLOTS + 1] ;
+    } ;
+
+    // 从根到叶子经过的内部节点和走的孩子下标，分裂和合并的时候顺着它往上改
+    struct Path {
+        Inner *nodes[MAX_DEPTH] ;
+        int index[MAX_DEPTH] ;
+        int depth ;
+    } ;
+
+    MemoryPool _pool ;
+    mutable std::shared_mutex _mutex ;
+    Node *_root ;
+    Leaf *_first ;      // 最左边的叶子，合并的时候总是右边并到左边，它不会被释放
+    // 叶子里的 key 每增删一次加一，迭代器用它判断上次的叶子和下标还能不能用；在锁里读写
+    uint64_t _version ;
+
+    // 写都在独占锁里：_next_seq 是分配出去的最大序列号，_pending 是还没有发布的 Writer 的序列号；
+    // _last_seq 之前的写都发布了，快照只会取到它，没有 Writer 在写的时候它就是 _next_seq
+    uint64_t _next_seq ;
+    std::vector<uint64_t> _pending ;
+    std::atomic<uint64_t> _last_seq ;
+    std::mutex _snapshot_mutex ;
+    std::multiset<uint64_t> _snapshots ;
+    std::atomic<uint64_t> _oldest_snapshot ;
+    std::atomic<size_t> _garbage ;
+    std::atomic<size_t> _collect_at ;
+
+    static uint64_t key_prefix(const ByteArray& key) ;
+
+    // 比较一个已经存下来的 key 和 key，返回值和 memcmp 一样
+    static int compare(uint64_t a_prefix , const char *a , size_t a_size , const ByteArray& key , uint64_t prefix) ;
+    static int compare(const Leaf *leaf , int i , const ByteArray& key , uint64_t prefix) ;
+    static int compare(const Inner *inner , int i , const ByteArray& key , uint64_t prefix) ;
+
+    // 叶子里第一个不小于 key 的下标
+    static int lower_bound(const Leaf *leaf , const ByteArray& key , uint64_t prefix) ;
+    // key 在内部节点的第几个孩子里
+    static int child_index(const Inner *inner , const ByteArray& key , uint64_t prefix) ;
+
+    // key 所在的叶子，path 不为空的话记下经过的内部节点
+    Leaf* find_leaf(const ByteArray& key , uint64_t prefix , Path *path) const ;
+    Leaf* last_leaf() const ;
+
+    Leaf* new_leaf() ;
+    Inner* new_inner() ;
+    Entry* new_entry(const ByteArray& key) ;
+    Key* new_key(const char *data , size_t size) ;
+    Value* new_value(const ByteArray& value , uint64_t seq , bool deleted) ;
+    void free_key(Key *key) ;
+    void free_value(Value *value) ;
+    void free_versions(Value *value) ;
+    // 连同版本链一起释放
+    void free_entry(Entry *entry) ;
+
+    // key 的 Entry，没有的话插入一个版本链为空的新 Entry
+    Entry* find_or_insert(const ByteArray& key) ;
+    // 叶子满了，分裂成两个以后把 entry 插到 pos
+    void split_leaf(Leaf *leaf , int pos , uint64_t prefix , Entry *entry , Path &path) ;
+    // 第 level 层的节点分裂出了 right，把分隔 key 插到它的父节点里，level 为 0 的话新建一个根
+    void insert_into_parent(Path &path , int level , Key *sep , uint64_t sep_prefix , Node *right) ;
+
+    // 把 key 从树里删掉，key 必须存在
+    void remove_entry(const ByteArray& key) ;
+    // 删掉父节点 parent 的第 sep 个分隔 key 和它右边的孩子
+    static void remove_child(Inner *parent , int sep) ;
+    void rebalance_leaf(Leaf *leaf , Path &path) ;
+    void rebalance_inner(Path &path , int level) ;
+
+    // LATEST 看的是已经发布了的最新版本；调用的线程要拿着锁
+    const Value* version_at(const Entry *entry , uint64_t seq) const ;
+    bool is_visible(const Entry *entry , uint64_t seq) const ;
+    bool is_published(uint64_t seq) const ;
+    // Writer 的序列号：begin_batch 分配一个不发布的序列号，end_batch 发布它；调用的线程要拿着独占锁
+    uint64_t begin_batch() ;
+    void end_batch(uint64_t seq) ;
+
+    uint64_t oldest_visible() const ;
+
+    // 写一个版本，value 为空表示删除；返回写之前 key 是不是存在。调用的线程要拿着独占锁
+    // seq 为 0 的时候分配一个新的序列号马上发布，不然用 Writer 的序列号
+    bool apply(const ByteArray& key , const ByteArray* value , uint64_t seq = 0) ;
+    // 摘掉 entry 上谁都看不到的版本，tombstone 谁都能看到的话把 key 从树里删掉
+    void collect(Entry *entry , const ByteArray& key) ;
+    void collect_locked() ;
+
+public :
+    class Writer : public Memtable::Writer {
+    public :
+        explicit Writer(BTree *tree) : _tree(tree) , _seq(0) { }
+        ~Writer() ;
+        bool upsert(const ByteArray& key , const ByteArray& value) override { return this->write(key , &value) ; }
+        bool erase(const ByteArray& key) override                           { return this->write(key , nullptr) ; }
+    private :
+        BTree *_tree ;
+        uint64_t _seq ;         // 还没有写过的时候是 0
+        bool write(const ByteArray& key , const ByteArray* value) ;
+    } ;
+
+    class Builder : public Memtable::Builder {
+    public :
+        explicit Builder(BTree *tree) ;
+        bool append(const ByteArray& key , const ByteArray& value) override ;
+    private :
+        BTree *_tree ;
+        std::unique_lock<std::shared_mutex> _lock ;
+        std::string _last ;
+        bool _has_last ;
+    } ;
+
+    // 迭代器拿着的是 key 和 value 的拷贝，不会读到被释放的内存
+    class Iterator : public Memtable::Iterator {
+    public :
+        Iterator(BTree *tree , uint64_t seq) ;
+        bool good() override                        { return this->_good ; }
+        void next() override ;
+        void prev() override ;
+        void seek(const ByteArray& key) override ;
+        void seek_to_first() override ;
+        void seek_to_last() override ;
+        ByteArray key() override                    { return ByteArray(this->_key) ; }
+        ByteArray value() override                  { return ByteArray(this->_value) ; }
+    private :
+        BTree *_tree ;
+        uint64_t _seq ;
+        const Leaf *_leaf ;
+        int _pos ;
+        uint64_t _version ;
+        bool _good ;
+        std::string _key ;
+        std::string _value ;
+
+        // 从 (_leaf , _pos) 开始往后(往前)找第一个快照里看得到的 key
+        void settle_forward() ;
+        void settle_backward() ;
+        void capture(const Entry *entry , const Value *value) ;
+    } ;
+
+    BTree() ;
+    ~BTree() ;
+
+    const char* name() const override { return "btree" ; }
+    std::unique_ptr<Memtable::Iterator> new_iterator(uint64_t seq = LATEST) override ;
+    bool get(const ByteArray& key , std::string* value , uint64_t seq = LATEST) override ;
+    void put(const ByteArray& key , const ByteArray& value , bool *existed = nullptr) override ;
+    bool del(const ByteArray& key) override ;
+    void multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) override ;
+    std::unique_ptr<Memtable::Writer> new_writer() override ;
+    std::unique_ptr<Memtable::Builder> new_builder() override ;
+    uint64_t acquire_snapshot() override ;
+    void release_snapshot(uint64_t seq) override ;
+    uint64_t last_sequence() const override ;
+    size_t memory_usage() const override ;
+
+    // 扫一遍整棵树，回收所有快照都看不到的旧版本和 tombstone
+    void collect_all() ;
+
+    // 树的高度，只有一个叶子的时候是 1
+    int height() const ;
+
+    // Non-copying
+    BTree(const BTree&) = delete ;
+    BTree& operator=(const BTree&) = delete ;
+} ;
+
+BTree::BTree() : _version(0) , _next_seq(0) , _last_seq(0) , _oldest_snapshot(NO_SNAPSHOT) , _garbage(0) , _collect_at(COLLECT_BATCH) {
+    this->_first = this->new_leaf() ;
+    this->_root = this->_first ;
+}
+
+// 节点、key 和版本都在内存池里，内存池析构时整块释放
+BTree::~BTree() { }
+
+inline uint64_t BTree::key_prefix(const ByteArray& key) {
+    uint64_t prefix = 0 ;
+    for(uint8_t i = 0 ; i < sizeof(uint64_t) ; ++i) {
+        prefix <<= 8 ;
+        if(i < key.size()) {
+            prefix |= static_cast<uint8_t>(key.data()[i]) ;
+        }
+    }
+    return prefix ;
+}
+
+inline int BTree::compare(uint64_t a_prefix , const char *a , size_t a_size , const ByteArray& key , uint64_t prefix) {
+    if(a_prefix != prefix) {
+        return a_prefix < prefix ? -1 : 1 ;
+    }
+    // 前 8 个字节一样，两个 key 都不短于 8 个字节的话从第 9 个字节开始比
+    size_t size = std::min(a_size , key.size()) ;
+    size_t skip = size >= sizeof(uint64_t) ? sizeof(uint64_t) : 0 ;
+    int cmp = memcmp(a + skip , key.data() + skip , size - skip) ;
+    if(cmp != 0) {
+        return cmp ;
+    }
+    if(a_size == key.size()) {
+        return 0 ;
+    }
+    return a_size < key.size() ? -1 : 1 ;
+}
+
+inline int BTree::compare(const Leaf *leaf , int i , const ByteArray& key , uint64_t prefix) {
+    const Entry *entry = leaf->entries[i] ;
+    return compare(leaf->prefix[i] , entry->key , entry->key_size , key , prefix) ;
+}
+
+inline int BTree::compare(const Inner *inner , int i , const ByteArray& key , uint64_t prefix) {
+    const Key *sep = inner->keys[i] ;
+    return compare(inner->prefix[i] , sep->data , sep->size , key , prefix) ;
+}
+
+inline int BTree::lower_bound(const Leaf *leaf , const ByteArray& key , uint64_t prefix) {
+    int lo = 0 , hi = leaf->count ;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2 ;
+        if(compare(leaf , mid , key , prefix) < 0) {
+            lo = mid + 1 ;
+        } else {
+            hi = mid ;
+        }
+    }
+    return lo ;
+}
+
+inline int BTree::child_index(const Inner *inner , const ByteArray& key , uint64_t prefix) {
+    // 第一个大于 key 的分隔 key 的下标
+    int lo = 0 , hi = inner->count ;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2 ;
+        if(compare(inner , mid , key , prefix) <= 0) {
+            lo = mid + 1 ;
+        } else {
+            hi = mid ;
+        }
+    }
+    return lo ;
+}
+
+BTree::Leaf* BTree::find_leaf(const ByteArray& key , uint64_t prefix , Path *path) const {
+    Node *node = this->_root ;
+    int depth = 0 ;
+    while(!node->leaf) {
+        Inner *inner = static_cast<Inner*>(node) ;
+        int i = child_index(inner , key , prefix) ;
+        if(path != nullptr) {
+            path->nodes[depth] = inner ;
+            path->index[depth] = i ;
+        }
+        ++depth ;
+        node = inner->children[i] ;
+    }
+    if(path != nullptr) {
+        path->depth = depth ;
+    }
+    return static_cast<Leaf*>(node) ;
+}
+
+BTree::Leaf* BTree::last_leaf() const {
+    Node *node = this->_root ;
+    while(!node->leaf) {
+        Inner *inner = static_cast<Inner*>(node) ;
+        node = inner->children[inner->count] ;
+    }
+    return static_cast<Leaf*>(node) ;
+}
+
+int BTree::height() const {
+    std::shared_lock<std::shared_mutex> lock(this->_mutex) ;
+    int height = 1 ;
+    for(const Node *node = this->_root ; !node->leaf ; node = static_cast<const Inner*>(node)->children[0]) {
+        ++height ;
+    }
+    return height ;
+}
+
+BTree::Leaf* BTree::new_leaf() {
+    Leaf *leaf = new (this->_pool.allocate(sizeof(Leaf))) Leaf() ;
+    leaf->leaf = true ;
+    leaf->count = 0 ;
+    leaf->prev = leaf->next = nullptr ;
+    return leaf ;
+}
+
+BTree::Inner* BTree::new_inner() {
+    Inner *inner = new (this->_pool.allocate(sizeof(Inner))) Inner() ;
+    inner->leaf = false ;
+    inner->count = 0 ;
+    return inner ;
+}
+
+BTree::Entry* BTree::new_entry(const ByteArray& key) {
+    Entry *entry = reinterpret_cast<Entry*>(this->_pool.allocate(offsetof(Entry , key) + key.size())) ;
+    entry->head = nullptr ;
+    entry->key_size = key.size() ;
+    memcpy(entry->key , key.data() , key.size()) ;
+    return entry ;
+}
+
+BTree::Key* BTree::new_key(const char *data , size_t size) {
+    Key *key = reinterpret_cast<Key*>(this->_pool.allocate(offsetof(Key , data) + size)) ;
+    key->size = size ;
+    memcpy(key->data , data , size) ;
+    return key ;
+}
+
+BTree::Value* BTree::new_value(const ByteArray& value , uint64_t seq , bool deleted) {
+    Value *v = reinterpret_cast<Value*>(this->_pool.allocate(offsetof(Value , data) + value.size())) ;
+    v->seq = seq ;
+    v->older = nullptr ;
+    v->size = value.size() ;
+    v->deleted = deleted ;
+    memcpy(v->data , value.data() , value.size()) ;
+    return v ;
+}
+
+inline void BTree::free_key(Key *key) {
+    this->_pool.deallocate(key , offsetof(Key , data) + key->size) ;
+}
+
+inline void BTree::free_value(Value *value) {
+    this->_pool.deallocate(value , offsetof(Value , data) + value->size) ;
+}
+
+void BTree::free_versions(Value *value) {
+    while(value != nullptr) {
+        Value *older = value->older ;
+        this->free_value(value) ;
+        value = older ;
+    }
+}
+
+void BTree::free_entry(Entry *entry) {
+    this->free_versions(entry->head) ;
+    this->_pool.deallocate(entry , offsetof(Entry , key) + entry->key_size) ;
+}
+
+BTree::Entry* BTree::find_or_insert(const ByteArray& key) {
+    const uint64_t prefix = key_prefix(key) ;
+    Path path ;
+    Leaf *leaf = this->find_leaf(key , prefix , &path) ;
+    int pos = lower_bound(leaf , key , prefix) ;
+    if(pos < leaf->count && compare(leaf , pos , key , prefix) == 0) {
+        return leaf->entries[pos] ;
+    }
+    Entry *entry = this->new_entry(key) ;
+    ++this->_version ;
+    if(leaf->count == LEAF_SLOTS) {
+        this->split_leaf(leaf , pos , prefix , entry , path) ;
+        return entry ;
+    }
+    for(int i = leaf->count ; i > pos ; --i) {
+        leaf->prefix[i] = leaf->prefix[i - 1] ;
+        leaf->entries[i] = leaf->entries[i - 1] ;
+    }
+    leaf->prefix[pos] = prefix ;
+    leaf->entries[pos] = entry ;
+    ++leaf->count ;
+    return entry ;
+}
+
+void BTree::split_leaf(Leaf *leaf , int pos , uint64_t prefix , Entry *entry , Path &path) {
+    uint64_t prefixes[LEAF_SLOTS + 1] ;
+    Entry *entries[LEAF_SLOTS + 1] ;
+    for(int i = 0 , j = 0 ; i <= LEAF_SLOTS ; ++i) {
+        if(i == pos) {
+            prefixes[i] = prefix ;
+            entries[i] = entry ;
+        } else {
+            prefixes[i] = leaf->prefix[j] ;
+            entries[i] = leaf->entries[j] ;
+            ++j ;
+        }
+    }
+    // 往最右边的叶子追加的时候左边留满，顺序写入不会留下一串半满的叶子
+    int left = (pos == LEAF_SLOTS && leaf->next == nullptr) ? LEAF_SLOTS : (LEAF_SLOTS + 1) / 2 ;
+
+    Leaf *right = this->new_leaf() ;
+    for(int i = 0 ; i < left ; ++i) {
+        leaf->prefix[i] = prefixes[i] ;
+        leaf->entries[i] = entries[i] ;
+    }
+    leaf->count = left ;
+    for(int i = left ; i <= LEAF_SLOTS ; ++i) {
+        right->prefix[i - left] = prefixes[i] ;
+        right->entries[i - left] = entries[i] ;
+    }
+    right->count = LEAF_SLOTS + 1 - left ;
+    right->next = leaf->next ;
+    right->prev = leaf ;
+    if(leaf->next != nullptr) {
+        leaf->next->prev = right ;
+    }
+    leaf->next = right ;
+
+    const Entry *first = right->entries[0] ;
+    this->insert_into_parent(path , path.depth , this->new_key(first->key , first->key_size) , right->prefix[0] , right) ;
+}
+
+void BTree::insert_into_parent(Path &path , int level , Key *sep , uint64_t sep_prefix , Node *right) {
+    if(level == 0) {
+        Inner *root = this->new_inner() ;
+        root->count = 1 ;
+        root->keys[0] = sep ;
+        root->prefix[0] = sep_prefix ;
+        root->children[0] = this->_root ;
+        root->children[1] = right ;
+        this->_root = root ;
+        return ;
+    }
+    Inner *parent = path.nodes[level - 1] ;
+    int pos = path.index[level - 1] ; // 分裂的节点是 children[pos]，分隔 key 插到 keys[pos]
+    if(parent->count < INNER_SLOTS) {
+        for(int i = parent->count ; i > pos ; --i) {
+            parent->keys[i] = parent->keys[i - 1] ;
+            parent->prefix[i] = parent->prefix[i - 1] ;
+            parent->children[i + 1] = parent->children[i] ;
+        }
+        parent->keys[pos] = sep ;
+        parent->prefix[pos] = sep_prefix ;
+        parent->children[pos + 1] = right ;
+        ++parent->count ;
+        return ;
+    }
+
+    // 父节点也满了：INNER_SLOTS + 1 个 key 里中间那个提到上一层，左右各分一半
+    Key *keys[INNER_SLOTS + 1] ;
+    uint64_t prefixes[INNER_SLOTS + 1] ;
+    Node *children[INNER_SLOTS + 2] ;
+    for(int i = 0 , j = 0 ; i <= INNER_SLOTS ; ++i) {
+        if(i == pos) {
+            keys[i] = sep ;
+            prefixes[i] = sep_prefix ;
+        } else {
+            keys[i] = parent->keys[j] ;
+            prefixes[i] = parent->prefix[j] ;
+            ++j ;
+        }
+    }
+    for(int i = 0 , j = 0 ; i <= INNER_SLOTS + 1 ; ++i) {
+        if(i == pos + 1) {
+            children[i] = right ;
+        } else {
+            children[i] = parent->children[j++] ;
+        }
+    }
+    bool rightmost = pos == INNER_SLOTS && (level == 1 || path.index[level - 2] == path.nodes[level - 2]->count) ;
+    int mid = rightmost ? INNER_SLOTS - 1 : INNER_SLOTS / 2 ;
+
+    Inner *sibling = this->new_inner() ;
+    for(int i = 0 ; i < mid ; ++i) {
+        parent->keys[i] = keys[i] ;
+        parent->prefix[i] = prefixes[i] ;
+    }
+    for(int i = 0 ; i <= mid ; ++i) {
+        parent->children[i] = children[i] ;
+    }
+    parent->count = mid ;
+    for(int i = mid + 1 ; i <= INNER_SLOTS ; ++i) {
+        sibling->keys[i - mid - 1] = keys[i] ;
+        sibling->prefix[i - mid - 1] = prefixes[i] ;
+    }
+    for(int i = mid + 1 ; i <= INNER_SLOTS + 1 ; ++i) {
+        sibling->children[i - mid - 1] = children[i] ;
+    }
+    sibling->count = INNER_SLOTS - mid ;
+    this->insert_into_parent(path , level - 1 , keys[mid] , prefixes[mid] , sibling) ;
+}
+
+void BTree::remove_entry(const ByteArray& key) {
+    const uint64_t prefix = key_prefix(key) ;
+    Path path ;
+    Leaf *leaf = this->find_leaf(key , prefix , &path) ;
+    int pos = lower_bound(leaf , key , prefix) ;
+    assert(pos < leaf->count && compare(leaf , pos , key , prefix) == 0) ;
+    this->free_entry(leaf->entries[pos]) ;
+    for(int i = pos + 1 ; i < leaf->count ; ++i) {
+        leaf->prefix[i - 1] = leaf->prefix[i] ;
+        leaf->entries[i - 1] = leaf->entries[i] ;
+    }
+    --leaf->count ;
+    ++this->_version ;
+    this->rebalance_leaf(leaf , path) ;
+}
+
+void BTree::remove_child(Inner *parent , int sep) {
+    for(int i = sep + 1 ; i < parent->count ; ++i) {
+        parent->keys[i - 1] = parent->keys[i] ;
+        parent->prefix[i - 1] = parent->prefix[i] ;
+        parent->children[i] = parent->children[i + 1] ;
+    }
+    --parent->count ;
+}
+
+void BTree::rebalance_leaf(Leaf *leaf , Path &path) {
+    if(path.depth == 0 || leaf->count >= LEAF_SLOTS / 4) {
+        return ;
+    }
+    Inner *parent = path.nodes[path.depth - 1] ;
+    int idx = path.index[path.depth - 1] ;
+    // 有左兄弟就和左兄弟一起调整，没有的话和右兄弟
+    int sep = idx > 0 ? idx - 1 : 0 ;
+    Leaf *left = static_cast<Leaf*>(parent->children[sep]) ;
+    Leaf *right = static_cast<Leaf*>(parent->children[sep + 1]) ;
+    int total = left->count + right->count ;
+
+    if(total <= LEAF_SLOTS) {
+        // 右边并到左边
+        for(int i = 0 ; i < right->count ; ++i) {
+            left->prefix[left->count + i] = right->prefix[i] ;
+            left->entries[left->count + i] = right->entries[i] ;
+        }
+        left->count = total ;
+        left->next = right->next ;
+        if(right->next != nullptr) {
+            right->next->prev = left ;
+        }
+        this->_pool.deallocate(right , sizeof(Leaf)) ;
+        this->free_key(parent->keys[sep]) ;
+        remove_child(parent , sep) ;
+        this->rebalance_inner(path , path.depth - 1) ;
+        return ;
+    }
+
+    // 两边的 key 平分
+    int n_left = total / 2 ;
+    if(left->count > n_left) {
+        int move = left->count - n_left ;
+        for(int i = right->count - 1 ; i >= 0 ; --i) {
+            right->prefix[i + move] = right->prefix[i] ;
+            right->entries[i + move] = right->entries[i] ;
+        }
+        for(int i = 0 ; i < move ; ++i) {
+            right->prefix[i] = left->prefix[n_left + i] ;
+            right->entries[i] = left->entries[n_left + i] ;
+        }
+        right->count += move ;
+    } else {
+        int move = n_left - left->count ;
+        for(int i = 0 ; i < move ; ++i) {
+            left->prefix[left->count + i] = right->prefix[i] ;
+            left->entries[left->count + i] = right->entries[i] ;
+        }
+        for(int i = move ; i < right->count ; ++i) {
+            right->prefix[i - move] = right->prefix[i] ;
+            right->entries[i - move] = right->entries[i] ;
+        }
+        right->count -= move ;
+    }
+    left->count = n_left ;
+    const Entry *first = right->entries[0] ;
+    this->free_key(parent->keys[sep]) ;
+    parent->keys[sep] = this->new_key(first->key , first->key_size) ;
+    parent->prefix[sep] = right->prefix[0] ;
+}
+
+void BTree::rebalance_inner(Path &path , int level) {
+    Inner *node = path.nodes[level] ;
+    if(level == 0) {
+        // 根只剩一个孩子的时候树矮一层
+        if(node->count == 0) {
+            this->_root = node->children[0] ;
+            this->_pool.deallocate(node , sizeof(Inner)) ;
+        }
+        return ;
+    }
+    if(node->count >= INNER_SLOTS / 4) {
+        return ;
+    }
+    Inner *parent = path.nodes[level - 1] ;
+    int idx = path.index[level - 1] ;
+    int sep = idx > 0 ? idx - 1 : 0 ;
+    Inner *left = static_cast<Inner*>(parent->children[sep]) ;
+    Inner *right = static_cast<Inner*>(parent->children[sep + 1]) ;
+    // 父节点的分隔 key 放到两个节点的 key 中间，一起重新分
+    int total = left->count + 1 + right->count ;
+
+    if(total <= INNER_SLOTS) {
+        left->keys[left->count] = parent->keys[sep] ;
+        left->prefix[left->count] = parent->prefix[sep] ;
+        for(int i = 0 ; i < right->count ; ++i) {
+            left->keys[left->count + 1 + i] = right->keys[i] ;
+            left->prefix[left->count + 1 + i] = right->prefix[i] ;
+        }
+        for(int i = 0 ; i <= right->count ; ++i) {
+            left->children[left->count + 1 + i] = right->children[i] ;
+        }
+        left->count = total ;
+        this->_pool.deallocate(right , sizeof(Inner)) ;
+        remove_child(parent , sep) ;
+        this->rebalance_inner(path , level - 1) ;
+        return ;
+    }
+
+    Key *keys[INNER_SLOTS * 2 + 1] ;
+    uint64_t prefixes[INNER_SLOTS * 2 + 1] ;
+    Node *children[INNER_SLOTS * 2 + 2] ;
+    int n = 0 , c = 0 ;
+    for(int i = 0 ; i < left->count ; ++i , ++n) {
+        keys[n] = left->keys[i] ;
+        prefixes[n] = left->prefix[i] ;
+    }
+    keys[n] = parent->keys[sep] ;
+    prefixes[n++] = parent->prefix[sep] ;
+    for(int i = 0 ; i < right->count ; ++i , ++n) {
+        keys[n] = right->keys[i] ;
+        prefixes[n] = right->prefix[i] ;
+    }
+    for(int i = 0 ; i <= left->count ; ++i) children[c++] = left->children[i] ;
+    for(int i = 0 ; i <= right->count ; ++i) children[c++] = right->children[i] ;
+
+    int mid = total / 2 ;
+    for(int i = 0 ; i < mid ; ++i) {
+        left->keys[i] = keys[i] ;
+        left->prefix[i] = prefixes[i] ;
+    }
+    for(int i = 0 ; i <= mid ; ++i) {
+        left->children[i] = children[i] ;
+    }
+    left->count = mid ;
+    parent->keys[sep] = keys[mid] ;
+    parent->prefix[sep] = prefixes[mid] ;
+    for(int i = mid + 1 ; i < total ; ++i) {
+        right->keys[i - mid - 1] = keys[i] ;
+        right->prefix[i - mid - 1] = prefixes[i] ;
+    }
+    for(int i = mid + 1 ; i <= total ; ++i) {
+        right->children[i - mid - 1] = children[i] ;
+    }
+    right->count = total - mid - 1 ;
+}
+
+inline const BTree::Value* BTree::version_at(const Entry *entry , uint64_t seq) const {
+    // 快照的序列号不大于 _last_seq，它能看到的版本都已经发布了
+    const Value *v = entry->head ;
+    while(v != nullptr && (v->seq > seq || (seq == LATEST && !this->is_published(v->seq)))) {
+        v = v->older ;
+    }
+    return v ;
+}
+
+inline bool BTree::is_visible(const Entry *entry , uint64_t seq) const {
+    const Value *v = this->version_at(entry , seq) ;
+    return v != nullptr && !v->deleted ;
+}
+
+inline bool BTree::is_published(uint64_t seq) const {
+    return seq <= this->_last_seq.load(std::memory_order_relaxed) ||
+           std::find(this->_pending.begin() , this->_pending.end() , seq) == this->_pending.end() ;
+}
+
+uint64_t BTree::begin_batch() {
+    uint64_t seq = ++this->_next_seq ;
+    this->_pending.push_back(seq) ;
+    return seq ;
+}
+
+void BTree::end_batch(uint64_t seq) {
+    this->_pending.erase(std::find(this->_pending.begin() , this->_pending.end() , seq)) ;
+    // 推到最早的还没有发布的 Writer 前面
+    uint64_t last = this->_next_seq ;
+    for(uint64_t pending : this->_pending) {
+        last = std::min(last , pending - 1) ;
+    }
+    this->_last_seq.store(last , std::memory_order_release) ;
+}
+
+inline uint64_t BTree::oldest_visible() const {
+    uint64_t last = this->_last_seq.load() ;
+    return std::min(last , this->_oldest_snapshot.load()) ;
+}
+
+bool BTree::apply(const ByteArray& key , const ByteArray* value , uint64_t seq) {
+    Entry *entry ;
+    if(value == nullptr) {
+        const uint64_t prefix = key_prefix(key) ;
+        Leaf *leaf = this->find_leaf(key , prefix , nullptr) ;
+        int pos = lower_bound(leaf , key , prefix) ;
+        if(pos == leaf->count || compare(leaf , pos , key , prefix) != 0 || leaf->entries[pos]->head->deleted) {
+            return false ;
+        }
+        entry = leaf->entries[pos] ;
+    } else {
+        entry = this->find_or_insert(key) ;
+    }
+    bool existed = entry->head != nullptr && !entry->head->deleted ;
+    const bool single = seq == 0 ;
+    if(single) {
+        seq = ++this->_next_seq ;
+    }
+    Value *v = value != nullptr ? this->new_value(*value , seq , false) : this->new_value("" , seq , true) ;
+    v->older = entry->head ;
+    entry->head = v ;
+    // 有 Writer 还没有发布的话 _last_seq 推不过去，这次写不在 _pending 里，不带快照的读照样看得到
+    if(single && this->_pending.empty()) {
+        this->_last_seq.store(seq , std::memory_order_release) ;
+    }
+    this->collect(entry , key) ;
+    if(this->_garbage.load(std::memory_order_relaxed) >= this->_collect_at.load(std::memory_order_relaxed)) {
+        this->collect_locked() ;
+    }
+    return existed ;
+}
+
+void BTree::collect(Entry *entry , const ByteArray& key) {
+    // v 是最老的快照能看到的版本，比它旧的版本谁都看不到了
+    uint64_t oldest = this->oldest_visible() ;
+    Value *head = entry->head ;
+    Value *v = head ;
+    while(v != nullptr && v->seq > oldest) {
+        v = v->older ;
+    }
+    if(v == nullptr) {
+        if(head->deleted || head->older != nullptr) {
+            this->_garbage.fetch_add(1 , std::memory_order_relaxed) ;
+        }
+        return ;
+    }
+    this->free_versions(v->older) ;
+    v->older = nullptr ;
+    if(v != head) {
+        this->_garbage.fetch_add(1 , std::memory_order_relaxed) ;
+        return ;
+    }
+    if(v->deleted) {
+        this->remove_entry(key) ;
+    }
+}
+
+void BTree::collect_all() {
+    std::unique_lock<std::shared_mutex> lock(this->_mutex) ;
+    this->collect_locked() ;
+}
+
+void BTree::collect_locked() {
+    this->_garbage.store(0 , std::memory_order_relaxed) ;
+    // 先摘掉旧版本，tombstone 能删掉的 key 记下来，遍历完再删，删除会改动叶子
+    std::vector<std::string> removable ;
+    for(Leaf *leaf = this->_first ; leaf != nullptr ; leaf = leaf->next) {
+        for(int i = 0 ; i < leaf->count ; ++i) {
+            Entry *entry = leaf->entries[i] ;
+            size_t garbage = this->_garbage.load(std::memory_order_relaxed) ;
+            if(entry->head->older == nullptr && !entry->head->deleted) {
+                continue ;
+            }
+            uint64_t oldest = this->oldest_visible() ;
+            Value *v = entry->head ;
+            while(v != nullptr && v->seq > oldest) {
+                v = v->older ;
+            }
+            if(v == nullptr || v != entry->head) {
+                this->_garbage.store(garbage + 1 , std::memory_order_relaxed) ;
+            }
+            if(v != nullptr) {
+                this->free_versions(v->older) ;
+                v->older = nullptr ;
+                if(v == entry->head && v->deleted) {
+                    removable.emplace_back(entry->key , entry->key_size) ;
+                }
+            }
+        }
+    }
+    for(const std::string &key : removable) {
+        this->remove_entry(key) ;
+    }
+    // 还有快照挡着回收不掉的，等它们再翻一倍再扫
+    size_t remain = this->_garbage.load(std::memory_order_relaxed) * 2 ;
+    this->_collect_at.store(remain > COLLECT_BATCH ? remain : static_cast<size_t>(COLLECT_BATCH) , std::memory_order_relaxed) ;
+}
+
+std::unique_ptr<Memtable::Iterator> BTree::new_iterator(uint64_t seq) {
+    Iterator *iter = new Iterator(this , seq) ;
+    iter->seek_to_first() ;
+    return std::unique_ptr<Memtable::Iterator>(iter) ;
+}
+
+bool BTree::get(const ByteArray& key , std::string* value , uint64_t seq) {
+    const uint64_t prefix = key_prefix(key) ;
+    std::shared_lock<std::shared_mutex> lock(this->_mutex) ;
+    const Leaf *leaf = this->find_leaf(key , prefix , nullptr) ;
+    int pos = lower_bound(leaf , key , prefix) ;
+    if(pos == leaf->count || compare(leaf , pos , key , prefix) != 0) {
+        return false ;
+    }
+    const Value *v = version_at(leaf->entries[pos] , seq) ;
+    if(v == nullptr || v->deleted) {
+        return false ;
+    }
+    if(value != nullptr) {
+        value->assign(v->data , v->size) ;
+    }
+    return true ;
+}
+
+void BTree::put(const ByteArray& key , const ByteArray& value , bool *existed) {
+    std::unique_lock<std::shared_mutex> lock(this->_mutex) ;
+    bool result = this->apply(key , &value) ;
+    if(existed != nullptr) {
+        *existed = result ;
+    }
+}
+
+bool BTree::del(const ByteArray& key) {
+    std::unique_lock<std::shared_mutex> lock(this->_mutex) ;
+    return this->apply(key , nullptr) ;
+}
+
+void BTree::multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq) {
+    std::shared_lock<std::shared_mutex> lock(this->_mutex) ;
+    const Leaf *leaf = nullptr ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        const ByteArray &key = keys[i] ;
+        const uint64_t prefix = key_prefix(key) ;
+        // keys 有序的时候相邻的 key 多半在同一个叶子里，落在上一个叶子的范围里就不用从根往下找
+        if(leaf == nullptr || leaf->count == 0 || compare(leaf , 0 , key , prefix) > 0 || compare(leaf , leaf->count - 1 , key , prefix) < 0) {
+            leaf = this->find_leaf(key , prefix , nullptr) ;
+        }
+        int pos = lower_bound(leaf , key , prefix) ;
+        if(pos == leaf->count || compare(leaf , pos , key , prefix) != 0) {
+            continue ;
+        }
+        const Value *v = version_at(leaf->entries[pos] , seq) ;
+        if(v != nullptr && !v->deleted) {
+            handler(i , ByteArray(v->data , v->size)) ;
+        }
+    }
+}
+
+bool BTree::Writer::write(const ByteArray& key , const ByteArray* value) {
+    std::unique_lock<std::shared_mutex> lock(this->_tree->_mutex) ;
+    if(this->_seq == 0) {
+        this->_seq = this->_tree->begin_batch() ;
+    }
+    return this->_tree->apply(key , value , this->_seq) ;
+}
+
+BTree::Writer::~Writer() {
+    if(this->_seq != 0) {
+        std::unique_lock<std::shared_mutex> lock(this->_tree->_mutex) ;
+        this->_tree->end_batch(this->_seq) ;
+    }
+}
+
+std::unique_ptr<Memtable::Writer> BTree::new_writer() {
+    return std::unique_ptr<Memtable::Writer>(new Writer(this)) ;
+}
+
+std::unique_ptr<Memtable::Builder> BTree::new_builder() {
+    return std::unique_ptr<Memtable::Builder>(new Builder(this)) ;
+}
+
+uint64_t BTree::acquire_snapshot() {
+    // 拿着共享锁，这时候没有写在回收旧版本，不会回收掉刚取到的序列号能看到的版本
+    std::shared_lock<std::shared_mutex> lock(this->_mutex) ;
+    std::lock_guard<std::mutex> snapshot_lock(this->_snapshot_mutex) ;
+    uint64_t seq = this->_last_seq.load() ;
+    this->_snapshots.insert(seq) ;
+    this->_oldest_snapshot.store(*this->_snapshots.begin()) ;
+    return seq ;
+}
+
+void BTree::release_snapshot(uint64_t seq) {
+    std::lock_guard<std::mutex> lock(this->_snapshot_mutex) ;
+    auto it = this->_snapshots.find(seq) ;
+    assert(it != this->_snapshots.end()) ;
+    this->_snapshots.erase(it) ;
+    if(this->_snapshots.empty()) {
+        this->_oldest_snapshot.store(NO_SNAPSHOT) ;
+    } else {
+        this->_oldest_snapshot.store(*this->_snapshots.begin()) ;
+    }
+    this->_collect_at.store(COLLECT_BATCH , std::memory_order_relaxed) ;
+}
+
+uint64_t BTree::last_sequence() const {
+    return this->_last_seq.load(std::memory_order_acquire) ;
+}
+
+size_t BTree::memory_usage() const {
+    return this->_pool.memory_usage() ;
+}
+
+BTree::Builder::Builder(BTree *tree) : _tree(tree) , _lock(tree->_mutex) , _has_last(false) {
+    const Leaf *leaf = tree->last_leaf() ;
+    if(leaf->count > 0) {
+        const Entry *entry = leaf->entries[leaf->count - 1] ;
+        this->_last.assign(entry->key , entry->key_size) ;
+        this->_has_last = true ;
+    }
+}
+
+bool BTree::Builder::append(const ByteArray& key , const ByteArray& value) {
+    if(this->_has_last && !(ByteArray(this->_last) < key)) {
+        return false ;
+    }
+    Entry *entry = this->_tree->find_or_insert(key) ;
+    entry->head = this->_tree->new_value(value , 0 , false) ;
+    this->_last.assign(key.data() , key.size()) ;
+    this->_has_last = true ;
+    return true ;
+}
+
+BTree::Iterator::Iterator(BTree *tree , uint64_t seq) : _tree(tree) , _seq(seq) , _leaf(nullptr) , _pos(0) ,
+    _version(0) , _good(false) { }
+
+void BTree::Iterator::capture(const Entry *entry , const Value *value) {
+    this->_key.assign(entry->key , entry->key_size) ;
+    this->_value.assign(value->data , value->size) ;
+    this->_version = this->_tree->_version ;
+    this->_good = true ;
+}
+
+void BTree::Iterator::settle_forward() {
+    while(this->_leaf != nullptr) {
+        if(this->_pos >= this->_leaf->count) {
+            this->_leaf = this->_leaf->next ;
+            this->_pos = 0 ;
+            continue ;
+        }
+        const Entry *entry = this->_leaf->entries[this->_pos] ;
+        const Value *v = this->_tree->version_at(entry , this->_seq) ;
+        if(v != nullptr && !v->deleted) {
+            this->capture(entry , v) ;
+            return ;
+        }
+        ++this->_pos ;
+    }
+    this->_good = false ;
+}
+
+void BTree::Iterator::settle_backward() {
+    while(this->_leaf != nullptr) {
+        if(this->_pos < 0) {
+            this->_leaf = this->_leaf->prev ;
+            this->_pos = this->_leaf != nullptr ? this->_leaf->count - 1 : 0 ;
+            continue ;
+        }
+        const Entry *entry = this->_leaf->entries[this->_pos] ;
+        const Value *v = this->_tree->version_at(entry , this->_seq) ;
+        if(v != nullptr && !v->deleted) {
+            this->capture(entry , v) ;
+            return ;
+        }
+        --this->_pos ;
+    }
+    this->_good = false ;
+}
+
+void BTree::Iterator::next() {
+    std::shared_lock<std::shared_mutex> lock(this->_tree->_mutex) ;
+    if(this->_version != this->_tree->_version) {
+        // 叶子变过了，重新找第一个大于当前 key 的位置
+        ByteArray key(this->_key) ;
+        uint64_t prefix = key_prefix(key) ;
+        this->_leaf = this->_tree->find_leaf(key , prefix , nullptr) ;
+        this->_pos = lower_bound(this->_leaf , key , prefix) ;
+        if(this->_pos < this->_leaf->count && compare(this->_leaf , this->_pos , key , prefix) == 0) {
+            ++this->_pos ;
+        }
+    } else {
+        ++this->_pos ;
+    }
+    this->settle_forward() ;
+}
+
+void BTree::Iterator::prev() {
+    std::shared_lock<std::shared_mutex> lock(this->_tree->_mutex) ;
+    if(this->_version != this->_tree->_version) {
+        ByteArray key(this->_key) ;
+        uint64_t prefix = key_prefix(key) ;
+        this->_leaf = this->_tree->find_leaf(key , prefix , nullptr) ;
+        this->_pos = lower_bound(this->_leaf , key , prefix) ;
+    }
+    --this->_pos ;
+    this->settle_backward() ;
+}
+
+void BTree::Iterator::seek(const ByteArray& key) {
+    std::shared_lock<std::shared_mutex> lock(this->_tree->_mutex) ;
+    uint64_t prefix = key_prefix(key) ;
+    this->_leaf = this->_tree->find_leaf(key , prefix , nullptr) ;
+    this->_pos = lower_bound(this->_leaf , key , prefix) ;
+    this->settle_forward() ;
+}
+
+void BTree::Iterator::seek_to_first() {
+    std::shared_lock<std::shared_mutex> lock(this->_tree->_mutex) ;
+    this->_leaf = this->_tree->_first ;
+    this->_pos = 0 ;
+    this->settle_forward() ;
+}
+
+void BTree::Iterator::seek_to_last() {
+    std::shared_lock<std::shared_mutex> lock(this->_tree->_mutex) ;
+    this->_leaf = this->_tree->last_leaf() ;
+    this->_pos = this->_leaf->count - 1 ;
+    this->settle_backward() ;
+}
+
+} // namespace table
+
+#endif
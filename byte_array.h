@@ -3,6 +3,7 @@
 
 #include <string>
 #include <string.h>
+#include <stdint.h>
 #include <iostream>
 namespace table {
 
@@ -10,30 +11,30 @@ class ByteArray {
 public:
     ByteArray();
     ~ByteArray();
-    ByteArray(const char* data, const uint8_t &size);
+    ByteArray(const char* data, size_t size);
     ByteArray(const char* str);
     ByteArray(const std::string& str);
 
     bool empty() const;
-    uint8_t size() const;
+    size_t size() const;
     char* data();
     const char* data() const;
-    void assign(const char* data,  const uint8_t &size);
+    void assign(const char* data, size_t size);
     bool operator == (const ByteArray &other) const ; 
     bool operator != (const ByteArray &other) const ; 
     bool operator < (const ByteArray &other) const ; 
     bool operator > (const ByteArray &other) const ; 
-    char operator [] (const uint8_t &index) const; 
+    char operator [] (size_t index) const; 
     friend std::ostream & operator << (std::ostream &cout , const ByteArray &A) ; 
 
 private:
-    uint8_t      _size;
+    size_t      _size;
     const char *_data;
 };
 
 // 都是浅拷贝 
 ByteArray::ByteArray() : _size(0) , _data(nullptr) { }
-ByteArray::ByteArray(const char *data , const uint8_t &size) : _size(size) , _data(data) { }
+ByteArray::ByteArray(const char *data , size_t size) : _size(size) , _data(data) { }
 ByteArray::ByteArray(const char *str) : _size(strlen(str)) , _data(str) { }
 ByteArray::ByteArray(const std::string &str) : _size(str.size()) , _data(str.data()) { }
 // 而且不释放内存空间，跳表删除时统一释放
@@ -43,7 +44,7 @@ bool ByteArray::empty() const {
     return this->_size == 0 ; 
 }
 
-uint8_t ByteArray::size() const {
+size_t ByteArray::size() const {
     return this->_size ; 
 }
 
@@ -56,7 +57,7 @@ const char *ByteArray::data() const {
     return this->_data ; 
 }
 
-void ByteArray::assign(const char *data , const uint8_t &size){
+void ByteArray::assign(const char *data , size_t size){
     this->_data = data ; 
     this->_size = size ; 
 }
@@ -112,8 +113,9 @@ bool ByteArray::operator > (const ByteArray &other) const {
     }
 }
 
-char ByteArray::operator [] (const uint8_t &index) const{
+char ByteArray::operator [] (size_t index) const{
     if(index < this->_size) return this->data()[index] ; 
+    return '\0' ; 
 }
 
 std::ostream & operator << (std::ostream &out , const ByteArray &other){
@@ -121,6 +123,35 @@ std::ostream & operator << (std::ostream &out , const ByteArray &other){
     return out ; 
 }
 
+// 变长整数：每个字节的低 7 位是数据，最高位为 1 表示后面还有字节，小于 128 的长度只占一个字节
+// 文件里的长度和 value log 的引用都用它编码
+static const int MAX_VARINT_LENGTH = 10 ;
+
+// 把 value 编码到 buf 里，返回用了几个字节，buf 至少要有 MAX_VARINT_LENGTH 个字节
+inline int encode_varint(char *buf , uint64_t value) {
+    int n = 0 ;
+    while(value >= 0x80) {
+        buf[n++] = static_cast<char>(value | 0x80) ;
+        value >>= 7 ;
+    }
+    buf[n++] = static_cast<char>(value) ;
+    return n ;
+}
+
+// 从 [p , limit) 解码一个变长整数，返回用了几个字节，数据不完整或者超过 64 位返回 0
+inline int decode_varint(const char *p , const char *limit , uint64_t *value) {
+    uint64_t result = 0 ;
+    for(int n = 0 ; n < MAX_VARINT_LENGTH && p + n < limit ; ++n) {
+        uint64_t byte = static_cast<uint8_t>(p[n]) ;
+        result |= (byte & 0x7f) << (7 * n) ;
+        if((byte & 0x80) == 0) {
+            *value = result ;
+            return n + 1 ;
+        }
+    }
+    return 0 ;
+}
+
 } // namespace table
 
 #endif
\ No newline at end of file
@@ -0,0 +1,177 @@
+#ifndef TABLE_CHECKPOINT_H
+#define TABLE_CHECKPOINT_H
+
+// 增量 dump：只把上次 dump 之后改过和删掉的 key 写成增量文件 "文件名.delta.N"，不用重写整个数据文件
+// 1. 数据文件是基础文件，增量文件从 1 开始编号，open 的时候在基础文件上按编号依次应用，后面的覆盖前面的
+// 2. 每个增量文件记着它所基于的基础文件的大小和 crc32c：重写基础文件以后，还没来得及删掉的旧增量文件对不上，不会被应用
+// 3. 增量文件用 FileWriter 写，崩溃的时候要么是完整的，要么不存在；整个文件有 crc32c 校验
+// +-------------------------------------------DeltaFile------------------------------------------------+
+// | MAGIC(8 字节) | 基础文件大小(8 字节) | 基础文件 crc32c(4 字节) | 操作 ... | 前面所有内容的 crc32c(4 字节) |
+// +----------------------------------------------------------------------------------------------------+
+// 操作的格式和预写日志的记录内容一样，见 WriteAheadLog::add_put
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include "byte_array.h"
+#include "wal.h"
+#include "file_writer.h"
+
+namespace table {
+
+#define     DELTA_FILE_EXT      ".delta."
+
+// 上次 dump 之后写过的 key，增量 dump 只写它们；分成几段各自加锁，写的线程之间不怎么抢锁
+// 要在写完内存表以后再 add，dump 的时候先 take 再建快照：take 之后才 add 的 key 下一次 dump 还会写，不会漏掉
+class DirtyKeys {
+public :
+    DirtyKeys() { }
+
+    void add(const ByteArray& key) ;
+
+    // 取出所有的 key 并清空，按 key 排好序
+    std::vector<std::string> take() ;
+
+    // Non-copying
+    DirtyKeys(const DirtyKeys&) = delete ;
+    DirtyKeys& operator=(const DirtyKeys&) = delete ;
+
+private :
+    static const size_t STRIPES = 16 ;
+
+    struct alignas(64) Stripe {
+        std::mutex mutex ;
+        std::unordered_set<std::string> keys ;
+    } ;
+
+    Stripe _stripes[STRIPES] ;
+} ;
+
+void DirtyKeys::add(const ByteArray& key) {
+    std::string k(key.data() , key.size()) ;
+    Stripe &stripe = this->_stripes[std::hash<std::string>()(k) % STRIPES] ;
+    std::lock_guard<std::mutex> lock(stripe.mutex) ;
+    stripe.keys.insert(std::move(k)) ;
+}
+
+std::vector<std::string> DirtyKeys::take() {
+    std::vector<std::string> keys ;
+    for(Stripe &stripe : this->_stripes) {
+        std::unordered_set<std::string> taken ;
+        {
+            std::lock_guard<std::mutex> lock(stripe.mutex) ;
+            taken.swap(stripe.keys) ;
+        }
+        keys.insert(keys.end() , taken.begin() , taken.end()) ;
+    }
+    std::sort(keys.begin() , keys.end()) ;
+    return keys ;
+}
+
+class DeltaFile {
+public :
+    // 表 fileName 的第 index 个增量文件
+    static std::string name(const std::string& fileName , size_t index) {
+        return fileName + DELTA_FILE_EXT + std::to_string(index) ;
+    }
+
+    // 把 ops 写成增量文件
+    static bool save(const std::string& fileName , uint64_t base_size , uint32_t base_crc , const std::string& ops) ;
+
+    // 读出增量文件里的操作；文件不存在、不完整、校验不对或者不是基于这个基础文件的，都返回 false
+    static bool load(const std::string& fileName , uint64_t base_size , uint32_t base_crc , std::string *ops) ;
+
+    // 整个文件的大小和 crc32c，基础文件写完以后用它算增量文件要记的值
+    static bool checksum(const std::string& fileName , uint64_t *size , uint32_t *crc) ;
+
+private :
+    static const uint64_t MAGIC = 0x31544c4544424454ULL ; // "TDBDELT1"
+    static const size_t HEADER_SIZE = sizeof(uint64_t) * 2 + sizeof(uint32_t) ;
+} ;
+
+bool DeltaFile::save(const std::string& fileName , uint64_t base_size , uint32_t base_crc , const std::string& ops) {
+    char header[HEADER_SIZE] ;
+    uint64_t magic = MAGIC ;
+    memcpy(header , &magic , sizeof(uint64_t)) ;
+    memcpy(header + sizeof(uint64_t) , &base_size , sizeof(uint64_t)) ;
+    memcpy(header + sizeof(uint64_t) * 2 , &base_crc , sizeof(uint32_t)) ;
+    uint32_t crc = crc32c(ops.data() , ops.size() , crc32c(header , HEADER_SIZE)) ;
+
+    FileWriter writer ;
+    return writer.open(fileName) && writer.append(header , HEADER_SIZE) && writer.append(ops) &&
+           writer.append(reinterpret_cast<const char*>(&crc) , sizeof(uint32_t)) && writer.finish() ;
+}
+
+bool DeltaFile::load(const std::string& fileName , uint64_t base_size , uint32_t base_crc , std::string *ops) {
+    int fd = ::open(fileName.data() , O_RDONLY) ;
+    if(fd == -1) {
+        return false ;
+    }
+    struct stat info ;
+    std::string data ;
+    bool ok = fstat(fd , &info) == 0 && static_cast<size_t>(info.st_size) >= HEADER_SIZE + sizeof(uint32_t) ;
+    if(ok) {
+        data.resize(info.st_size) ;
+        size_t done = 0 ;
+        while(ok && done < data.size()) {
+            ssize_t n = pread(fd , &data[done] , data.size() - done , done) ;
+            ok = n > 0 ;
+            done += ok ? n : 0 ;
+        }
+    }
+    ::close(fd) ;
+    if(!ok) {
+        return false ;
+    }
+    uint64_t magic , size ;
+    uint32_t crc , file_crc ;
+    memcpy(&magic , data.data() , sizeof(uint64_t)) ;
+    memcpy(&size , data.data() + sizeof(uint64_t) , sizeof(uint64_t)) ;
+    memcpy(&crc , data.data() + sizeof(uint64_t) * 2 , sizeof(uint32_t)) ;
+    memcpy(&file_crc , data.data() + data.size() - sizeof(uint32_t) , sizeof(uint32_t)) ;
+    if(magic != MAGIC || size != base_size || crc != base_crc ||
+       crc32c(data.data() , data.size() - sizeof(uint32_t)) != file_crc) {
+        return false ;
+    }
+    ops->assign(data , HEADER_SIZE , data.size() - HEADER_SIZE - sizeof(uint32_t)) ;
+    return true ;
+}
+
+bool DeltaFile::checksum(const std::string& fileName , uint64_t *size , uint32_t *crc) {
+    int fd = ::open(fileName.data() , O_RDONLY) ;
+    if(fd == -1) {
+        return false ;
+    }
+    struct stat info ;
+    if(fstat(fd , &info) != 0) {
+        ::close(fd) ;
+        return false ;
+    }
+    *size = info.st_size ;
+    *crc = 0 ;
+    if(info.st_size > 0) {
+        char *data = reinterpret_cast<char*>(mmap(nullptr , info.st_size , PROT_READ , MAP_PRIVATE , fd , 0)) ;
+        if(data == MAP_FAILED) {
+            ::close(fd) ;
+            return false ;
+        }
+        *crc = crc32c(data , info.st_size) ;
+        munmap(data , info.st_size) ;
+    }
+    ::close(fd) ;
+    return true ;
+}
+
+} // namespace table
+
+#endif
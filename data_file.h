@@ -0,0 +1,590 @@
+#ifndef TABLE_DATA_FILE_H
+#define TABLE_DATA_FILE_H
+
+// 按块组织的数据文件：可以只读需要的块、不同的块并行解码、点查先二分索引再在块里二分，不用从头扫一遍
+// 1. 数据块大约 Options::block_size 字节，entry 按 key 有序；key 只存和前一个 key 不同的后缀，
+//    每 RESTART_INTERVAL 个 entry 一个重启点，重启点上存完整的 key，块末尾是所有重启点的偏移，块内按重启点二分
+// 2. 哈夫曼编码表和索引块也是块，索引块里每个数据块一项：块里最后一个 key 和块的位置；
+//    每个块后面跟着它的 crc32c，读块的时候校验
+// 3. 文件末尾是定长的 footer，记着编码表和索引块的位置；末尾没有 MAGIC 的是以前的格式，编码表在 ".huffman_code" 文件里
+// +-------------------------------------------数据文件-------------------------------------------+
+// | 数据块 | crc32c | 数据块 | crc32c | ... | 编码表块 | crc32c | 索引块 | crc32c | footer(56 字节) |
+// +----------------------------------------------------------------------------------------------+
+// 数据块：| entry ... | 重启点偏移(4 字节) ... | 重启点个数(4 字节) |
+// entry：| varint 共享前缀长度 | varint 后缀编码以后的字节数 | 后缀的哈夫曼编码 | value |
+// value：| INLINE_VALUE | varint 编码以后的字节数 | 哈夫曼编码 |  或者  | VALUE_LOG_REF | varint 偏移 | varint 长度 |
+//        或者 | TOMBSTONE_VALUE |，只有 LSM 的 L0 run 里有，表示更旧的 run 里的 key 已经删掉了
+// 编码表块：HuffmanTree::save_codes 的格式
+// 索引块的一项：| varint key 长度 | key | varint 块偏移 | varint 块大小 |，key 不编码，块大小不算后面的 crc32c
+// footer：| 编码表偏移 | 编码表大小 | 索引块偏移 | 索引块大小 | entry 数 | 版本(4 字节) | 前面的 crc32c(4 字节) | MAGIC |
+//         没有写长度的都是 8 字节
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <string.h>
+#include <stdint.h>
+#include "status.h"
+#include "byte_array.h"
+#include "hufman_code.h"
+#include "value_log.h"
+#include "wal.h"
+#include "file_writer.h"
+
+namespace table {
+
+// 把有序的 entry 写成数据文件，数据交给 FileWriter，文件从 writer 的开头写起
+class DataFileBuilder {
+public :
+    static const int RESTART_INTERVAL = 16 ;
+
+    // codes 要已经建好，key 和 value 里的字符都要在里面；block_size 是数据块的目标大小
+    DataFileBuilder(FileWriter *writer , const HuffmanTree *codes , size_t block_size) ;
+
+    // key 要比前一个大；value 是内存表里存的 value，第一个字节是类型
+    // 编码失败或者写失败返回 false
+    bool add(const ByteArray& key , const ByteArray& value) ;
+
+    // 写完最后一个数据块、编码表、索引块和 footer，之后还要调用 writer 的 finish
+    bool finish() ;
+
+    uint64_t entries() const            { return this->_entries ; }
+
+    // Non-copying
+    DataFileBuilder(const DataFileBuilder&) = delete ;
+    DataFileBuilder& operator=(const DataFileBuilder&) = delete ;
+
+private :
+    // 把当前的数据块写出去，在索引块里记一项
+    bool flush_block() ;
+    // 写一个块和它的 crc32c，返回块的位置
+    bool write_block(const std::string& block , uint64_t *offset , uint64_t *size) ;
+
+    FileWriter *_writer ;
+    const HuffmanTree *_codes ;
+    size_t _block_size ;
+    std::string _block ;
+    std::vector<uint32_t> _restarts ;
+    int _counter ;          // 上一个重启点之后的 entry 数
+    std::string _last_key ;
+    std::string _index ;
+    uint64_t _entries ;
+} ;
+
+// 读 DataFileBuilder 写的数据文件，文件整个映射在内存里，open 的时候只读 footer、编码表和索引块
+// 数据块用到的时候再解码，不同的数据块可以在不同的线程里同时读
+class DataFileReader {
+public :
+    DataFileReader() : _data(nullptr) , _size(0) , _entries(0) { }
+
+    // 文件末尾是不是新格式的 MAGIC，不是的话是以前的格式
+    static bool is_block_format(const char *data , uint64_t size) ;
+
+    // data 是整个文件，reader 用完之前要一直有效；校验 footer、编码表块和索引块
+    bool open(const char *data , uint64_t size) ;
+
+    size_t block_count() const          { return this->_index.size() ; }
+    uint64_t entries() const            { return this->_entries ; }
+
+    // 按顺序解码第 index 个数据块里的 entry，value 是内存表里存的 value；fn 返回 false 就停下
+    // 块坏了或者 fn 返回 false 都返回 false
+    bool read_block(size_t index , const std::function<bool(const std::string& , const std::string&)>& fn) const ;
+
+    // 按顺序解码所有的数据块，fn 只在调用的线程里按 key 的顺序调用；返回值和 read_block 一样
+    // 索引块就是每一段的边界：数据块每 SEGMENT_BLOCKS 个一段，threads 个线程各自把一段解码成一个有序的 run，
+    // 调用的线程按段的顺序把 run 交给 fn；最多有 threads * 2 个段解码好了还没交出去，内存不随文件变大
+    bool read_blocks(size_t threads , const std::function<bool(const std::string& , const std::string&)>& fn) const ;
+
+    // 第一个最后一个 key 不小于 key 的块，也就是 key 可能在的块；key 比所有的 key 都大的话返回 block_count()
+    size_t find_block(const ByteArray& key) const ;
+
+    // 二分索引找到 key 可能在的块，再在块里按重启点二分；value 是内存表里存的 value
+    // 找到返回 ok，没有的话返回 not_found，块坏了返回 io_error
+    Status get(const ByteArray& key , std::string *value) const ;
+
+    // 索引和编码表占的内存，文件映射的内存不算
+    size_t memory_usage() const ;
+
+    // Non-copying
+    DataFileReader(const DataFileReader&) = delete ;
+    DataFileReader& operator=(const DataFileReader&) = delete ;
+
+private :
+    static const uint64_t MAGIC = 0x314b4c4244424454ULL ; // "TDBDBLK1"
+    static const uint32_t VERSION = 1 ;
+    static const size_t FOOTER_SIZE = sizeof(uint64_t) * 6 + sizeof(uint32_t) * 2 ;
+    static const size_t SEGMENT_BLOCKS = 32 ;
+    friend class DataFileBuilder ;
+
+    struct BlockHandle {
+        std::string last_key ;
+        uint64_t offset ;
+        uint64_t size ;
+    } ;
+
+    // 数据块里 entry 的部分和重启点
+    struct Block {
+        const char *data ;
+        const char *limit ;
+        const char *restarts ;
+        uint32_t restart_count ;
+    } ;
+
+    // 校验 [offset , offset + size) 和后面的 crc32c
+    bool check_block(uint64_t offset , uint64_t size) const ;
+    bool parse_block(size_t index , Block *block) const ;
+    // 从 p 开始解码一个 entry 的 key，key 里原来是前一个 key；返回 value 的开头，坏了返回 nullptr
+    const char* decode_key(const char *p , const char *limit , std::string *key) const ;
+    // 从 p 开始解码一个 value，value 为空的话只跳过去；返回 entry 的末尾，坏了返回 nullptr
+    const char* decode_value(const char *p , const char *limit , std::string *value) const ;
+    // 第 i 个重启点的位置
+    const char* restart_point(const Block& block , uint32_t i) const ;
+
+    const char *_data ;
+    uint64_t _size ;
+    uint64_t _entries ;
+    HuffmanTree _codes ;
+    std::vector<BlockHandle> _index ;
+    // 文件不会再变，数据块只在第一次读的时候校验，和整个加载进内存表的时候一样只校验一次
+    // 几个线程同时第一次读同一块的话可能会校验几次，没关系
+    std::unique_ptr<std::atomic<bool>[]> _verified ;
+} ;
+
+// 按字节的字典序，和内存表的顺序一样
+inline int compare_key(const char *a , size_t a_size , const char *b , size_t b_size) {
+    int r = memcmp(a , b , std::min(a_size , b_size)) ;
+    if(r != 0) {
+        return r ;
+    }
+    return a_size < b_size ? -1 : (a_size > b_size ? 1 : 0) ;
+}
+
+DataFileBuilder::DataFileBuilder(FileWriter *writer , const HuffmanTree *codes , size_t block_size) :
+    _writer(writer) , _codes(codes) , _block_size(block_size) , _counter(0) , _entries(0) { }
+
+bool DataFileBuilder::add(const ByteArray& key , const ByteArray& value) {
+    size_t shared = 0 ;
+    if(this->_counter < RESTART_INTERVAL && !this->_restarts.empty()) {
+        size_t n = std::min(this->_last_key.size() , key.size()) ;
+        while(shared < n && this->_last_key[shared] == key.data()[shared]) {
+            ++shared ;
+        }
+    } else {
+        this->_restarts.push_back(this->_block.size()) ;
+        this->_counter = 0 ;
+    }
+    char varint[MAX_VARINT_LENGTH] ;
+    this->_block.append(varint , encode_varint(varint , shared)) ;
+    if(this->_codes->encode_string(ByteArray(key.data() + shared , key.size() - shared) , &this->_block) == false) {
+        return false ;
+    }
+    // 内存表里的 value 至少有一个类型字节，空的 value 写进去就读不回来了
+    if(value.empty()) {
+        return false ;
+    }
+    // 只有内存表里的 value 要编码，value log 的引用原样写
+    if(value[0] == INLINE_VALUE) {
+        this->_block.push_back(INLINE_VALUE) ;
+        if(this->_codes->encode_string(ByteArray(value.data() + 1 , value.size() - 1) , &this->_block) == false) {
+            return false ;
+        }
+    } else {
+        this->_block.append(value.data() , value.size()) ;
+    }
+    this->_last_key.assign(key.data() , key.size()) ;
+    ++this->_counter ;
+    ++this->_entries ;
+    if(this->_block.size() + (this->_restarts.size() + 1) * sizeof(uint32_t) >= this->_block_size) {
+        return this->flush_block() ;
+    }
+    return true ;
+}
+
+bool DataFileBuilder::flush_block() {
+    if(this->_restarts.empty()) {
+        return true ;
+    }
+    for(uint32_t restart : this->_restarts) {
+        this->_block.append(reinterpret_cast<const char*>(&restart) , sizeof(uint32_t)) ;
+    }
+    uint32_t count = this->_restarts.size() ;
+    this->_block.append(reinterpret_cast<const char*>(&count) , sizeof(uint32_t)) ;
+    uint64_t offset , size ;
+    if(this->write_block(this->_block , &offset , &size) == false) {
+        return false ;
+    }
+    char varint[MAX_VARINT_LENGTH] ;
+    this->_index.append(varint , encode_varint(varint , this->_last_key.size())) ;
+    this->_index += this->_last_key ;
+    this->_index.append(varint , encode_varint(varint , offset)) ;
+    this->_index.append(varint , encode_varint(varint , size)) ;
+    this->_block.clear() ;
+    this->_restarts.clear() ;
+    this->_counter = 0 ;
+    return true ;
+}
+
+bool DataFileBuilder::write_block(const std::string& block , uint64_t *offset , uint64_t *size) {
+    *offset = this->_writer->size() ;
+    *size = block.size() ;
+    uint32_t crc = crc32c(block.data() , block.size()) ;
+    return this->_writer->append(block) && this->_writer->append(reinterpret_cast<const char*>(&crc) , sizeof(uint32_t)) ;
+}
+
+bool DataFileBuilder::finish() {
+    std::string codes ;
+    this->_codes->save_codes(&codes) ;
+    uint64_t fields[6] ;
+    if(this->flush_block() == false ||
+       this->write_block(codes , &fields[0] , &fields[1]) == false ||
+       this->write_block(this->_index , &fields[2] , &fields[3]) == false) {
+        return false ;
+    }
+    fields[4] = this->_entries ;
+    fields[5] = DataFileReader::MAGIC ;
+    char footer[DataFileReader::FOOTER_SIZE] ;
+    const size_t crc_at = sizeof(uint64_t) * 5 + sizeof(uint32_t) ;
+    uint32_t version = DataFileReader::VERSION ;
+    memcpy(footer , fields , sizeof(uint64_t) * 5) ;
+    memcpy(footer + sizeof(uint64_t) * 5 , &version , sizeof(uint32_t)) ;
+    uint32_t crc = crc32c(footer , crc_at) ;
+    memcpy(footer + crc_at , &crc , sizeof(uint32_t)) ;
+    memcpy(footer + crc_at + sizeof(uint32_t) , &fields[5] , sizeof(uint64_t)) ;
+    return this->_writer->append(footer , DataFileReader::FOOTER_SIZE) ;
+}
+
+bool DataFileReader::is_block_format(const char *data , uint64_t size) {
+    uint64_t magic ;
+    if(size < FOOTER_SIZE) {
+        return false ;
+    }
+    memcpy(&magic , data + size - sizeof(uint64_t) , sizeof(uint64_t)) ;
+    return magic == MAGIC ;
+}
+
+bool DataFileReader::open(const char *data , uint64_t size) {
+    if(!is_block_format(data , size)) {
+        return false ;
+    }
+    this->_data = data ;
+    this->_size = size ;
+    const char *footer = data + size - FOOTER_SIZE ;
+    const size_t crc_at = sizeof(uint64_t) * 5 + sizeof(uint32_t) ;
+    uint64_t fields[5] ;
+    uint32_t version , crc ;
+    memcpy(fields , footer , sizeof(fields)) ;
+    memcpy(&version , footer + sizeof(fields) , sizeof(uint32_t)) ;
+    memcpy(&crc , footer + crc_at , sizeof(uint32_t)) ;
+    if(crc32c(footer , crc_at) != crc || version != VERSION ||
+       !this->check_block(fields[0] , fields[1]) || !this->check_block(fields[2] , fields[3]) ||
+       !this->_codes.load_codes(data + fields[0] , fields[1])) {
+        return false ;
+    }
+    this->_entries = fields[4] ;
+
+    this->_index.clear() ;
+    const char *p = data + fields[2] , *limit = p + fields[3] ;
+    while(p < limit) {
+        BlockHandle handle ;
+        uint64_t key_size ;
+        int n = decode_varint(p , limit , &key_size) ;
+        if(n == 0 || key_size > static_cast<uint64_t>(limit - p - n)) {
+            return false ;
+        }
+        handle.last_key.assign(p + n , key_size) ;
+        p += n + key_size ;
+        int a = decode_varint(p , limit , &handle.offset) ;
+        int b = a == 0 ? 0 : decode_varint(p + a , limit , &handle.size) ;
+        // 数据块都在编码表前面，至少有一个重启点
+        if(b == 0 || handle.size < sizeof(uint32_t) * 2 || handle.offset > fields[0] ||
+           handle.size + sizeof(uint32_t) > fields[0] - handle.offset) {
+            return false ;
+        }
+        p += a + b ;
+        this->_index.push_back(std::move(handle)) ;
+    }
+    this->_verified.reset(new std::atomic<bool>[this->_index.size()]) ;
+    for(size_t i = 0 ; i < this->_index.size() ; ++i) {
+        this->_verified[i].store(false , std::memory_order_relaxed) ;
+    }
+    return true ;
+}
+
+bool DataFileReader::check_block(uint64_t offset , uint64_t size) const {
+    uint64_t end = this->_size - FOOTER_SIZE ;
+    if(offset > end || size + sizeof(uint32_t) > end - offset) {
+        return false ;
+    }
+    uint32_t crc ;
+    memcpy(&crc , this->_data + offset + size , sizeof(uint32_t)) ;
+    return crc32c(this->_data + offset , size) == crc ;
+}
+
+bool DataFileReader::parse_block(size_t index , Block *block) const {
+    const BlockHandle &handle = this->_index[index] ;
+    if(!this->_verified[index].load(std::memory_order_relaxed)) {
+        if(!this->check_block(handle.offset , handle.size)) {
+            return false ;
+        }
+        this->_verified[index].store(true , std::memory_order_relaxed) ;
+    }
+    const char *data = this->_data + handle.offset ;
+    memcpy(&block->restart_count , data + handle.size - sizeof(uint32_t) , sizeof(uint32_t)) ;
+    uint64_t restarts_size = (static_cast<uint64_t>(block->restart_count) + 1) * sizeof(uint32_t) ;
+    if(block->restart_count == 0 || restarts_size > handle.size) {
+        return false ;
+    }
+    block->data = data ;
+    block->limit = data + handle.size - restarts_size ;
+    block->restarts = block->limit ;
+    return true ;
+}
+
+const char* DataFileReader::decode_key(const char *p , const char *limit , std::string *key) const {
+    uint64_t shared , size ;
+    int n = decode_varint(p , limit , &shared) ;
+    if(n == 0 || shared > key->size()) {
+        return nullptr ;
+    }
+    p += n ;
+    n = decode_varint(p , limit , &size) ;
+    if(n == 0 || size > static_cast<uint64_t>(limit - p - n)) {
+        return nullptr ;
+    }
+    p += n ;
+    key->resize(shared) ;
+    if(!this->_codes.decode_string(p , size , key)) {
+        return nullptr ;
+    }
+    return p + size ;
+}
+
+const char* DataFileReader::decode_value(const char *p , const char *limit , std::string *value) const {
+    if(p >= limit) {
+        return nullptr ;
+    }
+    const char *start = p ;
+    if(*p == INLINE_VALUE) {
+        uint64_t size ;
+        int n = decode_varint(p + 1 , limit , &size) ;
+        if(n == 0 || size > static_cast<uint64_t>(limit - p - 1 - n)) {
+            return nullptr ;
+        }
+        p += 1 + n ;
+        if(value != nullptr) {
+            value->assign(1 , INLINE_VALUE) ;
+            if(!this->_codes.decode_string(p , size , value)) {
+                return nullptr ;
+            }
+        }
+        return p + size ;
+    } else if(*p == VALUE_LOG_REF) {
+        // 引用原样放进内存表
+        uint64_t unused ;
+        int a = decode_varint(p + 1 , limit , &unused) ;
+        int b = a == 0 ? 0 : decode_varint(p + 1 + a , limit , &unused) ;
+        if(b == 0) {
+            return nullptr ;
+        }
+        p += 1 + a + b ;
+        if(value != nullptr) {
+            value->assign(start , p - start) ;
+        }
+        return p ;
+    } else if(*p == TOMBSTONE_VALUE) {
+        if(value != nullptr) {
+            value->assign(1 , TOMBSTONE_VALUE) ;
+        }
+        return p + 1 ;
+    }
+    return nullptr ;
+}
+
+const char* DataFileReader::restart_point(const Block& block , uint32_t i) const {
+    uint32_t restart ;
+    memcpy(&restart , block.restarts + i * sizeof(uint32_t) , sizeof(uint32_t)) ;
+    return restart < static_cast<uint64_t>(block.limit - block.data) ? block.data + restart : nullptr ;
+}
+
+bool DataFileReader::read_block(size_t index , const std::function<bool(const std::string& , const std::string&)>& fn) const {
+    Block block ;
+    if(!this->parse_block(index , &block)) {
+        return false ;
+    }
+    std::string key , value ;
+    for(const char *p = block.data ; p < block.limit ; ) {
+        p = this->decode_key(p , block.limit , &key) ;
+        p = p == nullptr ? nullptr : this->decode_value(p , block.limit , &value) ;
+        if(p == nullptr || !fn(key , value)) {
+            return false ;
+        }
+    }
+    return true ;
+}
+
+bool DataFileReader::read_blocks(size_t threads , const std::function<bool(const std::string& , const std::string&)>& fn) const {
+    typedef std::vector<std::pair<std::string , std::string>> Run ;
+    const size_t segments = (this->_index.size() + SEGMENT_BLOCKS - 1) / SEGMENT_BLOCKS ;
+    threads = std::min(threads , segments) ;
+    if(threads <= 1) {
+        for(size_t i = 0 ; i < this->_index.size() ; ++i) {
+            if(!this->read_block(i , fn)) {
+                return false ;
+            }
+        }
+        return true ;
+    }
+
+    // 下面的状态都由 mutex 保护；next 是下一个要解码的段，consumed 之前的段已经交给 fn 了
+    struct Segment {
+        Run run ;
+        bool done = false ;
+        bool ok = true ;
+    } ;
+    std::vector<Segment> done(segments) ;
+    std::mutex mutex ;
+    std::condition_variable cond ;
+    size_t next = 0 , consumed = 0 ;
+    bool stop = false ;
+    const size_t window = threads * 2 ;
+    // run 按平均每段的 entry 数预留，不用边解码边扩容
+    const size_t per_segment = this->_entries / this->_index.size() * SEGMENT_BLOCKS + SEGMENT_BLOCKS ;
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex) ;
+        while(true) {
+            cond.wait(lock , [&]() { return stop || next >= segments || next < consumed + window ; }) ;
+            if(stop || next >= segments) {
+                return ;
+            }
+            size_t segment = next++ ;
+            lock.unlock() ;
+            Run run ;
+            run.reserve(per_segment) ;
+            bool ok = true ;
+            size_t end = std::min((segment + 1) * SEGMENT_BLOCKS , this->_index.size()) ;
+            for(size_t i = segment * SEGMENT_BLOCKS ; ok && i < end ; ++i) {
+                ok = this->read_block(i , [&run](const std::string& key , const std::string& value) {
+                    run.emplace_back(key , value) ;
+                    return true ;
+                }) ;
+            }
+            lock.lock() ;
+            done[segment].run.swap(run) ;
+            done[segment].ok = ok ;
+            done[segment].done = true ;
+            cond.notify_all() ;
+        }
+    } ;
+    std::vector<std::thread> workers ;
+    for(size_t i = 0 ; i < threads ; ++i) {
+        workers.emplace_back(worker) ;
+    }
+    bool ok = true ;
+    for(size_t segment = 0 ; ok && segment < segments ; ++segment) {
+        Run run ;
+        {
+            std::unique_lock<std::mutex> lock(mutex) ;
+            cond.wait(lock , [&]() { return done[segment].done ; }) ;
+            run.swap(done[segment].run) ;
+            ok = done[segment].ok ;
+            consumed = segment + 1 ;
+        }
+        cond.notify_all() ;
+        for(size_t i = 0 ; ok && i < run.size() ; ++i) {
+            ok = fn(run[i].first , run[i].second) ;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex) ;
+        stop = true ;
+    }
+    cond.notify_all() ;
+    for(std::thread &worker : workers) {
+        worker.join() ;
+    }
+    return ok ;
+}
+
+size_t DataFileReader::find_block(const ByteArray& key) const {
+    size_t left = 0 , right = this->_index.size() ;
+    while(left < right) {
+        size_t mid = left + (right - left) / 2 ;
+        const std::string &last = this->_index[mid].last_key ;
+        if(compare_key(last.data() , last.size() , key.data() , key.size()) < 0) {
+            left = mid + 1 ;
+        } else {
+            right = mid ;
+        }
+    }
+    return left ;
+}
+
+size_t DataFileReader::memory_usage() const {
+    size_t usage = sizeof(*this) + this->_index.capacity() * (sizeof(BlockHandle) + sizeof(std::atomic<bool>)) ;
+    for(const BlockHandle &handle : this->_index) {
+        usage += handle.last_key.capacity() ;
+    }
+    return usage ;
+}
+
+Status DataFileReader::get(const ByteArray& key , std::string *value) const {
+    const Status corrupted = Status::io_error("data file block is corrupted") ;
+    size_t index = this->find_block(key) ;
+    if(index == this->_index.size()) {
+        return Status::not_found() ;
+    }
+    Block block ;
+    if(!this->parse_block(index , &block)) {
+        return corrupted ;
+    }
+    // 最后一个 key 小于 key 的重启点，从那里往后找；第一个重启点的 key 也不小于 key 的话从头找
+    std::string current ;
+    uint32_t lo = 0 , hi = block.restart_count - 1 ;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2 ;
+        const char *p = this->restart_point(block , mid) ;
+        current.clear() ;
+        if(p == nullptr || this->decode_key(p , block.limit , &current) == nullptr) {
+            return corrupted ;
+        }
+        if(compare_key(current.data() , current.size() , key.data() , key.size()) < 0) {
+            lo = mid ;
+        } else {
+            hi = mid - 1 ;
+        }
+    }
+    const char *p = this->restart_point(block , lo) ;
+    if(p == nullptr) {
+        return corrupted ;
+    }
+    // 只解码 key，找到了再解码 value
+    current.clear() ;
+    while(p < block.limit) {
+        p = this->decode_key(p , block.limit , &current) ;
+        if(p == nullptr) {
+            return corrupted ;
+        }
+        int r = compare_key(current.data() , current.size() , key.data() , key.size()) ;
+        if(r == 0) {
+            return this->decode_value(p , block.limit , value) == nullptr ? corrupted : Status::ok() ;
+        }
+        if(r > 0) {
+            break ;
+        }
+        p = this->decode_value(p , block.limit , nullptr) ;
+        if(p == nullptr) {
+            return corrupted ;
+        }
+    }
+    return Status::not_found() ;
+}
+
+} // namespace table
+
+#endif
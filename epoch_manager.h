@@ -0,0 +1,255 @@
+#ifndef TABLE_EPOCH_MANAGER_H
+#define TABLE_EPOCH_MANAGER_H
+
+// 基于 epoch 的内存回收(EBR)
+// 1. 读写跳表之前先 enter() 把当前的全局 epoch 登记到自己线程的槽位里，用完 exit()，可以嵌套
+// 2. 从跳表里摘下来的节点不能马上释放，先 retire() 挂到本线程的待回收链表上，记下当时的全局 epoch
+// 3. 所有正在读的线程都已经登记了当前的全局 epoch 时，全局 epoch 才能加一；
+//    在 epoch e 里 retire 的内存，等全局 epoch 到了 e + 2 就不可能还有线程拿着它，可以还给内存池
+// 4. 待回收链表攒够一批才去推进 epoch 和释放，读路径上只有一次 store 和一次 fence
+// 5. 要马上释放的大对象(比如换下来的整个内存表)不走 retire，摘下来以后 synchronize() 等读者都离开再释放
+// 6. 同时活着的线程超过 MAX_THREADS 个的时候，多出来的线程共用最后一个槽位，在它上面的操作都要拿锁
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include <assert.h>
+#include "memory_pool.h"
+
+namespace table {
+
+class EpochManager {
+public :
+    static const int MAX_THREADS = 256 ;
+
+    // pool 是分配这些内存的分配器，要有 deallocate(ptr , bytes)，比如 MemoryPool
+    template <typename Allocator>
+    explicit EpochManager(Allocator *pool) ;
+    // 只用 synchronize，不用 retire
+    EpochManager() ;
+    ~EpochManager() ;
+
+    // 进入/离开临界区，临界区里读到的节点在 exit() 之前都不会被释放
+    void enter() ;
+    void exit() ;
+
+    // 由 allocate(bytes) 分配、已经不可能再被新的读者看到的内存，等没有读者的时候再还给内存池
+    void retire(void *ptr , size_t bytes) ;
+
+    // 本线程还没有释放的内存块数
+    size_t pending() ;
+
+    // 等到调用之前已经在临界区里的线程都离开，之后它们读到的东西都可以释放；调用的线程不能在临界区里
+    void synchronize() ;
+
+    class Guard {
+    public :
+        explicit Guard(EpochManager *epoch) : _epoch(epoch) { this->_epoch->enter() ; }
+        ~Guard() { this->_epoch->exit() ; }
+        Guard(const Guard&) = delete ;
+        Guard& operator=(const Guard&) = delete ;
+    private :
+        EpochManager *_epoch ;
+    } ;
+
+    // Non-copying
+    EpochManager(const EpochManager&) = delete ;
+    EpochManager& operator=(const EpochManager&) = delete ;
+
+private :
+    static const uint64_t INACTIVE = 0 ;
+    static const size_t RECLAIM_BATCH = 64 ;
+
+    struct Retired {
+        void *ptr ;
+        size_t bytes ;
+        uint64_t epoch ;
+    } ;
+
+    // 每个线程一个槽位，只有自己会改 nest 和 retired，epoch 会被推进 epoch 的线程读
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch ;
+        int nest ;
+        std::vector<Retired> retired ;
+        size_t reclaim_at ; // 待回收链表长到这么长再去回收，回收不掉的时候(比如有长时间的遍历)避免每次 retire 都扫一遍
+    } ;
+
+    // 分配器的类型在构造的时候擦掉，回收不在读路径上，多一次间接调用没关系
+    void *_pool ;
+    void (*_deallocate)(void *pool , void *ptr , size_t bytes) ;
+    std::atomic<uint64_t> _global_epoch ;
+    // 下标为 MAX_THREADS 的是共用的槽位：nest 是所有用它的线程加起来的，第一个进去的线程登记的 epoch 只会更早，一样安全
+    Slot _slots[MAX_THREADS + 1] ;
+    std::mutex _shared_mutex ;
+
+    // 所有正在临界区里的线程都已经看到了当前的全局 epoch 时把它加一
+    bool try_advance() ;
+    void reclaim(Slot &slot) ;
+
+    // 进程内每个活着的线程一个不重复的编号，线程退出后编号可以给新线程用；编号用完了的线程返回 MAX_THREADS
+    static int thread_index() ;
+    // 共用槽位的线程要拿着这个锁才能动槽位，别的线程拿到的是空的锁
+    std::unique_lock<std::mutex> lock_slot(int index) ;
+    static std::atomic<int>& max_thread_index() ;
+} ;
+
+template <typename Allocator>
+EpochManager::EpochManager(Allocator *pool) : _pool(pool) , _global_epoch(1) {
+    this->_deallocate = [](void *pool , void *ptr , size_t bytes) {
+        static_cast<Allocator*>(pool)->deallocate(ptr , bytes) ;
+    } ;
+    for(int i = 0 ; i <= MAX_THREADS ; ++i) {
+        this->_slots[i].epoch.store(INACTIVE , std::memory_order_relaxed) ;
+        this->_slots[i].nest = 0 ;
+        this->_slots[i].reclaim_at = RECLAIM_BATCH ;
+    }
+}
+
+EpochManager::EpochManager() : _pool(nullptr) , _deallocate(nullptr) , _global_epoch(1) {
+    for(int i = 0 ; i <= MAX_THREADS ; ++i) {
+        this->_slots[i].epoch.store(INACTIVE , std::memory_order_relaxed) ;
+        this->_slots[i].nest = 0 ;
+        this->_slots[i].reclaim_at = RECLAIM_BATCH ;
+    }
+}
+
+// 析构的时候不会再有读者，待回收的内存随内存池一起释放
+EpochManager::~EpochManager() { }
+
+int EpochManager::thread_index() {
+    struct ThreadIndex {
+        int index ;
+        ThreadIndex() : index(MAX_THREADS) {
+            std::lock_guard<std::mutex> lock(registry_mutex()) ;
+            std::vector<bool> &used = registry() ;
+            for(int i = 0 ; i < MAX_THREADS ; ++i) {
+                if(!used[i]) {
+                    used[i] = true ; this->index = i ;
+                    break ;
+                }
+            }
+            // 同时活着的线程超过了 MAX_THREADS 的话用共用的槽位，try_advance 也要扫到它
+            int max_index = max_thread_index().load() ;
+            while(max_index < this->index && !max_thread_index().compare_exchange_weak(max_index , this->index)) { }
+        }
+        ~ThreadIndex() {
+            if(this->index == MAX_THREADS) {
+                return ;
+            }
+            std::lock_guard<std::mutex> lock(registry_mutex()) ;
+            registry()[this->index] = false ;
+        }
+        static std::mutex& registry_mutex() { static std::mutex mutex ; return mutex ; }
+        static std::vector<bool>& registry() { static std::vector<bool> used(MAX_THREADS , false) ; return used ; }
+    } ;
+    static thread_local ThreadIndex id ;
+    return id.index ;
+}
+
+std::atomic<int>& EpochManager::max_thread_index() {
+    static std::atomic<int> max_index(0) ;
+    return max_index ;
+}
+
+std::unique_lock<std::mutex> EpochManager::lock_slot(int index) {
+    if(index == MAX_THREADS) {
+        return std::unique_lock<std::mutex>(this->_shared_mutex) ;
+    }
+    return std::unique_lock<std::mutex>() ;
+}
+
+void EpochManager::enter() {
+    const int index = thread_index() ;
+    std::unique_lock<std::mutex> lock = this->lock_slot(index) ;
+    Slot &slot = this->_slots[index] ;
+    if(slot.nest++ > 0) {
+        return ;
+    }
+    // 登记之后再确认一次全局 epoch 没变，避免登记了一个已经过时的 epoch
+    uint64_t epoch = this->_global_epoch.load(std::memory_order_relaxed) ;
+    while(true) {
+        slot.epoch.store(epoch , std::memory_order_relaxed) ;
+        std::atomic_thread_fence(std::memory_order_seq_cst) ;
+        uint64_t now = this->_global_epoch.load(std::memory_order_relaxed) ;
+        if(now == epoch) {
+            break ;
+        }
+        epoch = now ;
+    }
+}
+
+void EpochManager::exit() {
+    const int index = thread_index() ;
+    std::unique_lock<std::mutex> lock = this->lock_slot(index) ;
+    Slot &slot = this->_slots[index] ;
+    assert(slot.nest > 0) ;
+    if(--slot.nest == 0) {
+        slot.epoch.store(INACTIVE , std::memory_order_release) ;
+    }
+}
+
+void EpochManager::retire(void *ptr , size_t bytes) {
+    const int index = thread_index() ;
+    std::unique_lock<std::mutex> lock = this->lock_slot(index) ;
+    Slot &slot = this->_slots[index] ;
+    slot.retired.push_back({ptr , bytes , this->_global_epoch.load(std::memory_order_acquire)}) ;
+    if(slot.retired.size() >= slot.reclaim_at) {
+        try_advance() ;
+        reclaim(slot) ;
+        slot.reclaim_at = slot.retired.size() + RECLAIM_BATCH ;
+    }
+}
+
+size_t EpochManager::pending() {
+    const int index = thread_index() ;
+    std::unique_lock<std::mutex> lock = this->lock_slot(index) ;
+    return this->_slots[index].retired.size() ;
+}
+
+void EpochManager::synchronize() {
+    // 和 retire 一样的道理：调用时的 epoch 是 e，推进到 e + 2 的时候登记着 e 或者更早的读者都已经离开了
+    uint64_t target = this->_global_epoch.load(std::memory_order_acquire) + 2 ;
+    for(int spins = 0 ; this->_global_epoch.load(std::memory_order_acquire) < target ; ++spins) {
+        if(!try_advance()) {
+            // 有长时间的遍历的话不要一直空转
+            if(spins < 64) {
+                std::this_thread::yield() ;
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1)) ;
+            }
+        }
+    }
+}
+
+bool EpochManager::try_advance() {
+    uint64_t epoch = this->_global_epoch.load(std::memory_order_acquire) ;
+    std::atomic_thread_fence(std::memory_order_seq_cst) ;
+    int max_index = max_thread_index().load(std::memory_order_acquire) ;
+    for(int i = 0 ; i <= max_index ; ++i) {
+        uint64_t slot_epoch = this->_slots[i].epoch.load(std::memory_order_acquire) ;
+        if(slot_epoch != INACTIVE && slot_epoch != epoch) {
+            return false ;
+        }
+    }
+    return this->_global_epoch.compare_exchange_strong(epoch , epoch + 1) ;
+}
+
+void EpochManager::reclaim(Slot &slot) {
+    uint64_t epoch = this->_global_epoch.load(std::memory_order_acquire) ;
+    size_t keep = 0 ;
+    for(size_t i = 0 ; i < slot.retired.size() ; ++i) {
+        const Retired &r = slot.retired[i] ;
+        if(r.epoch + 2 <= epoch) {
+            this->_deallocate(this->_pool , r.ptr , r.bytes) ;
+        } else {
+            slot.retired[keep++] = r ;
+        }
+    }
+    slot.retired.resize(keep) ;
+}
+
+} // namespace table
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef TABLE_FILE_MEMTABLE_H
+#define TABLE_FILE_MEMTABLE_H
+
+// 直接读数据文件的只读内存表，打开 Options::mmap_reads 的时候是 LayeredMemtable 的 base
+// 1. open 只映射文件、读 footer、编码表和索引块，数据不拷到堆上，冷数据只在页缓存里有一份
+// 2. get 二分索引找到数据块，在块里按重启点二分，只解码用到的块；迭代器一次解码一个数据块
+// 3. 文件不会再变，所有快照看到的都一样，序列号都是 0；不能写，写只会进上面的 active
+// 4. dump 把新的数据文件改名覆盖原来的文件以后，旧文件的映射还是有效的，旧的 FileMemtable 等没人用了再释放
+#include <string>
+#include <vector>
+#include <utility>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "byte_array.h"
+#include "memtable.h"
+#include "data_file.h"
+
+namespace table {
+
+class FileMemtable : public Memtable {
+public :
+    FileMemtable() : _data(nullptr) , _size(0) { }
+    ~FileMemtable() ;
+
+    // 映射 fileName 并打开它的索引，不是按块组织的数据文件或者坏了的话返回 false
+    bool open(const std::string& fileName) ;
+
+    const char* name() const override               { return "file" ; }
+    std::unique_ptr<Iterator> new_iterator(uint64_t seq = LATEST) override ;
+    // 数据块坏了的话 get 和 multi_get 当成没有找到，find 和 multi_find 返回 io_error
+    bool get(const ByteArray& key , std::string* value , uint64_t seq = LATEST) override ;
+    Status find(const ByteArray& key , std::string* value , uint64_t seq = LATEST) override ;
+    void multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) override ;
+    Status multi_find(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) override ;
+    uint64_t acquire_snapshot() override            { return 0 ; }
+    void release_snapshot(uint64_t) override        { }
+    uint64_t last_sequence() const override         { return 0 ; }
+    // 只算索引和编码表，映射的文件在页缓存里
+    size_t memory_usage() const override            { return this->_reader.memory_usage() ; }
+
+    // 只读，LayeredMemtable 不会写 base 是 FileMemtable 的那一层
+    void put(const ByteArray& , const ByteArray& , bool *existed = nullptr) override    { assert(false) ; if(existed) *existed = false ; }
+    bool del(const ByteArray&) override                 { assert(false) ; return false ; }
+    std::unique_ptr<Writer> new_writer() override       { assert(false) ; return nullptr ; }
+    std::unique_ptr<Builder> new_builder() override     { assert(false) ; return nullptr ; }
+
+    size_t entries() const                          { return this->_reader.entries() ; }
+    const DataFileReader& reader() const            { return this->_reader ; }
+
+    // Non-copying
+    FileMemtable(const FileMemtable&) = delete ;
+    FileMemtable& operator=(const FileMemtable&) = delete ;
+
+private :
+    class FileIterator ;
+
+    char *_data ;
+    size_t _size ;
+    DataFileReader _reader ;
+} ;
+
+// 解码好的当前数据块放在 _entries 里，走出这个块再解码下一块；数据块坏了的话迭代器停下，good() 为 false，status() 为 io_error
+class FileMemtable::FileIterator : public Memtable::Iterator {
+public :
+    explicit FileIterator(const DataFileReader *reader) : _reader(reader) , _block(0) , _pos(0) { this->seek_to_first() ; }
+
+    bool good() override                { return this->_pos < this->_entries.size() ; }
+    ByteArray key() override            { return this->_entries[this->_pos].first ; }
+    ByteArray value() override          { return this->_entries[this->_pos].second ; }
+    Status status() override            { return this->_status ; }
+
+    void seek(const ByteArray& key) override {
+        if(!this->load(this->_reader->find_block(key))) {
+            return ;
+        }
+        auto iter = std::lower_bound(this->_entries.begin() , this->_entries.end() , key ,
+            [](const std::pair<std::string , std::string>& entry , const ByteArray& key) {
+                return compare_key(entry.first.data() , entry.first.size() , key.data() , key.size()) < 0 ;
+            }) ;
+        this->_pos = iter - this->_entries.begin() ;
+    }
+    void seek_to_first() override {
+        this->load(0) ;
+    }
+    void seek_to_last() override {
+        if(this->load(this->_reader->block_count() - 1)) {
+            this->_pos = this->_entries.size() - 1 ;
+        }
+    }
+    void next() override {
+        if(++this->_pos == this->_entries.size()) {
+            this->load(this->_block + 1) ;
+        }
+    }
+    void prev() override {
+        if(this->_pos > 0) {
+            --this->_pos ;
+        } else if(this->_block > 0 && this->load(this->_block - 1)) {
+            this->_pos = this->_entries.size() - 1 ;
+        } else {
+            this->invalidate() ;
+        }
+    }
+
+private :
+    // 解码第 block 块，停在它的第一个 entry 上；没有这一块或者块坏了返回 false，块坏了的话记下错误
+    bool load(size_t block) {
+        this->invalidate() ;
+        this->_status = Status::ok() ;
+        if(block >= this->_reader->block_count()) {
+            return false ;
+        }
+        this->_block = block ;
+        bool ok = this->_reader->read_block(block , [this](const std::string& key , const std::string& value) {
+            this->_entries.emplace_back(key , value) ;
+            return true ;
+        }) ;
+        if(!ok) {
+            this->invalidate() ;
+            this->_status = Status::io_error("data file block " + std::to_string(block) + " is corrupted") ;
+        }
+        return ok && !this->_entries.empty() ;
+    }
+    void invalidate() {
+        this->_entries.clear() ;
+        this->_pos = 0 ;
+    }
+
+    const DataFileReader *_reader ;
+    size_t _block ;
+    std::vector<std::pair<std::string , std::string>> _entries ;
+    size_t _pos ;
+    Status _status ;
+} ;
+
+FileMemtable::~FileMemtable() {
+    if(this->_data != nullptr) {
+        munmap(this->_data , this->_size) ;
+    }
+}
+
+bool FileMemtable::open(const std::string& fileName) {
+    int fd = ::open(fileName.data() , O_RDONLY) ;
+    if(fd == -1) {
+        return false ;
+    }
+    struct stat info ;
+    if(fstat(fd , &info) != 0 || info.st_size == 0) {
+        ::close(fd) ;
+        return false ;
+    }
+    void *data = mmap(nullptr , info.st_size , PROT_READ , MAP_PRIVATE , fd , 0) ;
+    ::close(fd) ;
+    if(data == MAP_FAILED) {
+        return false ;
+    }
+    this->_data = static_cast<char*>(data) ;
+    this->_size = info.st_size ;
+    return this->_reader.open(this->_data , this->_size) ;
+}
+
+std::unique_ptr<Memtable::Iterator> FileMemtable::new_iterator(uint64_t) {
+    return std::unique_ptr<Memtable::Iterator>(new FileIterator(&this->_reader)) ;
+}
+
+bool FileMemtable::get(const ByteArray& key , std::string* value , uint64_t seq) {
+    return this->find(key , value , seq).good() ;
+}
+
+Status FileMemtable::find(const ByteArray& key , std::string* value , uint64_t) {
+    std::string found ;
+    return this->_reader.get(key , value != nullptr ? value : &found) ;
+}
+
+void FileMemtable::multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t) {
+    std::string value ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        if(this->_reader.get(keys[i] , &value).good()) {
+            handler(i , value) ;
+        }
+    }
+}
+
+Status FileMemtable::multi_find(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t) {
+    std::string value ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        Status s = this->_reader.get(keys[i] , &value) ;
+        if(s.good()) {
+            handler(i , value) ;
+        } else if(s.code() != Status::NOT_FOUND) {
+            return s ;
+        }
+    }
+    return Status::ok() ;
+}
+
+} // namespace table
+
+#endif
@@ -0,0 +1,438 @@
+#ifndef TABLE_FILE_WRITER_H
+#define TABLE_FILE_WRITER_H
+
+// dump 写数据文件用的输出管道
+// 1. 数据先拷到几个按页对齐的大缓冲区里，不再每个字节一次 write
+// 2. PWRITEV：几个缓冲区都满了以后用一次 pwritev 写出去；IO_URING：一个缓冲区满了就交给 io_uring 异步写，
+//    同时最多有 BUFFERS - 1 个写在进行，接着填下一个缓冲区；内核不支持 io_uring 的时候自动退回 PWRITEV
+// 3. 写的是 "文件名.tmp"，finish 的时候 fdatasync 一次再改名覆盖原来的文件，dump 到一半失败或者崩溃，原来的文件还是完整的
+#include <string>
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include "options.h"
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define TABLE_HAVE_IO_URING
+#endif
+
+namespace table {
+
+// 改名以后要刷一下所在的目录，改名本身才落了盘
+inline bool sync_dir(const std::string& fileName) {
+    size_t slash = fileName.rfind('/') ;
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : fileName.substr(0 , slash)) ;
+    int fd = ::open(dir.data() , O_RDONLY | O_DIRECTORY) ;
+    if(fd == -1) {
+        return false ;
+    }
+    bool ok = fsync(fd) == 0 ;
+    ::close(fd) ;
+    return ok ;
+}
+
+class FileWriter {
+public :
+    // 缓冲区的大小和个数，一共 4MB
+    static const size_t BUFFER_SIZE = 1 << 20 ;
+    static const int BUFFERS = 4 ;
+
+    explicit FileWriter(DumpIO io = DumpIO::PWRITEV) ;
+    // 没有 finish 的话删掉临时文件
+    ~FileWriter() ;
+
+    // 开始写 fileName，数据先写在 fileName.tmp 里
+    bool open(const std::string& fileName) ;
+
+    bool append(const char *data , size_t size) ;
+    bool append(const std::string& data)    { return this->append(data.data() , data.size()) ; }
+
+    // 已经追加的字节数，也就是 finish 以后文件的大小
+    uint64_t size() const                   { return this->_size ; }
+
+    // 是不是真的在用 io_uring
+    bool use_io_uring() const               { return this->_ring_fd != -1 ; }
+
+    // 写完剩下的数据，fdatasync，改名覆盖 fileName，再刷一下目录
+    bool finish() ;
+
+    // Non-copying
+    FileWriter(const FileWriter&) = delete ;
+    FileWriter& operator=(const FileWriter&) = delete ;
+
+private :
+    // 当前缓冲区满了(或者是最后一个)，写出去或者交给 io_uring，换下一个缓冲区
+    bool flush_current() ;
+    // 把前 count 个缓冲区用 pwritev 写出去
+    bool write_buffers(int count) ;
+    // 把 [data, data + size) 同步写到 offset
+    bool write_at(const char *data , size_t size , uint64_t offset) ;
+    // 等所有在进行的写完成
+    bool wait_all() ;
+    void abort() ;
+
+#ifdef TABLE_HAVE_IO_URING
+    bool ring_setup() ;
+    void ring_teardown() ;
+    bool ring_submit(int index) ;
+    // 等一个写完成，失败或者写少了的话返回 false
+    bool ring_wait_one() ;
+
+    struct Ring {
+        void *sq_ptr , *cq_ptr ;
+        size_t sq_size , cq_size , sqes_size ;
+        unsigned *sq_tail , *sq_mask , *sq_array ;
+        unsigned *cq_head , *cq_tail , *cq_mask ;
+        struct io_uring_sqe *sqes ;
+        struct io_uring_cqe *cqes ;
+    } ;
+    Ring _ring ;
+#endif
+
+    DumpIO _io ;
+    int _fd ;
+    int _ring_fd ;
+    std::string _file_name ;
+    std::string _tmp_name ;
+    char *_buffers[BUFFERS] ;
+    size_t _used[BUFFERS] ;
+    // io_uring 模式下每个缓冲区在文件里的位置，和它是不是正在写
+    uint64_t _offsets[BUFFERS] ;
+    bool _in_flight[BUFFERS] ;
+    int _current ;
+    // 已经交出去写的字节数和一共追加的字节数
+    uint64_t _written ;
+    uint64_t _size ;
+    bool _failed ;
+} ;
+
+FileWriter::FileWriter(DumpIO io) : _io(io) , _fd(-1) , _ring_fd(-1) , _current(0) , _written(0) , _size(0) , _failed(false) {
+#ifdef TABLE_HAVE_IO_URING
+    memset(&this->_ring , 0 , sizeof(this->_ring)) ;
+#endif
+    for(int i = 0 ; i < BUFFERS ; ++i) {
+        this->_buffers[i] = nullptr ;
+        this->_used[i] = 0 ;
+        this->_offsets[i] = 0 ;
+        this->_in_flight[i] = false ;
+    }
+}
+
+FileWriter::~FileWriter() {
+    this->abort() ;
+    for(int i = 0 ; i < BUFFERS ; ++i) {
+        free(this->_buffers[i]) ;
+    }
+}
+
+bool FileWriter::open(const std::string& fileName) {
+    this->abort() ;
+    this->_file_name = fileName ;
+    this->_tmp_name = fileName + ".tmp" ;
+    this->_fd = ::open(this->_tmp_name.data() , O_WRONLY | O_CREAT | O_TRUNC , 0644) ;
+    if(this->_fd == -1) {
+        return false ;
+    }
+    for(int i = 0 ; i < BUFFERS ; ++i) {
+        if(this->_buffers[i] == nullptr && posix_memalign(reinterpret_cast<void**>(&this->_buffers[i]) , 4096 , BUFFER_SIZE) != 0) {
+            this->_buffers[i] = nullptr ;
+            this->abort() ;
+            return false ;
+        }
+        this->_used[i] = 0 ;
+    }
+    this->_current = 0 ;
+    this->_written = this->_size = 0 ;
+    this->_failed = false ;
+#ifdef TABLE_HAVE_IO_URING
+    if(this->_io == DumpIO::IO_URING && !this->ring_setup()) {
+        this->ring_teardown() ;
+    }
+#endif
+    return true ;
+}
+
+bool FileWriter::append(const char *data , size_t size) {
+    if(this->_fd == -1 || this->_failed) {
+        return false ;
+    }
+    this->_size += size ;
+    while(size > 0) {
+        size_t &used = this->_used[this->_current] ;
+        size_t n = std::min(size , BUFFER_SIZE - used) ;
+        memcpy(this->_buffers[this->_current] + used , data , n) ;
+        used += n ;
+        data += n ;
+        size -= n ;
+        if(used == BUFFER_SIZE && !this->flush_current()) {
+            this->_failed = true ;
+            return false ;
+        }
+    }
+    return true ;
+}
+
+bool FileWriter::flush_current() {
+#ifdef TABLE_HAVE_IO_URING
+    if(this->_ring_fd != -1) {
+        if(!this->ring_submit(this->_current)) {
+            return false ;
+        }
+        // 下一个缓冲区还在写的话等它写完
+        this->_current = (this->_current + 1) % BUFFERS ;
+        while(this->_in_flight[this->_current]) {
+            if(!this->ring_wait_one()) {
+                return false ;
+            }
+        }
+        this->_used[this->_current] = 0 ;
+        return true ;
+    }
+#endif
+    if(this->_current + 1 < BUFFERS) {
+        ++this->_current ;
+        return true ;
+    }
+    return this->write_buffers(BUFFERS) ;
+}
+
+bool FileWriter::write_buffers(int count) {
+    struct iovec iov[BUFFERS] ;
+    size_t total = 0 ;
+    for(int i = 0 ; i < count ; ++i) {
+        iov[i].iov_base = this->_buffers[i] ;
+        iov[i].iov_len = this->_used[i] ;
+        total += this->_used[i] ;
+    }
+    // 写少了的话跳过已经写完的部分接着写
+    struct iovec *cur = iov ;
+    int left = count ;
+    size_t done = 0 ;
+    while(done < total) {
+        ssize_t n = pwritev(this->_fd , cur , left , this->_written + done) ;
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) continue ;
+            return false ;
+        }
+        done += n ;
+        while(left > 0 && static_cast<size_t>(n) >= cur->iov_len) {
+            n -= cur->iov_len ;
+            ++cur ;
+            --left ;
+        }
+        if(left > 0) {
+            cur->iov_base = static_cast<char*>(cur->iov_base) + n ;
+            cur->iov_len -= n ;
+        }
+    }
+    this->_written += total ;
+    for(int i = 0 ; i < count ; ++i) {
+        this->_used[i] = 0 ;
+    }
+    this->_current = 0 ;
+    return true ;
+}
+
+bool FileWriter::write_at(const char *data , size_t size , uint64_t offset) {
+    size_t done = 0 ;
+    while(done < size) {
+        ssize_t n = pwrite(this->_fd , data + done , size - done , offset + done) ;
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) continue ;
+            return false ;
+        }
+        done += n ;
+    }
+    return true ;
+}
+
+bool FileWriter::finish() {
+    if(this->_fd == -1 || this->_failed) {
+        this->abort() ;
+        return false ;
+    }
+    bool ok ;
+#ifdef TABLE_HAVE_IO_URING
+    if(this->_ring_fd != -1) {
+        ok = (this->_used[this->_current] == 0 || this->ring_submit(this->_current)) && this->wait_all() ;
+    } else
+#endif
+    {
+        ok = this->write_buffers(this->_current + 1) ;
+    }
+    if(!ok || fdatasync(this->_fd) != 0) {
+        this->abort() ;
+        return false ;
+    }
+    ::close(this->_fd) ;
+    this->_fd = -1 ;
+#ifdef TABLE_HAVE_IO_URING
+    this->ring_teardown() ;
+#endif
+    if(rename(this->_tmp_name.data() , this->_file_name.data()) != 0) {
+        remove(this->_tmp_name.data()) ;
+        return false ;
+    }
+    return sync_dir(this->_file_name) ;
+}
+
+bool FileWriter::wait_all() {
+    bool ok = true ;
+#ifdef TABLE_HAVE_IO_URING
+    if(this->_ring_fd != -1) {
+        for(int i = 0 ; i < BUFFERS ; ++i) {
+            while(this->_in_flight[i]) {
+                if(!this->ring_wait_one()) {
+                    ok = false ;
+                    // 内核还拿着缓冲区的话不能放手，等不到就只能不再用这个 ring
+                    if(this->_in_flight[i]) {
+                        return false ;
+                    }
+                }
+            }
+        }
+    }
+#endif
+    return ok ;
+}
+
+void FileWriter::abort() {
+    if(this->_fd == -1) {
+        return ;
+    }
+    this->wait_all() ;
+    ::close(this->_fd) ;
+    this->_fd = -1 ;
+    remove(this->_tmp_name.data()) ;
+#ifdef TABLE_HAVE_IO_URING
+    this->ring_teardown() ;
+#endif
+}
+
+#ifdef TABLE_HAVE_IO_URING
+
+bool FileWriter::ring_setup() {
+    struct io_uring_params params ;
+    memset(&params , 0 , sizeof(params)) ;
+    memset(&this->_ring , 0 , sizeof(this->_ring)) ;
+    this->_ring_fd = syscall(__NR_io_uring_setup , BUFFERS , &params) ;
+    if(this->_ring_fd < 0) {
+        this->_ring_fd = -1 ;
+        return false ;
+    }
+    Ring &r = this->_ring ;
+    r.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned) ;
+    r.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) ;
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        r.sq_size = r.cq_size = std::max(r.sq_size , r.cq_size) ;
+    }
+    r.sq_ptr = mmap(nullptr , r.sq_size , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE , this->_ring_fd , IORING_OFF_SQ_RING) ;
+    if(r.sq_ptr == MAP_FAILED) {
+        r.sq_ptr = nullptr ;
+        return false ;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        r.cq_ptr = r.sq_ptr ;
+    } else {
+        r.cq_ptr = mmap(nullptr , r.cq_size , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE , this->_ring_fd , IORING_OFF_CQ_RING) ;
+        if(r.cq_ptr == MAP_FAILED) {
+            r.cq_ptr = nullptr ;
+            return false ;
+        }
+    }
+    r.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe) ;
+    void *sqes = mmap(nullptr , r.sqes_size , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE , this->_ring_fd , IORING_OFF_SQES) ;
+    if(sqes == MAP_FAILED) {
+        return false ;
+    }
+    r.sqes = static_cast<struct io_uring_sqe*>(sqes) ;
+    char *sq = static_cast<char*>(r.sq_ptr) , *cq = static_cast<char*>(r.cq_ptr) ;
+    r.sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail) ;
+    r.sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask) ;
+    r.sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array) ;
+    r.cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head) ;
+    r.cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail) ;
+    r.cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask) ;
+    r.cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes) ;
+    return true ;
+}
+
+void FileWriter::ring_teardown() {
+    // 没有用 io_uring 的时候什么也没有映射
+    if(this->_ring_fd == -1) {
+        return ;
+    }
+    Ring &r = this->_ring ;
+    if(r.sqes != nullptr) munmap(r.sqes , r.sqes_size) ;
+    if(r.cq_ptr != nullptr && r.cq_ptr != r.sq_ptr) munmap(r.cq_ptr , r.cq_size) ;
+    if(r.sq_ptr != nullptr) munmap(r.sq_ptr , r.sq_size) ;
+    memset(&r , 0 , sizeof(r)) ;
+    ::close(this->_ring_fd) ;
+    this->_ring_fd = -1 ;
+}
+
+bool FileWriter::ring_submit(int index) {
+    Ring &r = this->_ring ;
+    unsigned tail = *r.sq_tail ;
+    unsigned slot = tail & *r.sq_mask ;
+    struct io_uring_sqe *sqe = &r.sqes[slot] ;
+    memset(sqe , 0 , sizeof(*sqe)) ;
+    sqe->opcode = IORING_OP_WRITE ;
+    sqe->fd = this->_fd ;
+    sqe->addr = reinterpret_cast<uint64_t>(this->_buffers[index]) ;
+    sqe->len = this->_used[index] ;
+    sqe->off = this->_written ;
+    sqe->user_data = index ;
+    r.sq_array[slot] = slot ;
+    __atomic_store_n(r.sq_tail , tail + 1 , __ATOMIC_RELEASE) ;
+    this->_offsets[index] = this->_written ;
+    this->_written += this->_used[index] ;
+    while(syscall(__NR_io_uring_enter , this->_ring_fd , 1 , 0 , 0 , nullptr , 0) < 0) {
+        if(errno != EINTR && errno != EAGAIN) {
+            // 交不出去的话撤回这一项，同步写掉
+            __atomic_store_n(r.sq_tail , tail , __ATOMIC_RELEASE) ;
+            return this->write_at(this->_buffers[index] , this->_used[index] , this->_offsets[index]) ;
+        }
+    }
+    this->_in_flight[index] = true ;
+    return true ;
+}
+
+bool FileWriter::ring_wait_one() {
+    Ring &r = this->_ring ;
+    while(true) {
+        unsigned head = *r.cq_head ;
+        if(head != __atomic_load_n(r.cq_tail , __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask] ;
+            int index = static_cast<int>(cqe->user_data) ;
+            int res = cqe->res ;
+            __atomic_store_n(r.cq_head , head + 1 , __ATOMIC_RELEASE) ;
+            this->_in_flight[index] = false ;
+            if(res < 0) {
+                return false ;
+            }
+            // 写少了的话剩下的同步写掉
+            size_t done = static_cast<size_t>(res) ;
+            return done == this->_used[index] ||
+                   this->write_at(this->_buffers[index] + done , this->_used[index] - done , this->_offsets[index] + done) ;
+        }
+        if(syscall(__NR_io_uring_enter , this->_ring_fd , 0 , 1 , IORING_ENTER_GETEVENTS , nullptr , 0) < 0 && errno != EINTR) {
+            return false ;
+        }
+    }
+}
+
+#endif // TABLE_HAVE_IO_URING
+
+} // namespace table
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef TABLE_HASH_INDEX_H
+#define TABLE_HASH_INDEX_H
+
+// 跳表旁边的哈希索引，key 直接映射到跳表节点，点查不用再从最高层一层层往下找
+// 1. 开放寻址，布局和 Swiss table 一样：每个槽位一个控制字节，没用过的是 EMPTY，删掉的是 DELETED，
+//    放了节点的是 key 哈希值的低 7 位(tag)；16 个槽位一组，一组的控制字节用 SSE2 一条指令比较完，
+//    只有 tag 对上的槽位才去比较 key，一组里有 EMPTY 就说明后面不会再有这个 key 了
+// 2. 并发：插入先用 CAS 把一个 EMPTY 抢成 BUSY，写好节点指针再把 BUSY 换成 tag；删除先把节点指针 CAS 成空，
+//    抢到的线程再把控制字节改成 DELETED。控制字节只会 EMPTY -> BUSY -> tag -> DELETED 单向变化，
+//    DELETED 的槽位不再复用，查找不加锁也不做 CAS
+// 3. 用过的槽位(包括 DELETED)超过 7/8 时换一个新数组：新的写先等着，等正在写的线程都写完，把活着的节点重新插一遍；
+//    查找不用等，照常读旧数组，旧数组交给 EpochManager 等没有读者了再回收
+// 4. 数组从跳表的内存池里分配，调用的线程要在 epoch 临界区里
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+#include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "memory_pool.h"
+#include "epoch_manager.h"
+
+namespace table {
+
+// Node 要有 hash() 返回它的 key 的哈希值，换数组重新插入的时候用；Allocator 和跳表的一样
+template <typename Node , typename Allocator = MemoryPool>
+class HashIndex {
+public :
+    HashIndex(Allocator *pool , EpochManager *epoch) ;
+
+    // 数组都在内存池里，随内存池一起释放
+    ~HashIndex() { }
+
+    // 找 tag 对上、match(node) 返回 true 的节点，没有的话返回 nullptr
+    template <typename Match>
+    Node* find(uint64_t h , Match match) const ;
+
+    // 预取 h 所在的第一组控制字节
+    void prefetch(uint64_t h) const ;
+
+    void insert(uint64_t h , Node* node) ;
+
+    // 去掉 node，返回它在不在索引里；同一个 node 只有一个线程能去掉
+    bool erase(uint64_t h , Node* node) ;
+
+    // 当前数组的槽位数
+    size_t capacity() const ;
+
+    // Non-copying
+    HashIndex(const HashIndex&) = delete ;
+    HashIndex& operator=(const HashIndex&) = delete ;
+
+private :
+    static const uint8_t EMPTY = 0x80 ;
+    static const uint8_t DELETED = 0xfe ;
+    static const uint8_t BUSY = 0xff ;
+    static const size_t GROUP = 16 ;            // 一组的槽位数，也是 SSE2 寄存器的字节数
+    static const size_t MIN_CAPACITY = 64 ;
+
+    // +-----------------------------------------------------------------+
+    // | capacity | used | ctrl[capacity / 8] | slots[capacity]           |
+    // +-----------------------------------------------------------------+
+    // 控制字节 8 个一组放在 uint64_t 里，第 i 个槽位是 ctrl[i / 8] 的第 i % 8 个字节(从低位数)
+    struct Array {
+        size_t capacity ;
+        std::atomic<size_t> used ;  // 不是 EMPTY 的槽位数
+        std::atomic<uint64_t> *ctrl ;
+        std::atomic<Node*> *slots ;
+    } ;
+
+    Allocator *_pool ;
+    EpochManager *_epoch ;
+    std::atomic<Array*> _array ;
+
+    // 正在写的线程数和是不是在换数组，换数组的时候没有线程在写
+    std::atomic<int> _writers ;
+    std::atomic<bool> _resizing ;
+    std::mutex _resize_mutex ;
+
+    static size_t array_size(size_t capacity) ;
+    Array* new_array(size_t capacity) ;
+
+    static uint8_t tag_of(uint64_t h)                   { return h & 0x7f ; }
+    static size_t group_of(const Array *a , uint64_t h)  { return (h >> 7) & (a->capacity / GROUP - 1) ; }
+
+    // 第 g 组里控制字节等于 b 的槽位，第 i 位对应组里的第 i 个槽位
+    static uint32_t match_byte(const Array *a , size_t g , uint8_t b) ;
+
+    // 槽位 i 的控制字节从 from 改成 to，from 不对的话返回 false
+    static bool change_ctrl(Array *a , size_t i , uint8_t from , uint8_t to) ;
+
+    // 不检查并发，只给换数组的时候往新数组里插
+    static void insert_unlocked(Array *a , uint64_t h , Node* node) ;
+
+    void enter_write() ;
+    void exit_write()                                  { this->_writers.fetch_sub(1) ; }
+
+    // 换一个更大(或者一样大、但是去掉了 DELETED)的数组，old 已经被别人换掉了的话什么都不做
+    void grow(Array *old) ;
+} ;
+
+template <typename Node , typename Allocator>
+HashIndex<Node , Allocator>::HashIndex(Allocator *pool , EpochManager *epoch) : _pool(pool) , _epoch(epoch) ,
+    _writers(0) , _resizing(false) {
+    this->_array.store(this->new_array(MIN_CAPACITY) , std::memory_order_relaxed) ;
+}
+
+template <typename Node , typename Allocator>
+inline size_t HashIndex<Node , Allocator>::array_size(size_t capacity) {
+    return sizeof(Array) + sizeof(std::atomic<uint64_t>) * (capacity / 8) + sizeof(std::atomic<Node*>) * capacity ;
+}
+
+template <typename Node , typename Allocator>
+typename HashIndex<Node , Allocator>::Array* HashIndex<Node , Allocator>::new_array(size_t capacity) {
+    char *mem = this->_pool->allocate(array_size(capacity)) ;
+    Array *a = reinterpret_cast<Array*>(mem) ;
+    a->capacity = capacity ;
+    new (&a->used) std::atomic<size_t>(0) ;
+    a->ctrl = reinterpret_cast<std::atomic<uint64_t>*>(mem + sizeof(Array)) ;
+    a->slots = reinterpret_cast<std::atomic<Node*>*>(a->ctrl + capacity / 8) ;
+    for(size_t i = 0 ; i < capacity / 8 ; ++i) {
+        new (&a->ctrl[i]) std::atomic<uint64_t>(0x8080808080808080ULL) ; // 全是 EMPTY
+    }
+    for(size_t i = 0 ; i < capacity ; ++i) {
+        new (&a->slots[i]) std::atomic<Node*>(nullptr) ;
+    }
+    return a ;
+}
+
+template <typename Node , typename Allocator>
+inline uint32_t HashIndex<Node , Allocator>::match_byte(const Array *a , size_t g , uint8_t b) {
+    uint64_t lo = a->ctrl[g * 2].load(std::memory_order_acquire) ;
+    uint64_t hi = a->ctrl[g * 2 + 1].load(std::memory_order_acquire) ;
+#ifdef __SSE2__
+    __m128i ctrl = _mm_set_epi64x(static_cast<long long>(hi) , static_cast<long long>(lo)) ;
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl , _mm_set1_epi8(static_cast<char>(b)))) ;
+#else
+    // 没有 SSE2 的时候一次比较 8 个字节：等于 b 的字节异或以后是 0，低 7 位加上 0x7f 不会进位到别的字节
+    auto match = [b](uint64_t word) -> uint32_t {
+        uint64_t x = word ^ (0x0101010101010101ULL * b) ;
+        uint64_t zero = ~(((x & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | x) & 0x8080808080808080ULL ;
+        return ((zero >> 7) * 0x0102040810204080ULL) >> 56 ; // 每个字节的最高位收集到一个字节里
+    } ;
+    return match(lo) | (match(hi) << 8) ;
+#endif
+}
+
+template <typename Node , typename Allocator>
+inline bool HashIndex<Node , Allocator>::change_ctrl(Array *a , size_t i , uint8_t from , uint8_t to) {
+    std::atomic<uint64_t> &word = a->ctrl[i / 8] ;
+    const int shift = (i % 8) * 8 ;
+    uint64_t old = word.load(std::memory_order_relaxed) ;
+    while(((old >> shift) & 0xff) == from) {
+        uint64_t now = old ^ (static_cast<uint64_t>(from ^ to) << shift) ;
+        if(word.compare_exchange_weak(old , now)) {
+            return true ;
+        }
+    }
+    return false ;
+}
+
+template <typename Node , typename Allocator>
+template <typename Match>
+Node* HashIndex<Node , Allocator>::find(uint64_t h , Match match) const {
+    const Array *a = this->_array.load(std::memory_order_acquire) ;
+    const size_t groups = a->capacity / GROUP ;
+    const uint8_t tag = tag_of(h) ;
+    size_t g = group_of(a , h) ;
+    // 按 1、2、3 ... 的步长跳组，组数是 2 的幂，每一组都会走到
+    for(size_t step = 1 ; step <= groups ; ++step) {
+        uint32_t bits = match_byte(a , g , tag) ;
+        while(bits != 0) {
+            Node *node = a->slots[g * GROUP + __builtin_ctz(bits)].load(std::memory_order_acquire) ;
+            if(node != nullptr && match(node)) {
+                return node ;
+            }
+            bits &= bits - 1 ;
+        }
+        if(match_byte(a , g , EMPTY) != 0) {
+            return nullptr ;
+        }
+        g = (g + step) & (groups - 1) ;
+    }
+    return nullptr ;
+}
+
+template <typename Node , typename Allocator>
+inline void HashIndex<Node , Allocator>::prefetch(uint64_t h) const {
+    const Array *a = this->_array.load(std::memory_order_acquire) ;
+    size_t g = group_of(a , h) ;
+    __builtin_prefetch(&a->ctrl[g * 2]) ;
+    __builtin_prefetch(&a->slots[g * GROUP]) ;
+}
+
+template <typename Node , typename Allocator>
+inline void HashIndex<Node , Allocator>::enter_write() {
+    // 先登记自己在写再看 _resizing，和 grow 里的顺序相反，两边至少有一边能看到另一边
+    while(true) {
+        this->_writers.fetch_add(1) ;
+        if(!this->_resizing.load()) {
+            return ;
+        }
+        this->_writers.fetch_sub(1) ;
+        while(this->_resizing.load()) {
+            std::this_thread::yield() ;
+        }
+    }
+}
+
+template <typename Node , typename Allocator>
+void HashIndex<Node , Allocator>::insert(uint64_t h , Node* node) {
+    const uint8_t tag = tag_of(h) ;
+    while(true) {
+        this->enter_write() ;
+        Array *a = this->_array.load(std::memory_order_acquire) ;
+        const size_t groups = a->capacity / GROUP ;
+        if(a->used.load(std::memory_order_relaxed) < a->capacity / 8 * 7) {
+            size_t g = group_of(a , h) ;
+            for(size_t step = 1 ; step <= groups ; ++step) {
+                uint32_t bits = match_byte(a , g , EMPTY) ;
+                while(bits != 0) {
+                    size_t i = g * GROUP + __builtin_ctz(bits) ;
+                    if(change_ctrl(a , i , EMPTY , BUSY)) {
+                        a->used.fetch_add(1 , std::memory_order_relaxed) ;
+                        a->slots[i].store(node , std::memory_order_release) ;
+                        change_ctrl(a , i , BUSY , tag) ;
+                        this->exit_write() ;
+                        return ;
+                    }
+                    bits &= bits - 1 ; // 被别的线程抢走了
+                }
+                g = (g + step) & (groups - 1) ;
+            }
+        }
+        // 快满了，或者并发插入把 EMPTY 都抢光了
+        this->exit_write() ;
+        this->grow(a) ;
+    }
+}
+
+template <typename Node , typename Allocator>
+bool HashIndex<Node , Allocator>::erase(uint64_t h , Node* node) {
+    const uint8_t tag = tag_of(h) ;
+    this->enter_write() ;
+    Array *a = this->_array.load(std::memory_order_acquire) ;
+    const size_t groups = a->capacity / GROUP ;
+    size_t g = group_of(a , h) ;
+    for(size_t step = 1 ; step <= groups ; ++step) {
+        uint32_t bits = match_byte(a , g , tag) ;
+        while(bits != 0) {
+            size_t i = g * GROUP + __builtin_ctz(bits) ;
+            Node *expected = node ;
+            if(a->slots[i].compare_exchange_strong(expected , nullptr)) {
+                change_ctrl(a , i , tag , DELETED) ;
+                this->exit_write() ;
+                return true ;
+            }
+            bits &= bits - 1 ;
+        }
+        if(match_byte(a , g , EMPTY) != 0) {
+            break ;
+        }
+        g = (g + step) & (groups - 1) ;
+    }
+    this->exit_write() ;
+    return false ;
+}
+
+template <typename Node , typename Allocator>
+void HashIndex<Node , Allocator>::insert_unlocked(Array *a , uint64_t h , Node* node) {
+    const size_t groups = a->capacity / GROUP ;
+    size_t g = group_of(a , h) ;
+    for(size_t step = 1 ; ; ++step) {
+        uint32_t bits = match_byte(a , g , EMPTY) ;
+        if(bits != 0) {
+            size_t i = g * GROUP + __builtin_ctz(bits) ;
+            change_ctrl(a , i , EMPTY , tag_of(h)) ;
+            a->slots[i].store(node , std::memory_order_relaxed) ;
+            a->used.fetch_add(1 , std::memory_order_relaxed) ;
+            return ;
+        }
+        g = (g + step) & (groups - 1) ;
+    }
+}
+
+template <typename Node , typename Allocator>
+void HashIndex<Node , Allocator>::grow(Array *old) {
+    std::lock_guard<std::mutex> lock(this->_resize_mutex) ;
+    if(this->_array.load(std::memory_order_acquire) != old) {
+        return ;
+    }
+    this->_resizing.store(true) ;
+    while(this->_writers.load() != 0) {
+        std::this_thread::yield() ;
+    }
+
+    // 新数组里活着的节点最多占 7/16，下一次换数组之前至少还能再插这么多
+    size_t live = 0 ;
+    for(size_t i = 0 ; i < old->capacity ; ++i) {
+        if(old->slots[i].load(std::memory_order_relaxed) != nullptr) {
+            ++live ;
+        }
+    }
+    size_t capacity = MIN_CAPACITY ;
+    while(capacity / 16 * 7 <= live) {
+        capacity *= 2 ;
+    }
+    Array *a = this->new_array(capacity) ;
+    for(size_t i = 0 ; i < old->capacity ; ++i) {
+        Node *node = old->slots[i].load(std::memory_order_relaxed) ;
+        if(node != nullptr) {
+            insert_unlocked(a , node->hash() , node) ;
+        }
+    }
+    this->_array.store(a , std::memory_order_release) ;
+    this->_resizing.store(false) ;
+    // 还在读旧数组的线程读完之前不能回收
+    this->_epoch->retire(old , array_size(old->capacity)) ;
+}
+
+template <typename Node , typename Allocator>
+size_t HashIndex<Node , Allocator>::capacity() const {
+    return this->_array.load(std::memory_order_acquire)->capacity ;
+}
+
+} // namespace table
+
+#endif
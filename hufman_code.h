@@ -2,18 +2,20 @@
 #define HUFMAN_CODE_H
 
 // 只对 key 和 value 进行 huffman 压缩
-// 前面的 len_key 和 len_value 改成压缩完所占用的字节数
+// 前面的 len_key 和 len_value 改成压缩完所占用的字节数，用变长整数编码，长度不再限制在一个字节以内
+// 编码存在 uint32_t 里，最高的 1 是标记位，码长最多 31 位
 // 所以这个文件只需要做的是：
 // 1. 统计词频，建立 哈弗曼编码
-// 2. 根据 bits 查找对应的字符 
+// 2. 根据 bits 查找对应的字符，解码时一次取 DECODE_BITS 位查表，更长的编码再逐位查 r_huffmanCodeTable
 // 3. 根据字符写入对应的编码 
-// 4. 保存/读取编码文件
+// 4. 保存/读取编码文件；现在的数据文件把编码表存在文件里面(save_codes/load_codes)，编码文件只有以前格式的数据文件还在用
 #include <string> 
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
 #include <queue>
 #include <memory>
+#include <algorithm>
  
 #include <unistd.h> // close_file_fd
 #include <fcntl.h> // open file_fd
@@ -30,8 +32,16 @@ public :
     bool build_huffmanTree() ; 
     bool save_encryptedFile(const char *fileName) ; 
     bool decrypt_File(const char *fileName) ;  
+    // 把编码表追加到 out 后面：| varint 字符数 | 字符(1 字节) | varint 编码 | ... |
+    void save_codes(std::string *out) const ;
+    // 读 save_codes 写的编码表，替换掉原来的；格式不对的话返回 false
+    bool load_codes(const char *data , size_t size) ;
+    // 把 str 编码以后追加到 out 后面，前面是编码以后的字节数；str 里有不在树里的字符的话返回 false
+    bool encode_string(const ByteArray &str , std::string *out) const ;
     bool write_string(std::shared_ptr<int> &fd , const ByteArray &str) const ;
-    std::string read_string(std::shared_ptr<char> &data , const off_t offset , const uint16_t len) const ; 
+    std::string read_string(std::shared_ptr<char> &data , const off_t offset , const size_t len) const ; 
+    // 把 [data , data + len) 解码以后追加到 out 后面；最后剩下半个编码的话返回 false
+    bool decode_string(const char *data , size_t len , std::string *out) const ;
 private : 
 
     struct HuffmanNode {
@@ -49,15 +59,26 @@ private :
         }
     };
     std::priority_queue<HuffmanNode* , std::vector<HuffmanNode*> , cmp> smallHeap ;
-    std::unordered_map<char , uint16_t> huffmanCodeTable ; 
-    std::unordered_map<uint16_t , char> r_huffmanCodeTable ; 
+    std::unordered_map<char , uint32_t> huffmanCodeTable ; 
+    // 和 huffmanCodeTable 一样，按字节直接查，0 表示没有这个字符
+    uint32_t codes[256] ; 
+    std::unordered_map<uint32_t , char> r_huffmanCodeTable ; 
+    // 以接下来的 DECODE_BITS 位为下标：低 8 位是字符，高 8 位是码长；0 表示编码比 DECODE_BITS 长，要逐位查
+    static const int DECODE_BITS = 12 ; 
+    uint16_t decodeTable[1 << DECODE_BITS] ; 
     struct HuffmanNode * head ; 
     
-    void makeHuffCode(const HuffmanNode *root , uint16_t s) ;
+    // 由 r_huffmanCodeTable 建 decodeTable，编码表变了以后都要调用
+    void build_decodeTable() ;
+    
+    // 码长超过 31 位的话返回 false
+    bool makeHuffCode(const HuffmanNode *root , uint32_t s) ;
+    // 编码连同标记位一共几位
+    static int code_bits(uint32_t code) { return 32 - __builtin_clz(code) ; }
     void destroyTree(const HuffmanNode *root) ; 
 } ; 
 
-HuffmanTree::HuffmanTree() : head(nullptr) {}
+HuffmanTree::HuffmanTree() : codes() , decodeTable() , head(nullptr) {}
 HuffmanTree::~HuffmanTree() {
     this->destroyTree(this->head) ; 
 }
@@ -70,7 +91,7 @@ void HuffmanTree::destroyTree(const HuffmanNode* root) {
 }
 
 bool HuffmanTree::insert_word(const ByteArray &word){
-    for(uint16_t i = 0 ; i < word.size() ; ++i) {
+    for(size_t i = 0 ; i < word.size() ; ++i) {
         this->frequencyTable[word[i]]++ ; 
         //std::cout<<word[i]<<" "<<this->frequencyTable[word[i]]<<std::endl ;
     }
@@ -92,22 +113,29 @@ bool HuffmanTree::build_huffmanTree() {
         tmp->_weight = tmp->_left->_weight + tmp->_right->_weight ; 
         smallHeap.push(tmp) ; 
     }
+    // 同一个表 dump 多次的话，上一次建的树不要了
+    this->destroyTree(this->head) ; 
     this->head = smallHeap.top() ; smallHeap.pop() ; 
     this->huffmanCodeTable.clear() ; this->r_huffmanCodeTable.clear() ; 
-    makeHuffCode(this->head , 1) ; 
-    return true ;  
+    std::fill(this->codes , this->codes + 256 , 0) ; 
+    bool ok = makeHuffCode(this->head , 1) ; 
+    this->build_decodeTable() ; 
+    return ok ; 
 }
 
-void HuffmanTree::makeHuffCode(const HuffmanNode *root , uint16_t code) {
+bool HuffmanTree::makeHuffCode(const HuffmanNode *root , uint32_t code) {
     
     if(root->_left == nullptr && root->_right == nullptr) {
         this->huffmanCodeTable[root->_ch] = code ; 
+        this->codes[static_cast<uint8_t>(root->_ch)] = code ; 
         this->r_huffmanCodeTable[code] = root->_ch ; 
         //std::cout<<root->_ch<<" "<<this->huffmanCodeTable[root->_ch]<<std::endl ; 
-        return ;
+        return true ;
+    }
+    if(code & 0x80000000u) {
+        return false ; 
     }
-    makeHuffCode(root->_left  , (code << 1) | 0) ; 
-    makeHuffCode(root->_right , (code << 1) | 1) ; 
+    return makeHuffCode(root->_left  , (code << 1) | 0) && makeHuffCode(root->_right , (code << 1) | 1) ; 
 }
 
 bool HuffmanTree::save_encryptedFile(const char *fileName){
@@ -133,86 +161,161 @@ bool HuffmanTree::decrypt_File(const char *fileName) {
     }
     while (infile.peek() != EOF) {
         char ch = infile.get() ; 
-        uint16_t code ; infile >> code ; 
+        uint32_t code ; infile >> code ; 
         infile.get(); // get \n
         //std::cout<<ch<<" "<<code<<std::endl ;
         this->r_huffmanCodeTable[code] = ch ; 
     }
     infile.close() ; 
+    this->build_decodeTable() ; 
     return true ; 
 }
 
+void HuffmanTree::save_codes(std::string *out) const {
+    char varint[MAX_VARINT_LENGTH] ; 
+    out->append(varint , encode_varint(varint , this->huffmanCodeTable.size())) ; 
+    for(const auto &it : this->huffmanCodeTable) {
+        out->push_back(it.first) ; 
+        out->append(varint , encode_varint(varint , it.second)) ; 
+    }
+}
 
-bool HuffmanTree::write_string(std::shared_ptr<int> &fd , const ByteArray &str) const {
-    uint16_t len = 0 ;
+bool HuffmanTree::load_codes(const char *data , size_t size) {
+    this->huffmanCodeTable.clear() ; this->r_huffmanCodeTable.clear() ; 
+    std::fill(this->codes , this->codes + 256 , 0) ; 
+    const char *limit = data + size ; 
+    uint64_t count ; 
+    int n = decode_varint(data , limit , &count) ; 
+    if(n == 0 || count > 256) {
+        return false ; 
+    }
+    data += n ; 
+    for(uint64_t i = 0 ; i < count ; ++i) {
+        uint64_t code ; 
+        if(data >= limit || (n = decode_varint(data + 1 , limit , &code)) == 0 || code == 0 || code > 0xffffffffu) {
+            return false ; 
+        }
+        char ch = *data ; 
+        this->huffmanCodeTable[ch] = code ; 
+        this->codes[static_cast<uint8_t>(ch)] = code ; 
+        this->r_huffmanCodeTable[code] = ch ; 
+        data += 1 + n ; 
+    }
+    this->build_decodeTable() ; 
+    return data == limit ; 
+}
+
+void HuffmanTree::build_decodeTable() {
+    std::fill(this->decodeTable , this->decodeTable + (1 << DECODE_BITS) , 0) ; 
+    for(const auto &it : this->r_huffmanCodeTable) {
+        int bits = code_bits(it.first) ; 
+        if(bits > DECODE_BITS) {
+            continue ; 
+        }
+        // 编码放在下标的高位，后面的位是什么都是这个字符
+        uint32_t first = it.first << (DECODE_BITS - bits) ; 
+        uint16_t entry = static_cast<uint16_t>((bits << 8) | static_cast<uint8_t>(it.second)) ; 
+        std::fill(this->decodeTable + first , this->decodeTable + first + (1u << (DECODE_BITS - bits)) , entry) ; 
+    }
+}
+
+bool HuffmanTree::encode_string(const ByteArray &str , std::string *out) const {
+    size_t len = 0 ;
     // computer string len ; 
-    for(uint8_t i = 0 ; i < str.size() ; ++i){
-        auto iter = this->huffmanCodeTable.find(str[i]) ; 
-        if(iter == this->huffmanCodeTable.end()){
+    for(size_t i = 0 ; i < str.size() ; ++i){
+        uint32_t code = this->codes[static_cast<uint8_t>(str[i])] ; 
+        if(code == 0){
             return false ; 
         }       
-        uint16_t code = iter->second ; 
-        for(uint16_t index = 7 ; i >= 0 ; --index){
-            if(code & (1 << index)) {
-                len = len + index + 1; 
-                //std::cout<<len<<" "<<index<<std::endl ;
-                break ; 
-            }
-        }
+        len += code_bits(code) ; 
     } 
     len = (len + 7) / 8 ; // 每个字符串按照 1 个字节进行对齐。
-    //std::cout<<"len = "<<len<<std::endl ;
-    if (write(*fd, &len , 1) == -1) { // 写入一个字节就够了，因为不会有超过 2^8 个字符
-        return false ; 
-    }
-    uint8_t bitIndex = 0 , byte = 0  ; 
-    for(uint8_t i = 0 ; i < str.size() ; ++i){
-        auto iter = this->huffmanCodeTable.find(str[i]) ;     
-        uint16_t code = iter->second , flag = 0 ; 
-        for(int8_t index = 7 ; index >= 0 ; --index){
-            if(code & (1 << index)) {
-                flag = 1 ; 
-            }
-            if(flag == 1) {
-                if(code & (1 << index)) { // 1 
-                    byte = byte | (1 << (7 ^ (bitIndex)) ) ; 
-                }// else 0 , 那么就不用动 , 但是 bitIndex 需要 ++ 
-                ++bitIndex ; 
-                if(bitIndex == 8){
-                    if (write(*fd, &byte , 1) == -1) {
-                        return false ; 
-                    }
-                    bitIndex = 0 ; byte = 0 ;
-                }
-            }
+    char varint[MAX_VARINT_LENGTH] ; 
+    out->append(varint , encode_varint(varint , len)) ; 
+    // 编码从标记位开始按位拼到 bits 的低位，凑够 8 位就取出最高的一个字节；bits 里最多剩 7 + 32 位
+    size_t start = out->size() ; 
+    out->resize(start + len) ; 
+    char *p = &(*out)[start] ; 
+    uint64_t bits = 0 ; 
+    int count = 0 ; 
+    for(size_t i = 0 ; i < str.size() ; ++i){
+        uint32_t code = this->codes[static_cast<uint8_t>(str[i])] ; 
+        bits = (bits << code_bits(code)) | code ; 
+        count += code_bits(code) ; 
+        while(count >= 8){
+            count -= 8 ; 
+            *p++ = static_cast<char>(bits >> count) ; 
         }
     }
+    if(count){
+        *p++ = static_cast<char>(bits << (8 - count)) ; 
+    }
+    return true ; 
+}
 
-    if(bitIndex){
-        if (write(*fd, &byte , 1) == -1) {
+bool HuffmanTree::write_string(std::shared_ptr<int> &fd , const ByteArray &str) const {
+    std::string buf ; 
+    if(this->encode_string(str , &buf) == false) {
+        return false ; 
+    }
+    size_t written = 0 ; 
+    while(written < buf.size()) {
+        ssize_t n = write(*fd , buf.data() + written , buf.size() - written) ; 
+        if(n <= 0) {
             return false ; 
         }
+        written += n ; 
     }
     return true ; 
 }
 
-std::string HuffmanTree::read_string(std::shared_ptr<char> &data , const off_t offset , const uint16_t len) const{
+std::string HuffmanTree::read_string(std::shared_ptr<char> &data , const off_t offset , const size_t len) const{
     std::string str ; 
-    uint16_t ZeroOne = 0 ; 
-    for(uint8_t i = 0 ; i < len ; ++i ) {
-        uint8_t Bit = *reinterpret_cast<uint8_t*>(data.get() + offset + i) ;
-        for(int index = 7 ; index >= 0; --index){
-            ZeroOne =  ZeroOne | ((Bit >> index) & 1) ; 
-            auto iter = this->r_huffmanCodeTable.find(ZeroOne) ; 
-            if(iter != this->r_huffmanCodeTable.end()){
-                str.push_back(iter->second) ; 
-                ZeroOne = 0 ; 
-            } else {
-                ZeroOne = ZeroOne << 1 ; 
+    this->decode_string(data.get() + offset , len , &str) ; 
+    return str ; 
+}
+
+bool HuffmanTree::decode_string(const char *data , size_t len , std::string *out) const {
+    // 还没解码的位从最高位开始放在 bits 里，一共 count 位，不够 57 位的时候一次补一个字节
+    const uint8_t *p = reinterpret_cast<const uint8_t*>(data) , *limit = p + len ; 
+    uint64_t bits = 0 ; 
+    int count = 0 ; 
+    while(true) {
+        while(count <= 56 && p < limit) {
+            bits |= static_cast<uint64_t>(*p++) << (56 - count) ; 
+            count += 8 ; 
+        }
+        if(count == 0) {
+            return true ; 
+        }
+        // 编码都是从标记位 1 开始的，这里是 0 只能是末尾补齐的不到一个字节的 0
+        if((bits >> 63) == 0) {
+            return bits == 0 && count < 8 && p == limit ; 
+        }
+        int n ; 
+        uint16_t entry = this->decodeTable[bits >> (64 - DECODE_BITS)] ; 
+        if(entry != 0) {
+            n = entry >> 8 ; 
+            if(n > count) {
+                return false ; 
+            }
+            out->push_back(static_cast<char>(entry & 0xff)) ; 
+        } else {
+            // 长编码逐位查，补过字节以后 count 至少有 32 位，除非已经到了末尾
+            uint32_t code = 0 ; 
+            auto iter = this->r_huffmanCodeTable.end() ; 
+            for(n = 0 ; n < count && n < 32 && iter == this->r_huffmanCodeTable.end() ; ++n) {
+                code = (code << 1) | static_cast<uint32_t>((bits >> (63 - n)) & 1) ; 
+                iter = this->r_huffmanCodeTable.find(code) ; 
+            }
+            if(iter == this->r_huffmanCodeTable.end()) {
+                return false ; // 码长最多 31 位，再长就是数据坏了
             }
-        } 
+            out->push_back(iter->second) ; 
+        }
+        bits <<= n ; 
+        count -= n ; 
     }
-    return str ; 
 }
 
 } // namespace table
@@ -18,7 +18,8 @@ static inline void my_assert(bool status , const string &s) {
 
 void test_encode(){
     HuffmanTree *tree = new HuffmanTree() ; 
-    vector<string> strVec = {"test" , "abcd" , "aacc" , "vvcc"} ; 
+    // 最后一对是超过 255 个字符的 key 和 value，压缩以后的长度要用多个字节的变长整数
+    vector<string> strVec = {"test" , "abcd" , "aacc" , "vvcc" , string(300 , 'k') + "end" , string(1000 , 'v') + "tail"} ; 
     for(auto &str : strVec){
         tree->insert_word(str) ; 
     }
@@ -64,10 +65,16 @@ void test_encode(){
     while(true) {
         string key_str , value_str ; 
         if(info.st_size - offset >= static_cast<off_t>(sizeof(uint8_t))) { // 判断是否还有 key-value 
-            uint16_t key_size = *reinterpret_cast<uint8_t*>(data.get() + offset++) ; // 读取 length of key bits 
+            const char *limit = data.get() + info.st_size ; 
+            uint64_t key_size , value_size ; 
+            int n = decode_varint(data.get() + offset , limit , &key_size) ; // 读取 length of key bits 
+            my_assert(n != 0 && key_size <= static_cast<uint64_t>(info.st_size - offset - n) , "bad length of key") ; 
+            offset += n ; 
             key_str = tree->read_string(data , offset , key_size) ; 
             offset = offset + key_size ; 
-            uint8_t value_size = *reinterpret_cast<uint8_t*>(data.get() + offset++) ;
+            n = decode_varint(data.get() + offset , limit , &value_size) ;
+            my_assert(n != 0 && value_size <= static_cast<uint64_t>(info.st_size - offset - n) , "bad length of value") ; 
+            offset += n ; 
             value_str = tree->read_string(data , offset , value_size) ; 
             offset = offset + value_size ;
         }
@@ -110,10 +117,16 @@ void test_decode(){
     while(true) {
         string key_str , value_str ; 
         if(info.st_size - offset >= static_cast<off_t>(sizeof(uint8_t))) { // 判断是否还有 key-value 
-            uint16_t key_size = *reinterpret_cast<uint8_t*>(data.get() + offset++) ; // 读取 length of key bits 
+            const char *limit = data.get() + info.st_size ; 
+            uint64_t key_size , value_size ; 
+            int n = decode_varint(data.get() + offset , limit , &key_size) ; // 读取 length of key bits 
+            my_assert(n != 0 && key_size <= static_cast<uint64_t>(info.st_size - offset - n) , "bad length of key") ; 
+            offset += n ; 
             key_str = tree->read_string(data , offset , key_size) ; 
             offset = offset + key_size ; 
-            uint8_t value_size = *reinterpret_cast<uint8_t*>(data.get() + offset++) ;
+            n = decode_varint(data.get() + offset , limit , &value_size) ;
+            my_assert(n != 0 && value_size <= static_cast<uint64_t>(info.st_size - offset - n) , "bad length of value") ; 
+            offset += n ; 
             value_str = tree->read_string(data , offset , value_size) ; 
             offset = offset + value_size ;
         }
@@ -126,9 +139,37 @@ void test_decode(){
     
     delete tree ; 
 }
+// 编码表存成字符串再读回来，解码的结果和原来一样
+void test_codes(){
+    HuffmanTree tree ; 
+    vector<string> strVec = {"user:00000001" , "hello world" , string(500 , 'x') + "\n\t " , "" } ; 
+    for(auto &str : strVec){
+        tree.insert_word(str) ; 
+    }
+    my_assert(tree.build_huffmanTree() == true , "fail build tree") ; 
+    string codes , data ; 
+    tree.save_codes(&codes) ; 
+
+    HuffmanTree loaded ; 
+    my_assert(loaded.load_codes(codes.data() , codes.size()) == true , "fail load codes") ; 
+    my_assert(loaded.load_codes(codes.data() , codes.size() - 1) == false , "load truncated codes") ; 
+    my_assert(loaded.load_codes(codes.data() , codes.size()) == true , "fail load codes") ; 
+    for(auto &str : strVec) {
+        data.clear() ; 
+        // 用读回来的编码表编码，和原来的树编出来的一样
+        string other ; 
+        my_assert(tree.encode_string(str , &data) && loaded.encode_string(str , &other) && data == other , "fail encode") ; 
+        uint64_t len ; 
+        int n = decode_varint(data.data() , data.data() + data.size() , &len) ; 
+        string decoded ; 
+        my_assert(n > 0 && loaded.decode_string(data.data() + n , len , &decoded) && decoded == str , "fail decode " + str) ; 
+    }
+}
+
 int main(){
     test_encode() ;
     test_decode() ; 
+    test_codes() ; 
     return 0 ; 
         
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+#ifndef TABLE_KEY_COMPARATOR_H
+#define TABLE_KEY_COMPARATOR_H
+
+// 跳表 key 的比较器，BasicSkipList 的模板参数
+// 比较器同时决定 key 在节点里怎么存：节点头里有一个定长的 Stored 字段，和 next[0] 在同一个 cache line 里，
+// 放不下的部分(key_size 个字节)跟在 next 数组后面；查找之前先用 probe 把目标 key 处理一遍，之后每个节点都和 Probe 比较
+// 一个比较器要提供：
+//   Stored , Probe                                            节点头里存的部分，查找时预先算好的目标 key
+//   size_t key_size(const Key&)                               跟在 next 数组后面的字节数
+//   void store(Stored* , char* bytes , const Key&)            把 key 写进节点
+//   Key load(const Stored& , const char* bytes , size_t size) 从节点里取出 key
+//   Probe probe(const Key&)
+//   int compare(const Stored& , const char* bytes , size_t size , const Probe&)
+//                                                             节点的 key 小于、等于、大于目标 key 分别返回 -1、0、1
+//   bool less(const Key& , const Key&)
+//   uint64_t hash(const Key&)                                 哈希索引用
+// 1. ByteArray：按字节的字典序，节点头里存前 8 个字节的大端序整数，大部分比较只看它就能出结果
+// 2. uint64_t 和 __uint128_t：key 整个存在节点头里，后面不跟字节，比较就是一次整数比较
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include "byte_array.h"
+
+namespace table {
+
+template <typename Key>
+struct KeyComparator ;
+
+// murmur3 的收尾，把整数的每一位都打散到高位和低位
+inline uint64_t mix_hash(uint64_t h) {
+    h ^= h >> 33 ;
+    h *= 0xff51afd7ed558ccdULL ;
+    h ^= h >> 33 ;
+    h *= 0xc4ceb9fe1a85ec53ULL ;
+    h ^= h >> 33 ;
+    return h ;
+}
+
+template <>
+struct KeyComparator<ByteArray> {
+    // key 前 8 个字节的大端序整数(不足 8 字节补 0)，比较结果和 key 的字典序一致
+    typedef uint64_t Stored ;
+    struct Probe {
+        uint64_t prefix ;
+        ByteArray key ;
+    } ;
+
+    static size_t key_size(const ByteArray& key)        { return key.size() ; }
+
+    static uint64_t prefix(const ByteArray& key) {
+        uint64_t prefix = 0 ;
+        if(key.size() >= sizeof(uint64_t)) {
+            memcpy(&prefix , key.data() , sizeof(uint64_t)) ;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            prefix = __builtin_bswap64(prefix) ;
+#endif
+            return prefix ;
+        }
+        for(size_t i = 0 ; i < sizeof(uint64_t) ; ++i) {
+            uint8_t byte = i < key.size() ? static_cast<uint8_t>(key.data()[i]) : 0 ;
+            prefix = (prefix << 8) | byte ;
+        }
+        return prefix ;
+    }
+
+    static void store(Stored *stored , char *bytes , const ByteArray& key) {
+        *stored = prefix(key) ;
+        if(key.size() > 0) {
+            memcpy(bytes , key.data() , key.size()) ;
+        }
+    }
+
+    static ByteArray load(const Stored& , const char *bytes , size_t size) {
+        return ByteArray(bytes , size) ;
+    }
+
+    static Probe probe(const ByteArray& key)            { return Probe{prefix(key) , key} ; }
+
+    static int compare(const Stored& stored , const char *bytes , size_t size , const Probe& probe) {
+        if(stored != probe.prefix) {
+            return stored < probe.prefix ? -1 : 1 ;
+        }
+        // 前缀相同，再比较剩下的字节；两个 key 都不短于 8 个字节的话，前 8 个字节已经确定相等
+        size_t common = std::min(size , probe.key.size()) ;
+        size_t skip = common >= sizeof(uint64_t) ? sizeof(uint64_t) : 0 ;
+        int cmp = memcmp(bytes + skip , probe.key.data() + skip , common - skip) ;
+        if(cmp != 0) {
+            return cmp < 0 ? -1 : 1 ;
+        }
+        if(size == probe.key.size()) {
+            return 0 ;
+        }
+        return size < probe.key.size() ? -1 : 1 ;
+    }
+
+    static bool less(const ByteArray& a , const ByteArray& b)   { return a < b ; }
+
+    static uint64_t hash(const ByteArray& key) {
+        // FNV-1a，再用 murmur3 的收尾把高位打散，哈希索引的组号用中间的位，tag 用低 7 位
+        uint64_t h = 14695981039346656037ULL ;
+        for(size_t i = 0 ; i < key.size() ; ++i) {
+            h ^= static_cast<uint8_t>(key.data()[i]) ;
+            h *= 1099511628211ULL ;
+        }
+        h ^= h >> 33 ;
+        h *= 0xff51afd7ed558ccdULL ;
+        h ^= h >> 33 ;
+        return h ;
+    }
+} ;
+
+template <>
+struct KeyComparator<uint64_t> {
+    typedef uint64_t Stored ;
+    typedef uint64_t Probe ;
+
+    static size_t key_size(uint64_t)                                { return 0 ; }
+    static void store(Stored *stored , char * , uint64_t key)       { *stored = key ; }
+    static uint64_t load(const Stored& stored , const char * , size_t) { return stored ; }
+    static Probe probe(uint64_t key)                                { return key ; }
+    static int compare(const Stored& stored , const char * , size_t , const Probe& probe) {
+        return (stored > probe) - (stored < probe) ;
+    }
+    static bool less(uint64_t a , uint64_t b)                       { return a < b ; }
+    static uint64_t hash(uint64_t key)                              { return mix_hash(key) ; }
+} ;
+
+template <>
+struct KeyComparator<__uint128_t> {
+    // 拆成两个 uint64_t 存，节点只要求 8 字节对齐
+    struct Stored {
+        uint64_t lo , hi ;
+    } ;
+    typedef __uint128_t Probe ;
+
+    static __uint128_t join(const Stored& stored)                   { return (static_cast<__uint128_t>(stored.hi) << 64) | stored.lo ; }
+
+    static size_t key_size(__uint128_t)                             { return 0 ; }
+    static void store(Stored *stored , char * , __uint128_t key) {
+        stored->lo = static_cast<uint64_t>(key) ;
+        stored->hi = static_cast<uint64_t>(key >> 64) ;
+    }
+    static __uint128_t load(const Stored& stored , const char * , size_t) { return join(stored) ; }
+    static Probe probe(__uint128_t key)                             { return key ; }
+    static int compare(const Stored& stored , const char * , size_t , const Probe& probe) {
+        __uint128_t key = join(stored) ;
+        return (key > probe) - (key < probe) ;
+    }
+    static bool less(__uint128_t a , __uint128_t b)                 { return a < b ; }
+    static uint64_t hash(__uint128_t key) {
+        return mix_hash(static_cast<uint64_t>(key) ^ mix_hash(static_cast<uint64_t>(key >> 64))) ;
+    }
+} ;
+
+} // namespace table
+
+#endif
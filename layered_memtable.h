@@ -0,0 +1,485 @@
+#ifndef TABLE_LAYERED_MEMTABLE_H
+#define TABLE_LAYERED_MEMTABLE_H
+
+// 分层的内存表，打开 Options::background_dump 的时候 Table 用它，dump 可以交给后台线程做，前台的读写照常进行
+// 1. 最多三层，从新到旧：active 接收所有的写；frozen 是 dump 的时候冻结的 active，只读；base 是已经 dump 过的全部数据
+//    读的时候从新到旧查，在哪一层找到就用哪一层的；有更旧的层的时候，删除在 active 里写一个 tombstone，读和遍历都跳过它
+// 2. freeze 把 active 冻结成 frozen、换一个新的空 active，只是换一下指针；之后后台线程调用 merge_frozen，
+//    把 frozen 合并进 base(还没有 base 的话 frozen 直接成为 base)，再去掉 frozen
+//    base 只有 merge_frozen 会写：合并的时候 frozen 还在，合并过的 key 读的时候先在 frozen 里找到，看不到 base 改了一半的样子
+// 3. 各层的组合 Layers 换的时候整个换掉：读写在 epoch 临界区里拿当前的 Layers，换下来的 Layers 等 synchronize 以后再释放
+//    迭代器和快照拿着各层的 shared_ptr，它们活着的时候换下来的内存表不会被释放
+// 4. 快照在每一层各取一个快照，快照的序列号是记着这些序列号的 SnapshotState 的地址
+// 5. 打开 Options::mmap_reads 的时候 base 是只读的 FileMemtable，不能往里合并：dump 用 acquire_frozen_snapshot
+//    把 frozen 和 base 一起写成新的数据文件，再用 replace_frozen 把它们换成新文件的 FileMemtable；
+//    打开 Options::lsm 的时候 base 是只读的 RunSet，dump 只把 wait_frozen 拿到的 frozen 写成一个新的 run，
+//    replace_frozen 换成多了这个 run 的 RunSet；合并的线程用 shared_base 拿着合并的时候的 RunSet，合并好以后用 replace_base 换掉 base
+// 6. put 和 Writer::upsert 的 existed 只说明 key 在 active 里有没有(包括 tombstone)；
+//    Writer::erase 在有更旧的层的时候，key 已经在 active 里删过了也返回 true；
+//    del 和 Writer::erase 在更旧的层里读出错的时候当成 key 存在，写一个 tombstone
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include "byte_array.h"
+#include "memtable.h"
+#include "epoch_manager.h"
+#include "merging_iterator.h"
+#include "value_log.h"
+
+namespace table {
+
+class LayeredMemtable : public Memtable {
+public :
+    typedef std::function<Memtable*()> Factory ;
+
+    // factory 创建每一层的内存表，一开始只有一个空的 active
+    explicit LayeredMemtable(const Factory& factory) ;
+    ~LayeredMemtable() ;
+
+    const char* name() const override ;
+    std::unique_ptr<Iterator> new_iterator(uint64_t seq = LATEST) override ;
+    bool get(const ByteArray& key , std::string* value , uint64_t seq = LATEST) override ;
+    // 哪一层读出错就返回它的错误，不再往更旧的层找
+    Status find(const ByteArray& key , std::string* value , uint64_t seq = LATEST) override ;
+    void put(const ByteArray& key , const ByteArray& value , bool *existed = nullptr) override ;
+    bool del(const ByteArray& key) override ;
+    void multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) override ;
+    Status multi_find(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) override ;
+    std::unique_ptr<Writer> new_writer() override ;
+    // 只在 open 的时候往空的 active 里加载
+    std::unique_ptr<Builder> new_builder() override ;
+    uint64_t acquire_snapshot() override ;
+    void release_snapshot(uint64_t seq) override ;
+    uint64_t last_sequence() const override ;
+    size_t memory_usage() const override ;
+
+    // 把 active 冻结成 frozen，换一个新的空 active；上一次冻结的还没有合并完的话返回 false
+    bool freeze() ;
+
+    // 等还在写 frozen 的线程写完，把 frozen 合并进 base 再去掉它；同一时间只能有一个线程调用，调用的线程不能在读写这个内存表
+    void merge_frozen() ;
+
+    // 只在 open 的时候、没有别的线程访问的时候用，base 以后归这个内存表管
+    void set_base(Memtable *base) ;
+
+    bool has_frozen() const ;
+
+    // 等还在写 frozen 的线程写完，建一个只有 frozen 和 base 的快照，用完 release_snapshot；
+    // 和 merge_frozen 一样同一时间只能有一个线程调用，调用的线程不能在读写这个内存表
+    uint64_t acquire_frozen_snapshot() ;
+
+    // 用 base 换掉 frozen 和原来的 base，base 里要已经有它们合在一起的全部数据
+    void replace_frozen(Memtable *base) ;
+
+    // 用 base 换掉原来的 base，base 里的数据要和原来的一样，frozen 和 active 不变
+    void replace_base(Memtable *base) ;
+
+    // 等还在写 frozen 的线程写完，返回 frozen，没有的话返回 nullptr；frozen 在 replace_frozen 之前不会变，只给做 dump 的线程用
+    Memtable* wait_frozen() ;
+
+    // 只算 active，也就是上一次 freeze 之后的写占的内存
+    size_t active_memory_usage() const ;
+
+    // merge_frozen 以后 base 就是冻结那一刻的全部数据，在下一次 merge_frozen 之前不会变；只给调用 merge_frozen 的线程用
+    // 别的线程也会 replace_frozen 或者 replace_base 的话要和它们互斥，不然返回的 base 可能已经换掉释放了
+    Memtable* base() ;
+    // 拿着现在的 base，别的线程 replace_frozen 或者 replace_base 换掉它以后，返回的指针释放之前它也不会释放
+    std::shared_ptr<Memtable> shared_base() ;
+
+    // Non-copying
+    LayeredMemtable(const LayeredMemtable&) = delete ;
+    LayeredMemtable& operator=(const LayeredMemtable&) = delete ;
+
+private :
+    enum { ACTIVE = 0 , FROZEN = 1 , BASE = 2 , LEVELS = 3 } ;
+    // 合并的时候每写这么多个 key 换一个 Writer：Writer 的写析构的时候才发布，一直不发布的话新的快照取不到之后的写，旧版本也回收不掉
+    static const size_t MERGE_BATCH = 128 ;
+
+    // 从新到旧的各层，frozen 和 base 可以没有
+    struct Layers {
+        std::shared_ptr<Memtable> tables[LEVELS] ;
+    } ;
+
+    struct SnapshotState {
+        Layers layers ;
+        uint64_t seqs[LEVELS] ;
+    } ;
+
+    class LayeredWriter ;
+
+    static bool is_tombstone(const ByteArray& value)     { return MergingIterator::is_tombstone(value) ; }
+    static ByteArray tombstone()                         { static const char data[1] = { TOMBSTONE_VALUE } ; return ByteArray(data , 1) ; }
+    static bool has_older(const Layers& layers)          { return layers.tables[FROZEN] != nullptr || layers.tables[BASE] != nullptr ; }
+    static uint64_t seq_at(const uint64_t *seqs , int level) { return seqs != nullptr ? seqs[level] : LATEST ; }
+
+    // 从第 from 层开始往旧的层找，seqs 为空表示每层都读最新的；返回值和 find 一样，找到 tombstone 返回 not_found
+    static Status lookup(const Layers& layers , int from , const ByteArray& key , std::string* value , const uint64_t *seqs) ;
+    static Status multi_lookup(const Layers& layers , const ByteArray* keys , size_t n , const LookupHandler& handler , const uint64_t *seqs) ;
+    // 按 key 从小到大合并各层，跳过 tombstone
+    static std::unique_ptr<Iterator> merge_layers(const Layers& layers , const uint64_t *seqs) ;
+
+    // 等读写都离开以后释放换下来的 Layers
+    void release_retired() ;
+
+    Factory _factory ;
+    mutable EpochManager _epoch ;
+    std::atomic<Layers*> _layers ;
+    // 换 Layers 和取快照互斥，快照里各层的序列号是同一个 Layers 上的
+    mutable std::mutex _mutex ;
+    std::vector<Layers*> _retired ;
+} ;
+
+// 写 active 的 Writer，活着的时候一直处在 epoch 临界区里，写的一直是创建时的那个 active
+class LayeredMemtable::LayeredWriter : public Memtable::Writer {
+public :
+    explicit LayeredWriter(LayeredMemtable *table) : _guard(&table->_epoch) , _layers(table->_layers.load(std::memory_order_acquire)) ,
+        _writer(_layers->tables[ACTIVE]->new_writer()) { }
+
+    bool upsert(const ByteArray& key , const ByteArray& value) override { return this->_writer->upsert(key , value) ; }
+
+    bool erase(const ByteArray& key) override {
+        if(!has_older(*this->_layers)) {
+            return this->_writer->erase(key) ;
+        }
+        // active 的 Writer 可能拿着锁，只查更旧的层：那里有的话写 tombstone，没有的话 active 里也不会有 tombstone，直接删；
+        // 读出错的话不知道有没有，也写 tombstone，不然坏块修好以后删掉的 key 又回来了
+        if(lookup(*this->_layers , FROZEN , key , nullptr , nullptr).code() != Status::NOT_FOUND) {
+            this->_writer->upsert(key , tombstone()) ;
+            return true ;
+        }
+        return this->_writer->erase(key) ;
+    }
+
+private :
+    EpochManager::Guard _guard ;
+    const Layers *_layers ;
+    std::unique_ptr<Memtable::Writer> _writer ;
+} ;
+
+LayeredMemtable::LayeredMemtable(const Factory& factory) : _factory(factory) {
+    Layers *layers = new Layers() ;
+    layers->tables[ACTIVE].reset(this->_factory()) ;
+    this->_layers.store(layers) ;
+}
+
+LayeredMemtable::~LayeredMemtable() {
+    this->release_retired() ;
+    delete this->_layers.load() ;
+}
+
+const char* LayeredMemtable::name() const {
+    EpochManager::Guard guard(&this->_epoch) ;
+    return this->_layers.load(std::memory_order_acquire)->tables[ACTIVE]->name() ;
+}
+
+std::unique_ptr<Memtable::Iterator> LayeredMemtable::new_iterator(uint64_t seq) {
+    if(seq != LATEST) {
+        const SnapshotState *state = reinterpret_cast<const SnapshotState*>(seq) ;
+        return merge_layers(state->layers , state->seqs) ;
+    }
+    EpochManager::Guard guard(&this->_epoch) ;
+    return merge_layers(*this->_layers.load(std::memory_order_acquire) , nullptr) ;
+}
+
+std::unique_ptr<Memtable::Iterator> LayeredMemtable::merge_layers(const Layers& layers , const uint64_t *seqs) {
+    // 迭代器拿着各层的 shared_ptr，换下来的内存表要等它析构才释放
+    std::vector<std::shared_ptr<Memtable>> tables ;
+    std::vector<std::unique_ptr<Memtable::Iterator>> children ;
+    for(int i = 0 ; i < LEVELS ; ++i) {
+        if(layers.tables[i] != nullptr) {
+            tables.push_back(layers.tables[i]) ;
+            children.push_back(layers.tables[i]->new_iterator(seq_at(seqs , i))) ;
+        }
+    }
+    return std::unique_ptr<Memtable::Iterator>(new MergingIterator(std::move(tables) , std::move(children) , true)) ;
+}
+
+bool LayeredMemtable::get(const ByteArray& key , std::string* value , uint64_t seq) {
+    return this->find(key , value , seq).good() ;
+}
+
+Status LayeredMemtable::find(const ByteArray& key , std::string* value , uint64_t seq) {
+    if(seq != LATEST) {
+        const SnapshotState *state = reinterpret_cast<const SnapshotState*>(seq) ;
+        return lookup(state->layers , ACTIVE , key , value , state->seqs) ;
+    }
+    EpochManager::Guard guard(&this->_epoch) ;
+    return lookup(*this->_layers.load(std::memory_order_acquire) , ACTIVE , key , value , nullptr) ;
+}
+
+Status LayeredMemtable::lookup(const Layers& layers , int from , const ByteArray& key , std::string* value , const uint64_t *seqs) {
+    // 要看找到的是不是 tombstone，value 为空的时候也要取出来
+    std::string found ;
+    std::string *out = value != nullptr ? value : &found ;
+    for(int i = from ; i < LEVELS ; ++i) {
+        if(layers.tables[i] == nullptr) {
+            continue ;
+        }
+        Status s = layers.tables[i]->find(key , out , seq_at(seqs , i)) ;
+        if(s.good() && is_tombstone(*out)) {
+            out->clear() ;
+            return Status::not_found() ;
+        }
+        if(s.code() != Status::NOT_FOUND) {
+            return s ;
+        }
+    }
+    return Status::not_found() ;
+}
+
+void LayeredMemtable::put(const ByteArray& key , const ByteArray& value , bool *existed) {
+    EpochManager::Guard guard(&this->_epoch) ;
+    this->_layers.load(std::memory_order_acquire)->tables[ACTIVE]->put(key , value , existed) ;
+}
+
+bool LayeredMemtable::del(const ByteArray& key) {
+    EpochManager::Guard guard(&this->_epoch) ;
+    const Layers &layers = *this->_layers.load(std::memory_order_acquire) ;
+    if(!has_older(layers)) {
+        return layers.tables[ACTIVE]->del(key) ;
+    }
+    // 先看 key 现在在不在，和同一个 key 上并发的写之间不是原子的，最后的结果和先删后写或者先写后删一样；
+    // 读出错的话和 LayeredWriter::erase 一样当成在
+    if(lookup(layers , ACTIVE , key , nullptr , nullptr).code() == Status::NOT_FOUND) {
+        return false ;
+    }
+    layers.tables[ACTIVE]->put(key , tombstone()) ;
+    return true ;
+}
+
+void LayeredMemtable::multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq) {
+    this->multi_find(keys , n , handler , seq) ;
+}
+
+Status LayeredMemtable::multi_find(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq) {
+    if(seq != LATEST) {
+        const SnapshotState *state = reinterpret_cast<const SnapshotState*>(seq) ;
+        return multi_lookup(state->layers , keys , n , handler , state->seqs) ;
+    }
+    EpochManager::Guard guard(&this->_epoch) ;
+    return multi_lookup(*this->_layers.load(std::memory_order_acquire) , keys , n , handler , nullptr) ;
+}
+
+Status LayeredMemtable::multi_lookup(const Layers& layers , const ByteArray* keys , size_t n , const LookupHandler& handler , const uint64_t *seqs) {
+    // 只有 active 的时候里面不会有 tombstone
+    if(!has_older(layers)) {
+        return layers.tables[ACTIVE]->multi_find(keys , n , handler , seq_at(seqs , ACTIVE)) ;
+    }
+    // 每一层只查前面的层都没有找到的 key，keys 排好序的话剩下的也是有序的
+    std::vector<size_t> pending(n) ;
+    std::vector<ByteArray> batch(keys , keys + n) ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        pending[i] = i ;
+    }
+    std::vector<bool> found ;
+    for(int level = 0 ; level < LEVELS && !pending.empty() ; ++level) {
+        if(layers.tables[level] == nullptr) {
+            continue ;
+        }
+        found.assign(pending.size() , false) ;
+        Status s = layers.tables[level]->multi_find(batch.data() , batch.size() , [&](size_t i , const ByteArray& value) {
+            found[i] = true ;
+            if(!is_tombstone(value)) {
+                handler(pending[i] , value) ;
+            }
+        } , seq_at(seqs , level)) ;
+        if(!s.good()) {
+            return s ;
+        }
+        size_t keep = 0 ;
+        for(size_t i = 0 ; i < pending.size() ; ++i) {
+            if(!found[i]) {
+                pending[keep] = pending[i] ;
+                batch[keep] = batch[i] ;
+                ++keep ;
+            }
+        }
+        pending.resize(keep) ;
+        batch.resize(keep) ;
+    }
+    return Status::ok() ;
+}
+
+std::unique_ptr<Memtable::Writer> LayeredMemtable::new_writer() {
+    return std::unique_ptr<Memtable::Writer>(new LayeredWriter(this)) ;
+}
+
+std::unique_ptr<Memtable::Builder> LayeredMemtable::new_builder() {
+    return this->_layers.load(std::memory_order_acquire)->tables[ACTIVE]->new_builder() ;
+}
+
+uint64_t LayeredMemtable::acquire_snapshot() {
+    std::lock_guard<std::mutex> lock(this->_mutex) ;
+    SnapshotState *state = new SnapshotState() ;
+    state->layers = *this->_layers.load(std::memory_order_acquire) ;
+    for(int i = 0 ; i < LEVELS ; ++i) {
+        state->seqs[i] = state->layers.tables[i] != nullptr ? state->layers.tables[i]->acquire_snapshot() : 0 ;
+    }
+    return reinterpret_cast<uint64_t>(state) ;
+}
+
+void LayeredMemtable::release_snapshot(uint64_t seq) {
+    SnapshotState *state = reinterpret_cast<SnapshotState*>(seq) ;
+    for(int i = 0 ; i < LEVELS ; ++i) {
+        if(state->layers.tables[i] != nullptr) {
+            state->layers.tables[i]->release_snapshot(state->seqs[i]) ;
+        }
+    }
+    delete state ;
+}
+
+uint64_t LayeredMemtable::last_sequence() const {
+    EpochManager::Guard guard(&this->_epoch) ;
+    return this->_layers.load(std::memory_order_acquire)->tables[ACTIVE]->last_sequence() ;
+}
+
+size_t LayeredMemtable::memory_usage() const {
+    EpochManager::Guard guard(&this->_epoch) ;
+    const Layers &layers = *this->_layers.load(std::memory_order_acquire) ;
+    size_t usage = 0 ;
+    for(int i = 0 ; i < LEVELS ; ++i) {
+        usage += layers.tables[i] != nullptr ? layers.tables[i]->memory_usage() : 0 ;
+    }
+    return usage ;
+}
+
+bool LayeredMemtable::freeze() {
+    std::lock_guard<std::mutex> lock(this->_mutex) ;
+    const Layers *current = this->_layers.load(std::memory_order_relaxed) ;
+    if(current->tables[FROZEN] != nullptr) {
+        return false ;
+    }
+    Layers *layers = new Layers(*current) ;
+    layers->tables[FROZEN] = layers->tables[ACTIVE] ;
+    layers->tables[ACTIVE].reset(this->_factory()) ;
+    // 还在写旧 active 的线程由 merge_frozen 去等，freeze 不用等
+    this->_retired.push_back(this->_layers.exchange(layers)) ;
+    return true ;
+}
+
+void LayeredMemtable::merge_frozen() {
+    // 冻结之前拿到旧 Layers 的写都写完了，之后 frozen 不会再变
+    this->release_retired() ;
+    std::shared_ptr<Memtable> frozen , base ;
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex) ;
+        const Layers *current = this->_layers.load(std::memory_order_relaxed) ;
+        frozen = current->tables[FROZEN] ;
+        base = current->tables[BASE] ;
+    }
+    if(frozen == nullptr) {
+        return ;
+    }
+    if(base != nullptr) {
+        // frozen 是按 key 的顺序遍历的，用 Writer 写可以复用相邻 key 的查找路径
+        std::unique_ptr<Memtable::Iterator> iter = frozen->new_iterator() ;
+        while(iter->good()) {
+            std::unique_ptr<Memtable::Writer> writer = base->new_writer() ;
+            for(size_t count = 0 ; iter->good() && count < MERGE_BATCH ; iter->next() , ++count) {
+                ByteArray value = iter->value() ;
+                if(is_tombstone(value)) {
+                    writer->erase(iter->key()) ;
+                } else {
+                    writer->upsert(iter->key() , value) ;
+                }
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex) ;
+        Layers *layers = new Layers(*this->_layers.load(std::memory_order_relaxed)) ;
+        if(base == nullptr) {
+            layers->tables[BASE] = frozen ;
+        }
+        layers->tables[FROZEN].reset() ;
+        this->_retired.push_back(this->_layers.exchange(layers)) ;
+    }
+    // 没有迭代器和快照拿着的话，frozen 在这里释放
+    frozen.reset() ;
+    this->release_retired() ;
+}
+
+void LayeredMemtable::set_base(Memtable *base) {
+    this->_layers.load(std::memory_order_relaxed)->tables[BASE].reset(base) ;
+}
+
+bool LayeredMemtable::has_frozen() const {
+    EpochManager::Guard guard(&this->_epoch) ;
+    return this->_layers.load(std::memory_order_acquire)->tables[FROZEN] != nullptr ;
+}
+
+uint64_t LayeredMemtable::acquire_frozen_snapshot() {
+    this->release_retired() ;
+    uint64_t seq = this->acquire_snapshot() ;
+    SnapshotState *state = reinterpret_cast<SnapshotState*>(seq) ;
+    state->layers.tables[ACTIVE]->release_snapshot(state->seqs[ACTIVE]) ;
+    state->layers.tables[ACTIVE].reset() ;
+    return seq ;
+}
+
+void LayeredMemtable::replace_frozen(Memtable *base) {
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex) ;
+        Layers *layers = new Layers(*this->_layers.load(std::memory_order_relaxed)) ;
+        layers->tables[FROZEN].reset() ;
+        layers->tables[BASE].reset(base) ;
+        this->_retired.push_back(this->_layers.exchange(layers)) ;
+    }
+    this->release_retired() ;
+}
+
+void LayeredMemtable::replace_base(Memtable *base) {
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex) ;
+        Layers *layers = new Layers(*this->_layers.load(std::memory_order_relaxed)) ;
+        layers->tables[BASE].reset(base) ;
+        this->_retired.push_back(this->_layers.exchange(layers)) ;
+    }
+    this->release_retired() ;
+}
+
+Memtable* LayeredMemtable::wait_frozen() {
+    this->release_retired() ;
+    // 合并的线程 replace_base 的时候会换下现在的 Layers
+    EpochManager::Guard guard(&this->_epoch) ;
+    return this->_layers.load(std::memory_order_acquire)->tables[FROZEN].get() ;
+}
+
+size_t LayeredMemtable::active_memory_usage() const {
+    EpochManager::Guard guard(&this->_epoch) ;
+    return this->_layers.load(std::memory_order_acquire)->tables[ACTIVE]->memory_usage() ;
+}
+
+Memtable* LayeredMemtable::base() {
+    EpochManager::Guard guard(&this->_epoch) ;
+    return this->_layers.load(std::memory_order_acquire)->tables[BASE].get() ;
+}
+
+std::shared_ptr<Memtable> LayeredMemtable::shared_base() {
+    // 换 Layers 的时候拿着 _mutex，这时候的 Layers 不会被换下来释放
+    std::lock_guard<std::mutex> lock(this->_mutex) ;
+    return this->_layers.load(std::memory_order_relaxed)->tables[BASE] ;
+}
+
+void LayeredMemtable::release_retired() {
+    std::vector<Layers*> retired ;
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex) ;
+        retired.swap(this->_retired) ;
+    }
+    if(retired.empty()) {
+        return ;
+    }
+    this->_epoch.synchronize() ;
+    for(Layers *layers : retired) {
+        delete layers ;
+    }
+}
+
+} // namespace table
+
+#endif
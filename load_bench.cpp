@@ -0,0 +1,87 @@
+// Table::open 加载数据文件的吞吐随线程数的变化
+// 用法：./load_bench [key 数量] [线程数 ...]，默认 2M 个 key，线程数从 1 一路翻倍到 CPU 核数
+// 先写一个按块组织的数据文件，再用不同的 Options::load_threads 打开，每种打开 3 次取最快的一次
+#include "table.h"
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <stdlib.h>
+using namespace table ;
+using namespace std ;
+
+static const string FILE_NAME = "load_bench.db" ;
+
+static string random_string(std::mt19937_64 &mt_rand , size_t length) {
+    const char* charset = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz" ;
+    string s(length , 0) ;
+    for(size_t i = 0 ; i < length ; ++i) {
+        s[i] = charset[mt_rand() % 62] ;
+    }
+    return s ;
+}
+
+static double elapsed_ms(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double , milli>(chrono::steady_clock::now() - start).count() ;
+}
+
+int main(int argc , char **argv) {
+    size_t n = argc > 1 ? strtoull(argv[1] , nullptr , 10) : 2000000 ;
+    vector<size_t> threads ;
+    for(int i = 2 ; i < argc ; ++i) {
+        threads.push_back(strtoull(argv[i] , nullptr , 10)) ;
+    }
+    if(threads.empty()) {
+        for(size_t t = 1 ; t <= std::max(std::thread::hardware_concurrency() , 1u) ; t *= 2) {
+            threads.push_back(t) ;
+        }
+    }
+
+    remove(FILE_NAME.data()) ;
+    Options options ;
+    options.create_if_missing = true ;
+    {
+        Table table(options , FILE_NAME) ;
+        Status s = table.open() ;
+        std::mt19937_64 mt_rand(20231017) ;
+        for(size_t i = 0 ; s.good() && i < n ; ++i) {
+            s = table.put(random_string(mt_rand , 16) , random_string(mt_rand , 16)) ;
+        }
+        if(s.good()) {
+            s = table.dump() ;
+        }
+        if(!s.good()) {
+            cout << s.string() << endl ;
+            return 1 ;
+        }
+        table.close() ;
+    }
+    struct stat info ;
+    stat(FILE_NAME.data() , &info) ;
+
+    options.create_if_missing = false ;
+    options.dump_when_close = false ;
+    for(size_t t : threads) {
+        options.load_threads = t ;
+        double best = 0 ;
+        for(int round = 0 ; round < 3 ; ++round) {
+            Table table(options , FILE_NAME) ;
+            auto start = chrono::steady_clock::now() ;
+            Status s = table.open() ;
+            double ms = elapsed_ms(start) ;
+            if(!s.good()) {
+                cout << s.string() << endl ;
+                return 1 ;
+            }
+            best = round == 0 ? ms : std::min(best , ms) ;
+            table.close() ;
+        }
+        cout << "keys=" << n
+             << " file=" << info.st_size / (1 << 20) << " MB"
+             << " load_threads=" << t
+             << " open=" << best << " ms"
+             << " throughput=" << info.st_size / 1048576.0 / (best / 1000) << " MB/s"
+             << " " << n / (best / 1000) / 1e6 << " Mkeys/s" << endl ;
+    }
+    remove(FILE_NAME.data()) ;
+    return 0 ;
+}
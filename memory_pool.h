@@ -0,0 +1,202 @@
+#ifndef TABLE_MEMORY_POOL_H
+#define TABLE_MEMORY_POOL_H
+
+// 跳表节点使用的内存池
+// 1. 每次向系统申请一大块内存(BLOCK_SIZE)，节点头、next 指针数组、key 和 value 的字节都从块里连续切出来，
+//    一次插入只需要一次分配，不再有 new Node + new char[] * 2 的三次 malloc
+// 2. 被删除的节点按大小(8 字节对齐)挂到对应的空闲链表上，之后同样大小的分配直接复用，避免碎片
+// 3. 内存池析构的时候(也就是跳表/表关闭的时候)整块整块地释放
+//    大于 MAX_SLAB_BYTES 的分配(比较长的 key 和 value)不从块里切，单独向系统申请，归还的时候马上释放，不会越更新越多
+// 4. 跳表是无锁的，多个写线程会同时分配，分配和归还都由一把自旋锁保护，临界区只有几条指令
+#include <vector>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+namespace table {
+
+class MemoryPool {
+public :
+    MemoryPool() ;
+    ~MemoryPool() ;
+
+    // 分配 bytes 字节，返回的地址按指针大小对齐
+    char* allocate(size_t bytes) ;
+
+    // 归还由 allocate(bytes) 得到的内存，bytes 必须和分配时一致
+    void deallocate(void *ptr , size_t bytes) ;
+
+    // 内存池向系统申请的总字节数
+    size_t memory_usage() const ;
+
+    // Non-copying
+    MemoryPool(const MemoryPool&) = delete ;
+    MemoryPool& operator=(const MemoryPool&) = delete ;
+
+private :
+    static const size_t BLOCK_SIZE = 64 * 1024 ;
+    static const size_t ALIGN = sizeof(void*) ;
+    // 小于等于 MAX_SLAB_BYTES 的内存块从大块里切，归还后进入空闲链表；更大的单独申请
+    static const size_t MAX_SLAB_BYTES = 1024 ;
+    static const size_t NUM_SLABS = MAX_SLAB_BYTES / ALIGN ;
+
+    struct FreeBlock {
+        FreeBlock *next ;
+    } ;
+
+    // 单独申请的内存前面的头，所有没归还的串成一个双向链表，析构的时候释放
+    struct alignas(16) LargeBlock {
+        LargeBlock *prev ;
+        LargeBlock *next ;
+        size_t bytes ;
+    } ;
+
+    char *_alloc_ptr ;
+    size_t _alloc_bytes_remaining ;
+    std::vector<char*> _blocks ;
+    std::atomic<size_t> _memory_usage ;
+    FreeBlock *_free_list[NUM_SLABS] ;
+    LargeBlock _large ; // 双向链表的哨兵
+    std::atomic_flag _lock = ATOMIC_FLAG_INIT ;
+
+    void lock() ;
+    void unlock() ;
+    void deallocate_locked(void *ptr , size_t bytes) ;
+
+    static size_t align_size(size_t bytes) ;
+    char* allocate_fallback(size_t bytes) ;
+    char* allocate_new_block(size_t block_bytes) ;
+    char* allocate_large(size_t bytes) ;
+    void deallocate_large(void *ptr) ;
+} ;
+
+MemoryPool::MemoryPool() : _alloc_ptr(nullptr) , _alloc_bytes_remaining(0) , _memory_usage(0) {
+    for(size_t i = 0 ; i < NUM_SLABS ; ++i) {
+        this->_free_list[i] = nullptr ;
+    }
+    this->_large.prev = this->_large.next = &this->_large ;
+}
+
+MemoryPool::~MemoryPool() {
+    for(size_t i = 0 ; i < this->_blocks.size() ; ++i) {
+        delete [] this->_blocks[i] ;
+    }
+    LargeBlock *block = this->_large.next ;
+    while(block != &this->_large) {
+        LargeBlock *next = block->next ;
+        delete [] reinterpret_cast<char*>(block) ;
+        block = next ;
+    }
+}
+
+inline void MemoryPool::lock() {
+    while(this->_lock.test_and_set(std::memory_order_acquire)) { }
+}
+
+inline void MemoryPool::unlock() {
+    this->_lock.clear(std::memory_order_release) ;
+}
+
+inline size_t MemoryPool::align_size(size_t bytes) {
+    if(bytes == 0) bytes = 1 ;
+    return (bytes + ALIGN - 1) & ~(ALIGN - 1) ;
+}
+
+char* MemoryPool::allocate(size_t bytes) {
+    bytes = align_size(bytes) ;
+    if(bytes > MAX_SLAB_BYTES) {
+        return allocate_large(bytes) ;
+    }
+    char *result = nullptr ;
+    lock() ;
+    // 先看空闲链表里有没有同样大小的内存块
+    if(this->_free_list[bytes / ALIGN - 1] != nullptr) {
+        FreeBlock *&head = this->_free_list[bytes / ALIGN - 1] ;
+        result = reinterpret_cast<char*>(head) ;
+        head = head->next ;
+    } else if(bytes <= this->_alloc_bytes_remaining) {
+        result = this->_alloc_ptr ;
+        this->_alloc_ptr += bytes ;
+        this->_alloc_bytes_remaining -= bytes ;
+    } else {
+        result = allocate_fallback(bytes) ;
+    }
+    unlock() ;
+    return result ;
+}
+
+void MemoryPool::deallocate(void *ptr , size_t bytes) {
+    if(ptr == nullptr) return ;
+    if(align_size(bytes) > MAX_SLAB_BYTES) {
+        deallocate_large(ptr) ;
+        return ;
+    }
+    lock() ;
+    deallocate_locked(ptr , bytes) ;
+    unlock() ;
+}
+
+void MemoryPool::deallocate_locked(void *ptr , size_t bytes) {
+    bytes = align_size(bytes) ;
+    assert(bytes <= MAX_SLAB_BYTES) ;
+    FreeBlock *block = reinterpret_cast<FreeBlock*>(ptr) ;
+    block->next = this->_free_list[bytes / ALIGN - 1] ;
+    this->_free_list[bytes / ALIGN - 1] = block ;
+}
+
+size_t MemoryPool::memory_usage() const {
+    return this->_memory_usage.load(std::memory_order_relaxed) ;
+}
+
+char* MemoryPool::allocate_fallback(size_t bytes) {
+    // 当前块剩下的空间切成空闲块挂起来，而不是直接丢掉
+    if(this->_alloc_bytes_remaining >= ALIGN) {
+        size_t rest = this->_alloc_bytes_remaining ;
+        if(rest > MAX_SLAB_BYTES) rest = MAX_SLAB_BYTES ;
+        deallocate_locked(this->_alloc_ptr , rest & ~(ALIGN - 1)) ;
+    }
+    this->_alloc_ptr = allocate_new_block(BLOCK_SIZE) ;
+    this->_alloc_bytes_remaining = BLOCK_SIZE ;
+
+    char *result = this->_alloc_ptr ;
+    this->_alloc_ptr += bytes ;
+    this->_alloc_bytes_remaining -= bytes ;
+    return result ;
+}
+
+char* MemoryPool::allocate_new_block(size_t block_bytes) {
+    // new char[] 返回的地址满足任意基本类型的对齐要求
+    char *block = new char[block_bytes] ;
+    this->_blocks.push_back(block) ;
+    this->_memory_usage += block_bytes + sizeof(char*) ;
+    return block ;
+}
+
+char* MemoryPool::allocate_large(size_t bytes) {
+    // 向系统申请放在锁外面，锁里只改链表
+    LargeBlock *block = reinterpret_cast<LargeBlock*>(new char[sizeof(LargeBlock) + bytes]) ;
+    block->bytes = bytes ;
+    lock() ;
+    block->prev = &this->_large ;
+    block->next = this->_large.next ;
+    this->_large.next->prev = block ;
+    this->_large.next = block ;
+    unlock() ;
+    this->_memory_usage += sizeof(LargeBlock) + bytes ;
+    return reinterpret_cast<char*>(block + 1) ;
+}
+
+void MemoryPool::deallocate_large(void *ptr) {
+    LargeBlock *block = reinterpret_cast<LargeBlock*>(ptr) - 1 ;
+    lock() ;
+    block->prev->next = block->next ;
+    block->next->prev = block->prev ;
+    unlock() ;
+    this->_memory_usage -= sizeof(LargeBlock) + block->bytes ;
+    delete [] reinterpret_cast<char*>(block) ;
+}
+
+} // namespace table
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef TABLE_MEMTABLE_H
+#define TABLE_MEMTABLE_H
+
+// 内存表的接口，Table 只通过它读写内存里的数据，具体用哪种数据结构由 Options::memtable 决定
+// 1. 所有实现都是多版本的：每次写有一个递增的序列号，读的时候带上快照的序列号就只看得到那之前写完的数据
+// 2. 所有操作都可以多线程并发调用；Iterator、Writer、Builder 只能在创建它们的线程里用
+// 3. 实现：SkipList(无锁跳表，可以加哈希索引) 和 BTree(B+ 树)
+#include <string>
+#include <memory>
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+#include "byte_array.h"
+#include "status.h"
+
+namespace table {
+
+class Memtable {
+public :
+    // 不指定快照，读每个 key 最新的版本
+    static const uint64_t LATEST = UINT64_MAX ;
+
+    // multi_get 找到 keys[i] 的时候调用 handler(i , value)，value 只在 handler 里有效
+    typedef std::function<void(size_t , const ByteArray&)> LookupHandler ;
+
+    // 有序遍历的迭代器，可以 seek 到任意位置、前后移动
+    // value() 是定位到这个 key 时看到的版本，之后 key 被更新或者删除了也不变
+    class Iterator {
+    public :
+        virtual ~Iterator() { }
+        virtual bool good() = 0 ;
+        virtual void next() = 0 ;
+        virtual void prev() = 0 ;
+        // 定位到第一个大于等于 key 的 key
+        virtual void seek(const ByteArray& key) = 0 ;
+        virtual void seek_to_first() = 0 ;
+        virtual void seek_to_last() = 0 ;
+        virtual ByteArray key() = 0 ;
+        virtual ByteArray value() = 0 ;
+        // 读数据文件的迭代器碰到坏了的块就停下，good() 为 false，这里返回 io_error；遍历完要看它才知道是不是真的走到头了
+        // 内存里的实现不会出错，默认是 ok
+        virtual Status status()             { return Status::ok() ; }
+    } ;
+
+    // 按 key 从小到大写入一批 key，实现可以利用相邻 key 的局部性；WriteBatch 用它来写
+    class Writer {
+    public :
+        virtual ~Writer() { }
+        // 返回写之前 key 是不是已经存在
+        virtual bool upsert(const ByteArray& key , const ByteArray& value) = 0 ;
+        // 返回 key 是不是存在
+        virtual bool erase(const ByteArray& key) = 0 ;
+    } ;
+
+    // 从有序的文件加载数据：key 必须严格递增，只能在没有其他线程访问的时候用；追加的数据所有快照都看得到
+    class Builder {
+    public :
+        virtual ~Builder() { }
+        // key 不比之前的 key(以及表里原有的 key)大的话返回 false
+        virtual bool append(const ByteArray& key , const ByteArray& value) = 0 ;
+    } ;
+
+    virtual ~Memtable() { }
+
+    virtual const char* name() const = 0 ;
+
+    // 新建一个指向第一个 key 的迭代器，seq 是快照的序列号，下面几个读的 seq 也一样
+    virtual std::unique_ptr<Iterator> new_iterator(uint64_t seq = LATEST) = 0 ;
+
+    // 找到的话把 value 拷贝出来，value 可以是空指针
+    virtual bool get(const ByteArray& key , std::string* value , uint64_t seq = LATEST) = 0 ;
+
+    // 和 get 一样，但是分得清没有找到和读出错：找到返回 ok，没有返回 not_found，从文件里读的数据坏了返回 io_error
+    // 内存里的实现不会读出错，默认用 get
+    virtual Status find(const ByteArray& key , std::string* value , uint64_t seq = LATEST) {
+        return this->get(key , value , seq) ? Status::ok() : Status::not_found() ;
+    }
+
+    // key 不存在就插入，存在就更新 value；existed 不为空的话，返回写之前 key 是不是已经存在
+    virtual void put(const ByteArray& key , const ByteArray& value , bool *existed = nullptr) = 0 ;
+
+    // 返回 key 是不是存在
+    virtual bool del(const ByteArray& key) = 0 ;
+
+    // 批量查找，keys 排好序的时候实现可以复用相邻 key 的查找路径
+    virtual void multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) = 0 ;
+
+    // 和 multi_get 一样，有 key 读出错的话停下来返回 io_error，这时候已经交给 handler 的结果不能用
+    virtual Status multi_find(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) {
+        this->multi_get(keys , n , handler , seq) ;
+        return Status::ok() ;
+    }
+
+    virtual std::unique_ptr<Writer> new_writer() = 0 ;
+
+    virtual std::unique_ptr<Builder> new_builder() = 0 ;
+
+    // 创建一个快照，返回它的序列号；快照活着的时候它能看到的旧版本不会被回收，用完要 release_snapshot
+    virtual uint64_t acquire_snapshot() = 0 ;
+    virtual void release_snapshot(uint64_t seq) = 0 ;
+
+    // 已经写完的最大序列号
+    virtual uint64_t last_sequence() const = 0 ;
+
+    // 向系统申请的总字节数
+    virtual size_t memory_usage() const = 0 ;
+} ;
+
+} // namespace table
+
+#endif
@@ -0,0 +1,107 @@
+// 内存表性能对比：跳表、带哈希索引的跳表、B+ 树
+// 用法：./memtable_bench [key 数量 ...]，默认分别测 1M 和 10M 个 key
+// 都通过 Memtable 接口调用，测随机插入、随机点查、排好序的批量查找、从随机位置开始的短范围扫描，以及占用的内存
+#include "skiplist.h"
+#include "btree.h"
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <stdlib.h>
+using namespace table ;
+using namespace std ;
+
+static vector<string> random_keys(size_t n , size_t length) {
+    const char* charset = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz" ;
+    std::mt19937_64 mt_rand(20231017) ;
+    vector<string> keys(n) ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        keys[i].resize(length) ;
+        for(size_t j = 0 ; j < length ; ++j) {
+            keys[i][j] = charset[mt_rand() % 62] ;
+        }
+    }
+    return keys ;
+}
+
+static double elapsed_ns(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double , nano>(chrono::steady_clock::now() - start).count() ;
+}
+
+static void bench(Memtable *memtable , const char *label , vector<string> keys) {
+    const size_t n = keys.size() ;
+    auto start = chrono::steady_clock::now() ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        memtable->put(keys[i] , keys[i]) ;
+    }
+    double insert_ns = elapsed_ns(start) ;
+
+    std::shuffle(keys.begin() , keys.end() , std::mt19937_64(42)) ;
+    size_t found = 0 ;
+    string value ;
+    start = chrono::steady_clock::now() ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        found += memtable->get(keys[i] , &value) ;
+    }
+    double get_ns = elapsed_ns(start) ;
+
+    const size_t BATCH = 256 ;
+    size_t batches = n / BATCH , multi_found = 0 ;
+    vector<ByteArray> sorted(BATCH) ;
+    start = chrono::steady_clock::now() ;
+    for(size_t b = 0 ; b < batches ; ++b) {
+        for(size_t i = 0 ; i < BATCH ; ++i) {
+            sorted[i] = keys[b * BATCH + i] ;
+        }
+        std::sort(sorted.begin() , sorted.end()) ;
+        memtable->multi_get(sorted.data() , BATCH , [&multi_found](size_t , const ByteArray&) { ++multi_found ; }) ;
+    }
+    double multi_ns = elapsed_ns(start) ;
+
+    // 从随机的 key 开始往后取 100 个
+    const size_t SCANS = n / 100 , SCAN_LENGTH = 100 ;
+    size_t scanned = 0 ;
+    auto it = memtable->new_iterator() ;
+    start = chrono::steady_clock::now() ;
+    for(size_t i = 0 ; i < SCANS ; ++i) {
+        it->seek(keys[i]) ;
+        for(size_t j = 0 ; j < SCAN_LENGTH && it->good() ; ++j , it->next()) {
+            scanned += it->value().size() ;
+        }
+    }
+    double scan_ns = elapsed_ns(start) ;
+
+    cout << "keys=" << n
+         << " " << label
+         << " insert=" << insert_ns / n << " ns/op"
+         << " get=" << get_ns / n << " ns/op"
+         << " multi_get(" << BATCH << ")=" << multi_ns / (batches * BATCH) << " ns/key"
+         << " scan(" << SCAN_LENGTH << ")=" << scan_ns / SCANS << " ns/scan"
+         << " memory=" << memtable->memory_usage() / n << " B/key"
+         << " found=" << found << "/" << multi_found << " scanned=" << scanned << endl ;
+}
+
+int main(int argc , char **argv) {
+    vector<size_t> sizes ;
+    for(int i = 1 ; i < argc ; ++i) {
+        sizes.push_back(strtoull(argv[i] , nullptr , 10)) ;
+    }
+    if(sizes.empty()) {
+        sizes = {1000000 , 10000000} ;
+    }
+    for(size_t n : sizes) {
+        vector<string> keys = random_keys(n , 16) ;
+        {
+            SkipList memtable ;
+            bench(&memtable , "skiplist" , keys) ;
+        }
+        {
+            SkipList memtable(true) ;
+            bench(&memtable , "skiplist+hash_index" , keys) ;
+        }
+        {
+            BTree memtable ;
+            bench(&memtable , "btree" , keys) ;
+        }
+    }
+    return 0 ;
+}
@@ -0,0 +1,141 @@
+#ifndef TABLE_MERGING_ITERATOR_H
+#define TABLE_MERGING_ITERATOR_H
+
+// 按 key 从小到大合并几个迭代器，同一个 key 用排在前面的(也就是更新的)那个；和 leveldb 的 MergingIterator 一样，
+// 正向的时候每个迭代器都停在大于等于当前 key 的第一个 key 上，反向的时候停在小于等于当前 key 的最后一个 key 上
+// LayeredMemtable 合并各层的时候跳过 tombstone；RunSet 合并各个 run 的时候不跳，留给上面的 LayeredMemtable 去跳，
+// 不然 run 里删掉的 key 会露出更旧的 run 里的值
+// 有一个迭代器读出错的话整个停下，status() 返回它的错误：接着合并剩下的会露出被它盖住的旧值，也会漏掉它后面的 key
+#include <string>
+#include <vector>
+#include <memory>
+#include "byte_array.h"
+#include "memtable.h"
+#include "value_log.h"
+
+namespace table {
+
+class MergingIterator : public Memtable::Iterator {
+public :
+    // children 从新到旧排好；tables 是 children 遍历的内存表，迭代器活着的时候不能释放
+    MergingIterator(std::vector<std::shared_ptr<Memtable>> tables , std::vector<std::unique_ptr<Memtable::Iterator>> children ,
+                    bool skip_tombstones) :
+        _tables(std::move(tables)) , _children(std::move(children)) , _skip_tombstones(skip_tombstones) , _current(-1) , _forward(true) {
+        this->seek_to_first() ;
+    }
+
+    static bool is_tombstone(const ByteArray& value)    { return value.size() == 1 && value[0] == TOMBSTONE_VALUE ; }
+
+    bool good() override                { return this->_current != -1 ; }
+    ByteArray key() override            { return this->_children[this->_current]->key() ; }
+    ByteArray value() override          { return this->_children[this->_current]->value() ; }
+    Status status() override            { return this->_status ; }
+
+    void seek(const ByteArray& key) override {
+        for(auto &child : this->_children) child->seek(key) ;
+        this->_forward = true ;
+        this->find_smallest() ;
+        this->skip_forward() ;
+    }
+    void seek_to_first() override {
+        for(auto &child : this->_children) child->seek_to_first() ;
+        this->_forward = true ;
+        this->find_smallest() ;
+        this->skip_forward() ;
+    }
+    void seek_to_last() override {
+        for(auto &child : this->_children) child->seek_to_last() ;
+        this->_forward = false ;
+        this->find_largest() ;
+        this->skip_backward() ;
+    }
+    void next() override {
+        this->step_forward() ;
+        this->skip_forward() ;
+    }
+    void prev() override {
+        this->step_backward() ;
+        this->skip_backward() ;
+    }
+
+private :
+    // 移到大于当前 key 的第一个 key
+    void step_forward() {
+        std::string current(this->key().data() , this->key().size()) ;
+        for(auto &child : this->_children) {
+            // 反向的时候别的迭代器停在当前 key 前面，先挪到当前 key 上
+            if(!this->_forward) child->seek(current) ;
+            if(child->good() && child->key() == ByteArray(current)) child->next() ;
+        }
+        this->_forward = true ;
+        this->find_smallest() ;
+    }
+    // 移到小于当前 key 的最后一个 key
+    void step_backward() {
+        std::string current(this->key().data() , this->key().size()) ;
+        for(auto &child : this->_children) {
+            if(this->_forward) {
+                // 正向的时候别的迭代器停在当前 key 后面，先挪到小于当前 key 的最后一个上
+                child->seek(current) ;
+                if(child->good()) child->prev() ;
+                else child->seek_to_last() ;
+            } else if(child->good() && child->key() == ByteArray(current)) {
+                child->prev() ;
+            }
+        }
+        this->_forward = false ;
+        this->find_largest() ;
+    }
+    void skip_forward() {
+        while(this->_skip_tombstones && this->good() && is_tombstone(this->value())) this->step_forward() ;
+    }
+    void skip_backward() {
+        while(this->_skip_tombstones && this->good() && is_tombstone(this->value())) this->step_backward() ;
+    }
+    // 有迭代器出错的话记下第一个错误，停在结束的位置上
+    bool check_children() {
+        this->_status = Status::ok() ;
+        for(auto &child : this->_children) {
+            if(!child->good() && !child->status().good()) {
+                this->_status = child->status() ;
+                this->_current = -1 ;
+                return false ;
+            }
+        }
+        return true ;
+    }
+    // key 相同的时候用前面的，也就是新的那一个
+    void find_smallest() {
+        this->_current = -1 ;
+        if(!this->check_children()) {
+            return ;
+        }
+        for(int i = 0 ; i < static_cast<int>(this->_children.size()) ; ++i) {
+            if(this->_children[i]->good() && (this->_current == -1 || this->_children[i]->key() < this->key())) {
+                this->_current = i ;
+            }
+        }
+    }
+    void find_largest() {
+        this->_current = -1 ;
+        if(!this->check_children()) {
+            return ;
+        }
+        for(int i = 0 ; i < static_cast<int>(this->_children.size()) ; ++i) {
+            if(this->_children[i]->good() && (this->_current == -1 || this->_children[i]->key() > this->key())) {
+                this->_current = i ;
+            }
+        }
+    }
+
+    std::vector<std::shared_ptr<Memtable>> _tables ;
+    std::vector<std::unique_ptr<Memtable::Iterator>> _children ;
+    bool _skip_tombstones ;
+    int _current ;
+    bool _forward ;
+    Status _status ;
+} ;
+
+} // namespace table
+
+#endif
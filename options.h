@@ -5,6 +5,25 @@
 
 namespace table {
 
+// 内存表用的数据结构
+enum class MemtableType {
+    SKIPLIST ,      // 无锁跳表，读写都不加锁，写多、并发高的时候用
+    BTREE ,         // B+ 树，读写锁保护，点查和范围扫描的 cache miss 少，每个 key 占的内存也少，读多写少的时候用
+} ;
+
+// 预写日志什么时候 fdatasync
+enum class WalSyncMode {
+    NONE ,          // 只 write 不 fdatasync：进程崩溃不丢数据，机器掉电可能丢掉还在页缓存里的写
+    PER_BATCH ,     // 每一组写 fdatasync 完才返回，同时写的线程共用一次 fdatasync；最安全，每次写都要等磁盘
+    INTERVAL ,      // 后台线程每 wal_sync_interval_ms 毫秒 fdatasync 一次，掉电最多丢这么长时间的写
+} ;
+
+// dump 写数据文件的方式，见 file_writer.h
+enum class DumpIO {
+    PWRITEV ,       // 攒满几个大缓冲区以后用一次 pwritev 写出去
+    IO_URING ,      // 缓冲区满了就交给 io_uring 异步写，同时有几个写在进行；内核不支持的话退回 PWRITEV
+} ;
+
 struct Options { 
    
     // 如果表文件没有存在，是否则创建
@@ -16,9 +35,80 @@ struct Options {
     // 关闭文件的时候，是否可持久化到磁盘上
     bool dump_when_close = true ;
 
-    // 文件的最大大小，也就是内存存储的键值最大字节大小，待实现中ing
+    // 文件的最大大小：一条 key-value 不能比它大；打开 lsm 的时候 L1 往下每一层的文件写到这么大就换下一个文件
     size_t max_file_size = 512 * 1024 * 1024 ;
 
+    // ShardedTable 的分片数，每个分片是一个独立的跳表，持久化到 "文件名.分片号"
+    // 打开已有的表时必须和 dump 时一样，否则 key 会被路由到错误的分片
+    size_t shard_count = 8 ;
+
+    // Table::get 前面的计数布隆过滤器预计要放的 key 数，0 表示不用过滤器
+    // 过滤器的大小是 filter_expected_keys * filter_counters_per_key 个 4 bit 的计数器，
+    // 每个 key 10 个计数器(5 字节)的时候，不存在的 key 大约有 1%-2% 会被误判成可能存在
+    size_t filter_expected_keys = 0 ;
+    size_t filter_counters_per_key = 10 ;
+
+    // 是否在跳表旁边维护一个 key 到节点的哈希索引，get/multi_get 查索引是 O(1) 的，
+    // 代价是每个 key 多占 10 到 20 字节，put 和 del 也要多维护一次索引
+    bool hash_index = false ;
+
+    // 跳表相邻两层节点数的比例，要是不小于 2 的 2 的幂，不然 open 返回 invalid_operation；4 的时候每个节点平均 1.33 个 next 指针，2 的时候平均 2 个，
+    // 查找的时候每层平均要往前走 branching / 2 步，key 的数量不影响选哪个
+    int skiplist_branching = 4 ;
+
+    // 内存表用哪种数据结构，hash_index 只对跳表有效；不影响文件格式，换了以后可以直接打开原来的表
+    MemtableType memtable = MemtableType::SKIPLIST ;
+
+    // 比这个大的 value 追加到 "文件名.vlog" 里只存一份，内存表和数据文件里只放它的偏移和长度，0 表示不用
+    // 大 value 不占内存表的内存，dump 也不用重新写；代价是读的时候多一次 pread，覆盖掉的旧 value 不会从日志里删掉
+    size_t value_log_threshold = 0 ;
+
+    // put/del/write 先追加到 "文件名.wal" 里再写内存表，open 的时候把上次 dump 之后的写重放回来，dump 成功以后清空
+    // 不打开的话 dump 之后的写在崩溃时会丢掉；关掉以后 open 还是会重放以前留下的日志
+    bool write_ahead_log = false ;
+    WalSyncMode wal_sync = WalSyncMode::PER_BATCH ;
+    uint32_t wal_sync_interval_ms = 100 ;
+
+    // dump 的时候只把上次 dump 之后改过和删掉的 key 写成增量文件 "文件名.delta.N"，open 的时候在数据文件上依次应用，
+    // dump 的 IO 和改动的 key 数成正比，和表的大小无关；增量文件攒到 max_delta_files 个，
+    // 或者加起来比数据文件还大的时候，下一次 dump 重写整个数据文件，删掉增量文件
+    bool incremental_dump = false ;
+    size_t max_delta_files = 8 ;
+
+    // 数据文件里数据块的目标大小，点查的时候只解码 key 所在的那一块；格式见 data_file.h
+    size_t block_size = 4096 ;
+
+    // dump 写数据文件的方式；不管哪种方式，都是写到临时文件里，fdatasync 以后再改名覆盖原来的文件
+    DumpIO dump_io = DumpIO::PWRITEV ;
+
+    // dump 的时候把当前的内存表冻结起来，新的写进一个新的空内存表，后台线程把冻结的内存表合并好再写文件，dump 马上返回，
+    // 用 Table::wait_dump 等它写完；读的时候新旧内存表都要查。删除在新内存表里记成 tombstone，
+    // 过滤器在删除的时候不再减掉 key，删掉的 key 要等重新 open 才会从过滤器里去掉
+    bool background_dump = false ;
+
+    // open 的时候只映射数据文件、读它的索引，不把数据加载进内存表，open 的时间和占的内存不随数据量增长；
+    // 读的时候先查内存表，再在文件的数据块里二分查找，用到的块才解码，内存表只存 open 之后的写。
+    // dump 把内存表和原来的文件合并成新的数据文件，不做增量 dump；和 background_dump 一样删除记成 tombstone、过滤器不减；
+    // 以前格式的数据文件还是整个加载进内存表，dump 一次以后换成新格式
+    bool mmap_reads = false ;
+
+    // open 加载数据文件的时候解码用几个线程，0 表示用 CPU 核数；数据块按顺序分成段，每个线程解码一段，
+    // 解码好的段按顺序批量追加进内存表。数据块少的时候或者以前格式的数据文件还是一个线程
+    size_t load_threads = 0 ;
+
+    // 把表变成一个小的 LSM 树(见 run_set.h)，数据可以比内存大：内存表写到 write_buffer_size 字节就冻结起来，
+    // 由 dump 写成一个只读的有序 run 文件；L0 的 run 攒够 l0_compaction_trigger 个，就和 L1 合并成一组 key 不重叠、
+    // 每个写到 max_file_size 就换下一个的文件。L1 超过 max_bytes_for_level_base 字节、往下每一层超过上一层的
+    // level_size_multiplier 倍，就挑它的一个文件和下一层重叠的文件合并。读的时候从新到旧查内存表和各个 run，每个 run 有自己的过滤器。
+    // 表的文件变成记着有哪些 run 的清单，打开过 lsm 的表以后也要打开 lsm 才能打开；以前的数据文件第一次打开的时候加载进内存表，
+    // 下一次 dump 写成 run。和 mmap_reads 一样删除记成 tombstone；不做增量 dump，filter_expected_keys 和 mmap_reads 不起作用。
+    // 合并总是在单独的线程里做，写操作不会等它；打开 background_dump 的话 flush 也在后台线程里做，否则写满写缓冲的那次写会等 flush 做完
+    bool lsm = false ;
+    size_t write_buffer_size = 64 * 1024 * 1024 ;
+    size_t l0_compaction_trigger = 4 ;
+    uint64_t max_bytes_for_level_base = 256 * 1024 * 1024 ;
+    size_t level_size_multiplier = 10 ;
+
 } ;  
 
 }// namespace table
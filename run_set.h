@@ -0,0 +1,728 @@
+#ifndef TABLE_RUN_SET_H
+#define TABLE_RUN_SET_H
+
+// LSM 树的磁盘部分，打开 Options::lsm 的时候是 LayeredMemtable 的 base
+// 1. 内存表写到 Options::write_buffer_size 就冻结起来，flush 把它写成一个只读的有序 run 文件 "文件名.run.N"，放在 L0 的最前面；
+//    L0 的 run 之间 key 会重叠，删除记成 tombstone
+// 2. L0 攒够 Options::l0_compaction_trigger 个 run，就把它们全部和 L1 里 key 范围重叠的文件合并成新的 L1 文件；
+//    L1 的目标大小是 Options::max_bytes_for_level_base，往下每一层是上一层的 Options::level_size_multiplier 倍，
+//    一层比目标大小大了，就从上次合并到的 key 往后挑它的一个文件，只和下一层里和这个文件重叠的文件合并，一次合并只重写几个文件；
+//    同一个 key 只留最新的，更深的层里没有和输入重叠的文件的话，删掉的 key 连同 tombstone 一起丢掉，一个文件写到 Options::max_file_size 就换下一个；
+//    下一层没有重叠的文件、tombstone 又要留着的话，文件直接挪到下一层，不用重写。
+//    L1 往下每一层的文件之间 key 不重叠，按 key 排好。一次点查最多查 L0 的每个 run 和下面每一层的一个文件
+// 3. 每个 run 有自己的布隆过滤器，和它的 key 范围一起先查，不存在的 key 大多不用解码数据块；过滤器存在 "run 文件名.filter" 里，
+//    没有或者对不上的话打开 run 的时候重新建
+// 4. RunSet 建好以后不会再变，flush 和 apply 返回一个新的 RunSet；旧的 RunSet 和它的 run 被快照和迭代器拿着的时候不会释放，
+//    run 文件是映射在内存里的，合并以后删掉的文件在映射解除之前还能读
+//    合并分三步：pick_compaction 挑好输入，compact 写好输出的文件，不改 RunSet，可以和 flush 同时做；apply 在那时候最新的 RunSet 上
+//    换掉输入、写好清单。挑好以后 flush 出来的 run 不在输入里，比输入都新，留在 L0 的前面
+// 5. 有哪些 run 记在清单里，清单就是表的文件 "文件名"：先写好新的 run 文件，再原子地换掉清单，中间崩溃的话还是旧的清单，
+//    多出来的 run 文件的编号以后会再用，到时候被覆盖；它的过滤器可能和新的 run 大小、key 数都对得上，写新的 run 之前先删掉。
+//    copy 出来的 RunSet 共用一个编号的计数器，flush 和合并同时写 run 也不会拿到同一个编号
+// 清单：| MAGIC(8 字节) | varint 下一个 run 的编号 | varint run 的个数 | level(1 字节) | varint 编号 | ... | crc32c(4 字节) |
+//       L0 从新到旧，下面每一层按 key 从小到大
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "status.h"
+#include "options.h"
+#include "byte_array.h"
+#include "memtable.h"
+#include "hufman_code.h"
+#include "bloom_filter.h"
+#include "value_log.h"
+#include "wal.h"
+#include "file_writer.h"
+#include "data_file.h"
+#include "file_memtable.h"
+#include "merging_iterator.h"
+
+namespace table {
+
+#define     RUN_FILE_EXT        ".run."
+
+class RunSet : public Memtable {
+public :
+    // L0 和 L1 到 L6，最底下一层不再往下合并
+    enum { LEVELS = 7 } ;
+
+    struct Compaction ;
+
+    // name 是表的文件名，也就是清单的文件名；options 要一直有效。一开始没有 run
+    RunSet(const std::string& name , const Options& options) ;
+
+    // 文件开头是不是清单的 MAGIC
+    static bool is_manifest(const char *data , uint64_t size) ;
+
+    // 读清单，打开里面所有的 run；清单坏了或者有 run 打不开的话返回 false
+    bool open(const char *data , uint64_t size) ;
+
+    const char* name() const override               { return "runs" ; }
+    // 不跳过 tombstone，同一个 key 用最新的 run 里的
+    std::unique_ptr<Iterator> new_iterator(uint64_t seq = LATEST) override ;
+    // 找到 tombstone 也算找到，value 是 tombstone；数据块坏了的话 get 和 multi_get 当成没有找到，find 和 multi_find 返回 io_error
+    bool get(const ByteArray& key , std::string* value , uint64_t seq = LATEST) override ;
+    Status find(const ByteArray& key , std::string* value , uint64_t seq = LATEST) override ;
+    void multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) override ;
+    Status multi_find(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) override ;
+    // run 不会再变，所有快照看到的都一样
+    uint64_t acquire_snapshot() override            { return 0 ; }
+    void release_snapshot(uint64_t) override        { }
+    uint64_t last_sequence() const override         { return 0 ; }
+    // 只算索引和编码表，映射的文件在页缓存里
+    size_t memory_usage() const override ;
+
+    // 只读，写只会进 LayeredMemtable 上面的 active
+    void put(const ByteArray& , const ByteArray& , bool *existed = nullptr) override    { assert(false) ; if(existed) *existed = false ; }
+    bool del(const ByteArray&) override                 { assert(false) ; return false ; }
+    std::unique_ptr<Writer> new_writer() override       { assert(false) ; return nullptr ; }
+    std::unique_ptr<Builder> new_builder() override     { assert(false) ; return nullptr ; }
+
+    size_t run_count(int level) const               { return this->_levels[level].size() ; }
+    // 第 level 层的 run 文件加起来的大小
+    uint64_t level_size(int level) const ;
+
+    // L0 的 run 够多了，或者 L1 往下有一层比它的目标大小大，要合并
+    bool needs_compaction() const ;
+
+    // 把 memtable 里的全部 entry(包括 tombstone)写成一个新的 L0 run，再写好清单；*result 是多了这个 run 的新 RunSet
+    // memtable 是空的话不写 run，只写清单
+    Status flush(Memtable *memtable , RunSet **result) const ;
+
+    // 挑要合并的程度最高的一层：L0 的话是它的全部 run，往下的层是从上次合并到的 key 往后的一个文件，再加上下一层和它们重叠的文件；
+    // 没有要合并的层返回 false
+    bool pick_compaction(Compaction *c) const ;
+
+    // 把 c 的输入合并成下一层的新文件放进 c->outputs，不写清单，不改这个 RunSet；失败的话写好的文件已经删掉了
+    Status compact(Compaction *c) const ;
+
+    // 在这个 RunSet 上去掉 c 的输入、放进它的输出，写好清单以后删掉合并掉的文件；*result 是合并以后的 RunSet
+    // 这个 RunSet 要有 c 的全部输入，也就是挑好以后只 flush 过；失败的话删掉输出的文件
+    Status apply(const Compaction& c , RunSet **result) const ;
+
+    // Non-copying
+    RunSet(const RunSet&) = delete ;
+    RunSet& operator=(const RunSet&) = delete ;
+
+private :
+    static const uint64_t MAGIC = 0x314d4d534c424454ULL ; // "TDBLSMM1"
+
+    struct Run {
+        uint64_t id ;
+        uint64_t size ;
+        std::string smallest ;
+        std::string largest ;
+        FileMemtable file ;
+        std::unique_ptr<CountingBloomFilter> filter ;
+
+        // 先看 key 范围，再查过滤器
+        bool may_contain(const ByteArray& key) const {
+            return compare_key(key.data() , key.size() , this->smallest.data() , this->smallest.size()) >= 0 &&
+                   compare_key(key.data() , key.size() , this->largest.data() , this->largest.size()) <= 0 &&
+                   this->filter->may_contain(key) ;
+        }
+    } ;
+    typedef std::vector<std::shared_ptr<Run>> Runs ;
+
+    class LevelIterator ;
+
+    std::string run_name(uint64_t id) const         { return this->_name + RUN_FILE_EXT + std::to_string(id) ; }
+    // 同样的 run 和编号，flush 和 apply 在它上面改
+    RunSet* copy() const ;
+    // 打开第 id 个 run，读出它的 key 范围，加载或者重建它的过滤器；打不开或者数据块坏了返回 nullptr
+    std::shared_ptr<Run> open_run(uint64_t id) const ;
+    // 把 iter 里的全部 entry 写成 run 文件，一个文件写到 max_size 字节就换下一个，几个文件用同一张编码表
+    // 写好的 run 按顺序放进 runs，失败的时候已经写好的也在里面，由调用的人删掉；iter 读出错的时候返回它的错误
+    Status write_runs(Memtable::Iterator *iter , uint64_t max_size , Runs *runs) const ;
+    // 原子地换掉清单
+    Status save_manifest() const ;
+    // 删掉 run 文件和它的过滤器
+    void remove_run(uint64_t id) const ;
+    // L1 往下的一层里第一个最大的 key 不小于 key 的文件，也就是 key 可能在的文件；没有的话返回 runs.size()
+    static size_t find_run(const Runs& runs , const ByteArray& key) ;
+    // L1 往下第 level 层的目标大小
+    uint64_t max_bytes(int level) const ;
+    // 第 level 层要合并的程度，不小于 1 就要合并了；最底下一层总是 0
+    double score(int level) const ;
+    // 第 level 层里 key 范围和 [smallest, largest] 重叠的文件
+    Runs overlapping(int level , const std::string& smallest , const std::string& largest) const ;
+
+    const std::string _name ;
+    const Options& _options ;
+    std::shared_ptr<std::atomic<uint64_t>> _next_id ;
+    Runs _levels[LEVELS] ;
+    // 每一层上次合并到的最大的 key，下一次从它后面挑文件
+    std::string _compact_pointer[LEVELS] ;
+} ;
+
+// 一次合并：inputs[0] 是第 level 层的输入，inputs[1] 是下一层和它们重叠的文件，合并成下一层的 outputs
+// 拿着输入的 run，挑好以后 RunSet 换掉了也还能读
+struct RunSet::Compaction {
+    int level = 0 ;
+    Runs inputs[2] ;
+    Runs outputs ;
+    // 更深的层里没有和输入重叠的文件，合并的时候 tombstone 不用再留着
+    bool drop_tombstones = false ;
+    // 第 level 层的输入里最大的 key
+    std::string largest ;
+} ;
+
+// L1 往下一层的文件之间 key 不重叠，一个文件走完了再走下一个，同一时间只有一个文件的迭代器；拿着这些 run，迭代器活着的时候不会释放
+// 一个文件读出错的话不接着走下一个文件，停下来，status() 返回它的错误
+class RunSet::LevelIterator : public Memtable::Iterator {
+public :
+    explicit LevelIterator(const Runs& runs) : _runs(runs) , _index(0) { this->seek_to_first() ; }
+
+    bool good() override                { return this->_iter != nullptr && this->_iter->good() ; }
+    ByteArray key() override            { return this->_iter->key() ; }
+    ByteArray value() override          { return this->_iter->value() ; }
+    Status status() override            { return this->_status ; }
+
+    void seek(const ByteArray& key) override {
+        this->open(find_run(this->_runs , key)) ;
+        if(this->_iter != nullptr) {
+            this->_iter->seek(key) ;
+        }
+        this->skip_forward() ;
+    }
+    void seek_to_first() override {
+        this->open(0) ;
+        this->skip_forward() ;
+    }
+    void seek_to_last() override {
+        this->open(this->_runs.size() - 1) ;
+        if(this->_iter != nullptr) {
+            this->_iter->seek_to_last() ;
+        }
+        this->skip_backward() ;
+    }
+    void next() override {
+        this->_iter->next() ;
+        this->skip_forward() ;
+    }
+    void prev() override {
+        this->_iter->prev() ;
+        this->skip_backward() ;
+    }
+
+private :
+    // 打开第 index 个文件，停在它的第一个 key 上；没有这个文件的话迭代器就结束了
+    void open(size_t index) {
+        this->_index = index ;
+        this->_iter.reset() ;
+        this->_status = Status::ok() ;
+        if(index < this->_runs.size()) {
+            this->_iter = this->_runs[index]->file.new_iterator() ;
+        }
+    }
+    // 当前文件是读出错停下的话记下错误，迭代器结束
+    bool failed() {
+        if(this->_iter->status().good()) {
+            return false ;
+        }
+        this->_status = this->_iter->status() ;
+        this->_iter.reset() ;
+        return true ;
+    }
+    void skip_forward() {
+        while(this->_iter != nullptr && !this->_iter->good() && !this->failed()) {
+            this->open(this->_index + 1) ;
+        }
+    }
+    void skip_backward() {
+        while(this->_iter != nullptr && !this->_iter->good() && !this->failed()) {
+            if(this->_index == 0) {
+                this->_iter.reset() ;
+                return ;
+            }
+            this->open(this->_index - 1) ;
+            this->_iter->seek_to_last() ;
+        }
+    }
+
+    Runs _runs ;
+    size_t _index ;
+    std::unique_ptr<Memtable::Iterator> _iter ;
+    Status _status ;
+} ;
+
+RunSet::RunSet(const std::string& name , const Options& options) :
+    _name(name) , _options(options) , _next_id(std::make_shared<std::atomic<uint64_t>>(1)) { }
+
+bool RunSet::is_manifest(const char *data , uint64_t size) {
+    uint64_t magic ;
+    if(size < sizeof(uint64_t) + sizeof(uint32_t)) {
+        return false ;
+    }
+    memcpy(&magic , data , sizeof(uint64_t)) ;
+    return magic == MAGIC ;
+}
+
+bool RunSet::open(const char *data , uint64_t size) {
+    uint32_t crc ;
+    if(!is_manifest(data , size)) {
+        return false ;
+    }
+    memcpy(&crc , data + size - sizeof(uint32_t) , sizeof(uint32_t)) ;
+    if(crc32c(data , size - sizeof(uint32_t)) != crc) {
+        return false ;
+    }
+    const char *p = data + sizeof(uint64_t) , *limit = data + size - sizeof(uint32_t) ;
+    uint64_t next_id , count ;
+    int n = decode_varint(p , limit , &next_id) ;
+    int m = n == 0 ? 0 : decode_varint(p + n , limit , &count) ;
+    if(m == 0) {
+        return false ;
+    }
+    this->_next_id->store(next_id) ;
+    p += n + m ;
+    for(uint64_t i = 0 ; i < count ; ++i) {
+        uint64_t id ;
+        if(p >= limit || static_cast<uint8_t>(*p) >= LEVELS || (n = decode_varint(p + 1 , limit , &id)) == 0) {
+            return false ;
+        }
+        int level = *p ;
+        p += 1 + n ;
+        std::shared_ptr<Run> run = this->open_run(id) ;
+        if(run == nullptr) {
+            return false ;
+        }
+        this->_levels[level].push_back(run) ;
+    }
+    return p == limit ;
+}
+
+std::shared_ptr<RunSet::Run> RunSet::open_run(uint64_t id) const {
+    const std::string name = this->run_name(id) ;
+    std::shared_ptr<Run> run(new Run()) ;
+    run->id = id ;
+    struct stat info ;
+    if(stat(name.data() , &info) != 0 || !run->file.open(name)) {
+        return nullptr ;
+    }
+    run->size = info.st_size ;
+    const DataFileReader &reader = run->file.reader() ;
+    if(reader.block_count() == 0) {
+        return nullptr ;
+    }
+    // 第一块的第一个 key 和最后一块的最后一个 key
+    bool found = false ;
+    reader.read_block(0 , [&](const std::string& key , const std::string&) {
+        run->smallest = key ;
+        found = true ;
+        return false ;
+    }) ;
+    bool ok = found && reader.read_block(reader.block_count() - 1 , [&](const std::string& key , const std::string&) {
+        run->largest = key ;
+        return true ;
+    }) ;
+    if(!ok) {
+        return nullptr ;
+    }
+    run->filter.reset(new CountingBloomFilter(std::max<uint64_t>(reader.entries() , 1) , this->_options.filter_counters_per_key)) ;
+    const std::string filter_name = name + FILTER_FILE_EXT ;
+    uint64_t keys = 0 ;
+    if(!run->filter->load(filter_name.data() , info.st_size , &keys) || keys != reader.entries()) {
+        // 过滤器不能漏掉 key，数据块坏了的话整个 run 都不能用
+        run->filter->clear() ;
+        ok = reader.read_blocks(1 , [&run](const std::string& key , const std::string&) {
+            run->filter->add(key) ;
+            return true ;
+        }) ;
+        if(!ok) {
+            return nullptr ;
+        }
+        // 存不下来也没关系，下次打开再建
+        run->filter->save(filter_name.data() , info.st_size , reader.entries()) ;
+    }
+    return run ;
+}
+
+size_t RunSet::find_run(const Runs& runs , const ByteArray& key) {
+    size_t left = 0 , right = runs.size() ;
+    while(left < right) {
+        size_t mid = left + (right - left) / 2 ;
+        const std::string &largest = runs[mid]->largest ;
+        if(compare_key(largest.data() , largest.size() , key.data() , key.size()) < 0) {
+            left = mid + 1 ;
+        } else {
+            right = mid ;
+        }
+    }
+    return left ;
+}
+
+std::unique_ptr<Memtable::Iterator> RunSet::new_iterator(uint64_t) {
+    // 用 shared_ptr 的别名构造拿着 run，迭代器里的 FileMemtable 在迭代器析构之前不会释放
+    std::vector<std::shared_ptr<Memtable>> tables ;
+    std::vector<std::unique_ptr<Memtable::Iterator>> children ;
+    for(const std::shared_ptr<Run> &run : this->_levels[0]) {
+        tables.push_back(std::shared_ptr<Memtable>(run , &run->file)) ;
+        children.push_back(run->file.new_iterator()) ;
+    }
+    for(int level = 1 ; level < LEVELS ; ++level) {
+        if(!this->_levels[level].empty()) {
+            children.emplace_back(new LevelIterator(this->_levels[level])) ;
+        }
+    }
+    return std::unique_ptr<Memtable::Iterator>(new MergingIterator(std::move(tables) , std::move(children) , false)) ;
+}
+
+bool RunSet::get(const ByteArray& key , std::string* value , uint64_t seq) {
+    return this->find(key , value , seq).good() ;
+}
+
+Status RunSet::find(const ByteArray& key , std::string* value , uint64_t) {
+    std::string found ;
+    std::string *out = value != nullptr ? value : &found ;
+    // 新的 run 读出错的话不能接着查旧的，旧的 run 里可能是已经被覆盖的 value
+    for(const std::shared_ptr<Run> &run : this->_levels[0]) {
+        if(run->may_contain(key)) {
+            Status s = run->file.find(key , out) ;
+            if(s.code() != Status::NOT_FOUND) {
+                return s ;
+            }
+        }
+    }
+    // 往下每一层最多一个文件可能有这个 key
+    for(int level = 1 ; level < LEVELS ; ++level) {
+        const Runs &runs = this->_levels[level] ;
+        size_t i = find_run(runs , key) ;
+        if(i < runs.size() && runs[i]->may_contain(key)) {
+            Status s = runs[i]->file.find(key , out) ;
+            if(s.code() != Status::NOT_FOUND) {
+                return s ;
+            }
+        }
+    }
+    return Status::not_found() ;
+}
+
+void RunSet::multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t) {
+    std::string value ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        if(this->get(keys[i] , &value)) {
+            handler(i , value) ;
+        }
+    }
+}
+
+Status RunSet::multi_find(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t) {
+    std::string value ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        Status s = this->find(keys[i] , &value) ;
+        if(s.good()) {
+            handler(i , value) ;
+        } else if(s.code() != Status::NOT_FOUND) {
+            return s ;
+        }
+    }
+    return Status::ok() ;
+}
+
+size_t RunSet::memory_usage() const {
+    size_t usage = sizeof(*this) ;
+    for(int level = 0 ; level < LEVELS ; ++level) {
+        for(const std::shared_ptr<Run> &run : this->_levels[level]) {
+            usage += run->file.memory_usage() ;
+        }
+    }
+    return usage ;
+}
+
+uint64_t RunSet::max_bytes(int level) const {
+    uint64_t bytes = std::max<uint64_t>(this->_options.max_bytes_for_level_base , 1) ;
+    for(int i = 1 ; i < level ; ++i) {
+        bytes *= std::max<size_t>(this->_options.level_size_multiplier , 2) ;
+    }
+    return bytes ;
+}
+
+double RunSet::score(int level) const {
+    if(level == 0) {
+        return static_cast<double>(this->_levels[0].size()) / std::max<size_t>(this->_options.l0_compaction_trigger , 1) ;
+    }
+    if(level == LEVELS - 1) {
+        return 0 ;
+    }
+    return static_cast<double>(this->level_size(level)) / this->max_bytes(level) ;
+}
+
+uint64_t RunSet::level_size(int level) const {
+    uint64_t bytes = 0 ;
+    for(const std::shared_ptr<Run> &run : this->_levels[level]) {
+        bytes += run->size ;
+    }
+    return bytes ;
+}
+
+RunSet::Runs RunSet::overlapping(int level , const std::string& smallest , const std::string& largest) const {
+    Runs runs ;
+    for(const std::shared_ptr<Run> &run : this->_levels[level]) {
+        if(compare_key(run->largest.data() , run->largest.size() , smallest.data() , smallest.size()) >= 0 &&
+           compare_key(run->smallest.data() , run->smallest.size() , largest.data() , largest.size()) <= 0) {
+            runs.push_back(run) ;
+        }
+    }
+    return runs ;
+}
+
+bool RunSet::needs_compaction() const {
+    for(int level = 0 ; level < LEVELS - 1 ; ++level) {
+        if(this->score(level) >= 1) {
+            return true ;
+        }
+    }
+    return false ;
+}
+
+RunSet* RunSet::copy() const {
+    RunSet *runs = new RunSet(this->_name , this->_options) ;
+    runs->_next_id = this->_next_id ;
+    for(int level = 0 ; level < LEVELS ; ++level) {
+        runs->_levels[level] = this->_levels[level] ;
+        runs->_compact_pointer[level] = this->_compact_pointer[level] ;
+    }
+    return runs ;
+}
+
+Status RunSet::flush(Memtable *memtable , RunSet **result) const {
+    std::unique_ptr<RunSet> next(this->copy()) ;
+    Runs runs ;
+    std::unique_ptr<Memtable::Iterator> iter = memtable->new_iterator() ;
+    Status s = next->write_runs(iter.get() , UINT64_MAX , &runs) ;
+    if(s.good()) {
+        next->_levels[0].insert(next->_levels[0].begin() , runs.begin() , runs.end()) ;
+        s = next->save_manifest() ;
+    }
+    if(!s.good()) {
+        for(const std::shared_ptr<Run> &run : runs) {
+            this->remove_run(run->id) ;
+        }
+        return s ;
+    }
+    *result = next.release() ;
+    return Status::ok() ;
+}
+
+bool RunSet::pick_compaction(Compaction *c) const {
+    // 要合并的程度最高的一层，一样的话挑上面的
+    int level = -1 ;
+    double best = 0 ;
+    for(int i = 0 ; i < LEVELS - 1 ; ++i) {
+        double score = this->score(i) ;
+        if(score >= 1 && score > best) {
+            level = i ;
+            best = score ;
+        }
+    }
+    if(level < 0) {
+        return false ;
+    }
+    c->level = level ;
+    c->outputs.clear() ;
+    const Runs &runs = this->_levels[level] ;
+    if(level == 0) {
+        // L0 的 run 之间 key 重叠，留下旧的 run 的话它会盖住合并下去的新 value，全部一起合并
+        c->inputs[0] = runs ;
+    } else {
+        // 从上次合并到的 key 后面挑第一个文件，到头了再从第一个开始，一层里的文件轮着往下合并
+        const std::string &pointer = this->_compact_pointer[level] ;
+        size_t i = pointer.empty() ? 0 : find_run(runs , pointer) ;
+        if(i < runs.size() && !pointer.empty() &&
+           compare_key(runs[i]->largest.data() , runs[i]->largest.size() , pointer.data() , pointer.size()) == 0) {
+            ++i ;
+        }
+        c->inputs[0] = Runs(1 , runs[i < runs.size() ? i : 0]) ;
+    }
+    // 输入的 key 范围，下一层只有和它重叠的文件要重写
+    const std::string *smallest = &c->inputs[0][0]->smallest , *largest = &c->inputs[0][0]->largest ;
+    for(const std::shared_ptr<Run> &run : c->inputs[0]) {
+        if(compare_key(run->smallest.data() , run->smallest.size() , smallest->data() , smallest->size()) < 0) {
+            smallest = &run->smallest ;
+        }
+        if(compare_key(run->largest.data() , run->largest.size() , largest->data() , largest->size()) > 0) {
+            largest = &run->largest ;
+        }
+    }
+    c->largest = *largest ;
+    c->inputs[1] = this->overlapping(level + 1 , *smallest , *largest) ;
+    // 合并出来的文件的范围还要算上下一层重叠的文件，更深的层里有和它重叠的文件的话 tombstone 要留着盖住它们
+    std::string low = *smallest , high = *largest ;
+    for(const std::shared_ptr<Run> &run : c->inputs[1]) {
+        if(compare_key(run->smallest.data() , run->smallest.size() , low.data() , low.size()) < 0) {
+            low = run->smallest ;
+        }
+        if(compare_key(run->largest.data() , run->largest.size() , high.data() , high.size()) > 0) {
+            high = run->largest ;
+        }
+    }
+    c->drop_tombstones = true ;
+    for(int i = level + 2 ; i < LEVELS && c->drop_tombstones ; ++i) {
+        c->drop_tombstones = this->overlapping(i , low , high).empty() ;
+    }
+    return true ;
+}
+
+Status RunSet::compact(Compaction *c) const {
+    c->outputs.clear() ;
+    // 下一层没有重叠的文件、tombstone 又要留着的话不用重写，文件原样挪下去
+    if(c->level > 0 && c->inputs[1].empty() && !c->drop_tombstones) {
+        c->outputs = c->inputs[0] ;
+        return Status::ok() ;
+    }
+    // 新的在前面
+    std::vector<std::unique_ptr<Memtable::Iterator>> children ;
+    if(c->level == 0) {
+        for(const std::shared_ptr<Run> &run : c->inputs[0]) {
+            children.push_back(run->file.new_iterator()) ;
+        }
+    } else {
+        children.emplace_back(new LevelIterator(c->inputs[0])) ;
+    }
+    if(!c->inputs[1].empty()) {
+        children.emplace_back(new LevelIterator(c->inputs[1])) ;
+    }
+    MergingIterator merged({} , std::move(children) , c->drop_tombstones) ;
+    Status s = this->write_runs(&merged , this->_options.max_file_size , &c->outputs) ;
+    if(!s.good()) {
+        for(const std::shared_ptr<Run> &run : c->outputs) {
+            this->remove_run(run->id) ;
+        }
+        c->outputs.clear() ;
+    }
+    return s ;
+}
+
+Status RunSet::apply(const Compaction& c , RunSet **result) const {
+    std::unique_ptr<RunSet> next(this->copy()) ;
+    for(int i = 0 ; i < 2 ; ++i) {
+        Runs &runs = next->_levels[c.level + i] ;
+        for(const std::shared_ptr<Run> &run : c.inputs[i]) {
+            runs.erase(std::remove(runs.begin() , runs.end() , run) , runs.end()) ;
+        }
+    }
+    Runs &lower = next->_levels[c.level + 1] ;
+    lower.insert(lower.end() , c.outputs.begin() , c.outputs.end()) ;
+    std::sort(lower.begin() , lower.end() , [](const std::shared_ptr<Run>& a , const std::shared_ptr<Run>& b) {
+        return compare_key(a->smallest.data() , a->smallest.size() , b->smallest.data() , b->smallest.size()) < 0 ;
+    }) ;
+    next->_compact_pointer[c.level] = c.largest ;
+    // 挪下去的文件既是输入又是输出，不能删
+    const bool moved = c.outputs == c.inputs[0] ;
+    Status s = next->save_manifest() ;
+    if(!s.good()) {
+        for(size_t i = 0 ; !moved && i < c.outputs.size() ; ++i) {
+            this->remove_run(c.outputs[i]->id) ;
+        }
+        return s ;
+    }
+    // 新的清单已经落盘了，合并掉的文件可以删掉，已经打开的映射还能读
+    for(int i = moved ? 1 : 0 ; i < 2 ; ++i) {
+        for(const std::shared_ptr<Run> &run : c.inputs[i]) {
+            this->remove_run(run->id) ;
+        }
+    }
+    *result = next.release() ;
+    return Status::ok() ;
+}
+
+Status RunSet::write_runs(Memtable::Iterator *iter , uint64_t max_size , Runs *runs) const {
+    // 第一遍统计字符的频率建哈夫曼树，第二遍写文件
+    HuffmanTree codes ;
+    bool empty = true ;
+    for(iter->seek_to_first() ; iter->good() ; iter->next()) {
+        empty = false ;
+        codes.insert_word(iter->key()) ;
+        // 只有内存表里的 value 要编码，value log 的引用和 tombstone 原样写
+        ByteArray value = iter->value() ;
+        if(!value.empty() && value[0] == INLINE_VALUE) {
+            codes.insert_word(ByteArray(value.data() + 1 , value.size() - 1)) ;
+        }
+    }
+    // 输入的 run 有坏了的块的话遍历提前停下，写出去就少了后面的 key，合并还会删掉输入
+    if(!iter->status().good()) {
+        return iter->status() ;
+    }
+    if(empty) {
+        return Status::ok() ;
+    }
+    if(codes.build_huffmanTree() == false) {
+        return Status::invalid_operation("build Huffman Tree") ;
+    }
+    iter->seek_to_first() ;
+    while(iter->good()) {
+        const uint64_t id = (*this->_next_id)++ ;
+        const std::string name = this->run_name(id) ;
+        // 崩溃留下的同编号的过滤器不是这个 run 的，删不掉的话 open_run 可能会用它，漏掉 key
+        if(remove(std::string(name + FILTER_FILE_EXT).data()) != 0 && errno != ENOENT) {
+            return Status::io_error("remove " + name + FILTER_FILE_EXT + " error, " + strerror(errno)) ;
+        }
+        FileWriter writer(this->_options.dump_io) ;
+        if(!writer.open(name)) {
+            return Status::io_error("open " + name + ".tmp error, " + strerror(errno)) ;
+        }
+        DataFileBuilder builder(&writer , &codes , this->_options.block_size) ;
+        for( ; iter->good() && writer.size() < max_size ; iter->next()) {
+            if(builder.add(iter->key() , iter->value()) == false) {
+                return Status::io_error("encode or write " + name + ".tmp error, " + strerror(errno)) ;
+            }
+        }
+        if(!iter->status().good()) {
+            return iter->status() ;
+        }
+        if(builder.finish() == false || writer.finish() == false) {
+            return Status::io_error("write " + name + " error, " + strerror(errno)) ;
+        }
+        std::shared_ptr<Run> run = this->open_run(id) ;
+        if(run == nullptr) {
+            this->remove_run(id) ;
+            return Status::io_error(name + " is corrupted") ;
+        }
+        runs->push_back(run) ;
+    }
+    return Status::ok() ;
+}
+
+Status RunSet::save_manifest() const {
+    const uint64_t magic = MAGIC ;
+    std::string data(reinterpret_cast<const char*>(&magic) , sizeof(uint64_t)) ;
+    char varint[MAX_VARINT_LENGTH] ;
+    size_t count = 0 ;
+    for(int level = 0 ; level < LEVELS ; ++level) {
+        count += this->_levels[level].size() ;
+    }
+    data.append(varint , encode_varint(varint , this->_next_id->load())) ;
+    data.append(varint , encode_varint(varint , count)) ;
+    for(int level = 0 ; level < LEVELS ; ++level) {
+        for(const std::shared_ptr<Run> &run : this->_levels[level]) {
+            data.push_back(static_cast<char>(level)) ;
+            data.append(varint , encode_varint(varint , run->id)) ;
+        }
+    }
+    uint32_t crc = crc32c(data.data() , data.size()) ;
+    data.append(reinterpret_cast<const char*>(&crc) , sizeof(uint32_t)) ;
+    FileWriter writer(this->_options.dump_io) ;
+    if(!writer.open(this->_name) || !writer.append(data) || !writer.finish()) {
+        return Status::io_error("write " + this->_name + " error, " + strerror(errno)) ;
+    }
+    return Status::ok() ;
+}
+
+void RunSet::remove_run(uint64_t id) const {
+    const std::string name = this->run_name(id) ;
+    remove(name.data()) ;
+    remove(std::string(name + FILTER_FILE_EXT).data()) ;
+}
+
+} // namespace table
+
+#endif
@@ -0,0 +1,359 @@
+#ifndef TABLE_SHARDED_TABLE_H
+#define TABLE_SHARDED_TABLE_H
+
+// 按 key 的哈希分片的表
+// 1. 有 Options::shard_count 个分片，每个分片是一个独立的 Table：自己的内存表、内存池、WriteBatch 锁和文件，
+//    不同分片上的写互不影响，多个线程写的时候可以分散到多个核上
+// 2. key 用 FNV-1a 哈希选分片，哈希只和 key 的字节有关，重新打开表的时候同一个 key 还在同一个分片里
+// 3. 每个分片里的 key 是有序的，有序遍历用 k 路归并的迭代器把所有分片合起来
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+
+#include "status.h"
+#include "options.h"
+#include "byte_array.h"
+#include "write_batch.h"
+#include "table.h"
+
+namespace table {
+
+class ShardedTable {
+public :
+    // 按 key 从小到大遍历所有分片的迭代器，每个分片一个 Table::Iterator，用最小堆选出当前最小的 key
+    // 不同分片的 key 不会重复，不用去重；只能在创建它的线程里使用，不要在它活着的时候关闭表
+    class Iterator {
+    public :
+        Iterator() { }
+
+        bool good()                         { return !this->_heap.empty() ; }
+        void next() ;
+        void seek(const ByteArray& key) ;
+        void seek_to_first() ;
+        ByteArray key()                     { return this->_iters[this->_heap.front()].key() ; }
+        ByteArray value()                   { return this->_iters[this->_heap.front()].value() ; }
+
+    private :
+        friend class ShardedTable ;
+        explicit Iterator(std::vector<Table::Iterator> &&iters) ;
+
+        std::vector<Table::Iterator> _iters ;
+        // 还没走完的分片下标，按当前 key 排成最小堆，堆顶就是所有分片里最小的 key
+        std::vector<size_t> _heap ;
+
+        // 比较两个分片当前 key 的大小，给 std::push_heap 等用，key 大的排在后面
+        bool greater(size_t a , size_t b) ;
+        void rebuild_heap() ;
+    } ;
+
+    // 分片 i 的文件名是 filename + "." + i
+    ShardedTable(const Options& option , const std::string &filename) ;
+
+    ~ShardedTable() ;
+
+    // 打开所有分片，有一个分片打不开的话已经打开的分片也会被关闭
+    Status open();
+
+    // 关闭所有分片，返回第一个出错的分片的结果
+    Status close();
+
+    // 每个分片持久化到自己的文件
+    Status dump();
+
+    // 等所有分片的后台 dump 写完，返回第一个出错的分片的结果
+    Status wait_dump();
+
+    Status get(const ByteArray& key, std::string* value);
+
+    Status put(const ByteArray& key, const ByteArray& value);
+
+    Status del(const ByteArray& key);
+
+    // 批按分片拆开，每个分片里的部分是原子的，但是不同分片之间不是
+    // 有一条不合法的话整批都不写
+    Status write(const WriteBatch& batch);
+
+    // 和 Table::multi_get 一样，keys 按分片分组后每个分片查一次
+    Status multi_get(const std::vector<ByteArray>& keys, std::vector<std::string>* values,
+                     std::vector<Status>* statuses, bool sort_keys = true);
+
+    // 新建一个指向第一个 key 的迭代器，表没有打开的话返回的迭代器 good() 为 false
+    Iterator new_iterator();
+
+    // 和 Table::scan 的参数一样，结果按 key 有序
+    Status scan(const ByteArray& begin, const ByteArray& end, size_t limit,
+                std::vector<std::pair<std::string, std::string>>* result);
+
+    // key 所在的分片
+    size_t shard_of(const ByteArray& key) const ;
+
+    size_t shard_count() const { return this->_shards.size() ; }
+
+    // 所有分片的过滤器统计加起来
+    FilterStats filter_stats() const ;
+
+    // Non-copying
+    ShardedTable(const ShardedTable&) = delete ;
+    ShardedTable& operator=(const ShardedTable&) = delete ;
+
+private :
+    bool _is_closed ;
+    const Options& _options ;
+    // Table 只保存文件名的引用，文件名放在这里，构造完以后不再改动
+    std::vector<std::string> _file_names ;
+    std::vector<std::unique_ptr<Table>> _shards ;
+} ;
+
+ShardedTable::ShardedTable(const Options& option , const std::string &filename) :
+    _is_closed(true) , _options(option) {
+    size_t count = std::max<size_t>(option.shard_count , 1) ;
+    this->_file_names.reserve(count) ;
+    for (size_t i = 0 ; i < count ; ++i) {
+        this->_file_names.push_back(filename + "." + std::to_string(i)) ;
+    }
+    for (size_t i = 0 ; i < count ; ++i) {
+        this->_shards.emplace_back(new Table(this->_options , this->_file_names[i])) ;
+    }
+}
+
+ShardedTable::~ShardedTable() {
+    this->close() ;
+}
+
+Status ShardedTable::open() {
+    if (!this->_is_closed) {
+        return Status::invalid_operation("Table was already open") ;
+    }
+    for (size_t i = 0 ; i < this->_shards.size() ; ++i) {
+        Status s = this->_shards[i]->open() ;
+        if (!s.good()) {
+            while (i-- > 0) {
+                this->_shards[i]->close() ;
+            }
+            return s ;
+        }
+    }
+    this->_is_closed = false ;
+    return Status::ok() ;
+}
+
+Status ShardedTable::close() {
+    if (this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+    // 一个分片出错也要接着关闭其他的分片
+    Status result = Status::ok() ;
+    for (auto &shard : this->_shards) {
+        Status s = shard->close() ;
+        if (!s.good() && result.good()) {
+            result = s ;
+        }
+    }
+    this->_is_closed = true ;
+    return result ;
+}
+
+Status ShardedTable::dump() {
+    if (this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+    for (auto &shard : this->_shards) {
+        Status s = shard->dump() ;
+        if (!s.good()) {
+            return s ;
+        }
+    }
+    return Status::ok() ;
+}
+
+Status ShardedTable::wait_dump() {
+    Status result = Status::ok() ;
+    for (auto &shard : this->_shards) {
+        Status s = shard->wait_dump() ;
+        if (result.good() && !s.good()) {
+            result = s ;
+        }
+    }
+    return result ;
+}
+
+inline size_t ShardedTable::shard_of(const ByteArray& key) const {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL ;
+    for (size_t i = 0 ; i < key.size() ; ++i) {
+        hash ^= static_cast<uint8_t>(key.data()[i]) ;
+        hash *= 1099511628211ULL ;
+    }
+    return hash % this->_shards.size() ;
+}
+
+Status ShardedTable::get(const ByteArray& key, std::string* value) {
+    return this->_shards[this->shard_of(key)]->get(key, value) ;
+}
+
+Status ShardedTable::put(const ByteArray& key, const ByteArray& value) {
+    return this->_shards[this->shard_of(key)]->put(key, value) ;
+}
+
+Status ShardedTable::del(const ByteArray& key) {
+    return this->_shards[this->shard_of(key)]->del(key) ;
+}
+
+Status ShardedTable::write(const WriteBatch& batch) {
+    if (this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+
+    // 和 Table::write 一样的检查，要在写任何一个分片之前做完
+    for (const WriteBatch::Record& record : batch._records) {
+        size_t entry_size = record.key.size() + record.value.size() + sizeof(uint8_t) * 2;
+        if (entry_size > _options.max_file_size) {
+            return Status::invalid_operation("size of entry is too large");
+        }
+    }
+
+    std::vector<WriteBatch> parts(this->_shards.size()) ;
+    for (const WriteBatch::Record& record : batch._records) {
+        parts[this->shard_of(record.key)]._records.push_back(record) ;
+    }
+    for (size_t i = 0 ; i < parts.size() ; ++i) {
+        if (parts[i].count() == 0) {
+            continue ;
+        }
+        Status s = this->_shards[i]->write(parts[i]) ;
+        if (!s.good()) {
+            return s ;
+        }
+    }
+    return Status::ok() ;
+}
+
+Status ShardedTable::multi_get(const std::vector<ByteArray>& keys, std::vector<std::string>* values,
+                               std::vector<Status>* statuses, bool sort_keys) {
+    if (this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+
+    // 每个分片的 key 和它们在 keys 里的下标
+    std::vector<std::vector<ByteArray>> shard_keys(this->_shards.size()) ;
+    std::vector<std::vector<size_t>> shard_index(this->_shards.size()) ;
+    for (size_t i = 0 ; i < keys.size() ; ++i) {
+        size_t shard = this->shard_of(keys[i]) ;
+        shard_keys[shard].push_back(keys[i]) ;
+        shard_index[shard].push_back(i) ;
+    }
+
+    values->assign(keys.size(), std::string()) ;
+    statuses->assign(keys.size(), Status::not_found()) ;
+    std::vector<std::string> shard_values ;
+    std::vector<Status> shard_statuses ;
+    for (size_t shard = 0 ; shard < this->_shards.size() ; ++shard) {
+        if (shard_keys[shard].empty()) {
+            continue ;
+        }
+        Status s = this->_shards[shard]->multi_get(shard_keys[shard], &shard_values, &shard_statuses, sort_keys) ;
+        if (!s.good()) {
+            return s ;
+        }
+        for (size_t j = 0 ; j < shard_index[shard].size() ; ++j) {
+            (*values)[shard_index[shard][j]].swap(shard_values[j]) ;
+            (*statuses)[shard_index[shard][j]] = shard_statuses[j] ;
+        }
+    }
+    return Status::ok() ;
+}
+
+FilterStats ShardedTable::filter_stats() const {
+    FilterStats result ;
+    for (auto &shard : this->_shards) {
+        FilterStats s = shard->filter_stats() ;
+        result.lookups += s.lookups ;
+        result.negatives += s.negatives ;
+        result.false_positives += s.false_positives ;
+    }
+    return result ;
+}
+
+ShardedTable::Iterator ShardedTable::new_iterator() {
+    if (this->_is_closed) {
+        return Iterator() ;
+    }
+    std::vector<Table::Iterator> iters ;
+    iters.reserve(this->_shards.size()) ;
+    for (auto &shard : this->_shards) {
+        iters.push_back(shard->new_iterator()) ;
+    }
+    return Iterator(std::move(iters)) ;
+}
+
+Status ShardedTable::scan(const ByteArray& begin, const ByteArray& end, size_t limit,
+                          std::vector<std::pair<std::string, std::string>>* result) {
+    if (this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+
+    auto it = this->new_iterator() ;
+    if (!begin.empty()) {
+        it.seek(begin) ;
+    }
+    for (size_t count = 0 ; it.good() && (limit == 0 || count < limit) ; it.next() , ++count) {
+        ByteArray key = it.key() ;
+        if (!end.empty() && !(key < end)) {
+            break ;
+        }
+        ByteArray value = it.value() ;
+        result->emplace_back(std::string(key.data(), key.size()), std::string(value.data(), value.size())) ;
+    }
+    return Status::ok() ;
+}
+
+ShardedTable::Iterator::Iterator(std::vector<Table::Iterator> &&iters) : _iters(std::move(iters)) {
+    this->rebuild_heap() ;
+}
+
+inline bool ShardedTable::Iterator::greater(size_t a , size_t b) {
+    return this->_iters[b].key() < this->_iters[a].key() ;
+}
+
+void ShardedTable::Iterator::rebuild_heap() {
+    this->_heap.clear() ;
+    for (size_t i = 0 ; i < this->_iters.size() ; ++i) {
+        if (this->_iters[i].good()) {
+            this->_heap.push_back(i) ;
+        }
+    }
+    std::make_heap(this->_heap.begin() , this->_heap.end() , [this](size_t a , size_t b) { return this->greater(a , b) ; }) ;
+}
+
+void ShardedTable::Iterator::next() {
+    auto cmp = [this](size_t a , size_t b) { return this->greater(a , b) ; } ;
+    // 把堆顶的分片拿出来往后走一步，没走完的话再放回堆里
+    std::pop_heap(this->_heap.begin() , this->_heap.end() , cmp) ;
+    size_t shard = this->_heap.back() ;
+    this->_iters[shard].next() ;
+    if (this->_iters[shard].good()) {
+        std::push_heap(this->_heap.begin() , this->_heap.end() , cmp) ;
+    } else {
+        this->_heap.pop_back() ;
+    }
+}
+
+void ShardedTable::Iterator::seek(const ByteArray& key) {
+    for (auto &iter : this->_iters) {
+        iter.seek(key) ;
+    }
+    this->rebuild_heap() ;
+}
+
+void ShardedTable::Iterator::seek_to_first() {
+    for (auto &iter : this->_iters) {
+        iter.seek_to_first() ;
+    }
+    this->rebuild_heap() ;
+}
+
+}// namespace table
+
+#endif
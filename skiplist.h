@@ -7,124 +7,440 @@
 #include <fstream> 
 #include <random>
 #include <sstream>
-#include <mutex> 
+#include <atomic>
+#include <algorithm>
 #include <assert.h>
+#include <stdint.h>
+#include <mutex>
+#include <set>
+#include <thread>
 #include "memory_pool.h"
+#include "epoch_manager.h"
+#include "hash_index.h"
+#include "memtable.h"
 #include "byte_array.h"
+#include "key_comparator.h"
 
 
 #define TABLE_DEBUG
 
 namespace table {
 
-class SkipList{
+// 无锁跳表
+// 1. 插入：先在第 0 层用 CAS 把节点链进去(这一步成功就算插入成功)，再自底向上逐层 CAS 链接上面的层
+// 2. 删除：先用 CAS 给节点的 value 指针打上删除标记(最低位置 1)，标记成功的线程就是删除成功的线程，
+//    它再把节点每一层的 next 指针也打上标记，被标记的节点由之后经过它的 find 用 CAS 从每一层摘掉
+// 3. 查找：只读，不加锁也不做任何 CAS，遇到被标记的节点直接跳过
+// 4. 摘下来的节点和被替换掉的 value 块交给 EpochManager，等所有可能还拿着它们的线程都离开临界区后再回收
+// 5. 多版本：每次写分配一个递增的序列号，节点上挂着按序列号从新到旧排的版本链，删除是加一个 tombstone 版本；
+//    快照记下一个序列号，只看序列号不大于它的版本。最老的快照也看不到的版本由写它的线程顺手摘掉，
+//    tombstone 成了谁都能看到的最新版本以后，节点才按第 2 条从跳表里物理删除；
+//    Writer 的一批写共用一个序列号，Writer 析构的时候才发布，不带快照的读跳过还没有发布的版本，一批写是同一刻出现的
+// 6. 可以在旁边挂一个哈希索引：节点链进第 0 层以后加进索引，物理删除的时候从索引里去掉，
+//    点查(lookup/update/multi_lookup)直接从索引拿到节点，有序遍历还是走跳表
+// 7. key 的类型、比较器、最大层数和分配器都是模板参数：比较器决定 key 在节点里怎么存、怎么比较(见 key_comparator.h)，
+//    uint64_t 和 __uint128_t 的 key 整个存在节点头里，比较是一次整数比较，不用 memcmp 也不用比较长度；
+//    Allocator 要有 allocate(bytes)、deallocate(ptr , bytes) 和 memory_usage()，和 MemoryPool 一样。
+//    value 都是 ByteArray。Table 用的是 key 为 ByteArray 的 SkipList，它另外实现了 Memtable 接口
+// 8. 层数：每个节点以 1/branching 的概率往上长一层(branching 在构造的时候指定，默认 4)，MaxLevel 层最多能放
+//    branching^MaxLevel 个 key 还保持 O(log n) 的查找，默认的 32 层、branching 为 4 远远够用；
+//    查找从当前最高的层(cur_skiplist_level)开始往下找，不用每次都从 MaxLevel 层走下来
+template <typename Key , typename Comparator = KeyComparator<Key> , int MaxLevel = 32 , typename Allocator = MemoryPool>
+class BasicSkipList {
+    static_assert(MaxLevel >= 1 && MaxLevel <= 64 , "MaxLevel must be in [1 , 64]") ;
+
+public :
+    // 不指定快照，读每个 key 最新的版本
+    static const uint64_t LATEST = UINT64_MAX ;
+
 private : 
-    const int MAX_LEVEL = 16 ; // 该跳表的最大层级数
-    int cur_skiplist_level ;   // 当前跳表所在的层级
-    std::mutex _mutex; 
+    static const int MAX_LEVEL = MaxLevel ; // 该跳表的最大层级数
+    static const int MULTI_LOOKUP_LANES = 8 ; // multi_lookup 同时交替进行的查找路数
+    static const uint64_t SEQ_RING = 1024 ; // 同时在写的序列号最多这么多个，再多的写要等前面的写完(包括还没写完的 Writer)
+    static const uint64_t NO_SNAPSHOT = UINT64_MAX ;
+    static const size_t COLLECT_BATCH = 65536 ; // 攒了这么多个回收不掉的旧版本以后扫一遍整个跳表
+    std::atomic<int> cur_skiplist_level ;   // 当前跳表所在的层级，只会变大；节点要先把它抬到自己的层数再往跳表里链
+    int _branching_bits ;                   // log2(branching)
+
+    // 一个版本：value 的字节单独用一个块存，写的时候把新版本 CAS 到节点的版本链头上，不用重新建节点
+    // 链上的版本按序列号从大到小排，older 指向上一个版本；deleted 为 true 的是 tombstone，没有 value
+    struct Value {
+        uint64_t seq ;
+        std::atomic<Value*> older ;
+        uint32_t size ;
+        bool deleted ;
+        char data[1] ;
+    } ;
 
+    typedef typename Comparator::Stored Stored ;
+    typedef typename Comparator::Probe Probe ;
+
+    // 节点头、next 指针数组、key 和第一个版本都在内存池里一次性连续分配
+    // +---------------------------------------------------------------------------------+
+    // | stored | cur_value | key_size | level | next[0 .. level-1] | key 字节 | value 块 |
+    // +---------------------------------------------------------------------------------+
+    // stored 是比较器放在节点头里的那部分 key，它和 next[0] 在同一个 cache line 里：ByteArray 的 key 存的是
+    // 前 8 个字节按大端序拼成的整数，find_prekey 往前跳的时候大部分比较只看它就能出结果，不用再去访问 key 的字节；
+    // 整数 key 整个存在这里，后面没有 key 字节
     struct Node {
-        ByteArray key ; 
-        ByteArray value ; 
-        int level ; 
-        std::vector<Node*> next ; // 是一个指针数组，有很多层，每一场都有指向下一个层级的索引 
-        
-        explicit Node(const ByteArray& key , const ByteArray& value , const int & level) {
-            this->key = key ; 
-            this->value = value ; 
-            this->level =  level ; 
-            this->next.resize(this->level , nullptr) ; 
-        }
-        ~Node() {
-            delete [] this->key.data() ; 
-            delete [] this->value.data() ; 
-            this->next.clear() ; 
+        Stored stored ; 
+        std::atomic<Value*> cur_value ; // 版本链的头，也就是最新的版本，最低位是节点的删除标记
+        uint32_t key_size ;             // 跟在 next 数组后面的 key 字节数，和 level 一起放在 next 数组前面的 8 个字节里，不占额外的空间
+        uint8_t level ; 
+        // 是一个指针数组，有很多层，实际长度为 level，每一层都有指向下一个层级的索引
+        // 指针的最低位是删除标记，置 1 表示这个节点在这一层已经被逻辑删除
+        std::atomic<Node*> next[1] ;
+
+        const char* key_data() const    { return reinterpret_cast<const char*>(this->next + this->level) ; }
+        Key key() const                 { return Comparator::load(this->stored , this->key_data() , this->key_size) ; }
+        uint64_t hash() const           { return Comparator::hash(this->key()) ; }
+        ByteArray value() const {
+            const Value *v = get_unmarked(this->cur_value.load(std::memory_order_acquire)) ;
+            return ByteArray(v->data , v->size) ;
         }
     }; 
 
+    Allocator _pool ; 
+    EpochManager _epoch ;
+
     Node *head ;
 
-    Node* new_node(const ByteArray& key, const ByteArray& value, int height);
-    
+    // 没有打开哈希索引的时候是 nullptr
+    HashIndex<Node , Allocator> *_index ;
+
+    // 分配出去的最大序列号和已经发布的序列号：不大于 _last_seq 的写都已经完成了，快照只会取到发布过的序列号
+    // 写完的序列号记在 _done 里，谁写完都顺手把 _last_seq 往后推过连续写完的序列号，不用按顺序等
+    std::atomic<uint64_t> _next_seq ;
+    std::atomic<uint64_t> _last_seq ;
+    std::atomic<uint64_t> _done[SEQ_RING] ;
+
+    // 活着的快照的序列号，_oldest_snapshot 是其中最小的，没有快照的时候是 NO_SNAPSHOT
+    std::mutex _snapshot_mutex ;
+    std::multiset<uint64_t> _snapshots ;
+    std::atomic<uint64_t> _oldest_snapshot ;
+
+    // 写的时候回收不掉的旧版本和 tombstone 数，到了 _collect_at 就调用 collect_all
+    std::atomic<size_t> _garbage ;
+    std::atomic<size_t> _collect_at ;
+    std::atomic_flag _collecting = ATOMIC_FLAG_INIT ;
+
+    Node* new_node(const Key& key, const ByteArray& value, int height, uint64_t seq);
+
     void  delete_node(Node* node);
 
-    void remove_node(Node* node, Node** prev);
+    // deleted 为 true 时分配一个 tombstone
+    Value* alloc_value(const ByteArray& value , uint64_t seq , bool deleted) ;
+
+    // 节点创建时和它一起分配的 value 块，放在 key 的字节后面按 8 字节对齐
+    static Value* inline_value(const Node* node) ;
+
+    static size_t value_size(const Value* value) ;
+
+    // 已经从每一层摘掉的节点交给 EpochManager 延迟回收，版本链上的版本也一起回收
+    void retire_node(Node* node) ;
+
+    // 回收从 older 开始的一段版本链，每一个版本都是用 exchange 从前一个版本上摘下来的，
+    // 两个线程同时回收重叠的两段链也不会把同一个版本回收两次
+    void retire_versions(const Node* node , Value* older) ;
+
+    // 分配一个新的序列号，写完以后必须 publish
+    uint64_t next_sequence() ;
+    void publish(uint64_t seq) ;
+    // 序列号为 seq 的写是不是已经发布了
+    bool is_published(uint64_t seq) const ;
+
+    // 最老的快照能看到的序列号，没有快照的时候是 _last_seq；比它能看到的版本更旧的版本谁都看不到了
+    uint64_t oldest_visible() const ;
+
+    // 摘掉 node 上谁都看不到的旧版本，tombstone 成了谁都能看到的版本时把节点物理删除，prev 用来查找前驱；
+    // 有回收不掉的(还有快照能看到的或者还在写的)就记到 _garbage 里
+    void collect(Node* node , Node ** prev) ;
+
+    // _garbage 够多了的话扫一遍整个跳表
+    void maybe_collect() ;
 
+    static size_t node_size(int height , size_t key_size , size_t value_size) ;
+
+    // 比较 node 的 key 和 probe 对应的 key 的大小，probe 为 Comparator::probe(key)
+    static int compare_key(const Node* node , const Probe& probe) ;
+
+    // 删除标记的读写
+    template <typename T> static bool is_marked(T* ptr)     { return reinterpret_cast<uintptr_t>(ptr) & 1 ; }
+    template <typename T> static T*   get_marked(T* ptr)    { return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(ptr) | 1) ; }
+    template <typename T> static T*   get_unmarked(T* ptr)  { return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(ptr) & ~static_cast<uintptr_t>(1)) ; }
+
+    // value 指针被标记了，节点就已经被删除了(next 指针可能还没来得及标记)
+    static bool is_deleted(const Node* node) ;
+
+    // 序列号为 seq 的快照能看到的版本(可能是 tombstone)，没有的话返回 nullptr；LATEST 看的是已经发布了的最新版本
+    const Value* version_at(const Node* node , uint64_t seq) const ;
+
+    // 序列号为 seq 的快照能不能看到这个 key
+    bool is_visible(const Node* node , uint64_t seq) const ;
+
+    // 给节点每一层的 next 指针都打上删除标记，可以重复调用
+    static void mark_levels(Node* node) ;
+
+    // 新节点的层数：每个线程一个 splitmix64 生成器，一个随机数里从低位开始每 _branching_bits 位全是 0 就往上长一层，
+    // 不用每次插入都向系统要随机数种子
     int get_random_level() const ; 
 
-    //找到每一层 i 小于目标值 targetKey 的最大节点 pre[i]，最后 pre 中存的就是每一层小于 target 的最大节点
-    void find_prekey(const ByteArray& targetKey , Node ** prev) const ;
+    // 当前最高的层数，查找从这一层开始
+    int top_level() const           { return this->cur_skiplist_level.load(std::memory_order_acquire) ; }
+
+    // 把 cur_skiplist_level 抬到 level
+    void raise_level(int level) ;
+
+    //找到每一层 i 小于目标值 targetKey 的最大节点 pre[i] 和它在这一层的后继 succ[i]，
+    //路上遇到被标记删除的节点就顺手用 CAS 摘掉，返回 targetKey 是否存在(也就是 succ[0] 的 key 是否等于 targetKey)
+    //from_prev 为 true 时 prev 里是之前查找一个不大于 targetKey 的 key 留下的前驱，每一层从它和上一层下来的节点里靠后的那个开始找
+    bool find_prekey(const Key& targetKey , Node ** prev , Node ** succ , bool from_prev = false) ;
+
+    // 不修改跳表的查找，返回第一个 key 大于等于 targetKey 且没有被删除的节点
+    Node* find_greater_or_equal(const Key& targetKey) const ;
+
+    // key 对应的没有被物理删除的节点，有哈希索引的时候查索引，没有的话返回 nullptr
+    Node* find_node(const Key& key) const ;
+
+    // 不修改跳表的查找，返回最后一个 key 小于 targetKey 且序列号为 seq 的快照能看到的节点，没有的话返回 nullptr
+    Node* find_less_than(const Key& targetKey , uint64_t seq) const ;
+
+    // 最后一个 key 小于 probe、没有被标记删除的节点，不管快照能不能看到；没有的话返回 head
+    Node* find_last_before(const Probe& probe) const ;
+
+    // 从 node 开始(包括 node)往前第一个序列号为 seq 的快照能看到的节点，node 为 head 的时候返回 nullptr
+    Node* skip_invisible_backward(Node* node , uint64_t seq) const ;
+
+    // 序列号为 seq 的快照能看到的最后一个节点
+    Node* find_last(uint64_t seq) const ;
+
+    // 从 node 开始(包括 node)第一个序列号为 seq 的快照能看到的节点
+    Node* skip_invisible(Node* node , uint64_t seq) const ;
+
+    // insert 和 upsert 的实现：只找一遍，key 不存在就链一个新节点进去；
+    // key 已经存在的时候，overwrite 为 true 就在它的版本链上加一个新版本，否则返回 nullptr
+    // prev 用来放每一层的前驱，from_prev 的意思和 find_prekey 一样，seq 是这次写的序列号
+    // existed 不为空的话，返回写之前 key 是不是已经存在
+    Node* put_node(const Key& key , const ByteArray& value , bool overwrite , Node ** prev , bool from_prev , uint64_t seq , bool *existed = nullptr) ;
+
+    // erase 的实现：在版本链上加一个 tombstone，返回删除的节点，key 不存在的话返回 nullptr
+    Node* erase_node(const Key& key , Node ** prev , bool from_prev , uint64_t seq) ;
 
+    // link_version 什么时候才链：ALWAYS 总是链，IF_EXISTS 只在 key 存在时链，IF_MISSING 只在 key 不存在时链
+    enum LinkCondition { ALWAYS , IF_EXISTS , IF_MISSING } ;
+    enum LinkResult { LINKED , EXISTS , MISSING , NODE_DELETED } ;
+
+    // 把版本 v 按序列号链到节点的版本链上，key 存不存在看的是 v 前面的版本(序列号比 v 小的最新版本)
+    // 不满足 cond 时返回 EXISTS 或者 MISSING，节点已经被物理删除时返回 NODE_DELETED；链上了的话 existed 是 key 之前存不存在
+    LinkResult link_version(Node* node , Value* v , LinkCondition cond , bool *existed = nullptr) ;
 
 public : 
 
+    // Iterator 活着的时候一直处在 epoch 临界区里，它指向的节点不会被回收
+    // 所以 Iterator 只能在创建它的线程里使用和析构，也不要长时间持有
+    // begin() 返回的 Iterator 可以 seek 到任意位置、前后移动；insert/lookup 等返回的只指向一个节点
+    // 带快照序列号的 Iterator 只看得到这个快照里的版本，快照要在 Iterator 析构之后再释放
+    // value() 是定位到节点时看到的版本，之后节点被更新或者删除了也不变
     class Iterator {
     private  :
         Node *_node ; 
+        BasicSkipList *_list ;
+        uint64_t _seq ;
+        const Value *_value ;
+
+        // 定位到一个新节点以后记下它的版本
+        void set_node(Node *node) {
+            this->_node = node ;
+            this->_value = node != nullptr ? this->_list->version_at(node , this->_seq) : nullptr ;
+        }
+        // 移动到 node；不带快照的时候 node 可能在 skip_invisible 之后、记下版本之前刚好被删除了，
+        // 这时候接着往同一个方向找，good() 的时候记下的一定不是删除的版本
+        void move_forward(Node *node) {
+            for(this->set_node(node) ; this->_node != nullptr && (this->_value == nullptr || this->_value->deleted) ; ) {
+                this->set_node(this->_list->skip_invisible(get_unmarked(this->_node->next[0].load(std::memory_order_acquire)) , this->_seq)) ;
+            }
+        }
+        void move_backward(Node *node) {
+            for(this->set_node(node) ; this->_node != nullptr && (this->_value == nullptr || this->_value->deleted) ; ) {
+                this->set_node(this->_list->find_less_than(this->_node->key() , this->_seq)) ;
+            }
+        }
     public : 
-        Iterator() : _node(nullptr) { } ;
-        Iterator(Node *node) : _node(node) { }; 
-        ~Iterator() { }; 
+        Iterator() : _node(nullptr) , _list(nullptr) , _seq(LATEST) , _value(nullptr) { } ;
+        Iterator(Node *node , BasicSkipList *list , uint64_t seq = LATEST) : _list(list) , _seq(seq) {
+            if(this->_list != nullptr) this->_list->_epoch.enter() ;
+            this->set_node(node) ;
+        }
+        Iterator(const Iterator &other) : Iterator(other._node , other._list , other._seq) { this->_value = other._value ; }
+        Iterator& operator=(const Iterator &other) {
+            if(other._list != nullptr) other._list->_epoch.enter() ;
+            if(this->_list != nullptr) this->_list->_epoch.exit() ;
+            this->_node = other._node ;
+            this->_list = other._list ;
+            this->_seq = other._seq ;
+            this->_value = other._value ;
+            return *this ;
+        }
+        ~Iterator() {
+            if(this->_list != nullptr) this->_list->_epoch.exit() ;
+        };
 
         bool good()                 { return this->_node != nullptr ; }
 
-        void next()                 { this->_node = this->_node->next[0] ; }
+        void next()                 { this->move_forward(this->_list->skip_invisible(get_unmarked(this->_node->next[0].load(std::memory_order_acquire)) , this->_seq)) ; }
+
+        // 前一个节点，跳表是单向的，用当前 key 再查一遍前驱，O(log n)
+        void prev()                 { this->move_backward(this->_list->find_less_than(this->_node->key() , this->_seq)) ; }
+
+        // 定位到第一个 key 大于等于 key 的节点
+        void seek(const Key& key)       { this->move_forward(this->_list->skip_invisible(this->_list->find_greater_or_equal(key) , this->_seq)) ; }
+
+        void seek_to_first()        { this->move_forward(this->_list->skip_invisible(get_unmarked(this->_list->head->next[0].load(std::memory_order_acquire)) , this->_seq)) ; }
+
+        void seek_to_last()         { this->move_backward(this->_list->find_last(this->_seq)) ; }
+
+        Key key()                   { return this->_node->key() ; } 
+
+        // 移动得到的 Iterator 记下的都是没有删除的版本；insert/lookup 等返回的 Iterator 不指定快照的时候，
+        // 节点可能在找到和记下版本之间刚好被删除了，这时候是空的 value
+        ByteArray value()           { return this->_value != nullptr ? ByteArray(this->_value->data , this->_value->size) : ByteArray() ; }
+    }; 
+
+    // 按 key 严格递增的顺序往跳表尾部追加节点，记住每一层最后一个节点，每次追加 O(1)，不用从头查找
+    // 只能在没有其他线程访问跳表的时候用，比如 Table::open 从有序的文件加载数据；追加的节点序列号是 0，所有快照都看得到
+    class Builder {
+    public :
+        explicit Builder(BasicSkipList *list) ;
+
+        // key 必须比之前的 key(以及跳表里原有的 key)都大，否则返回 false
+        bool append(const Key& key , const ByteArray& value) ;
 
-        const ByteArray& key()      { return this->_node->key ; } 
+    private :
+        BasicSkipList *_list ;
+        Node *_last[MAX_LEVEL] ;
+    } ;
 
-        const ByteArray& value()    { return this->_node->value ; }  
-    };
+    // 按 key 从小到大的顺序写入一批 key，每次查找从上一个 key 留下的每一层前驱开始(finger search)，
+    // 相邻的 key 离得近的时候每层只要走一两步；碰到比上一个 key 小的 key 就从头节点开始找
+    // 可以和其他线程的读写并发，但是一个 Writer 只能在创建它的线程里用；它活着的时候一直处在 epoch 临界区里
+    // 所有写共用第一次写的时候分配的序列号，析构的时候才发布：之前不带快照的读和新的快照都看不到这一批里的任何一个
+    class Writer {
+    public :
+        explicit Writer(BasicSkipList *list) ;
+        ~Writer() ;
 
-    SkipList() ; 
+        // 返回写之前 key 是不是已经存在
+        bool upsert(const Key& key , const ByteArray& value) ;
 
-    ~SkipList() ; 
+        bool erase(const Key& key) ;
 
-    Iterator begin();
+        // Non-copying
+        Writer(const Writer&) = delete ;
+        Writer& operator=(const Writer&) = delete ;
 
-    Iterator insert(const ByteArray& key, const ByteArray& value);
+    private :
+        BasicSkipList *_list ;
+        Node *_prev[MAX_LEVEL] ;
+        bool _has_prev ;
+        uint64_t _seq ;         // 还没有写过的时候是 0
 
-    bool erase(const ByteArray& key);
-    
-    Iterator update(const ByteArray& key, const ByteArray& new_value);
-    
-    Iterator lookup(const ByteArray& key);
+        // _prev 还能不能用来找 key
+        bool can_resume(const Key& key) const ;
+    } ;
+
+    // hash_index 为 true 的时候在旁边维护一个 key 到节点的哈希索引
+    // branching 是相邻两层节点数的比例，要是 2 的幂：越大每个节点的平均指针数越少(1 / (1 - 1/branching) 个)，
+    // 每层要往前走的步数越多(平均 branching / 2 步)
+    explicit BasicSkipList(bool hash_index = false , int branching = 4) ; 
+
+    ~BasicSkipList() ; 
+
+    // seq 是快照的序列号，下面几个查找的 seq 也一样，不传就是不用快照
+    Iterator begin(uint64_t seq = LATEST);
+
+    Iterator insert(const Key& key, const ByteArray& value);
+
+    bool erase(const Key& key);
+
+    Iterator update(const Key& key, const ByteArray& new_value);
+
+    // key 不存在就插入，存在就更新 value，只查找一遍，也不会重新分配节点
+    // existed 不为空的话，返回写之前 key 是不是已经存在
+    Iterator upsert(const Key& key, const ByteArray& value, bool *existed = nullptr);
+
+    Iterator lookup(const Key& key , uint64_t seq = LATEST);
+
+    // 创建一个快照，返回它的序列号：之后的读带上这个序列号，只能看到创建快照之前已经写完的数据；
+    // 快照活着的时候它能看到的旧版本不会被回收，用完要 release_snapshot
+    uint64_t acquire_snapshot() ;
+    void release_snapshot(uint64_t seq) ;
+
+    // 已经写完的最大序列号
+    uint64_t last_sequence() const ;
+
+    // 扫一遍整个跳表，回收所有快照都看不到的旧版本和 tombstone
+    void collect_all() ;
+
+    // 批量查找，找到的 keys[i] 调用 handler(i , value)，value 只在 handler 里有效
+    // 1. keys 分成几路，每一路各自往前走一步就换下一路，走到一个节点时先预取它，等轮回来的时候它多半已经在 cache 里了，
+    //    几路的 cache miss 可以重叠起来，而不是一次 lookup 等一次
+    // 2. keys 按从小到大排好序的时候，同一路里后一个 key 从前一个 key 的前驱开始找，不用每次都从头节点开始；
+    //    没有排序也能查对，只是碰到比前一个 key 小的 key 要从头找
+    template <typename Handler>
+    void multi_lookup(const Key* keys , size_t n , Handler handler , uint64_t seq = LATEST) ;
+
+    // 内存池向系统申请的总字节数
+    size_t memory_usage() const ;
 
     // Non-copying
-    SkipList(const SkipList&) = delete;
-    SkipList& operator=(const SkipList&) = delete;
+    BasicSkipList(const BasicSkipList&) = delete;
+    BasicSkipList& operator=(const BasicSkipList&) = delete;
 
 #ifdef TABLE_DEBUG
     std::string serialize();
 #endif
+
 } ; 
- 
- 
-SkipList::SkipList(){
+
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+BasicSkipList<Key , Comparator , MaxLevel , Allocator>::BasicSkipList(bool hash_index , int branching) : _epoch(&_pool) , _index(nullptr) , _next_seq(0) , _last_seq(0) , _oldest_snapshot(NO_SNAPSHOT) ,
+    _garbage(0) , _collect_at(COLLECT_BATCH) {
+    assert(branching >= 2 && (branching & (branching - 1)) == 0) ;
     this->cur_skiplist_level = 1 ; 
-    this->head = new_node("head" , "head" , MAX_LEVEL) ; 
+    this->_branching_bits = __builtin_ctz(branching) ;
+    for(uint64_t i = 0 ; i < SEQ_RING ; ++i) {
+        this->_done[i].store(0 , std::memory_order_relaxed) ;
+    }
+    this->head = new_node(Key() , "" , MAX_LEVEL , 0) ; 
+    if(hash_index) {
+        this->_index = new HashIndex<Node , Allocator>(&this->_pool , &this->_epoch) ;
+    }
 }
 
-SkipList::~SkipList(){
-    Node *cur = this->head ; 
-    while(cur->next[0] != nullptr) {
-        Node *next = cur->next[0] ; 
-        delete cur ; cur = next ;  
-    }
-    delete cur ; 
+// 节点都在内存池里，内存池析构时整块释放
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+BasicSkipList<Key , Comparator , MaxLevel , Allocator>::~BasicSkipList(){
+    delete this->_index ;
 }
 
-inline int SkipList::get_random_level() const{
-    int level = 1 ; 
-    std::mt19937 mt_rand{std::random_device{}()};
-    while(level <= this->MAX_LEVEL && (mt_rand() % 2)) {
-        
-        ++level ; 
-    }
-    return level ; 
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline int BasicSkipList<Key , Comparator , MaxLevel , Allocator>::get_random_level() const{
+    static thread_local uint64_t state = (static_cast<uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}() ;
+    uint64_t bits = mix_hash(state += 0x9e3779b97f4a7c15ULL) ;
+    // 最高位置 1，64 位全是 0 的时候也有个上限
+    int level = 1 + __builtin_ctzll(bits | (1ULL << 63)) / this->_branching_bits ; 
+    return level < MAX_LEVEL ? level : MAX_LEVEL ; 
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::raise_level(int level) {
+    int cur = this->cur_skiplist_level.load(std::memory_order_relaxed) ;
+    while(cur < level && !this->cur_skiplist_level.compare_exchange_weak(cur , level)) { }
 }
 
 void my_memcpy(void *dest , const void *src , const size_t& size){
-    
+
     assert(dest != nullptr) ; 
     assert(src != nullptr) ; 
 
@@ -145,127 +461,860 @@ void my_memcpy(void *dest , const void *src , const size_t& size){
     }
 }
 
-SkipList::Node* SkipList::new_node(const ByteArray& key, const ByteArray& value, int height) {
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline size_t BasicSkipList<Key , Comparator , MaxLevel , Allocator>::node_size(int height , size_t key_size , size_t value_size) {
+    return sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1) + ((key_size + 7) & ~static_cast<size_t>(7)) + offsetof(Value , data) + value_size ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline int BasicSkipList<Key , Comparator , MaxLevel , Allocator>::compare_key(const Node* node , const Probe& probe) {
+    return Comparator::compare(node->stored , node->key_data() , node->key_size , probe) ;
+}
 
-    char *new_key = new char[key.size()] ; 
-    my_memcpy(new_key , key.data() , key.size()) ; 
-    char *new_value = new char[value.size()] ; 
-    my_memcpy(new_value , value.data() , value.size()) ;  
-     
-    // 一定要将 key.size() 和 value.size() 赋给新开的节点，因为构造函数里面的 strlen() 根本就无法判断出函数
-    ByteArray _key(new_key , key.size()) , _value(new_value , value.size()) ;
-    Node *node = new Node(_key , _value , height) ; 
-    // std::cout<<std::string(node->key.data() , node->key.size())<<" "<<std::string(node->value.data() , node->value.size())<<std::endl ; 
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::new_node(const Key& key, const ByteArray& value, int height, uint64_t seq) {
+
+    const size_t key_size = Comparator::key_size(key) ;
+    char *mem = this->_pool.allocate(node_size(height , key_size , value.size())) ; 
+    Node *node = reinterpret_cast<Node*>(mem) ; 
+    node->key_size = key_size ; 
+    node->level = height ; 
+    for(int i = 0 ; i < height ; ++i) {
+        new (&node->next[i]) std::atomic<Node*>(nullptr) ;
+    }
+    // key 放不进节点头的字节和第一个 value 块紧跟在 next 数组后面
+    Comparator::store(&node->stored , const_cast<char*>(node->key_data()) , key) ; 
+    Value *v = inline_value(node) ;
+    v->seq = seq ;
+    new (&v->older) std::atomic<Value*>(nullptr) ;
+    v->size = value.size() ;
+    v->deleted = false ;
+    my_memcpy(v->data , value.data() , value.size()) ;
+    new (&node->cur_value) std::atomic<Value*>(v) ;
     return node ; 
 }
 
-void SkipList::delete_node(Node *node){
-    delete node ; 
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Value* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::alloc_value(const ByteArray& value , uint64_t seq , bool deleted) {
+    Value *v = reinterpret_cast<Value*>(this->_pool.allocate(offsetof(Value , data) + value.size())) ;
+    v->seq = seq ;
+    new (&v->older) std::atomic<Value*>(nullptr) ;
+    v->size = value.size() ;
+    v->deleted = deleted ;
+    my_memcpy(v->data , value.data() , value.size()) ;
+    return v ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Value* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::inline_value(const Node* node) {
+    return reinterpret_cast<Value*>(const_cast<char*>(node->key_data()) + ((node->key_size + 7) & ~7)) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline size_t BasicSkipList<Key , Comparator , MaxLevel , Allocator>::value_size(const Value* value) {
+    return offsetof(Value , data) + value->size ;
+}
+
+// 只能用来释放还没有被链进跳表的节点，已经链进去的节点可能还有别的线程在读，要用 retire_node
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::delete_node(Node *node){
+    this->_pool.deallocate(node , node_size(node->level , node->key_size , inline_value(node)->size)) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::retire_node(Node *node) {
+    Value *v = get_unmarked(node->cur_value.load(std::memory_order_acquire)) ;
+    this->retire_versions(node , v->older.exchange(nullptr)) ;
+    if(v != inline_value(node)) {
+        this->_epoch.retire(v , value_size(v)) ;
+    }
+    this->_epoch.retire(node , node_size(node->level , node->key_size , inline_value(node)->size)) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::retire_versions(const Node* node , Value* older) {
+    // 和节点一起分配的那个版本随节点一起回收
+    while(older != nullptr) {
+        Value *next = older->older.exchange(nullptr) ;
+        if(older != inline_value(node)) {
+            this->_epoch.retire(older , value_size(older)) ;
+        }
+        older = next ;
+    }
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::is_deleted(const Node* node) {
+    return is_marked(node->cur_value.load(std::memory_order_acquire)) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline const typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Value* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::version_at(const Node* node , uint64_t seq) const {
+    // 快照的序列号不大于 _last_seq，它能看到的版本都已经发布了
+    const Value *v = get_unmarked(node->cur_value.load(std::memory_order_acquire)) ;
+    while(v != nullptr && (v->seq > seq || (seq == LATEST && !this->is_published(v->seq)))) {
+        v = v->older.load(std::memory_order_acquire) ;
+    }
+    return v ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::is_visible(const Node* node , uint64_t seq) const {
+    if(is_deleted(node)) {
+        return false ;
+    }
+    const Value *v = this->version_at(node , seq) ;
+    return v != nullptr && !v->deleted ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline uint64_t BasicSkipList<Key , Comparator , MaxLevel , Allocator>::next_sequence() {
+    uint64_t seq = this->_next_seq.fetch_add(1) + 1 ;
+    // 槽位 seq % SEQ_RING 上一次是给 seq - SEQ_RING 用的，等它被 _last_seq 推过去
+    while(seq - this->_last_seq.load(std::memory_order_acquire) > SEQ_RING) {
+        std::this_thread::yield() ;
+    }
+    return seq ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::publish(uint64_t seq) {
+    // 先登记自己写完了，再看 _last_seq：和前一个序列号的线程一定有一个能看到另一个，不会谁都不去推
+    this->_done[seq % SEQ_RING].store(seq) ;
+    uint64_t last = this->_last_seq.load() ;
+    while(this->_done[(last + 1) % SEQ_RING].load() == last + 1) {
+        this->_last_seq.compare_exchange_weak(last , last + 1) ; // 失败的话 last 是别人推到的位置，接着推
+    }
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::is_published(uint64_t seq) const {
+    if(seq <= this->_last_seq.load(std::memory_order_acquire)) {
+        return true ;
+    }
+    // 槽位里还是 seq 就是发布了；槽位已经换成了 seq + SEQ_RING 的话，_last_seq 一定已经推过了 seq
+    return this->_done[seq % SEQ_RING].load(std::memory_order_acquire) == seq ||
+           seq <= this->_last_seq.load(std::memory_order_acquire) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+uint64_t BasicSkipList<Key , Comparator , MaxLevel , Allocator>::last_sequence() const {
+    return this->_last_seq.load(std::memory_order_acquire) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline uint64_t BasicSkipList<Key , Comparator , MaxLevel , Allocator>::oldest_visible() const {
+    // 先读 _last_seq 再读 _oldest_snapshot，和 acquire_snapshot 的顺序相反，
+    // 这样没看到正在创建的快照的话，它取到的序列号一定不小于这里的 _last_seq
+    uint64_t last = this->_last_seq.load() ;
+    return std::min(last , this->_oldest_snapshot.load()) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+uint64_t BasicSkipList<Key , Comparator , MaxLevel , Allocator>::acquire_snapshot() {
+    std::lock_guard<std::mutex> lock(this->_snapshot_mutex) ;
+    // 先告诉 collect 有快照正在创建，什么都不要回收，再去读序列号
+    this->_oldest_snapshot.store(0) ;
+    uint64_t seq = this->_last_seq.load() ;
+    this->_snapshots.insert(seq) ;
+    this->_oldest_snapshot.store(*this->_snapshots.begin()) ;
+    return seq ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::release_snapshot(uint64_t seq) {
+    std::lock_guard<std::mutex> lock(this->_snapshot_mutex) ;
+    auto it = this->_snapshots.find(seq) ;
+    assert(it != this->_snapshots.end()) ;
+    this->_snapshots.erase(it) ;
+    if(this->_snapshots.empty()) {
+        this->_oldest_snapshot.store(NO_SNAPSHOT) ;
+    } else {
+        this->_oldest_snapshot.store(*this->_snapshots.begin()) ;
+    }
+    // 快照挡住的旧版本现在可能可以回收了，下一次写的时候攒够一批就去扫
+    this->_collect_at.store(COLLECT_BATCH , std::memory_order_relaxed) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::collect(Node* node , Node ** prev) {
+    Value *head = node->cur_value.load(std::memory_order_acquire) ;
+    if(is_marked(head)) {
+        return ;
+    }
+    // v 是最老的快照能看到的版本，比它旧的版本谁都看不到了
+    uint64_t oldest = this->oldest_visible() ;
+    Value *v = head ;
+    while(v != nullptr && v->seq > oldest) {
+        v = v->older.load(std::memory_order_acquire) ;
+    }
+    if(v == nullptr) { // 版本都还有快照看不到，只有一个版本的话本来也没什么可回收的
+        if(head->deleted || head->older.load(std::memory_order_relaxed) != nullptr) {
+            this->_garbage.fetch_add(1 , std::memory_order_relaxed) ;
+        }
+        return ;
+    }
+    this->retire_versions(node , v->older.exchange(nullptr)) ;
+    if(v != head) {
+        this->_garbage.fetch_add(1 , std::memory_order_relaxed) ;
+        return ;
+    }
+    // 所有快照都能看到这个 tombstone，没有人需要这个节点了，和以前的 erase 一样把它物理删除
+    if(v->deleted && node->cur_value.compare_exchange_strong(head , get_marked(head))) {
+        Node *succ[MAX_LEVEL] ;
+        if(this->_index != nullptr) {
+            std::atomic_thread_fence(std::memory_order_seq_cst) ; // 和 put_node 加进索引以后的检查配对
+            this->_index->erase(Comparator::hash(node->key()) , node) ;
+        }
+        mark_levels(node) ;
+        this->find_prekey(node->key() , prev , succ) ;
+        this->retire_node(node) ;
+    }
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::maybe_collect() {
+    if(this->_garbage.load(std::memory_order_relaxed) >= this->_collect_at.load(std::memory_order_relaxed)) {
+        this->collect_all() ;
+    }
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::collect_all() {
+    // 同一时间只要一个线程去扫
+    if(this->_collecting.test_and_set(std::memory_order_acquire)) {
+        return ;
+    }
+    EpochManager::Guard guard(&this->_epoch) ;
+    this->_garbage.store(0 , std::memory_order_relaxed) ;
+    Node *prev[MAX_LEVEL] ;
+    Node *node = get_unmarked(this->head->next[0].load(std::memory_order_acquire)) ;
+    while(node != nullptr) {
+        // collect 可能把 node 物理删除，先拿到后继；被删除的节点在 epoch 临界区里还可以读
+        Node *next = get_unmarked(node->next[0].load(std::memory_order_acquire)) ;
+        this->collect(node , prev) ;
+        node = next ;
+    }
+    // 还有快照挡着回收不掉的，等它们再翻一倍再扫，免得每攒一批就扫一遍
+    size_t remain = this->_garbage.load(std::memory_order_relaxed) * 2 ;
+    this->_collect_at.store(remain > COLLECT_BATCH ? remain : static_cast<size_t>(COLLECT_BATCH) , std::memory_order_relaxed) ;
+    this->_collecting.clear(std::memory_order_release) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::mark_levels(Node* node) {
+    for(int i = node->level - 1 ; i >= 0 ; --i) {
+        Node *next = node->next[i].load(std::memory_order_acquire) ;
+        while(!is_marked(next)) {
+            node->next[i].compare_exchange_weak(next , get_marked(next)) ;
+        }
+    }
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::skip_invisible(Node* node , uint64_t seq) const {
+    while(node != nullptr && !this->is_visible(node , seq)) {
+        node = get_unmarked(node->next[0].load(std::memory_order_acquire)) ;
+    }
+    return node ; 
 }
 
-SkipList::Iterator SkipList::begin() {
-    return Iterator(this->head->next[0]) ; 
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Iterator BasicSkipList<Key , Comparator , MaxLevel , Allocator>::begin(uint64_t seq) {
+    EpochManager::Guard guard(&this->_epoch) ;
+    return Iterator(skip_invisible(get_unmarked(this->head->next[0].load(std::memory_order_acquire)) , seq) , this , seq) ;
 }
 
-void SkipList::find_prekey(const ByteArray& targetKey, Node ** prev) const{
-    
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::find_prekey(const Key& targetKey, Node ** prev , Node ** succ , bool from_prev) {
+
+    const Probe probe = Comparator::probe(targetKey) ; 
+retry :
     Node* cur = this->head;
-    for(int i = MAX_LEVEL - 1 ; i >= 0 ; --i){
-        while(cur->next.size() > 0 && cur->next[i] != nullptr && cur->next[i]->key < targetKey){
-            cur = cur->next[i] ; 
+    // 比当前最高层还高的层上没有节点，也不会有节点要链到这些层上(链之前要先抬高 cur_skiplist_level)
+    const int top = this->top_level() ;
+    for(int i = MAX_LEVEL - 1 ; i >= top ; --i) {
+        prev[i] = this->head ;
+        succ[i] = nullptr ;
+    }
+    for(int i = top - 1 ; i >= 0 ; --i){
+        // 之前留下的前驱还在这一层上(next 没有被标记)，而且比 cur 靠后，就从它开始找
+        if(from_prev && prev[i] != cur && prev[i] != this->head && !is_marked(prev[i]->next[i].load(std::memory_order_acquire))
+           && (cur == this->head || compare_key(prev[i] , Comparator::probe(cur->key())) > 0)) {
+            cur = prev[i] ;
+        }
+        Node *next = get_unmarked(cur->next[i].load(std::memory_order_acquire)) ;
+        while(next != nullptr) {
+            Node *next_next = next->next[i].load(std::memory_order_acquire) ;
+            // next 在这一层已经被标记删除，把它摘掉，cur 也被删除了的话 CAS 会失败，只能从头再来
+            while(is_marked(next_next)) {
+                if(!cur->next[i].compare_exchange_strong(next , get_unmarked(next_next))) {
+                    from_prev = false ;
+                    goto retry ;
+                }
+                next = get_unmarked(next_next) ;
+                if(next == nullptr) {
+                    break ;
+                }
+                next_next = next->next[i].load(std::memory_order_acquire) ;
+            }
+            if(next == nullptr || compare_key(next , probe) >= 0) {
+                break ;
+            }
+            cur = next ;
+            next = next_next ;
         }
         prev[i] = cur ; 
+        succ[i] = next ;
     }
-     
+    return succ[0] != nullptr && compare_key(succ[0] , probe) == 0 ;
 }
 
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::find_greater_or_equal(const Key& targetKey) const {
+    const Probe probe = Comparator::probe(targetKey) ; 
+    Node *cur = this->head , *next = nullptr ;
+    for(int i = this->top_level() - 1 ; i >= 0 ; --i){
+        next = get_unmarked(cur->next[i].load(std::memory_order_acquire)) ;
+        while(next != nullptr) {
+            Node *next_next = next->next[i].load(std::memory_order_acquire) ;
+            // 跳过被标记删除的节点，但是不去摘它
+            while(is_marked(next_next)) {
+                next = get_unmarked(next_next) ;
+                if(next == nullptr) {
+                    break ;
+                }
+                next_next = next->next[i].load(std::memory_order_acquire) ;
+            }
+            if(next == nullptr || compare_key(next , probe) >= 0) {
+                break ;
+            }
+            cur = next ;
+            next = next_next ;
+        }
+    }
+    return next ;
+}
 
-SkipList::Iterator SkipList::insert(const ByteArray& key, const ByteArray& value) {
-    Node *prev[MAX_LEVEL] = {nullptr} ; 
-    this->find_prekey(key , prev) ; 
-    // prev[0]->next[0] is must null , because new head will resize next size ;
-    if(prev[0]->next[0] != nullptr && prev[0]->next[0]->key == key){ 
-         return Iterator(nullptr) ; 
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::find_less_than(const Key& targetKey , uint64_t seq) const {
+    return this->skip_invisible_backward(this->find_last_before(Comparator::probe(targetKey)) , seq) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::find_last_before(const Probe& probe) const {
+    Node *cur = this->head ;
+    for(int i = this->top_level() - 1 ; i >= 0 ; --i){
+        Node *next = get_unmarked(cur->next[i].load(std::memory_order_acquire)) ;
+        while(next != nullptr) {
+            Node *next_next = next->next[i].load(std::memory_order_acquire) ;
+            while(is_marked(next_next)) {
+                next = get_unmarked(next_next) ;
+                if(next == nullptr) {
+                    break ;
+                }
+                next_next = next->next[i].load(std::memory_order_acquire) ;
+            }
+            if(next == nullptr || compare_key(next , probe) >= 0) {
+                break ;
+            }
+            cur = next ;
+            next = next_next ;
+        }
+    }
+    return cur ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::skip_invisible_backward(Node* node , uint64_t seq) const {
+    // 找到的前驱刚好被删除了或者快照里还没有它，就用它的 key 再找一遍前驱；
+    // 快照拿着一长串删掉的节点的时候要找很多遍，用循环不用递归，栈不会随着它变深
+    while(node != this->head && !this->is_visible(node , seq)) {
+        const Key key = node->key() ;
+        node = this->find_last_before(Comparator::probe(key)) ;
+    }
+    return node != this->head ? node : nullptr ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::find_last(uint64_t seq) const {
+    Node *cur = this->head ;
+    for(int i = this->top_level() - 1 ; i >= 0 ; --i){
+        Node *next = get_unmarked(cur->next[i].load(std::memory_order_acquire)) ;
+        while(next != nullptr) {
+            Node *next_next = next->next[i].load(std::memory_order_acquire) ;
+            if(!is_marked(next_next)) {
+                cur = next ;
+            }
+            next = get_unmarked(next_next) ;
+        }
+    }
+    return this->skip_invisible_backward(cur , seq) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Iterator BasicSkipList<Key , Comparator , MaxLevel , Allocator>::insert(const Key& key, const ByteArray& value) {
+    Node *prev[MAX_LEVEL] ;
+    EpochManager::Guard guard(&this->_epoch) ;
+    uint64_t seq = this->next_sequence() ;
+    Node *node = this->put_node(key , value , false , prev , false , seq) ;
+    this->publish(seq) ;
+    if(node == nullptr) {
+        return Iterator() ;
+    }
+    this->collect(node , prev) ;
+    this->maybe_collect() ;
+    return Iterator(node , this) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Iterator BasicSkipList<Key , Comparator , MaxLevel , Allocator>::upsert(const Key& key, const ByteArray& value, bool *existed) {
+    Node *prev[MAX_LEVEL] ;
+    EpochManager::Guard guard(&this->_epoch) ;
+    uint64_t seq = this->next_sequence() ;
+    Node *node = this->put_node(key , value , true , prev , false , seq , existed) ;
+    this->publish(seq) ;
+    this->collect(node , prev) ;
+    this->maybe_collect() ;
+    return Iterator(node , this) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::LinkResult BasicSkipList<Key , Comparator , MaxLevel , Allocator>::link_version(Node* node , Value* v , LinkCondition cond , bool *existed) {
+    Value *head = node->cur_value.load(std::memory_order_acquire) ;
+    while(true) {
+        if(is_marked(head)) {
+            return NODE_DELETED ;
+        }
+        // 一般 v 就是最新的版本，链在最前面；序列号更大的写先完成了的话，要插到它们后面
+        std::atomic<Value*> *link = &node->cur_value ;
+        Value *older = head ;
+        while(older != nullptr && older->seq > v->seq) {
+            link = &older->older ;
+            older = link->load(std::memory_order_acquire) ;
+        }
+        bool live = older != nullptr && !older->deleted ;
+        if(live && cond == IF_MISSING) {
+            return EXISTS ;
+        }
+        if(!live && cond == IF_EXISTS) {
+            return MISSING ;
+        }
+        v->older.store(older , std::memory_order_relaxed) ;
+        if(link->compare_exchange_strong(older , v , std::memory_order_acq_rel)) {
+            if(existed != nullptr) {
+                *existed = live ;
+            }
+            return LINKED ;
+        }
+        // 被别的写抢先了，或者节点被删除了，重新来
+        head = node->cur_value.load(std::memory_order_acquire) ;
     }
-     
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::put_node(const Key& key , const ByteArray& value , bool overwrite , Node ** prev , bool from_prev , uint64_t seq , bool *existed) {
+    Node *succ[MAX_LEVEL] ;
+    Node *insert_node = nullptr ;
     int random_level = this->get_random_level() ; 
-    this->cur_skiplist_level = std::max(this->cur_skiplist_level , random_level) ; 
-
-    std::lock_guard<std::mutex> lock(_mutex);
-    Node *insert_node = new_node(key , value , random_level) ; 
-    for(int i = 0 ; i < random_level ; ++i) {
-        insert_node->next[i] = prev[i]->next[i] ; 
-        prev[i]->next[i] = insert_node ; 
-    }
-     
-    return Iterator(insert_node) ; 
-}
-
-bool SkipList::erase(const ByteArray &key) {
-    Node *prev[MAX_LEVEL] = {nullptr} ; 
-    this->find_prekey(key , prev) ; 
-
-    std::lock_guard<std::mutex> lock(_mutex);
-    if(prev[0]->next[0] != nullptr && prev[0]->next[0]->key == key){
-        Node* node = prev[0]->next[0] ; 
-        for(int i = 0 ; i < this->MAX_LEVEL ; ++i){
-            if(prev[i]->next[i] != nullptr && prev[i]->next[i]->key == key){
-                prev[i]->next[i] = prev[i]->next[i]->next[i] ;         
-            }else {
-                break ;// already find over 
+    // 先抬高最高层再找，保证 find_prekey 找到了新节点要链的每一层的前驱
+    this->raise_level(random_level) ;
+
+    // 第 0 层链接成功才算插入成功
+    while(true) {
+        // 第一次之后 prev 里都是 key 的前驱，重新找的时候也可以从它们开始
+        bool found = this->find_prekey(key , prev , succ , from_prev) ;
+        from_prev = true ;
+        if(found) {
+            // key 已经有节点了：在它的版本链上加一个版本，节点刚被物理删除的话和下面一样重新找
+            Value *v = alloc_value(value , seq , false) ;
+            LinkResult result = this->link_version(succ[0] , v , overwrite ? ALWAYS : IF_MISSING , existed) ;
+            if(result != LINKED) {
+                this->_pool.deallocate(v , value_size(v)) ;
+            }
+            if(result == NODE_DELETED) {
+                // 已经被删除、但是还没摘掉的节点，帮删除它的线程打完标记再重新找
+                mark_levels(succ[0]) ;
+                continue ;
+            }
+            if(insert_node != nullptr) {
+                delete_node(insert_node) ;
+            }
+            return result == LINKED ? succ[0] : nullptr ;
+        }
+        if(insert_node == nullptr) {
+            insert_node = new_node(key , value , random_level , seq) ;
+        }
+        for(int i = 0 ; i < random_level ; ++i) {
+            insert_node->next[i].store(succ[i] , std::memory_order_relaxed) ;
+        }
+        Node *expected = succ[0] ;
+        if(prev[0]->next[0].compare_exchange_strong(expected , insert_node)) {
+            if(existed != nullptr) {
+                *existed = false ;
+            }
+            break ;
+        }
+    }
+
+    if(this->_index != nullptr) {
+        uint64_t h = Comparator::hash(key) ;
+        this->_index->insert(h , insert_node) ;
+        // 链进第 0 层之后、加进索引之前，节点可能已经被删掉、collect 在索引里没找到它，这里自己去掉；
+        // collect 是先打删除标记再去索引里找，两边都先写后读，至少有一边能看到另一边
+        std::atomic_thread_fence(std::memory_order_seq_cst) ;
+        if(is_deleted(insert_node)) {
+            this->_index->erase(h , insert_node) ;
+        }
+    }
+
+    // 再逐层链接上面的层，节点在这期间被别的线程删除的话就不用再往上链了
+    for(int i = 1 ; i < random_level ; ++i) {
+        while(true) {
+            Node *next = insert_node->next[i].load(std::memory_order_acquire) ;
+            if(is_marked(next)) {
+                goto done ;
+            }
+            if(next != succ[i] && !insert_node->next[i].compare_exchange_strong(next , succ[i])) {
+                goto done ; // 只有被标记了才会失败
+            }
+            Node *expected = succ[i] ;
+            if(prev[i]->next[i].compare_exchange_strong(expected , insert_node)) {
+                break ;
+            }
+            // prev[i] 或者 succ[i] 变了，重新找一遍
+            this->find_prekey(key , prev , succ) ;
+            if(succ[0] != insert_node) {
+                goto done ;
+            }
+        }
+    }
+done :
+    // 上面几层链接的时候节点可能已经被删除了，删除它的线程不一定能看到后链上去的层，这里再摘一遍
+    if(is_marked(insert_node->next[0].load(std::memory_order_acquire))) {
+        this->find_prekey(key , prev , succ) ;
+    }
+    return insert_node ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::erase(const Key &key) {
+    Node *prev[MAX_LEVEL] ;
+    EpochManager::Guard guard(&this->_epoch) ;
+    uint64_t seq = this->next_sequence() ;
+    Node *node = this->erase_node(key , prev , false , seq) ;
+    this->publish(seq) ;
+    if(node == nullptr) {
+        return false ;
+    }
+    this->collect(node , prev) ;
+    this->maybe_collect() ;
+    return true ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::erase_node(const Key& key , Node ** prev , bool from_prev , uint64_t seq) {
+    Node *succ[MAX_LEVEL] ;
+    while(this->find_prekey(key , prev , succ , from_prev)) {
+        // 只加一个 tombstone，还有快照能看到旧的 value，节点等 collect 确认没人需要了再物理删除
+        Node *node = succ[0] ;
+        Value *tombstone = alloc_value("" , seq , true) ;
+        LinkResult result = this->link_version(node , tombstone , IF_EXISTS) ;
+        if(result == LINKED) {
+            return node ;
+        }
+        this->_pool.deallocate(tombstone , value_size(tombstone)) ;
+        if(result == MISSING) {
+            return nullptr ;
+        }
+        // 节点刚被物理删除，可能又有新的节点插进来了，重新找
+        mark_levels(node) ;
+        from_prev = true ;
+    }
+    return nullptr ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Node* BasicSkipList<Key , Comparator , MaxLevel , Allocator>::find_node(const Key& key) const {
+    const Probe probe = Comparator::probe(key) ;
+    if(this->_index != nullptr) {
+        // 物理删除和重新插入之间，同一个 key 可能有一个打了删除标记的旧节点和一个新节点同时在索引里
+        return this->_index->find(Comparator::hash(key) , [&](const Node *node) {
+            return compare_key(node , probe) == 0 && !is_deleted(node) ;
+        }) ;
+    }
+    Node *node = this->find_greater_or_equal(key) ;
+    if(node != nullptr && compare_key(node , probe) == 0) {
+        return node ;
+    }
+    return nullptr ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Iterator BasicSkipList<Key , Comparator , MaxLevel , Allocator>::update(const Key& key, const ByteArray& new_value) {
+    EpochManager::Guard guard(&this->_epoch) ;
+    Node *node = this->find_node(key) ;
+    if(node == nullptr || !is_visible(node , LATEST)) {
+        return Iterator() ;
+    }
+    // 值没变就什么都不用做
+    const Value *cur = version_at(node , LATEST) ;
+    if(cur->size == new_value.size() && memcmp(cur->data , new_value.data() , new_value.size()) == 0) {
+        return Iterator() ;
+    }
+    uint64_t seq = this->next_sequence() ;
+    Value *v = alloc_value(new_value , seq , false) ;
+    // 查完之后 key 被删除了的话不把它加回来
+    LinkResult result = this->link_version(node , v , IF_EXISTS) ;
+    this->publish(seq) ;
+    if(result != LINKED) {
+        this->_pool.deallocate(v , value_size(v)) ;
+        return Iterator() ;
+    }
+    Node *prev[MAX_LEVEL] ;
+    this->collect(node , prev) ;
+    this->maybe_collect() ;
+    return Iterator(node , this) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+typename BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Iterator BasicSkipList<Key , Comparator , MaxLevel , Allocator>::lookup(const Key& key , uint64_t seq) {
+    EpochManager::Guard guard(&this->_epoch) ;
+    // 快照也可以查索引：节点只有在 tombstone 所有快照都能看到以后才会从跳表和索引里去掉
+    Node *node = this->find_node(key) ;
+    if(node != nullptr && is_visible(node , seq)){
+        return Iterator(node , this , seq) ;
+    }
+    return Iterator() ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+template <typename Handler>
+void BasicSkipList<Key , Comparator , MaxLevel , Allocator>::multi_lookup(const Key* keys , size_t n , Handler handler , uint64_t seq) {
+    // 每一路的查找状态，相当于把 find_greater_or_equal 的循环变量存下来，走一步就切到下一路
+    struct Lane {
+        size_t index , end ;    // 这一路正在查找的 keys[index] 和这一路的结束位置
+        Probe probe ;           // Comparator::probe(keys[index])
+        int level ;
+        Node *cur ;             // 第 level 层上已知小于 key 的节点
+        Node *next ;            // cur 在第 level 层的后继，已经预取过
+        Node *prev[MAX_LEVEL] ; // 每一层小于 key 的最后一个节点，下一个 key 从这里开始找
+    } ;
+    if(n == 0) {
+        return ;
+    }
+    EpochManager::Guard guard(&this->_epoch) ;
+
+    // 有哈希索引的时候每个 key 查一次索引，提前几个 key 算好哈希值、预取它们的组
+    if(this->_index != nullptr) {
+        uint64_t hashes[MULTI_LOOKUP_LANES] ;
+        for(size_t i = 0 ; i < n && i < static_cast<size_t>(MULTI_LOOKUP_LANES) ; ++i) {
+            hashes[i] = Comparator::hash(keys[i]) ;
+            this->_index->prefetch(hashes[i]) ;
+        }
+        for(size_t i = 0 ; i < n ; ++i) {
+            const Key &key = keys[i] ;
+            const Probe probe = Comparator::probe(key) ;
+            Node *node = this->_index->find(hashes[i % MULTI_LOOKUP_LANES] , [&](const Node *candidate) {
+                return compare_key(candidate , probe) == 0 && !is_deleted(candidate) ;
+            }) ;
+            if(i + MULTI_LOOKUP_LANES < n) {
+                hashes[i % MULTI_LOOKUP_LANES] = Comparator::hash(keys[i + MULTI_LOOKUP_LANES]) ;
+                this->_index->prefetch(hashes[i % MULTI_LOOKUP_LANES]) ;
+            }
+            if(node != nullptr && is_visible(node , seq)) {
+                const Value *v = version_at(node , seq) ;
+                handler(i , ByteArray(v->data , v->size)) ;
             }
         }
-        delete_node(node) ; 
-        return true ; 
-    }
-    
-    return false ;  
-}
- 
-SkipList::Iterator SkipList::update(const ByteArray& key, const ByteArray& new_value) {
-    Node *prev[MAX_LEVEL] = {nullptr} ; 
-    this->find_prekey(key , prev) ; 
-    std::lock_guard<std::mutex> lock(_mutex);
-    if(prev[0]->next[0] != nullptr && prev[0]->next[0]->key == key && prev[0]->next[0]->value != new_value){
-        Node* node = prev[0]->next[0] ; 
-        Node *insert_node = new_node(key , new_value , node->level) ;
-        for(int i = 0 ; i < this->MAX_LEVEL ; ++i){
-            if(prev[i]->next[i] != nullptr && prev[i]->next[i]->key == key){
-                prev[i]->next[i] = insert_node ; 
-                insert_node->next[i] = node->next[i] ;         
-            }else {
-                break ;// already find over 
+        return ;
+    }
+
+    const int top = this->top_level() ;
+    Lane lanes[MULTI_LOOKUP_LANES] ;
+    size_t active = std::min(n , static_cast<size_t>(MULTI_LOOKUP_LANES)) ;
+    for(size_t j = 0 ; j < active ; ++j) {
+        Lane &lane = lanes[j] ;
+        lane.index = n * j / active ;
+        lane.end = n * (j + 1) / active ;
+        lane.probe = Comparator::probe(keys[lane.index]) ;
+        lane.level = top - 1 ;
+        lane.cur = this->head ;
+        lane.next = get_unmarked(this->head->next[lane.level].load(std::memory_order_acquire)) ;
+        __builtin_prefetch(lane.next) ;
+    }
+
+    size_t j = 0 ;
+    while(active > 0) {
+        if(j >= active) {
+            j = 0 ;
+        }
+        Lane &lane = lanes[j] ;
+        Node *next = lane.next ;
+        int cmp = 1 ;
+        if(next != nullptr) {
+            Node *next_next = next->next[lane.level].load(std::memory_order_acquire) ;
+            // 和 find_greater_or_equal 一样跳过被标记删除的节点
+            if(is_marked(next_next)) {
+                lane.next = get_unmarked(next_next) ;
+                __builtin_prefetch(lane.next) ;
+                ++j ;
+                continue ;
+            }
+            cmp = compare_key(next , lane.probe) ;
+            if(cmp < 0) {
+                lane.cur = next ;
+                lane.next = get_unmarked(next_next) ;
+                __builtin_prefetch(lane.next) ;
+                ++j ;
+                continue ;
             }
         }
-        delete_node(node) ; 
-        return Iterator(insert_node) ; 
+        // next 不小于 key，往下走一层
+        lane.prev[lane.level] = lane.cur ;
+        if(lane.level > 0) {
+            --lane.level ;
+            lane.next = get_unmarked(lane.cur->next[lane.level].load(std::memory_order_acquire)) ;
+            __builtin_prefetch(lane.next) ;
+            ++j ;
+            continue ;
+        }
+
+        // 第 0 层也找到了位置，这个 key 查完了
+        if(cmp == 0 && is_visible(next , seq)) {
+            const Value *v = version_at(next , seq) ;
+            handler(lane.index , ByteArray(v->data , v->size)) ;
+        }
+        if(++lane.index == lane.end) {
+            lanes[j] = lanes[--active] ; // 这一路查完了，把最后一路换过来
+            continue ;
+        }
+        const Key &key = keys[lane.index] ;
+        lane.probe = Comparator::probe(key) ;
+        if(Comparator::less(key , keys[lane.index - 1])) {
+            lane.level = top - 1 ;
+            lane.cur = this->head ;
+        } else {
+            // 前一个 key 的前驱都小于这个 key，从下往上找到第一个后继不小于 key 的层，从那一层的前驱开始往下找；
+            // 前驱已经被删除的层跳过，它的 next 可能已经过时了
+            int h = 0 ;
+            while(h < top - 1) {
+                Node *succ = lane.prev[h]->next[h].load(std::memory_order_acquire) ;
+                if(!is_marked(succ) && (succ == nullptr || compare_key(succ , lane.probe) >= 0)) {
+                    break ;
+                }
+                ++h ;
+            }
+            lane.level = h ;
+            lane.cur = is_marked(lane.prev[h]->next[h].load(std::memory_order_acquire)) ? this->head : lane.prev[h] ;
+        }
+        lane.next = get_unmarked(lane.cur->next[lane.level].load(std::memory_order_acquire)) ;
+        __builtin_prefetch(lane.next) ;
+        ++j ;
+    }
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Builder::Builder(BasicSkipList *list) : _list(list) {
+    // 找到每一层现在的最后一个节点
+    Node *cur = list->head ;
+    for(int i = MAX_LEVEL - 1 ; i >= 0 ; --i) {
+        Node *next = get_unmarked(cur->next[i].load(std::memory_order_acquire)) ;
+        while(next != nullptr) {
+            cur = next ;
+            next = get_unmarked(cur->next[i].load(std::memory_order_acquire)) ;
+        }
+        this->_last[i] = cur ;
     }
-    return Iterator(nullptr) ; 
 }
 
-SkipList::Iterator SkipList::lookup(const ByteArray& key) {
-    Node *prev[MAX_LEVEL] = {nullptr} ; 
-    this->find_prekey(key , prev) ; 
-    if(prev[0]->next[0] != nullptr && prev[0]->next[0]->key == key){
-        return Iterator(prev[0]->next[0]) ; 
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Builder::append(const Key& key , const ByteArray& value) {
+    Node *last = this->_last[0] ;
+    if(last != this->_list->head && compare_key(last , Comparator::probe(key)) >= 0) {
+        return false ;
+    }
+    int level = this->_list->get_random_level() ;
+    this->_list->raise_level(level) ;
+    Node *node = this->_list->new_node(key , value , level , 0) ;
+    for(int i = 0 ; i < level ; ++i) {
+        this->_last[i]->next[i].store(node , std::memory_order_release) ;
+        this->_last[i] = node ;
+    }
+    if(this->_list->_index != nullptr) {
+        this->_list->_index->insert(Comparator::hash(key) , node) ;
     }
-    return Iterator(nullptr) ; 
+    return true ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Writer::Writer(BasicSkipList *list) : _list(list) , _has_prev(false) , _seq(0) {
+    this->_list->_epoch.enter() ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Writer::~Writer() {
+    // 一步发布整批写
+    if(this->_seq != 0) {
+        this->_list->publish(this->_seq) ;
+    }
+    this->_list->_epoch.exit() ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+inline bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Writer::can_resume(const Key& key) const {
+    // 每一层的前驱都不在 _prev[0] 后面，_prev[0] 小于 key 的话它们都小于 key
+    return this->_has_prev && (this->_prev[0] == this->_list->head || compare_key(this->_prev[0] , Comparator::probe(key)) < 0) ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Writer::upsert(const Key& key , const ByteArray& value) {
+    bool existed = false ;
+    if(this->_seq == 0) {
+        this->_seq = this->_list->next_sequence() ;
+    }
+    Node *node = this->_list->put_node(key , value , true , this->_prev , this->can_resume(key) , this->_seq , &existed) ;
+    this->_list->collect(node , this->_prev) ;
+    this->_list->maybe_collect() ;
+    this->_has_prev = true ;
+    return existed ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+bool BasicSkipList<Key , Comparator , MaxLevel , Allocator>::Writer::erase(const Key& key) {
+    if(this->_seq == 0) {
+        this->_seq = this->_list->next_sequence() ;
+    }
+    Node *node = this->_list->erase_node(key , this->_prev , this->can_resume(key) , this->_seq) ;
+    if(node != nullptr) {
+        this->_list->collect(node , this->_prev) ;
+        this->_list->maybe_collect() ;
+    }
+    this->_has_prev = true ;
+    return node != nullptr ;
+}
+
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+size_t BasicSkipList<Key , Comparator , MaxLevel , Allocator>::memory_usage() const {
+    return this->_pool.memory_usage() ;
 }
 
 #ifdef TABLE_DEBUG
-std::string SkipList::serialize() {
+template <typename Key , typename Comparator , int MaxLevel , typename Allocator>
+std::string BasicSkipList<Key , Comparator , MaxLevel , Allocator>::serialize() {
     std::stringstream sstr;
 
     int height = this->MAX_LEVEL - 1;
     while (height >= 0) {
-        
-        Node *p = this->head->next[height];
+
+        Node *p = get_unmarked(this->head->next[height].load());
         if(p != nullptr) {
             sstr << "height " << height << ": ";
         }
         while (p) {
-            sstr << std::string(p->key.data() , p->key.size())<<" "<<p->key.size()<<":"<<std::string(p->value.data() , p->key.size()) << "    ";
-            p = p->next[height];
+            ByteArray value = p->value() ;
+            sstr << p->key() << ":" << std::string(value.data() , value.size()) << "    ";
+            p = get_unmarked(p->next[height].load());
             if(p == nullptr) {
                  sstr << std::endl;
             }
@@ -276,6 +1325,107 @@ std::string SkipList::serialize() {
     return sstr.str();
 }
 #endif
+
+// key 是 8 字节、16 字节整数 ID 的跳表，比较是一次整数比较
+typedef BasicSkipList<uint64_t> Uint64SkipList ;
+typedef BasicSkipList<__uint128_t> Uint128SkipList ;
+
+// key 为 ByteArray 的跳表，另外实现 Memtable 接口，Table 默认用它
+// Iterator、Builder、Writer 和基类的一样，Memtable 接口要的那几个类由它们包一层
+class SkipList : public BasicSkipList<ByteArray> , public Memtable {
+public :
+    typedef BasicSkipList<ByteArray>::Iterator Iterator ;
+    typedef BasicSkipList<ByteArray>::Builder Builder ;
+    typedef BasicSkipList<ByteArray>::Writer Writer ;
+    using BasicSkipList<ByteArray>::LATEST ;
+
+    explicit SkipList(bool hash_index = false , int branching = 4) : BasicSkipList<ByteArray>(hash_index , branching) { }
+
+    // Memtable 的接口，都是基类的几个函数包一层
+    const char* name() const override { return "skiplist" ; }
+    std::unique_ptr<Memtable::Iterator> new_iterator(uint64_t seq = LATEST) override ;
+    bool get(const ByteArray& key , std::string* value , uint64_t seq = LATEST) override ;
+    void put(const ByteArray& key , const ByteArray& value , bool *existed = nullptr) override ;
+    bool del(const ByteArray& key) override ;
+    void multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq = LATEST) override ;
+    std::unique_ptr<Memtable::Writer> new_writer() override ;
+    std::unique_ptr<Memtable::Builder> new_builder() override ;
+    uint64_t acquire_snapshot() override                { return BasicSkipList<ByteArray>::acquire_snapshot() ; }
+    void release_snapshot(uint64_t seq) override        { BasicSkipList<ByteArray>::release_snapshot(seq) ; }
+    uint64_t last_sequence() const override             { return BasicSkipList<ByteArray>::last_sequence() ; }
+    size_t memory_usage() const override                { return BasicSkipList<ByteArray>::memory_usage() ; }
+
+private :
+    // 把 Iterator 包成 Memtable::Iterator
+    class MemtableIterator : public Memtable::Iterator {
+    public :
+        explicit MemtableIterator(const SkipList::Iterator &iter) : _iter(iter) { }
+        bool good() override                        { return this->_iter.good() ; }
+        void next() override                        { this->_iter.next() ; }
+        void prev() override                        { this->_iter.prev() ; }
+        void seek(const ByteArray& key) override    { this->_iter.seek(key) ; }
+        void seek_to_first() override               { this->_iter.seek_to_first() ; }
+        void seek_to_last() override                { this->_iter.seek_to_last() ; }
+        ByteArray key() override                    { return this->_iter.key() ; }
+        ByteArray value() override                  { return this->_iter.value() ; }
+    private :
+        SkipList::Iterator _iter ;
+    } ;
+
+    class MemtableWriter : public Memtable::Writer {
+    public :
+        explicit MemtableWriter(SkipList *list) : _writer(list) { }
+        bool upsert(const ByteArray& key , const ByteArray& value) override { return this->_writer.upsert(key , value) ; }
+        bool erase(const ByteArray& key) override   { return this->_writer.erase(key) ; }
+    private :
+        SkipList::Writer _writer ;
+    } ;
+
+    class MemtableBuilder : public Memtable::Builder {
+    public :
+        explicit MemtableBuilder(SkipList *list) : _builder(list) { }
+        bool append(const ByteArray& key , const ByteArray& value) override { return this->_builder.append(key , value) ; }
+    private :
+        SkipList::Builder _builder ;
+    } ;
+} ;
+
+std::unique_ptr<Memtable::Iterator> SkipList::new_iterator(uint64_t seq) {
+    return std::unique_ptr<Memtable::Iterator>(new MemtableIterator(this->begin(seq))) ;
+}
+
+bool SkipList::get(const ByteArray& key , std::string* value , uint64_t seq) {
+    auto it = this->lookup(key , seq) ;
+    if(!it.good()) {
+        return false ;
+    }
+    if(value != nullptr) {
+        ByteArray v = it.value() ;
+        value->assign(v.data() , v.size()) ;
+    }
+    return true ;
+}
+
+void SkipList::put(const ByteArray& key , const ByteArray& value , bool *existed) {
+    this->upsert(key , value , existed) ;
+}
+
+bool SkipList::del(const ByteArray& key) {
+    return this->erase(key) ;
 }
 
-#endif
\ No newline at end of file
+void SkipList::multi_get(const ByteArray* keys , size_t n , const LookupHandler& handler , uint64_t seq) {
+    this->multi_lookup(keys , n , std::cref(handler) , seq) ;
+}
+
+std::unique_ptr<Memtable::Writer> SkipList::new_writer() {
+    return std::unique_ptr<Memtable::Writer>(new MemtableWriter(this)) ;
+}
+
+std::unique_ptr<Memtable::Builder> SkipList::new_builder() {
+    return std::unique_ptr<Memtable::Builder>(new MemtableBuilder(this)) ;
+}
+
+}
+
+#endif
@@ -0,0 +1,219 @@
+// 跳表查找性能测试
+// 用法：./skiplist_bench [key 数量 ...]，默认分别测 1M 和 10M 个 key
+//       ./skiplist_bench --scaling [最大 key 数量]，默认到 100M，看查找的代价是不是随 log n 增长
+// 除了逐个 insert/lookup，还比较一批 key 逐个 lookup 和排序后 multi_lookup 的吞吐；
+// 每种大小分别测不带和带哈希索引的跳表；
+// 最后比较整数 ID 当 key 的时候，ByteArray 的跳表(key 是大端序的 8/16 个字节)和 Uint64SkipList/Uint128SkipList 的插入和查找
+#include "skiplist.h"
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>
+#include <math.h>
+using namespace table ;
+using namespace std ;
+
+static vector<string> random_keys(size_t n , size_t length) {
+    const char* charset = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz" ;
+    std::mt19937_64 mt_rand(20231017) ;
+    vector<string> keys(n) ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        keys[i].resize(length) ;
+        for(size_t j = 0 ; j < length ; ++j) {
+            keys[i][j] = charset[mt_rand() % 62] ;
+        }
+    }
+    return keys ;
+}
+
+static double elapsed_ns(const chrono::steady_clock::time_point &start) {
+    return chrono::duration<double , nano>(chrono::steady_clock::now() - start).count() ;
+}
+
+static void bench_lookup(size_t n , bool hash_index) {
+    vector<string> keys = random_keys(n , 16) ;
+    SkipList *skList = new SkipList(hash_index) ;
+
+    auto start = chrono::steady_clock::now() ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        skList->insert(keys[i] , keys[i]) ;
+    }
+    double insert_ns = elapsed_ns(start) ;
+
+    std::shuffle(keys.begin() , keys.end() , std::mt19937_64(42)) ;
+    size_t found = 0 ;
+    start = chrono::steady_clock::now() ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        found += skList->lookup(keys[i]).good() ;
+    }
+    double lookup_ns = elapsed_ns(start) ;
+
+    cout << "keys=" << n
+         << " hash_index=" << hash_index
+         << " insert=" << insert_ns / n << " ns/op"
+         << " lookup=" << lookup_ns / n << " ns/op"
+         << " found=" << found << endl ;
+
+    // 每批 BATCH 个随机 key，multi_lookup 的时间里包括了排序
+    const size_t BATCH[] = {16 , 64 , 256 , 512} ;
+    for(size_t batch : BATCH) {
+        size_t batches = n / batch ;
+        size_t loop_found = 0 , multi_found = 0 ;
+        start = chrono::steady_clock::now() ;
+        for(size_t b = 0 ; b < batches ; ++b) {
+            for(size_t i = b * batch ; i < (b + 1) * batch ; ++i) {
+                loop_found += skList->lookup(keys[i]).good() ;
+            }
+        }
+        double loop_ns = elapsed_ns(start) ;
+
+        vector<ByteArray> sorted(batch) ;
+        start = chrono::steady_clock::now() ;
+        for(size_t b = 0 ; b < batches ; ++b) {
+            for(size_t i = 0 ; i < batch ; ++i) {
+                sorted[i] = keys[b * batch + i] ;
+            }
+            std::sort(sorted.begin() , sorted.end()) ;
+            skList->multi_lookup(sorted.data() , batch , [&multi_found](size_t , const ByteArray&) { ++multi_found ; }) ;
+        }
+        double multi_ns = elapsed_ns(start) ;
+        cout << "  batch=" << batch
+             << " lookup loop=" << loop_ns / (batches * batch) << " ns/key"
+             << " multi_lookup=" << multi_ns / (batches * batch) << " ns/key"
+             << " found=" << loop_found << "/" << multi_found << endl ;
+    }
+    delete skList ;
+}
+
+// 整数按大端序写成字节，ByteArray 的字典序和整数的大小一致
+template <typename Key>
+static string big_endian(Key key) {
+    string bytes(sizeof(Key) , 0) ;
+    for(size_t i = 0 ; i < sizeof(Key) ; ++i) {
+        bytes[sizeof(Key) - 1 - i] = static_cast<char>(key >> (8 * i)) ;
+    }
+    return bytes ;
+}
+
+template <typename List , typename Key>
+static void bench_integer(size_t n , const char *label) {
+    std::mt19937_64 mt_rand(20231017) ;
+    vector<Key> ids(n) ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        ids[i] = (static_cast<Key>(mt_rand()) << 32) ^ mt_rand() ;
+    }
+    vector<string> bytes(n) ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        bytes[i] = big_endian(ids[i]) ;
+    }
+    SkipList *byte_list = new SkipList() ;
+    List *int_list = new List() ;
+
+    auto start = chrono::steady_clock::now() ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        byte_list->insert(bytes[i] , "v") ;
+    }
+    double byte_insert_ns = elapsed_ns(start) ;
+    start = chrono::steady_clock::now() ;
+    for(size_t i = 0 ; i < n ; ++i) {
+        int_list->insert(ids[i] , "v") ;
+    }
+    double int_insert_ns = elapsed_ns(start) ;
+
+    vector<size_t> order(n) ;
+    for(size_t i = 0 ; i < n ; ++i) order[i] = i ;
+    std::shuffle(order.begin() , order.end() , std::mt19937_64(42)) ;
+    size_t byte_found = 0 , int_found = 0 ;
+    start = chrono::steady_clock::now() ;
+    for(size_t i : order) {
+        byte_found += byte_list->lookup(bytes[i]).good() ;
+    }
+    double byte_lookup_ns = elapsed_ns(start) ;
+    start = chrono::steady_clock::now() ;
+    for(size_t i : order) {
+        int_found += int_list->lookup(ids[i]).good() ;
+    }
+    double int_lookup_ns = elapsed_ns(start) ;
+
+    cout << "keys=" << n << " " << label
+         << " ByteArray insert=" << byte_insert_ns / n << " ns/op lookup=" << byte_lookup_ns / n << " ns/op"
+         << " | integer insert=" << int_insert_ns / n << " ns/op lookup=" << int_lookup_ns / n << " ns/op"
+         << " memory=" << byte_list->memory_usage() / n << "/" << int_list->memory_usage() / n << " B/key"
+         << " found=" << byte_found << "/" << int_found << endl ;
+    delete int_list ;
+    delete byte_list ;
+}
+
+// 数一下比较了多少次的 uint64_t 比较器，基准测试是单线程的
+struct CountingComparator : public KeyComparator<uint64_t> {
+    static uint64_t compares ;
+    static int compare(const Stored& stored , const char *bytes , size_t size , const Probe& probe) {
+        ++compares ;
+        return KeyComparator<uint64_t>::compare(stored , bytes , size , probe) ;
+    }
+} ;
+uint64_t CountingComparator::compares = 0 ;
+
+// 往同一个跳表里一直插随机的 uint64_t key，key 数每到 10 的幂就随机查一批已有的 key；
+// 每次查找的比较次数除以 log2(n) 基本不变，就说明查找是 O(log n) 的。时间还要加上 cache miss，
+// key 多到放不进 cache 以后每一步都要访存，增长得比比较次数快；分别测 branching 为 2 和 4
+static void bench_scaling(size_t max_keys , int branching) {
+    typedef BasicSkipList<uint64_t , CountingComparator> List ;
+    List *list = new List(false , branching) ;
+    std::mt19937_64 mt_rand(20231017) ;
+    vector<uint64_t> keys ;
+    keys.reserve(max_keys) ;
+    double insert_ns = 0 ;
+    for(size_t checkpoint = 1000 ; checkpoint <= max_keys ; checkpoint *= 10) {
+        auto start = chrono::steady_clock::now() ;
+        while(keys.size() < checkpoint) {
+            keys.push_back(mt_rand()) ;
+            list->insert(keys.back() , "v") ;
+        }
+        insert_ns += elapsed_ns(start) ;
+
+        const size_t LOOKUPS = 1000000 ;
+        std::mt19937_64 pick(42) ;
+        size_t found = 0 ;
+        CountingComparator::compares = 0 ;
+        start = chrono::steady_clock::now() ;
+        for(size_t i = 0 ; i < LOOKUPS ; ++i) {
+            found += list->lookup(keys[pick() % keys.size()]).good() ;
+        }
+        double lookup_ns = elapsed_ns(start) / LOOKUPS ;
+        double compares = static_cast<double>(CountingComparator::compares) / LOOKUPS ;
+        double log_n = log2(static_cast<double>(keys.size())) ;
+        cout << "branching=" << branching
+             << " keys=" << keys.size()
+             << " insert=" << insert_ns / keys.size() << " ns/op"
+             << " lookup=" << lookup_ns << " ns/op"
+             << " compares=" << compares << " compares/log2(n)=" << compares / log_n
+             << " memory=" << list->memory_usage() / keys.size() << " B/key"
+             << " found=" << found << endl ;
+    }
+    delete list ;
+}
+
+int main(int argc , char **argv) {
+    if(argc >= 2 && string(argv[1]) == "--scaling") {
+        size_t max_keys = argc >= 3 ? strtoull(argv[2] , nullptr , 10) : 100000000 ;
+        bench_scaling(max_keys , 2) ;
+        bench_scaling(max_keys , 4) ;
+        return 0 ;
+    }
+    vector<size_t> sizes ;
+    for(int i = 1 ; i < argc ; ++i) {
+        sizes.push_back(strtoull(argv[i] , nullptr , 10)) ;
+    }
+    if(sizes.empty()) {
+        sizes = {1000000 , 10000000} ;
+    }
+    for(size_t n : sizes) {
+        bench_lookup(n , false) ;
+        bench_lookup(n , true) ;
+    }
+    for(size_t n : sizes) {
+        bench_integer<Uint64SkipList , uint64_t>(n , "uint64") ;
+        bench_integer<Uint128SkipList , __uint128_t>(n , "uint128") ;
+    }
+    return 0 ;
+}
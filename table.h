@@ -9,18 +9,89 @@
 #include <fcntl.h> // open file_fd
 #include <sys/mman.h> // mmap 
 #include <atomic> 
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 
 #include "status.h"
 #include "options.h"
 #include "byte_array.h"
+#include "memtable.h"
 #include "skiplist.h"
+#include "btree.h"
+#include "layered_memtable.h"
+#include "file_memtable.h"
+#include "run_set.h"
+#include "write_batch.h"
 #include "memory_pool.h"
 #include "hufman_code.h"
+#include "bloom_filter.h"
+#include "value_log.h"
+#include "wal.h"
+#include "checkpoint.h"
+#include "file_writer.h"
+#include "data_file.h"
 
 namespace table { 
 
 class Table {
 public : 
+    // 表在某一时刻的只读快照，读和迭代器带上它就只能看到创建快照之前写完的数据，之后的写不影响它
+    // 快照活着的时候它能看到的旧版本不会被回收，用完尽快析构；要在用它的迭代器之后、关闭表之前析构
+    class Snapshot {
+    public :
+        Snapshot(Snapshot&& other) : _memtable(other._memtable) , _seq(other._seq) { other._memtable = nullptr ; }
+        ~Snapshot() {
+            if(this->_memtable != nullptr) this->_memtable->release_snapshot(this->_seq) ;
+        }
+
+        // 表没有打开的时候创建的快照 good() 为 false
+        bool good() const               { return this->_memtable != nullptr ; }
+        uint64_t sequence() const       { return this->_seq ; }
+
+        // Non-copying
+        Snapshot(const Snapshot&) = delete ;
+        Snapshot& operator=(const Snapshot&) = delete ;
+
+    private :
+        friend class Table ;
+        Snapshot(Memtable *memtable , uint64_t seq) : _memtable(memtable) , _seq(seq) { }
+        Memtable *_memtable ;
+        uint64_t _seq ;
+    } ;
+
+    // 有序遍历表的迭代器，可以 seek 到任意 key，也可以反向遍历
+    // 和内存表的 Iterator 一样，只能在创建它的线程里使用，不要在它活着的时候关闭表；只能移动，不能拷贝
+    // 不带快照的迭代器不保证看到的是 write 之前或者之后的完整状态，需要的话用快照
+    // 表没有打开的时候返回的迭代器是空的：good() 为 false，移动什么也不做，key() 和 value() 返回空
+    class Iterator {
+    public :
+        Iterator() { }
+
+        bool good()                         { return this->_iter != nullptr && this->_iter->good() ; }
+        void next()                         { if(this->_iter != nullptr) this->_iter->next() ; }
+        void prev()                         { if(this->_iter != nullptr) this->_iter->prev() ; }
+        void seek(const ByteArray& key)     { if(this->_iter != nullptr) this->_iter->seek(key) ; }
+        void seek_to_first()                { if(this->_iter != nullptr) this->_iter->seek_to_first() ; }
+        void seek_to_last()                 { if(this->_iter != nullptr) this->_iter->seek_to_last() ; }
+        ByteArray key()                     { return this->_iter != nullptr ? this->_iter->key() : ByteArray() ; }
+        // 存在 value log 里的 value 读出来放在迭代器里，下一次调用 value() 之前有效；读失败的话返回空
+        ByteArray value() ;
+        // good() 为 false 以后看是走到头了还是数据文件坏了提前停下(io_error)
+        Status status()                     { return this->_iter != nullptr ? this->_iter->status() : Status::ok() ; }
+
+    private :
+        friend class Table ;
+        Iterator(std::unique_ptr<Memtable::Iterator> &&iter , const ValueLog *value_log) :
+            _iter(std::move(iter)) , _value_log(value_log) { }
+        std::unique_ptr<Memtable::Iterator> _iter ;
+        const ValueLog *_value_log ;
+        std::string _large_value ;
+    } ;
+
     // 打开文件名为 filename 的文件  
     Table(const Options& option , const std::string &filename) ; 
     
@@ -32,11 +103,20 @@ public :
     // 关闭文件
     Status close();
 
-    // 可持久化文件
+    // 可持久化文件；打开 Options::background_dump 的时候只冻结内存表就返回，文件由后台线程写
+    // 打开 Options::lsm 的时候把内存表写成一个新的 run，写满写缓冲的时候写操作也会自己调用它
     Status dump();
 
-    // get key 
-    Status get(const ByteArray& key, std::string* value);
+    // 等后台的 dump 写完，返回它的结果，没有后台 dump 的话返回 ok
+    Status wait_dump();
+
+    // 打开 Options::lsm 的时候，等合并的线程把要合并的层都合并完，返回并清掉上一次合并的错误；不等还在后台 flush 的 dump
+    // 合并失败不会丢数据，只是 run 没有合并，下一次 flush 以后再试
+    Status wait_compaction();
+
+    // get key，snapshot 不为空时读快照里的值，下面几个读操作的 snapshot 也一样
+    // 从 mmap_reads 或者 lsm 的数据文件里读到坏了的块返回 io_error，multi_get 也一样
+    Status get(const ByteArray& key, std::string* value, const Snapshot* snapshot = nullptr);
 
     // put "key" to "value".
     Status put(const ByteArray& key, const ByteArray& value);
@@ -44,24 +124,146 @@ public :
     // delete key 如果 key 存在的话
     Status del(const ByteArray& key);
 
+    // 原子地写入一批 put/del：整批写完之前，get/multi_get/scan 看不到其中任何一条
+    // 有一条不合法的话整批都不写；批里删除不存在的 key 不算错误
+    Status write(const WriteBatch& batch);
+
+    // 批量 get，(*values)[i] 和 (*statuses)[i] 是 keys[i] 的结果，没找到的 key 对应 Status::not_found()
+    // sort_keys 为 true 时先把 keys 排好序再查，批量比较大的时候相邻的 key 可以复用查找路径；
+    // keys 本来就有序或者批量很小的时候可以传 false 省掉排序
+    Status multi_get(const std::vector<ByteArray>& keys, std::vector<std::string>* values,
+                     std::vector<Status>* statuses, bool sort_keys = true, const Snapshot* snapshot = nullptr);
+
+    // 新建一个指向第一个 key 的迭代器，表没有打开的话返回的迭代器 good() 为 false
+    Iterator new_iterator(const Snapshot* snapshot = nullptr);
+
+    // 按顺序取出 [begin, end) 范围内的最多 limit 个键值对，begin 为空表示从头开始，end 为空表示不设上界，limit 为 0 表示不限
+    // 不传 snapshot 的话在内部建一个快照，扫描的时候不挡写，也不会看到写了一半的 WriteBatch
+    Status scan(const ByteArray& begin, const ByteArray& end, size_t limit,
+                std::vector<std::pair<std::string, std::string>>* result, const Snapshot* snapshot = nullptr);
+
+    // 按顺序取出所有以 prefix 开头的最多 limit 个键值对
+    Status scan_prefix(const ByteArray& prefix, size_t limit,
+                       std::vector<std::pair<std::string, std::string>>* result, const Snapshot* snapshot = nullptr);
+
+    // 创建一个快照，不会看到写了一半的 WriteBatch
+    Snapshot snapshot();
+
+    // 过滤器的统计，没有用过滤器的话都是 0
+    FilterStats filter_stats() const;
+
     // Non-copying
     Table(const Table&) = delete ;
     Table& operator=(const Table&) = delete ;
 
 private : 
     std::atomic<bool> _is_closed ; 
+    // 同一时间只有一个 WriteBatch 在写；一批写用内存表的一个 Writer 写，Writer 析构的时候整批一起发布，读不用等它
+    std::mutex _write_mutex ;
     const std::string &_file_name ; 
     const Options& _options ;  
-    SkipList *_skiplist ; 
+    // Options::memtable 选的内存表，打开 Options::background_dump、Options::mmap_reads 或者 Options::lsm 的时候是 _layered
+    Memtable *_memtable ; 
+    // Options::background_dump、Options::mmap_reads 和 Options::lsm 都是 false 的时候是 nullptr；lsm 的时候 base 是 RunSet
+    LayeredMemtable *_layered ;
+    // 后台 dump 的线程和它的结果；dump 和 wait_dump 互斥，lsm 的写操作也会发起 dump
+    std::mutex _dump_mutex ;
+    std::thread _dump_thread ;
+    Status _dump_status ;
+    // 后台 dump 的线程还没做完，lsm 的写操作不用等它
+    std::atomic<bool> _dump_running ;
+    // 打开 Options::lsm 的时候合并 run 的线程：flush 以后叫醒它，它一直合并到没有要合并的层，写操作不会等它
+    // flush 和合并换 base 的时候都拿着 _runs_mutex，合并写文件的时候 flush 换了 base 的话，合并好的结果放到新的 base 上
+    std::mutex _runs_mutex ;
+    std::mutex _compaction_mutex ;
+    std::condition_variable _compaction_cv ;
+    std::thread _compaction_thread ;
+    bool _compaction_pending ;
+    bool _compaction_running ;
+    bool _compaction_stop ;
+    Status _compaction_status ;
     HuffmanTree *_HufTree ; 
+    // Options::value_log_threshold 为 0、也没有以前留下的日志文件的时候是 nullptr
+    ValueLog *_value_log ;
+    // Options::filter_expected_keys 为 0 或者打开 Options::lsm 的时候是 nullptr，lsm 的每个 run 有自己的过滤器
+    // 不带快照的读先查它，它说不存在就不用查内存表；快照里的数据可能已经从过滤器里删掉了，带快照的读不查它
+    CountingBloomFilter *_filter ;
+    // Options::write_ahead_log 为 false 的时候是 nullptr
+    WriteAheadLog *_wal ;
+    // Options::incremental_dump 为 false 或者打开 Options::lsm 的时候是 nullptr
+    DirtyKeys *_dirty ;
+    // 基础文件的大小和 crc32c，增量文件要记着它们；基础文件上已经有的增量文件个数和总大小
+    uint64_t _base_size ;
+    uint32_t _base_crc ;
+    size_t _delta_count ;
+    uint64_t _delta_bytes ;
+
+
+    // 内存表里存的 value：前面加一个类型字节，大的 value 先追加到 value log，存它的引用
+    Status encode_value(const ByteArray& value, std::string* stored) ;
+    // 把内存表里读出来的 value 原地还原成用户的 value
+    Status decode_value(std::string* value) const ;
+    // put/del 写内存表和过滤器，写日志的时候由组提交的线程调用，重放日志的时候也用它们
+    void apply_put(const ByteArray& key, const ByteArray& stored) ;
+    bool apply_del(const ByteArray& key) ;
+    // 先把 record 追加到预写日志里，再调用 apply 写内存表
+    Status commit(const std::string& record, const std::function<void()>& apply) ;
+    // 把日志文件里的写重放到内存表里，文件不存在的话什么也不做
+    Status replay_log(const std::string& log_name) ;
+    // 应用一串预写日志格式的操作，日志记录和增量文件里存的都是它
+    bool apply_ops(const ByteArray& ops) ;
+    // 加载以前的格式的数据文件：entry 一个接一个，没有索引，编码表在 ".huffman_code" 文件里；append 返回 false 就停下
+    Status load_legacy(const char *data , uint64_t size ,
+                       const std::function<bool(const std::string&, const std::string&)>& append) ;
+    // 按 Options::memtable 新建一个内存表
+    Memtable* new_memtable() const ;
+    // dump 和 wait_dump 的实现，调用的时候拿着 _dump_mutex
+    Status start_dump() ;
+    Status join_dump() ;
+    // 打开 Options::lsm 的时候 dump 做的事：把 frozen 写成一个新的 run 换掉它，成功以后删掉换下来的日志，再叫醒合并的线程
+    Status flush_runs(bool has_log) ;
+    // 合并的线程：等 flush 叫醒它，合并失败的话记下错误，等下一次 flush 再试
+    void compaction_loop() ;
+    // 一次合并一层，一直合并到没有要合并的层或者要停下来
+    Status compact_runs() ;
+    // 叫醒合并的线程；停下合并的线程，正在做的合并做完才返回
+    void schedule_compaction() ;
+    void stop_compaction() ;
+    // 打开 Options::lsm 的时候，active 写满了 Options::write_buffer_size 就发起一次 dump；已经有人在 dump 的话不用等
+    Status maybe_flush() ;
+    // 换下来的日志里的写都已经落盘了，删掉它们
+    void remove_dumped_logs() ;
+    // 把快照写成基础文件或者增量文件，成功以后删掉换下来的日志；失败的话把 dirty_keys 放回去
+    Status finish_dump(const Snapshot& snapshot, const std::vector<std::string>& dirty_keys, bool has_log) ;
+    // 把快照写成完整的基础文件，成功以后删掉所有增量文件
+    Status dump_full(const Snapshot& snapshot) ;
+    // 把 keys 在快照里的样子写成下一个增量文件
+    Status dump_delta(const Snapshot& snapshot, const std::vector<std::string>& keys) ;
+    // 检查一条 put 能不能写
+    Status check_entry(const ByteArray& key, const ByteArray& value) const ;
+    // multi_get 找到的 value 查完以后再还原
+    void decode_values(const std::vector<size_t>& order, std::vector<std::string>* values,
+                       std::vector<Status>* statuses) const ;
 }; 
  
 Table::Table(const Options& option , const std::string &filename) : 
-    _is_closed(true) , _file_name(filename) , _options(option) , 
-    _skiplist(nullptr) , _HufTree(nullptr) { } // 跳表 和 哈弗曼树的创建在成功 open 之后
+    _is_closed(true) , _file_name(filename) , _options(option) ,
+    _memtable(nullptr) , _layered(nullptr) , _dump_running(false) ,
+    _compaction_pending(false) , _compaction_running(false) , _compaction_stop(true) ,
+    _HufTree(nullptr) , _value_log(nullptr) , _filter(nullptr) , _wal(nullptr) , _dirty(nullptr) ,
+    _base_size(0) , _base_crc(0) , _delta_count(0) , _delta_bytes(0) { } // 内存表、哈弗曼树、value log、过滤器和日志的创建在成功 open 之后
 
 Table::~Table(){
     this->close() ; 
+    // close 失败的话合并的线程还在，先停下它
+    this->stop_compaction() ;
+    // open 失败的话 close 什么也不做，open 到一半建好的东西在这里释放
+    delete this->_memtable ; 
+    delete this->_HufTree ; 
+    delete this->_filter ; 
+    delete this->_wal ; 
+    delete this->_dirty ; 
+    delete this->_value_log ; 
 }
 
 Status Table::open() {
@@ -69,6 +271,11 @@ Status Table::open() {
     if(!this->_is_closed) { 
         return Status::invalid_operation("Table was already open") ; 
     }
+    // 跳表按 branching 的二进制位数取随机层数，不是 2 的幂的话层数的分布就不对了
+    const int branching = this->_options.skiplist_branching ;
+    if(branching < 2 || (branching & (branching - 1)) != 0) {
+        return Status::invalid_operation("skiplist_branching must be a power of two no less than 2") ;
+    }
 
     struct stat info ; 
     bool table_exist = stat(this->_file_name.data() , &info) == 0 ;
@@ -92,27 +299,36 @@ Status Table::open() {
     if(table_exist && this->_options.error_if_exists) { 
         return Status::io_error(this->_file_name + " open file error");
     }
-     
-    // if (info.st_size > _options.max_file_size) {
-    //     return Status::io_error("file " + std::string(this->_file_name.data()) + " is too large, "
-    //                                 "max file size " + std::to_string(_options.max_file_size));
-    // }
 
-    // new SkipList
-    if(this->_skiplist == nullptr) {
-        this->_skiplist = new SkipList() ; 
+    // new Memtable
+    if(this->_memtable == nullptr) {
+        if(this->_options.background_dump || this->_options.mmap_reads || this->_options.lsm) {
+            this->_layered = new LayeredMemtable([this]() { return this->new_memtable() ; }) ;
+            this->_memtable = this->_layered ;
+        } else {
+            this->_memtable = this->new_memtable() ;
+        }
     }
     // new HuffmanTree 
     if(this->_HufTree == nullptr) {
         this->_HufTree = new HuffmanTree() ; 
     }
+    // new filter
+    if(this->_filter == nullptr && this->_options.filter_expected_keys > 0 && !this->_options.lsm) {
+        this->_filter = new CountingBloomFilter(this->_options.filter_expected_keys , this->_options.filter_counters_per_key) ;
+    }
+    // new ValueLog，数据文件里可能有以前写的引用，日志文件存在的话不管阈值是多少都要打开
+    std::string value_log_name = this->_file_name + VALUE_LOG_FILE_EXT ;
+    struct stat value_log_info ;
+    if(this->_value_log == nullptr &&
+       (this->_options.value_log_threshold > 0 || stat(value_log_name.data() , &value_log_info) == 0)) {
+        this->_value_log = new ValueLog() ;
+        if(this->_value_log->open(value_log_name.data()) == false) {
+            return Status::io_error("open " + value_log_name + " error, " + strerror(errno));
+        }
+    }
 
     if (info.st_size > 0) {// read data
-        // std::cout<<info.st_size<<std::endl ;
-        if(this->_HufTree->decrypt_File(std::string(this->_file_name + TARGETCODE_FILE_EXT).data()) == false) {
-            return Status::io_error(this->_file_name + TARGETCODE_FILE_EXT + " open huffman code file error");
-        } 
-
         auto munmap_func = [&info](char *data){
             if(data != MAP_FAILED){
                 munmap(data , info.st_size) ; 
@@ -126,35 +342,139 @@ Status Table::open() {
             return Status::io_error("mmap " + std::string(this->_file_name.data()) + " error, " + strerror(errno));
         }
 
-        // +--------------------Entry----------------------+
-        // | length of key | key | length of value | value |
-        // +-----------------------------------------------+
-        off_t offset = 0 ; 
-        while(true) {
-            std::string key_str , value_str ; 
-
-            if(info.st_size - offset >= static_cast<off_t>(sizeof(uint8_t))) { // 判断是否还有 key-value 
-                uint16_t key_size = *reinterpret_cast<uint8_t*>(data.get() + offset++) ; // 读取 length of key bits 
-                key_str = this->_HufTree->read_string(data , offset , key_size) ; 
-                offset = offset + key_size ; 
-                uint8_t value_size = *reinterpret_cast<uint8_t*>(data.get() + offset++) ;
-                value_str = this->_HufTree->read_string(data , offset , value_size) ; 
-                offset = offset + value_size ;
-            }
-            if(key_str.size() == 0) {
-                break ; 
+        // 和数据文件一起保存的过滤器能用就直接加载，不能用的话边加载数据边重新建
+        uint64_t filter_keys = 0 ;
+        bool filter_loaded = this->_filter != nullptr &&
+            this->_filter->load(std::string(this->_file_name + FILTER_FILE_EXT).data() , info.st_size , &filter_keys) ;
+        uint64_t keys = 0 ;
+
+        // dump 是按内存表的顺序写的，文件里的 key 本来就是有序的，直接按顺序追加
+        std::unique_ptr<Memtable::Builder> builder = this->_memtable->new_builder() ;
+        const Status corrupted = Status::io_error(this->_file_name + " is corrupted") ;
+        Status s = Status::ok() ;
+        auto append = [&](const std::string& key_str , const std::string& value_str) {
+            if(value_str[0] == VALUE_LOG_REF && this->_value_log == nullptr) {
+                s = corrupted ;
+                return false ;
             }
-            //std::cout<<key_str<<" "<<value_str<<std::endl ; 
-            auto result = this->_skiplist->insert(key_str , value_str) ; 
-            if(result.good() == false){
-                return Status::invalid_operation(
-                    "insert fail , maybe duplicate key = " + key_str + "value = " + value_str
+            if(builder->append(key_str , value_str) == false){
+                s = Status::invalid_operation(
+                    "insert fail , maybe duplicate or unsorted key = " + key_str + "value = " + value_str
                 ) ;
+                return false ;
+            }
+            ++keys ;
+            if(this->_filter != nullptr && !filter_loaded) {
+                this->_filter->add(key_str) ;
+            }
+            return true ;
+        } ;
+        if(RunSet::is_manifest(data.get() , info.st_size)) {
+            // 表的文件是 LSM 的清单，数据都在 run 文件里，只打开它们的索引和过滤器
+            if(!this->_options.lsm) {
+                return Status::invalid_operation(this->_file_name + " is an LSM table, open it with Options::lsm") ;
+            }
+            std::unique_ptr<RunSet> runs(new RunSet(this->_file_name , this->_options)) ;
+            if(runs->open(data.get() , info.st_size) == false) {
+                return corrupted ;
+            }
+            this->_layered->set_base(runs.release()) ;
+        } else if(this->_options.mmap_reads && !this->_options.lsm && DataFileReader::is_block_format(data.get() , info.st_size)) {
+            // 不加载，数据文件直接当 base，用到的块才解码；只有过滤器要重建的时候才读一遍整个文件
+            std::unique_ptr<FileMemtable> file(new FileMemtable()) ;
+            if(file->open(this->_file_name) == false) {
+                return corrupted ;
+            }
+            keys = file->entries() ;
+            if(this->_filter != nullptr && !filter_loaded) {
+                for(auto iter = file->new_iterator() ; iter->good() ; iter->next()) {
+                    this->_filter->add(iter->key()) ;
+                }
+            }
+            this->_layered->set_base(file.release()) ;
+        } else if(DataFileReader::is_block_format(data.get() , info.st_size)) {
+            // 格式见 data_file.h，几个线程分段解码，按顺序追加
+            DataFileReader reader ;
+            if(reader.open(data.get() , info.st_size) == false) {
+                return corrupted ;
+            }
+            size_t threads = this->_options.load_threads ;
+            if(threads == 0) {
+                threads = std::max(std::thread::hardware_concurrency() , 1u) ;
+            }
+            if(reader.read_blocks(threads , append) == false) {
+                return s.good() ? corrupted : s ;
             }
+        } else {
+            // 以前的格式，编码表在单独的文件里
+            Status legacy = this->load_legacy(data.get() , info.st_size , append) ;
+            if(!legacy.good()) {
+                return s.good() ? legacy : s ;
+            }
+        }
+        // BTree 的 Builder 一直拿着写锁，先释放再遍历
+        builder.reset() ;
+        // 文件大小对得上但是 key 数对不上，说明过滤器文件不是这份数据的，重新建
+        if(filter_loaded && filter_keys != keys) {
+            this->_filter->clear() ;
+            for(auto iter = this->_memtable->new_iterator() ; iter->good() ; iter->next()) {
+                this->_filter->add(iter->key()) ;
+            }
+        }
+    }
+    // 还没有 run 的 LSM 表从空的 RunSet 开始，以前的数据文件已经加载进了 active，下一次 dump 写成第一个 run
+    if(this->_options.lsm && this->_layered->base() == nullptr) {
+        this->_layered->set_base(new RunSet(this->_file_name , this->_options)) ;
+    }
+
+    // 在基础文件上依次应用增量文件，到第一个不存在或者不是基于这个基础文件的为止
+    // mmap_reads 和 lsm 的时候 dump 总是写完整的文件，没有增量文件就不用读一遍基础文件算校验和
+    const bool incremental = this->_options.incremental_dump && !this->_options.mmap_reads && !this->_options.lsm ;
+    this->_base_size = this->_base_crc = 0 ;
+    this->_delta_count = this->_delta_bytes = 0 ;
+    struct stat delta_info ;
+    if(incremental || stat(DeltaFile::name(this->_file_name , 1).data() , &delta_info) == 0) {
+        if(!DeltaFile::checksum(this->_file_name , &this->_base_size , &this->_base_crc)) {
+            return Status::io_error("read " + this->_file_name + " error, " + strerror(errno)) ;
+        }
+        std::string ops ;
+        while(DeltaFile::load(DeltaFile::name(this->_file_name , this->_delta_count + 1) , this->_base_size , this->_base_crc , &ops)) {
+            if(!this->apply_ops(ops)) {
+                return Status::io_error(DeltaFile::name(this->_file_name , this->_delta_count + 1) + " is corrupted") ;
+            }
+            ++this->_delta_count ;
+            this->_delta_bytes += ops.size() ;
         }
     }
-    _is_closed = false;
-    return Status::ok();
+    // 从这里开始的写都要记下来，日志里重放回来的写也是
+    if(this->_dirty == nullptr && incremental) {
+        this->_dirty = new DirtyKeys() ;
+    }
+
+    // 重放上次 dump 之后的写：先是上次 dump 失败留下的旧日志，再是当前的日志
+    for(const char *ext : {WAL_OLD_FILE_EXT , WAL_FILE_EXT}) {
+        Status s = this->replay_log(this->_file_name + ext) ;
+        if(!s.good()) {
+            return s ;
+        }
+    }
+    if(this->_wal == nullptr && this->_options.write_ahead_log) {
+        this->_wal = new WriteAheadLog() ;
+        if(!this->_wal->open(std::string(this->_file_name + WAL_FILE_EXT).data() , this->_options.wal_sync ,
+                             this->_options.wal_sync_interval_ms , this->_value_log)) {
+            return Status::io_error("open " + this->_file_name + WAL_FILE_EXT + " error, " + strerror(errno)) ;
+        }
+    }
+    // 上次没合并完的层打开以后接着合并
+    if(this->_options.lsm) {
+        this->_compaction_pending = true ;
+        this->_compaction_running = false ;
+        this->_compaction_stop = false ;
+        this->_compaction_status = Status::ok() ;
+        this->_compaction_thread = std::thread(&Table::compaction_loop , this) ;
+    }
+    this->_is_closed = false ;
+    return Status::ok() ;
 }
 
 Status Table::close() {
@@ -162,110 +482,887 @@ Status Table::close() {
         return Status::invalid_operation("Table is closed") ; 
     }
 
+    // 先等后台的 dump 写完；它失败了的话，没写出去的数据还在内存表里，下面的 dump 会再写一次；
+    // 不在关闭的时候 dump 的话就没人再写它了，返回它的错误，表不关，还可以再 dump 一次
+    Status pending = this->wait_dump() ;
+    if(!pending.good() && !this->_options.dump_when_close) {
+        return pending ;
+    }
     if(this->_options.dump_when_close){
         Status s = this->dump() ; 
+        if(s.good()) {
+            s = this->wait_dump() ;
+        }
         if(!s.good()) {
-            return s; 
+            return s ; 
         }
     }
-    delete this->_skiplist ; this->_skiplist = nullptr ; 
+    // 合并只是重新组织已经落盘的 run，做到一半的留到下次打开
+    this->stop_compaction() ;
+    delete this->_memtable ; this->_memtable = nullptr ; this->_layered = nullptr ; 
     delete this->_HufTree ; this->_HufTree = nullptr ; 
+    delete this->_filter ; this->_filter = nullptr ; 
+    delete this->_wal ; this->_wal = nullptr ; 
+    delete this->_dirty ; this->_dirty = nullptr ; 
+    delete this->_value_log ; this->_value_log = nullptr ; 
     this->_is_closed = true ; 
     return Status::ok() ; 
 }
 
+Status Table::load_legacy(const char *data , uint64_t size ,
+                          const std::function<bool(const std::string& , const std::string&)>& append) {
+    if(this->_HufTree->decrypt_File(std::string(this->_file_name + TARGETCODE_FILE_EXT).data()) == false) {
+        return Status::io_error(this->_file_name + TARGETCODE_FILE_EXT + " open huffman code file error") ;
+    } 
+    const char *limit = data + size ;
+    const Status corrupted = Status::io_error(this->_file_name + " is corrupted") ;
+    uint64_t offset = 0 ; 
+    while(offset < size) { // 判断是否还有 key-value 
+        std::string key_str , value_str ; 
+
+        // +----------------------------------Entry-------------------------------------+
+        // | varint 长度 | key | INLINE_VALUE | varint 长度 | value |                      |
+        // | varint 长度 | key | VALUE_LOG_REF | varint 偏移 | varint 长度 |               |
+        // +----------------------------------------------------------------------------+
+        // 长度是哈夫曼编码以后的字节数，value log 的引用不编码
+        uint64_t key_size , value_size ;
+        int n = decode_varint(data + offset , limit , &key_size) ;
+        if(n == 0 || key_size >= size - offset - n) {
+            return corrupted ;
+        }
+        offset += n ;
+        if(this->_HufTree->decode_string(data + offset , key_size , &key_str) == false) {
+            return corrupted ;
+        }
+        offset = offset + key_size ; 
+        char type = data[offset] ;
+        if(type == INLINE_VALUE) {
+            n = decode_varint(data + offset + 1 , limit , &value_size) ;
+            if(n == 0 || value_size > size - offset - 1 - n) {
+                return corrupted ;
+            }
+            offset += 1 + n ;
+            value_str.push_back(INLINE_VALUE) ;
+            if(this->_HufTree->decode_string(data + offset , value_size , &value_str) == false) {
+                return corrupted ;
+            }
+            offset = offset + value_size ;
+        } else if(type == VALUE_LOG_REF) {
+            // 引用原样放进内存表
+            uint64_t unused ;
+            int a = decode_varint(data + offset + 1 , limit , &unused) ;
+            int b = a == 0 ? 0 : decode_varint(data + offset + 1 + a , limit , &unused) ;
+            if(b == 0) {
+                return corrupted ;
+            }
+            value_str.assign(data + offset , 1 + a + b) ;
+            offset += 1 + a + b ;
+        } else {
+            return corrupted ;
+        }
+        if(append(key_str , value_str) == false) {
+            return Status::invalid_operation() ;
+        }
+    }
+    return Status::ok() ;
+}
+
 Status Table::dump() {
      
     if(this->_is_closed){
-        return Status::invalid_operation("Table is closed");
+        return Status::invalid_operation("Table is closed") ;
     }
-     
-    for(auto iter = this->_skiplist->begin() ;  iter.good() ; iter.next() ) {
+    std::lock_guard<std::mutex> lock(this->_dump_mutex) ;
+    return this->start_dump() ;
+}
+
+Status Table::start_dump() {
+    // 后台 dump 一次只有一个，先等上一个写完
+    if(this->_layered != nullptr) {
+        Status s = this->join_dump() ;
+        if(!s.good()) {
+            return s ;
+        }
+        // base 是只读的数据文件或者 RunSet 的时候，上一次 dump 失败了的话 frozen 还在，先把它写出去，不然冻结不了新的 active
+        if(this->_options.lsm && this->_layered->has_frozen()) {
+            s = this->flush_runs(false) ;
+        } else if(this->_options.mmap_reads && this->_layered->has_frozen()) {
+            Snapshot snapshot(this->_layered , this->_layered->acquire_frozen_snapshot()) ;
+            s = this->finish_dump(snapshot , {} , false) ;
+        }
+        if(!s.good()) {
+            return s ;
+        }
+    }
+
+    // 开了预写日志的话换日志和建快照一起做：换下来的日志里的写都在快照里，之后的写都记在新日志里
+    // 增量 dump 先取出改过的 key 再建快照，取出之后才写完的 key 留到下一次
+    // 后台 dump 不建快照，冻结内存表：冻结之前的写都在冻结的内存表和 base 里，之后的写都在新的 active 里
+    std::unique_ptr<Snapshot> snapshot ;
+    std::vector<std::string> dirty_keys ;
+    auto take_snapshot = [&]() {
+        if(this->_dirty != nullptr) {
+            dirty_keys = this->_dirty->take() ;
+        }
+        if(this->_layered != nullptr) {
+            this->_layered->freeze() ;
+        } else {
+            snapshot.reset(new Snapshot(this->snapshot())) ;
+        }
+    } ;
+    const std::string log_name = this->_file_name + WAL_FILE_EXT ;
+    const std::string old_log_name = this->_file_name + WAL_OLD_FILE_EXT ;
+    bool rotated = true ;
+    if(this->_wal != nullptr) {
+        rotated = this->_wal->rotate(old_log_name.data() , take_snapshot) ;
+    } else {
+        take_snapshot() ;
+    }
+    struct stat log_info ;
+    bool has_log = this->_wal != nullptr || stat(old_log_name.data() , &log_info) == 0 || stat(log_name.data() , &log_info) == 0 ;
+    if(!rotated) {
+        for(const std::string& key : dirty_keys) {
+            this->_dirty->add(key) ;
+        }
+        dirty_keys.clear() ;
+    }
+
+    if(this->_layered != nullptr) {
+        // 冻结的内存表总要合并进 base；换日志失败的话不写文件，换下来的日志留到下一次 dump
+        // base 是只读的数据文件的话不能合并，只能把 frozen 和 base 写成新的数据文件再去掉 frozen，换日志失败的话只是不删日志
+        auto job = [this , rotated , has_log , keys = std::move(dirty_keys)]() {
+            if(this->_options.lsm) {
+                this->_dump_status = this->flush_runs(rotated && has_log) ;
+                return ;
+            }
+            if(this->_options.mmap_reads) {
+                Snapshot snapshot(this->_layered , this->_layered->acquire_frozen_snapshot()) ;
+                this->_dump_status = this->finish_dump(snapshot , keys , rotated && has_log) ;
+                return ;
+            }
+            this->_layered->merge_frozen() ;
+            if(rotated) {
+                Memtable *base = this->_layered->base() ;
+                Snapshot snapshot(base , base->acquire_snapshot()) ;
+                this->_dump_status = this->finish_dump(snapshot , keys , has_log) ;
+            }
+        } ;
+        if(this->_options.background_dump) {
+            this->_dump_running = true ;
+            this->_dump_thread = std::thread([this , job = std::move(job)]() {
+                job() ;
+                this->_dump_running = false ;
+            }) ;
+        } else {
+            job() ;
+            Status s = this->join_dump() ;
+            if(!s.good()) {
+                return s ;
+            }
+        }
+    } else if(rotated) {
+        return this->finish_dump(*snapshot , dirty_keys , has_log) ;
+    }
+    if(!rotated) {
+        return Status::io_error("rotate " + log_name + " error, " + strerror(errno)) ;
+    }
+    return Status::ok() ;
+}
+
+Status Table::wait_dump() {
+    std::lock_guard<std::mutex> lock(this->_dump_mutex) ;
+    return this->join_dump() ;
+}
+
+Status Table::join_dump() {
+    if(this->_dump_thread.joinable()) {
+        this->_dump_thread.join() ;
+    }
+    Status s = this->_dump_status ;
+    this->_dump_status = Status::ok() ;
+    return s ;
+}
+
+Status Table::finish_dump(const Snapshot& snapshot , const std::vector<std::string>& dirty_keys , bool has_log) {
+    // 增量文件攒够了 Options::max_delta_files 个，或者加起来比基础文件还大的时候，重写一遍基础文件
+    // base 是只读的数据文件的时候，frozen 要写进新的数据文件才能去掉，总是重写(这时候 open 不建 _dirty)
+    bool incremental = this->_dirty != nullptr &&
+                       this->_delta_count < this->_options.max_delta_files && this->_delta_bytes < this->_base_size ;
+    Status s = incremental ? this->dump_delta(snapshot , dirty_keys) : this->dump_full(snapshot) ;
+    if(!s.good()) {
+        // 没写出去的 key 放回去，下一次 dump 还要写
+        for(const std::string& key : dirty_keys) {
+            this->_dirty->add(key) ;
+        }
+        return s ;
+    }
+    if(this->_options.mmap_reads) {
+        // 新的数据文件里已经有 frozen 和 base 的全部数据，之后读新文件
+        std::unique_ptr<FileMemtable> file(new FileMemtable()) ;
+        if(!file->open(this->_file_name)) {
+            return Status::io_error("open " + this->_file_name + " error, " + strerror(errno)) ;
+        }
+        this->_layered->replace_frozen(file.release()) ;
+    }
+
+    if(has_log) {
+        this->remove_dumped_logs() ;
+    }
+    return Status::ok() ;
+}
+
+void Table::remove_dumped_logs() {
+    // 没开日志的话，open 时重放过的日志也都在这次 dump 里了
+    remove(std::string(this->_file_name + WAL_OLD_FILE_EXT).data()) ;
+    if(this->_wal == nullptr) {
+        remove(std::string(this->_file_name + WAL_FILE_EXT).data()) ;
+    }
+}
 
-        if(this->_HufTree->insert_word(iter.key()) == false ){
-            return Status::invalid_operation("Huffman Tree insert key word fail " + *iter.key().data()) ;
+Status Table::flush_runs(bool has_log) {
+    Memtable *frozen = this->_layered->wait_frozen() ;
+    if(frozen != nullptr) {
+        // run 引用的 value 要先落盘
+        if(this->_value_log != nullptr && this->_value_log->sync() == false) {
+            return Status::io_error("sync " + this->_file_name + VALUE_LOG_FILE_EXT + " error, " + strerror(errno)) ;
+        }
+        // 合并的线程也会换 base，拿着锁在最新的 RunSet 上加 run
+        std::lock_guard<std::mutex> lock(this->_runs_mutex) ;
+        RunSet *runs = static_cast<RunSet*>(this->_layered->base()) ;
+        RunSet *next = nullptr ;
+        Status s = runs->flush(frozen , &next) ;
+        if(!s.good()) {
+            return s ;
+        }
+        this->_layered->replace_frozen(next) ;
+    }
+    if(has_log) {
+        this->remove_dumped_logs() ;
+    }
+    this->schedule_compaction() ;
+    return Status::ok() ;
+}
+
+void Table::compaction_loop() {
+    std::unique_lock<std::mutex> lock(this->_compaction_mutex) ;
+    while(true) {
+        this->_compaction_cv.wait(lock , [this]() { return this->_compaction_pending || this->_compaction_stop ; }) ;
+        if(this->_compaction_stop) {
+            return ;
+        }
+        this->_compaction_pending = false ;
+        this->_compaction_running = true ;
+        lock.unlock() ;
+        Status s = this->compact_runs() ;
+        lock.lock() ;
+        this->_compaction_running = false ;
+        if(!s.good()) {
+            this->_compaction_status = s ;
+        }
+        this->_compaction_cv.notify_all() ;
+    }
+}
+
+Status Table::compact_runs() {
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(this->_compaction_mutex) ;
+            if(this->_compaction_stop) {
+                return Status::ok() ;
+            }
+        }
+        // 拿着挑输入的时候的 RunSet，写文件的时候不拿锁，flush 可以同时往 L0 里加 run
+        std::shared_ptr<Memtable> base = this->_layered->shared_base() ;
+        RunSet::Compaction c ;
+        if(!static_cast<RunSet*>(base.get())->pick_compaction(&c)) {
+            return Status::ok() ;
+        }
+        Status s = static_cast<RunSet*>(base.get())->compact(&c) ;
+        if(!s.good()) {
+            return s ;
+        }
+        std::lock_guard<std::mutex> lock(this->_runs_mutex) ;
+        RunSet *next = nullptr ;
+        s = static_cast<RunSet*>(this->_layered->base())->apply(c , &next) ;
+        if(!s.good()) {
+            return s ;
+        }
+        this->_layered->replace_base(next) ;
+    }
+}
+
+void Table::schedule_compaction() {
+    std::lock_guard<std::mutex> lock(this->_compaction_mutex) ;
+    this->_compaction_pending = true ;
+    this->_compaction_cv.notify_all() ;
+}
+
+void Table::stop_compaction() {
+    if(!this->_compaction_thread.joinable()) {
+        return ;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->_compaction_mutex) ;
+        this->_compaction_stop = true ;
+        this->_compaction_cv.notify_all() ;
+    }
+    this->_compaction_thread.join() ;
+}
+
+Status Table::wait_compaction() {
+    std::unique_lock<std::mutex> lock(this->_compaction_mutex) ;
+    this->_compaction_cv.wait(lock , [this]() {
+        return this->_compaction_stop || (!this->_compaction_pending && !this->_compaction_running) ;
+    }) ;
+    Status s = this->_compaction_status ;
+    this->_compaction_status = Status::ok() ;
+    return s ;
+}
+
+Status Table::maybe_flush() {
+    if(!this->_options.lsm || this->_options.write_buffer_size == 0 ||
+       this->_layered->active_memory_usage() < this->_options.write_buffer_size) {
+        return Status::ok() ;
+    }
+    // 后台还在 flush 上一个写缓冲的话不等它，接着写 active，它做完以后的写再发起 dump
+    if(this->_dump_running) {
+        return Status::ok() ;
+    }
+    std::unique_lock<std::mutex> lock(this->_dump_mutex , std::try_to_lock) ;
+    // 别的线程正在发起 dump，它冻结以后 active 就是空的了
+    if(!lock.owns_lock() || this->_layered->active_memory_usage() < this->_options.write_buffer_size) {
+        return Status::ok() ;
+    }
+    return this->start_dump() ;
+}
+
+Memtable* Table::new_memtable() const {
+    switch(this->_options.memtable) {
+    case MemtableType::BTREE :
+        return new BTree() ;
+    default :
+        return new SkipList(this->_options.hash_index , this->_options.skiplist_branching) ;
+    }
+}
+
+Status Table::dump_full(const Snapshot& snapshot) {
+    // 两遍遍历都在同一个快照上，dump 的时候不用停写，也保证写文件时的每个字符都在哈夫曼树里
+    // 过滤器也按快照里的 key 重新建一个保存，正在用的那个可能已经删掉了快照里还有的 key
+    std::unique_ptr<CountingBloomFilter> filter ;
+    if(this->_filter != nullptr) {
+        filter.reset(new CountingBloomFilter(this->_options.filter_expected_keys , this->_options.filter_counters_per_key)) ;
+    }
+    uint64_t keys = 0 ;
+    auto iter = snapshot._memtable->new_iterator(snapshot.sequence()) ;
+    for( ; iter->good() ; iter->next() ) {
+        ++keys ;
+        if(filter != nullptr) {
+            filter->add(iter->key()) ;
+        }
+
+        if(this->_HufTree->insert_word(iter->key()) == false ){
+            return Status::invalid_operation("Huffman Tree insert key word fail " + *iter->key().data()) ;
         }  
-        if(this->_HufTree->insert_word(iter.value()) == false) {
-            return Status::invalid_operation("Huffman Tree insert value word fail" + *iter.value().data()) ;
+        // 只有内存表里的 value 要编码，value log 的引用原样写
+        ByteArray value = iter->value() ;
+        if(!value.empty() && value[0] == INLINE_VALUE && this->_HufTree->insert_word(ByteArray(value.data() + 1 , value.size() - 1)) == false) {
+            return Status::invalid_operation("Huffman Tree insert value word fail") ;
         }
     }
+    // 数据文件的块坏了的话遍历会提前停下，写出去的文件会少掉后面的 key，还会覆盖原来的文件、删掉日志
+    if(!iter->status().good()) {
+        return iter->status() ;
+    }
      
     if(this->_HufTree->build_huffmanTree() == false) {
         return Status::invalid_operation("build Huffman Tree") ;
     }
-    if(this->_HufTree->save_encryptedFile(std::string(this->_file_name + TARGETCODE_FILE_EXT).data()) == false) {
-        return Status::invalid_operation("save Huffman Tree Code fail") ;
+    // 数据文件引用的 value 要先落盘
+    if(this->_value_log != nullptr && this->_value_log->sync() == false) {
+        return Status::io_error("sync " + this->_file_name + VALUE_LOG_FILE_EXT + " error, " + strerror(errno)) ;
+    }
+    // 编码表写在数据文件里面，格式见 data_file.h
+    FileWriter writer(this->_options.dump_io) ;
+    if(!writer.open(this->_file_name)) {
+        return Status::io_error("open " + std::string(this->_file_name.data()) + ".tmp error, " + strerror(errno)) ;
     }
+    DataFileBuilder builder(&writer , this->_HufTree , this->_options.block_size) ;
+    for(iter = snapshot._memtable->new_iterator(snapshot.sequence()) ; iter->good() ; iter->next() ) {
+        if(builder.add(iter->key() , iter->value()) == false)
+            return Status::io_error("encode or write " + std::string(this->_file_name.data()) + ".tmp error, " + strerror(errno)) ;
+    }
+    // 在 finish 改名覆盖原来的文件之前返回，临时文件由 writer 删掉
+    if(!iter->status().good()) {
+        return iter->status() ;
+    }
+    if(builder.finish() == false || writer.finish() == false) {
+        return Status::io_error("write " + std::string(this->_file_name.data()) + " error, " + strerror(errno)) ;
+    }
+    // 以前的格式留下的编码文件已经用不到了
+    remove(std::string(this->_file_name + TARGETCODE_FILE_EXT).data()) ;
 
-    auto close_func = [](int *fd) {
-        if(fd) {
-            ::close(*fd) ; 
-            delete fd ; 
+    if(filter != nullptr) {
+        if(filter->save(std::string(this->_file_name + FILTER_FILE_EXT).data() , writer.size() , keys) == false) {
+            return Status::io_error("save filter " + this->_file_name + FILTER_FILE_EXT + " fail") ;
+        }
+    }
+
+    // 数据文件落了盘才能删掉换下来的日志和旧的增量文件
+    if(this->_dirty != nullptr && !DeltaFile::checksum(this->_file_name , &this->_base_size , &this->_base_crc)) {
+        return Status::io_error("read " + std::string(this->_file_name.data()) + " error, " + strerror(errno)) ;
+    }
+    // 增量文件是连续编号的，删到第一个不存在的为止；没删掉的也对不上新的基础文件，不会被应用
+    for(size_t i = 1 ; remove(DeltaFile::name(this->_file_name , i).data()) == 0 ; ++i) { }
+    this->_delta_count = 0 ;
+    this->_delta_bytes = 0 ;
+    return Status::ok() ;
+}
+
+Status Table::dump_delta(const Snapshot& snapshot , const std::vector<std::string>& keys) {
+    if(keys.empty()) {
+        return Status::ok() ;
+    }
+    // 快照里还在的 key 记成 put，不在的记成 del；value log 的引用原样写
+    std::string ops ;
+    std::string value ;
+    for(const std::string& key : keys) {
+        if(snapshot._memtable->get(key , &value , snapshot.sequence())) {
+            WriteAheadLog::add_put(&ops , key , value) ;
+        } else {
+            WriteAheadLog::add_delete(&ops , key) ;
         }
-    } ; 
-    std::shared_ptr<int> fd(new int(::open(this->_file_name.data(), O_WRONLY | O_CREAT | O_TRUNC, 0666)), close_func);
-    if (*fd == -1) {
-        return Status::io_error("open " + std::string(this->_file_name.data()) + " error, " + strerror(errno));
     }
-    for(auto iter = this->_skiplist->begin() ; iter.good() ; iter.next() ) {
-        // +--------------------Entry----------------------+
-        // | length of key | key | length of value | value |
-        // +-----------------------------------------------+
-        if(this->_HufTree->write_string(fd , iter.key()) == false)
-            return Status::io_error("write " + std::string(this->_file_name.data()) + " error, " + strerror(errno));
-        
-        if(this->_HufTree->write_string(fd , iter.value()) == false)
-            return Status::io_error("write " + std::string(this->_file_name.data()) + " error, " + strerror(errno));
-        
+    if(this->_value_log != nullptr && this->_value_log->sync() == false) {
+        return Status::io_error("sync " + this->_file_name + VALUE_LOG_FILE_EXT + " error, " + strerror(errno)) ;
     }
-    return Status::ok();
+    const std::string delta_name = DeltaFile::name(this->_file_name , this->_delta_count + 1) ;
+    if(!DeltaFile::save(delta_name , this->_base_size , this->_base_crc , ops)) {
+        return Status::io_error("write " + delta_name + " error, " + strerror(errno)) ;
+    }
+    ++this->_delta_count ;
+    this->_delta_bytes += ops.size() ;
+    return Status::ok() ;
 }
 
-Status Table::get(const ByteArray &key , std::string *value){
-    if (_is_closed) {
-        return Status::invalid_operation("Table is closed");
+Status Table::get(const ByteArray &key , std::string *value , const Snapshot* snapshot){
+    if(this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+
+    // 快照里的数据不会再变，不用和 WriteBatch 对序号
+    if(snapshot != nullptr) {
+        Status s = this->_memtable->find(key , value , snapshot->sequence()) ;
+        if(!s.good()) {
+            return s ;
+        }
+        return value != nullptr ? this->decode_value(value) : Status::ok() ;
+    }
+
+    if(this->_filter != nullptr && !this->_filter->may_contain(key)) {
+        this->_filter->record(false , false) ;
+        return Status::not_found() ;
     }
 
-    auto it = this->_skiplist->lookup(key);
-    if (!it.good()) {
-        return Status::not_found();
+    // 还没有发布的 WriteBatch 里的写看不到；数据文件坏了的话返回 io_error，不当成没有找到
+    Status s = this->_memtable->find(key , value) ;
+    if(!s.good() && s.code() != Status::NOT_FOUND) {
+        return s ;
     }
 
-    if (value != nullptr) {
-        value->assign(it.value().data(), it.value().size());
+    if(this->_filter != nullptr) {
+        this->_filter->record(true , s.good()) ;
+    }
+    if(!s.good()) {
+        return s ;
     }
-    return Status::ok();
+    return value != nullptr ? this->decode_value(value) : Status::ok() ;
 }
 
-Status Table::put(const ByteArray& key, const ByteArray& value) {
-    if (_is_closed) {
-        return Status::invalid_operation("Table is closed");
+Status Table::put(const ByteArray& key , const ByteArray& value) {
+    if(this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
     }
 
-    uint8_t entry_size = key.size() + value.size() + sizeof(uint8_t) * 2;
-    if (static_cast<off_t>(entry_size) > _options.max_file_size) {
-        return Status::invalid_operation("size of entry is too large");
+    Status s = this->check_entry(key , value) ;
+    if(!s.good()) {
+        return s ;
+    }
+    std::string stored ;
+    s = this->encode_value(value , &stored) ;
+    if(!s.good()) {
+        return s ;
     }
 
-    auto it = this->_skiplist->insert(key, value) ;
-    
-    if (it.good() == false) { // already exist , then update 
-        this->_skiplist->update(key, value);
+    if(this->_wal == nullptr) {
+        this->apply_put(key , stored) ;
+        return this->maybe_flush() ;
     }
+    std::string record ;
+    WriteAheadLog::add_put(&record , key , stored) ;
+    s = this->commit(record , [&]() { this->apply_put(key , stored) ; }) ;
+    return s.good() ? this->maybe_flush() : s ;
+}
 
-    return Status::ok();
+void Table::apply_put(const ByteArray& key , const ByteArray& stored) {
+    // 先加进过滤器再写内存表，get 不会因为过滤器漏掉已经写进去的 key；key 本来就存在的话再把多加的一次去掉
+    if(this->_filter != nullptr) {
+        this->_filter->add(key) ;
+    }
+    // 只查找一遍：key 不存在就插入，已经存在就原地换掉 value
+    bool existed = false ;
+    this->_memtable->put(key , stored , &existed) ;
+    if(this->_filter != nullptr && existed) {
+        this->_filter->remove(key) ;
+    }
+    if(this->_dirty != nullptr) {
+        this->_dirty->add(key) ;
+    }
+}
+
+Status Table::write(const WriteBatch& batch) {
+    if(this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+
+    // 和 put 一样的检查，先全部检查完再写；大 value 在拿锁之前写进 value log
+    const std::vector<WriteBatch::Record>& records = batch._records ;
+    for(const WriteBatch::Record& record : records) {
+        Status s = this->check_entry(record.key , record.value) ;
+        if(!s.good()) {
+            return s ;
+        }
+    }
+    std::vector<std::string> stored(records.size()) ;
+    for(size_t i = 0 ; i < records.size() ; ++i) {
+        if(!records[i].is_delete) {
+            Status s = this->encode_value(records[i].value , &stored[i]) ;
+            if(!s.good()) {
+                return s ;
+            }
+        }
+    }
+
+    // 按 key 稳定排序，同一个 key 的多次操作保持原来的先后
+    std::vector<size_t> order(records.size()) ;
+    for(size_t i = 0 ; i < order.size() ; ++i) {
+        order[i] = i ;
+    }
+    std::stable_sort(order.begin() , order.end() , [&records](size_t a , size_t b) {
+        return ByteArray(records[a].key) < ByteArray(records[b].key) ;
+    }) ;
+
+    auto apply = [&]() {
+        std::lock_guard<std::mutex> lock(this->_write_mutex) ;
+        // writer 析构的时候整批一起发布
+        {
+            std::unique_ptr<Memtable::Writer> writer = this->_memtable->new_writer() ;
+            for(size_t i : order) {
+                const WriteBatch::Record& record = records[i] ;
+                // 过滤器和 put/del 一样维护
+                if(record.is_delete) {
+                    if(writer->erase(record.key)) {
+                        if(this->_filter != nullptr && this->_layered == nullptr) {
+                            this->_filter->remove(record.key) ;
+                        }
+                        if(this->_dirty != nullptr) {
+                            this->_dirty->add(record.key) ;
+                        }
+                    }
+                    continue ;
+                }
+                if(this->_filter != nullptr) {
+                    this->_filter->add(record.key) ;
+                }
+                if(writer->upsert(record.key , stored[i]) && this->_filter != nullptr) {
+                    this->_filter->remove(record.key) ;
+                }
+                if(this->_dirty != nullptr) {
+                    this->_dirty->add(record.key) ;
+                }
+            }
+        }
+    } ;
+    if(this->_wal == nullptr) {
+        apply() ;
+        return this->maybe_flush() ;
+    }
+    // 整批是日志里的一条记录，按加入的顺序记，重放的时候后面的操作覆盖前面的
+    std::string log_record ;
+    for(size_t i = 0 ; i < records.size() ; ++i) {
+        if(records[i].is_delete) {
+            WriteAheadLog::add_delete(&log_record , records[i].key) ;
+        } else {
+            WriteAheadLog::add_put(&log_record , records[i].key , stored[i]) ;
+        }
+    }
+    Status s = this->commit(log_record , apply) ;
+    return s.good() ? this->maybe_flush() : s ;
 }
 
 Status Table::del(const ByteArray& key) {
-    if (_is_closed) {
-        return Status::invalid_operation("Table is closed");
+    if(this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
     }
 
-    if (this->_skiplist->erase(key)) {
-        return Status::ok();
+    bool found = false ;
+    if(this->_wal == nullptr) {
+        found = this->apply_del(key) ;
     } else {
-        return Status::not_found();
+        std::string record ;
+        WriteAheadLog::add_delete(&record , key) ;
+        Status s = this->commit(record , [&]() { found = this->apply_del(key) ; }) ;
+        if(!s.good()) {
+            return s ;
+        }
+    }
+    if(!found) {
+        return Status::not_found() ;
+    }
+    // lsm 的删除是写一个 tombstone，也占写缓冲
+    return this->maybe_flush() ;
+}
+
+bool Table::apply_del(const ByteArray& key) {
+    if(!this->_memtable->del(key)) {
+        return false ;
+    }
+    // 分层的内存表删除只是写一个 tombstone，更旧的层里还有这个 key，过滤器里不能减掉
+    if(this->_filter != nullptr && this->_layered == nullptr) {
+        this->_filter->remove(key) ;
+    }
+    if(this->_dirty != nullptr) {
+        this->_dirty->add(key) ;
+    }
+    return true ;
+}
+
+Status Table::commit(const std::string& record , const std::function<void()>& apply) {
+    // 日志记录的长度是 32 位的
+    if(record.size() > UINT32_MAX) {
+        return Status::invalid_operation("size of batch is too large") ;
+    }
+    if(!this->_wal->append(record , apply)) {
+        return Status::io_error("write " + this->_file_name + WAL_FILE_EXT + " error, " + strerror(errno)) ;
+    }
+    return Status::ok() ;
+}
+
+Status Table::replay_log(const std::string& log_name) {
+    // 这时候表还没有打开，没有别的线程在写，每个操作直接写内存表
+    bool ok = WriteAheadLog::replay(log_name.data() , [this](const ByteArray& record) {
+        return this->apply_ops(record) ;
+    }) ;
+    if(!ok) {
+        return Status::io_error(log_name + " is corrupted") ;
+    }
+    return Status::ok() ;
+}
+
+bool Table::apply_ops(const ByteArray& ops) {
+    const char *p = ops.data() , *limit = ops.data() + ops.size() ;
+    while(p < limit) {
+        bool is_delete ;
+        ByteArray key , value ;
+        if(!WriteAheadLog::next_op(&p , limit , &is_delete , &key , &value)) {
+            return false ;
+        }
+        if(is_delete) {
+            this->apply_del(key) ;
+            continue ;
+        }
+        // 引用了 value log 的操作，value log 一定在
+        if(value.size() == 0 || (value[0] != INLINE_VALUE && (value[0] != VALUE_LOG_REF || this->_value_log == nullptr))) {
+            return false ;
+        }
+        this->apply_put(key , value) ;
+    }
+    return true ;
+}
+
+Status Table::multi_get(const std::vector<ByteArray>& keys , std::vector<std::string>* values ,
+                        std::vector<Status>* statuses , bool sort_keys , const Snapshot* snapshot) {
+    if(this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+
+    // 排的是下标，查完按下标把结果放回原来的位置；过滤器说不存在的 key 不用去查
+    const bool use_filter = this->_filter != nullptr && snapshot == nullptr ;
+    std::vector<size_t> order ;
+    order.reserve(keys.size()) ;
+    for(size_t i = 0 ; i < keys.size() ; ++i) {
+        if(use_filter && !this->_filter->may_contain(keys[i])) {
+            this->_filter->record(false , false) ;
+            continue ;
+        }
+        order.push_back(i) ;
+    }
+    std::vector<ByteArray> selected ;
+    if(sort_keys) {
+        std::sort(order.begin() , order.end() , [&keys](size_t a , size_t b) { return keys[a] < keys[b] ; }) ;
+    }
+    if(sort_keys || order.size() != keys.size()) {
+        selected.resize(order.size()) ;
+        for(size_t i = 0 ; i < order.size() ; ++i) {
+            selected[i] = keys[order[i]] ;
+        }
+    }
+    const std::vector<ByteArray>& batch = (sort_keys || order.size() != keys.size()) ? selected : keys ;
+
+    // 没给快照的话自己取一个，一批 key 都在同一个序列号上查，不会一半在某个 WriteBatch 之前一半在之后
+    Snapshot own = snapshot != nullptr ? Snapshot(nullptr , 0) : this->snapshot() ;
+    const uint64_t seq = snapshot != nullptr ? snapshot->sequence() : own.sequence() ;
+    values->assign(keys.size() , std::string()) ;
+    statuses->assign(keys.size() , Status::not_found()) ;
+    Status s = this->_memtable->multi_find(batch.data() , batch.size() , [&](size_t i , const ByteArray& value) {
+        (*values)[order[i]].assign(value.data() , value.size()) ;
+        (*statuses)[order[i]] = Status::ok() ;
+    } , seq) ;
+    if(!s.good()) {
+        return s ;
+    }
+    if(use_filter) {
+        for(size_t i : order) {
+            this->_filter->record(true , (*statuses)[i].good()) ;
+        }
+    }
+    this->decode_values(order , values , statuses) ;
+    return Status::ok() ;
+}
+
+Table::Iterator Table::new_iterator(const Snapshot* snapshot) {
+    if(this->_is_closed) {
+        return Iterator() ;
+    }
+    return Iterator(this->_memtable->new_iterator(snapshot != nullptr ? snapshot->sequence() : Memtable::LATEST) , this->_value_log) ;
+}
+
+Status Table::scan(const ByteArray& begin , const ByteArray& end , size_t limit ,
+                   std::vector<std::pair<std::string , std::string>>* result , const Snapshot* snapshot) {
+    if(this->_is_closed) {
+        return Status::invalid_operation("Table is closed") ;
+    }
+
+    if(snapshot == nullptr) {
+        Snapshot own = this->snapshot() ;
+        return this->scan(begin , end , limit , result , &own) ;
+    }
+
+    // 先 O(log n) 定位到 begin，之后按顺序往后走 k 个 key
+    auto it = this->_memtable->new_iterator(snapshot->sequence()) ;
+    if(!begin.empty()) {
+        it->seek(begin) ;
+    }
+    for(size_t count = 0 ; it->good() && (limit == 0 || count < limit) ; it->next() , ++count) {
+        ByteArray key = it->key() ;
+        if(!end.empty() && !(key < end)) {
+            break ;
+        }
+        ByteArray value = it->value() ;
+        std::string decoded(value.data() , value.size()) ;
+        Status s = this->decode_value(&decoded) ;
+        if(!s.good()) {
+            return s ;
+        }
+        result->emplace_back(std::string(key.data() , key.size()) , std::move(decoded)) ;
+    }
+    // 数据文件坏了的话遍历提前停下，不能当成只有这些 key
+    return it->status() ;
+}
+
+FilterStats Table::filter_stats() const {
+    if(this->_filter == nullptr) {
+        return FilterStats() ;
+    }
+    return this->_filter->stats() ;
+}
+
+Table::Snapshot Table::snapshot() {
+    if(this->_is_closed) {
+        return Snapshot(nullptr , 0) ;
+    }
+    // 快照的序列号只会取到已经发布的，正在写的 WriteBatch 整批都在它后面
+    return Snapshot(this->_memtable , this->_memtable->acquire_snapshot()) ;
+}
+
+Status Table::check_entry(const ByteArray& key , const ByteArray& value) const {
+    // 内存表里的长度是 32 位的，value 前面还有一个类型字节
+    size_t entry_size = key.size() + value.size() + sizeof(uint8_t) * 2 ;
+    if(key.size() > UINT32_MAX || value.size() >= UINT32_MAX || entry_size > this->_options.max_file_size) {
+        return Status::invalid_operation("size of entry is too large") ;
+    }
+    return Status::ok() ;
+}
+
+Status Table::encode_value(const ByteArray& value , std::string* stored) {
+    if(this->_value_log != nullptr && this->_options.value_log_threshold > 0 &&
+       value.size() > this->_options.value_log_threshold) {
+        if(!this->_value_log->append(value , stored)) {
+            return Status::io_error("write " + this->_file_name + VALUE_LOG_FILE_EXT + " error, " + strerror(errno)) ;
+        }
+        return Status::ok() ;
+    }
+    stored->reserve(value.size() + 1) ;
+    stored->assign(1 , INLINE_VALUE) ;
+    stored->append(value.data() , value.size()) ;
+    return Status::ok() ;
+}
+
+Status Table::decode_value(std::string* value) const {
+    if(!value->empty() && (*value)[0] == INLINE_VALUE) {
+        value->erase(0 , 1) ;
+        return Status::ok() ;
+    }
+    std::string large ;
+    if(this->_value_log == nullptr || !this->_value_log->read(*value , &large)) {
+        return Status::io_error("read " + this->_file_name + VALUE_LOG_FILE_EXT + " error") ;
+    }
+    value->swap(large) ;
+    return Status::ok() ;
+}
+
+void Table::decode_values(const std::vector<size_t>& order , std::vector<std::string>* values ,
+                          std::vector<Status>* statuses) const {
+    for(size_t i : order) {
+        if((*statuses)[i].good()) {
+            Status s = this->decode_value(&(*values)[i]) ;
+            if(!s.good()) {
+                (*values)[i].clear() ;
+                (*statuses)[i] = s ;
+            }
+        }
+    }
+}
+
+ByteArray Table::Iterator::value() {
+    if(this->_iter == nullptr) {
+        return ByteArray() ;
+    }
+    ByteArray value = this->_iter->value() ;
+    // 空的 value 没有类型字节，ByteArray 越界读到的 '\0' 和 INLINE_VALUE 一样，不能当成内存表里的 value
+    if(value.empty()) {
+        return ByteArray() ;
+    }
+    if(value[0] == INLINE_VALUE) {
+        return ByteArray(value.data() + 1 , value.size() - 1) ;
+    }
+    if(this->_value_log == nullptr || !this->_value_log->read(value , &this->_large_value)) {
+        return ByteArray() ;
+    }
+    return ByteArray(this->_large_value) ;
+}
+
+Status Table::scan_prefix(const ByteArray& prefix , size_t limit ,
+                          std::vector<std::pair<std::string , std::string>>* result , const Snapshot* snapshot) {
+    // 以 prefix 开头的 key 都小于 prefix 最后一个不是 0xff 的字节加一后截断得到的 key；
+    // prefix 全是 0xff 的话没有上界
+    std::string end(prefix.data() , prefix.size()) ;
+    while(!end.empty() && static_cast<uint8_t>(end.back()) == 0xff) {
+        end.pop_back() ;
+    }
+    if(!end.empty()) {
+        end.back() = static_cast<char>(static_cast<uint8_t>(end.back()) + 1) ;
     }
+    return this->scan(prefix , end , limit , result , snapshot) ;
 }
 
 }// namespace table
@@ -2,6 +2,9 @@
 #include <assert.h>
 #include <thread> 
 #include "table.h" 
+#include "sharded_table.h"
+#include <map>
+#include <fstream>
 
 using namespace table ; 
 using namespace std ;
@@ -19,7 +22,7 @@ static string random_string(size_t length) {
     string str(length , 0) ; 
     std::mt19937 mt_rand{std::random_device{}()};
     for(int i = 0 ; i < length ; ++i){
-        str[i] = charset[mt_rand() % length] ; 
+        str[i] = charset[mt_rand() % strlen(charset)] ; 
     }
     return str ; 
 }
@@ -51,8 +54,9 @@ void OPEN_AND_CLOSE() {
     }
 }
 
-void LOAD_AND_DUMP(){
+void LOAD_AND_DUMP(MemtableType memtable){
     Options options ; 
+    options.memtable = memtable ; 
     options.create_if_missing = true ; 
     options.dump_when_close = true ; 
     options.max_file_size = 4096 ; 
@@ -160,6 +164,1761 @@ void TABLE_CRUD(){
     my_assert(s.good() == false, s) ; 
 }
 
+void TABLE_SCAN(MemtableType memtable){
+    Options options ;
+    options.memtable = memtable ;
+    options.create_if_missing = true ;
+    options.dump_when_close = false ;
+    Table table(options , DEFAULT_NAME) ;
+    Status s = table.open() ;
+    my_assert(s.good() == true, s) ;
+
+    vector<string> keys = {"user:001" , "user:002" , "user:010" , "user\xff" , "video:1" , "video:2"} ;
+    for(auto &key : keys) {
+        s = table.put(key , "v-" + key) ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // range [user:002, video:1)
+    vector<pair<string , string>> result ;
+    s = table.scan("user:002" , "video:1" , 0 , &result) ;
+    my_assert(s.good() == true, s) ;
+    my_assert(result.size() == 3 && result[0].first == "user:002" && result[2].first == "user\xff", s) ;
+    my_assert(result[1].second == "v-user:010", s) ;
+
+    // limit，从上一页最后一个 key 之后继续取
+    result.clear() ;
+    s = table.scan("" , "" , 2 , &result) ;
+    my_assert(s.good() == true && result.size() == 2 && result[1].first == "user:002", s) ;
+    string next_begin = result.back().first + string(1 , '\0') ;
+    result.clear() ;
+    s = table.scan(next_begin , "" , 2 , &result) ;
+    my_assert(s.good() == true && result.size() == 2 && result[0].first == "user:010", s) ;
+
+    // prefix
+    result.clear() ;
+    s = table.scan_prefix("user:" , 0 , &result) ;
+    my_assert(s.good() == true && result.size() == 3 && result.back().first == "user:010", s) ;
+    result.clear() ;
+    s = table.scan_prefix("video" , 0 , &result) ;
+    my_assert(s.good() == true && result.size() == 2, s) ;
+
+    // 反向遍历，迭代器要在 close 之前析构
+    {
+    Table::Iterator it = table.new_iterator() ;
+    it.seek_to_last() ;
+    for(int i = keys.size() - 1 ; i >= 0 ; --i , it.prev()) {
+        my_assert(it.good() && it.key() == keys[i], s) ;
+    }
+    my_assert(it.good() == false, s) ;
+    it.seek("video") ;
+    my_assert(it.good() && it.key() == "video:1", s) ;
+    }
+
+    s = table.close() ;
+    my_assert(s.good() == true, s) ;
+
+    // 关闭以后拿到的迭代器是空的，怎么用都不会出错
+    Table::Iterator closed = table.new_iterator() ;
+    closed.seek_to_first() ;
+    closed.seek("user") ;
+    closed.seek_to_last() ;
+    closed.next() ;
+    closed.prev() ;
+    my_assert(closed.good() == false && closed.key().size() == 0 && closed.value().size() == 0, s) ;
+}
+
+void TABLE_MULTI_GET(bool hash_index){
+    Options options ;
+    options.create_if_missing = true ;
+    options.dump_when_close = false ;
+    options.hash_index = hash_index ;
+    Table table(options , DEFAULT_NAME) ;
+    Status s = table.open() ;
+    my_assert(s.good() == true, s) ;
+    for(int i = 0 ; i < 100 ; i += 2) {
+        s = table.put(to_string(i) , "value" + to_string(i)) ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    vector<string> key_strs = {"42" , "7" , "0" , "98" , "42" , "99" , "" , "10"} ;
+    vector<ByteArray> keys(key_strs.begin() , key_strs.end()) ;
+    for(bool sort_keys : {true , false}) {
+        vector<string> values ;
+        vector<Status> statuses ;
+        s = table.multi_get(keys , &values , &statuses , sort_keys) ;
+        my_assert(s.good() == true && values.size() == keys.size() && statuses.size() == keys.size(), s) ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            string value ;
+            Status one = table.get(keys[i] , &value) ;
+            my_assert(statuses[i].code() == one.code(), statuses[i]) ;
+            my_assert(values[i] == (one.good() ? value : ""), statuses[i]) ;
+        }
+        my_assert(statuses[0].good() && values[0] == "value42" && statuses[1].code() == Status::NOT_FOUND, s) ;
+    }
+
+    s = table.close() ;
+    my_assert(s.good() == true, s) ;
+    vector<string> values ;
+    vector<Status> statuses ;
+    s = table.multi_get(keys , &values , &statuses) ;
+    my_assert(s.code() == Status::INVALID_OPERATION, s) ;
+}
+
+void TABLE_WRITE_BATCH(){
+    Options options ;
+    options.create_if_missing = true ;
+    options.dump_when_close = false ;
+    options.max_file_size = 64 ;
+    Table table(options , DEFAULT_NAME) ;
+    Status s = table.open() ;
+    my_assert(s.good() == true, s) ;
+    s = table.put("b" , "old") ;
+    my_assert(s.good() == true, s) ;
+    s = table.put("d" , "old") ;
+    my_assert(s.good() == true, s) ;
+
+    // 乱序、重复 key，同一个 key 最后一次操作生效
+    WriteBatch batch ;
+    batch.put("c" , "1") ;
+    batch.put("a" , "1") ;
+    batch.del("b") ;
+    batch.put("d" , "1") ;
+    batch.put("a" , "2") ;
+    batch.del("c") ;
+    batch.del("x") ;
+    my_assert(batch.count() == 7, s) ;
+    s = table.write(batch) ;
+    my_assert(s.good() == true, s) ;
+    vector<pair<string , string>> result ;
+    s = table.scan("" , "" , 0 , &result) ;
+    my_assert(result.size() == 2 && result[0] == make_pair(string("a") , string("2")) && result[1] == make_pair(string("d") , string("1")), s) ;
+
+    // 有一条不合法整批都不写
+    batch.clear() ;
+    batch.put("e" , "1") ;
+    batch.put("f" , string(100 , 'v')) ;
+    s = table.write(batch) ;
+    my_assert(s.code() == Status::INVALID_OPERATION, s) ;
+    my_assert(table.get("e" , nullptr).code() == Status::NOT_FOUND, s) ;
+
+    // 读的线程要么看到整批都写进去了，要么一条都没看到：每一批把所有 key 改成同一个版本号
+    vector<string> key_strs ;
+    for(int i = 0 ; i < 64 ; ++i) key_strs.push_back("k" + to_string(100 + i)) ;
+    batch.clear() ;
+    for(auto &key : key_strs) batch.put(key , "0") ;
+    s = table.write(batch) ;
+    my_assert(s.good() == true, s) ;
+    std::atomic<bool> stop(false) ;
+    thread reader([&]() {
+        vector<ByteArray> keys(key_strs.begin() , key_strs.end()) ;
+        while(!stop) {
+            vector<string> values ;
+            vector<Status> statuses ;
+            Status rs = table.multi_get(keys , &values , &statuses) ;
+            for(auto &value : values) my_assert(value == values[0], rs) ;
+            vector<pair<string , string>> rows ;
+            rs = table.scan("k" , "l" , 0 , &rows) ;
+            my_assert(rows.size() == key_strs.size(), rs) ;
+            for(auto &row : rows) my_assert(row.second == rows[0].second, rs) ;
+        }
+    }) ;
+    for(int version = 1 ; version <= 200 ; ++version) {
+        batch.clear() ;
+        for(auto &key : key_strs) batch.put(key , to_string(version)) ;
+        s = table.write(batch) ;
+        my_assert(s.good() == true, s) ;
+    }
+    stop = true ;
+    reader.join() ;
+
+    s = table.close() ;
+    my_assert(s.good() == true, s) ;
+    s = table.write(batch) ;
+    my_assert(s.code() == Status::INVALID_OPERATION, s) ;
+}
+
+void SHARDED_TABLE(){
+    Options options ;
+    options.create_if_missing = true ;
+    options.dump_when_close = true ;
+    options.shard_count = 4 ;
+    const string table_name = "table_SHARDED.txt" ;
+
+    std::map<string , string> expect ;
+    {
+        ShardedTable table(options , table_name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        my_assert(table.shard_count() == 4, s) ;
+        // 多个线程同时写，每个线程写自己的 key
+        vector<thread> writers ;
+        for(int t = 0 ; t < 4 ; ++t) {
+            writers.emplace_back([&table , t]() {
+                for(int i = 0 ; i < 500 ; ++i) {
+                    string key = "k" + to_string(1000 + i * 4 + t) ;
+                    Status ws = table.put(key , "v" + key) ;
+                    my_assert(ws.good() == true, ws) ;
+                }
+            }) ;
+        }
+        for(auto &writer : writers) writer.join() ;
+        for(int i = 0 ; i < 2000 ; ++i) {
+            string key = "k" + to_string(1000 + i) ;
+            expect[key] = "v" + key ;
+        }
+        // 每个分片都分到了 key
+        vector<size_t> per_shard(table.shard_count() , 0) ;
+        for(auto &kv : expect) ++per_shard[table.shard_of(kv.first)] ;
+        for(size_t count : per_shard) my_assert(count > 0, s) ;
+
+        WriteBatch batch ;
+        batch.del("k1000") ;
+        batch.put("k0999" , "new") ;
+        batch.put("k1001" , "new") ;
+        s = table.write(batch) ;
+        my_assert(s.good() == true, s) ;
+        expect.erase("k1000") ;
+        expect["k0999"] = "new" ;
+        expect["k1001"] = "new" ;
+        s = table.del("k2999") ;
+        my_assert(s.good() == true, s) ;
+        expect.erase("k2999") ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    {
+        ShardedTable table(options , table_name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        // 归并迭代器按 key 有序走完所有分片
+        {
+            auto it = table.new_iterator() ;
+            for(auto &kv : expect) {
+                my_assert(it.good() && it.key() == kv.first && it.value() == kv.second, s) ;
+                it.next() ;
+            }
+            my_assert(it.good() == false, s) ;
+            it.seek("k15") ;
+            my_assert(it.good() && it.key() == "k1500", s) ;
+        }
+
+        vector<pair<string , string>> result ;
+        s = table.scan("k1998" , "k2003" , 0 , &result) ;
+        my_assert(result.size() == 5 && result[0].first == "k1998" && result[4].first == "k2002", s) ;
+
+        vector<ByteArray> keys = {"k2002" , "k1000" , "k0999" , "nope"} ;
+        vector<string> values ;
+        vector<Status> statuses ;
+        s = table.multi_get(keys , &values , &statuses) ;
+        my_assert(s.good() == true, s) ;
+        my_assert(statuses[0].good() && values[0] == "vk2002", s) ;
+        my_assert(statuses[1].code() == Status::NOT_FOUND, s) ;
+        my_assert(statuses[2].good() && values[2] == "new", s) ;
+        my_assert(statuses[3].code() == Status::NOT_FOUND, s) ;
+        string value ;
+        s = table.get("k2999" , &value) ;
+        my_assert(s.code() == Status::NOT_FOUND, s) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+        s = table.get("k1001" , &value) ;
+        my_assert(s.code() == Status::INVALID_OPERATION, s) ;
+    }
+}
+
+void TABLE_SNAPSHOT(MemtableType memtable){
+    Options options ;
+    options.memtable = memtable ;
+    options.create_if_missing = true ;
+    options.dump_when_close = false ;
+    Table table(options , DEFAULT_NAME) ;
+    Status s = table.open() ;
+    my_assert(s.good() == true, s) ;
+    for(int i = 0 ; i < 100 ; ++i) {
+        s = table.put("k" + to_string(100 + i) , "0") ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    {
+        Table::Snapshot snapshot = table.snapshot() ;
+        my_assert(snapshot.good() == true, s) ;
+        s = table.put("k100" , "1") ;
+        my_assert(s.good() == true, s) ;
+        s = table.del("k101") ;
+        my_assert(s.good() == true, s) ;
+        s = table.put("k000" , "1") ;
+        my_assert(s.good() == true, s) ;
+
+        string value ;
+        s = table.get("k100" , &value , &snapshot) ;
+        my_assert(s.good() && value == "0", s) ;
+        s = table.get("k101" , &value , &snapshot) ;
+        my_assert(s.good() && value == "0", s) ;
+        s = table.get("k000" , &value , &snapshot) ;
+        my_assert(s.code() == Status::NOT_FOUND, s) ;
+        s = table.get("k101" , &value) ;
+        my_assert(s.code() == Status::NOT_FOUND, s) ;
+
+        vector<string> values ;
+        vector<Status> statuses ;
+        s = table.multi_get({"k000" , "k100" , "k101"} , &values , &statuses , true , &snapshot) ;
+        my_assert(statuses[0].code() == Status::NOT_FOUND && values[1] == "0" && values[2] == "0", s) ;
+
+        auto it = table.new_iterator(&snapshot) ;
+        size_t count = 0 ;
+        for( ; it.good() ; it.next() , ++count) my_assert(it.value() == "0", s) ;
+        my_assert(count == 100, s) ;
+    }
+
+    // 扫描的时候写一直在进行：每一轮把所有 key 改成同一个版本号，快照里看到的版本号都一样
+    WriteBatch reset ;
+    for(int i = 0 ; i < 100 ; ++i) reset.put("k" + to_string(100 + i) , "0") ;
+    s = table.write(reset) ;
+    my_assert(s.good() == true, s) ;
+    std::atomic<bool> stop(false) ;
+    thread writer([&]() {
+        for(int version = 1 ; !stop ; ++version) {
+            WriteBatch batch ;
+            for(int i = 0 ; i < 100 ; ++i) batch.put("k" + to_string(100 + i) , to_string(version)) ;
+            Status ws = table.write(batch) ;
+            my_assert(ws.good() == true, ws) ;
+        }
+    }) ;
+    for(int round = 0 ; round < 200 ; ++round) {
+        Table::Snapshot snapshot = table.snapshot() ;
+        vector<pair<string , string>> rows ;
+        s = table.scan("k1" , "k2" , 0 , &rows , &snapshot) ;
+        my_assert(rows.size() == 100, s) ;
+        for(auto &row : rows) my_assert(row.second == rows[0].second, s) ;
+        // 快照里的值一直不变
+        string value ;
+        s = table.get("k150" , &value , &snapshot) ;
+        my_assert(s.good() && value == rows[0].second, s) ;
+    }
+    stop = true ;
+    writer.join() ;
+
+    s = table.close() ;
+    my_assert(s.good() == true, s) ;
+    my_assert(table.snapshot().good() == false, s) ;
+}
+
+void TABLE_FILTER(){
+    Options options ;
+    options.create_if_missing = true ;
+    options.dump_when_close = true ;
+    options.filter_expected_keys = 1000 ;
+    const string filter_name = DEFAULT_NAME + FILTER_FILE_EXT ;
+    remove(DEFAULT_NAME.data()) ;
+    remove(filter_name.data()) ;
+    {
+        Table table(options , DEFAULT_NAME) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        for(int i = 0 ; i < 1000 ; ++i) {
+            s = table.put("key" + to_string(i) , "value" + to_string(i)) ;
+            my_assert(s.good() == true, s) ;
+        }
+        // 覆盖写不会让 del 之后的 key 还留在过滤器里
+        s = table.put("key0" , "new") ;
+        my_assert(s.good() == true, s) ;
+        s = table.del("key0") ;
+        my_assert(s.good() == true, s) ;
+        WriteBatch batch ;
+        batch.del("key1") ;
+        batch.put("key1000" , "value1000") ;
+        s = table.write(batch) ;
+        my_assert(s.good() == true, s) ;
+
+        string value ;
+        for(int i = 1 ; i <= 1000 ; ++i) {
+            s = table.get("key" + to_string(i) , &value) ;
+            my_assert((i == 1) == (s.code() == Status::NOT_FOUND), s) ;
+        }
+        for(int i = 0 ; i < 1000 ; ++i) {
+            s = table.get("miss" + to_string(i) , &value) ;
+            my_assert(s.code() == Status::NOT_FOUND, s) ;
+        }
+        FilterStats stats = table.filter_stats() ;
+        my_assert(stats.lookups == 2000, s) ;
+        // 大部分不存在的 key 都被过滤器挡掉了
+        my_assert(stats.negatives > 900, s) ;
+        my_assert(stats.negatives + stats.false_positives >= 1000, s) ;
+
+        vector<string> values ;
+        vector<Status> statuses ;
+        s = table.multi_get({"miss0" , "key2" , "key1"} , &values , &statuses) ;
+        my_assert(statuses[0].code() == Status::NOT_FOUND && values[1] == "value2" &&
+                  statuses[2].code() == Status::NOT_FOUND, s) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // 重新打开的时候加载保存的过滤器，数据文件被换掉的话重新建
+    for(int round = 0 ; round < 2 ; ++round) {
+        if(round == 1) {
+            ofstream outfile(filter_name , ios::binary | ios::trunc) ;
+            outfile << "broken" ;
+        }
+        options.dump_when_close = false ;
+        Table table(options , DEFAULT_NAME) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        string value ;
+        for(int i = 2 ; i <= 1000 ; ++i) {
+            s = table.get("key" + to_string(i) , &value) ;
+            my_assert(s.good() && value == "value" + to_string(i), s) ;
+        }
+        s = table.get("key1" , &value) ;
+        my_assert(s.code() == Status::NOT_FOUND, s) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    remove(DEFAULT_NAME.data()) ;
+    remove(filter_name.data()) ;
+}
+
+// key 和 value 超过 255 字节，大 value 存到 value log 里，dump 的时候只写引用
+void TABLE_LARGE_VALUE(size_t value_log_threshold){
+    const string name = "table_LARGE_VALUE.txt" ;
+    const string value_log_name = name + VALUE_LOG_FILE_EXT ;
+    remove(name.data()) ;
+    remove(value_log_name.data()) ;
+    Options options ;
+    options.create_if_missing = true ;
+    options.dump_when_close = true ;
+    options.value_log_threshold = value_log_threshold ;
+
+    // 长度跨过 1 字节和 2、3 字节变长整数的边界
+    vector<size_t> sizes = {0 , 1 , 127 , 128 , 255 , 256 , 1000 , 5000 , 70000} ;
+    vector<string> keys , values ;
+    for(size_t i = 0 ; i < sizes.size() ; ++i) {
+        string key = "key" + to_string(i) + ":" , value ;
+        for(size_t j = 0 ; j < sizes[i] ; ++j) {
+            key.push_back('a' + (i + j) % 26) ;
+            value.push_back('0' + (i * 7 + j) % 75) ;
+        }
+        keys.push_back(key) ;
+        values.push_back(value) ;
+    }
+    auto check = [&](Table &table , size_t skip) {
+        string value ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            Status s = table.get(keys[i] , &value) ;
+            if(i == skip) {
+                my_assert(s.code() == Status::NOT_FOUND, s) ;
+            } else {
+                my_assert(s.good() && value == values[i], s) ;
+            }
+        }
+    } ;
+    size_t value_log_size = 0 ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            s = table.put(keys[i] , i % 2 == 0 ? "old" : values[i]) ;
+            my_assert(s.good() == true, s) ;
+        }
+        WriteBatch batch ;
+        for(size_t i = 0 ; i < keys.size() ; i += 2) {
+            batch.put(keys[i] , values[i]) ;
+        }
+        s = table.write(batch) ;
+        my_assert(s.good() == true, s) ;
+        check(table , keys.size()) ;
+
+        vector<ByteArray> lookup(keys.rbegin() , keys.rend()) ;
+        vector<string> found ;
+        vector<Status> statuses ;
+        s = table.multi_get(lookup , &found , &statuses) ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            my_assert(statuses[i].good() && found[i] == values[keys.size() - 1 - i], statuses[i]) ;
+        }
+        vector<pair<string , string>> result ;
+        s = table.scan("" , "" , 0 , &result) ;
+        my_assert(s.good() && result.size() == keys.size(), s) ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            my_assert(result[i].first == keys[i] && result[i].second == values[i], s) ;
+        }
+        {
+        Table::Iterator it = table.new_iterator() ;
+        for(size_t i = 0 ; i < keys.size() ; ++i , it.next()) {
+            my_assert(it.good() && it.key() == keys[i] && it.value() == values[i], s) ;
+        }
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    // 超过阈值的 value 只在日志里存一份，重新打开再 dump 日志不会变大
+    for(int round = 0 ; round < 2 ; ++round) {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table , keys.size()) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+
+        struct stat info ;
+        size_t size = stat(value_log_name.data() , &info) == 0 ? info.st_size : 0 ;
+        if(round == 1) {
+            my_assert(size == value_log_size, s) ;
+        }
+        value_log_size = size ;
+    }
+    size_t large = 0 ;
+    for(size_t i = 0 ; i < keys.size() ; ++i) {
+        if(value_log_threshold > 0 && values[i].size() > value_log_threshold) {
+            large += values[i].size() ;
+        }
+    }
+    my_assert(value_log_size == large, Status::ok()) ;
+
+    // 删掉一个大 value 的 key 以后还能正常加载
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        s = table.del(keys.back()) ;
+        my_assert(s.good() == true, s) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table , keys.size() - 1) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    remove(name.data()) ;
+    remove(value_log_name.data()) ;
+    remove((name + TARGETCODE_FILE_EXT).data()) ;
+    remove((name + FILTER_FILE_EXT).data()) ;
+}
+
+// 不 dump 就关掉表，相当于崩溃：重新打开的时候上次 dump 之后的写从预写日志里重放回来
+void TABLE_WAL(WalSyncMode mode){
+    const string name = "table_WAL.txt" ;
+    const string log_name = name + WAL_FILE_EXT ;
+    const string old_log_name = name + WAL_OLD_FILE_EXT ;
+    auto cleanup = [&]() {
+        remove(name.data()) ;
+        remove(log_name.data()) ;
+        remove(old_log_name.data()) ;
+        remove((name + VALUE_LOG_FILE_EXT).data()) ;
+        remove((name + TARGETCODE_FILE_EXT).data()) ;
+    } ;
+    cleanup() ;
+
+    Options options ;
+    options.create_if_missing = true ;
+    options.dump_when_close = false ;
+    options.write_ahead_log = true ;
+    options.wal_sync = mode ;
+    options.wal_sync_interval_ms = 10 ;
+    // 大 value 在日志里存的是 value log 的引用
+    options.value_log_threshold = 64 ;
+
+    map<string , string> expected ;
+    auto check = [&](Table& table) {
+        string value ;
+        for(auto &kv : expected) {
+            Status s = table.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second, s) ;
+        }
+        size_t count = 0 ;
+        for(auto it = table.new_iterator() ; it.good() ; it.next()) {
+            ++count ;
+        }
+        my_assert(count == expected.size(), Status::ok()) ;
+    } ;
+
+    // 多个线程同时写，一起提交；写到一半 dump 一次，dump 之前的写在数据文件里，之后的在新日志里
+    const int THREADS = 4 , KEYS = 500 ;
+    auto value_of = [](int t , int i) {
+        return i % 10 == 0 ? string(100 , 'a' + t) : "v" + to_string(t) + "-" + to_string(i) ;
+    } ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        vector<thread> threads ;
+        for(int t = 0 ; t < THREADS ; ++t) {
+            threads.emplace_back([&table , &value_of , t]() {
+                for(int i = 0 ; i < KEYS ; ++i) {
+                    Status ws = table.put("t" + to_string(t) + "-" + to_string(i) , value_of(t , i)) ;
+                    my_assert(ws.good() == true, ws) ;
+                }
+            }) ;
+        }
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        for(auto &th : threads) th.join() ;
+        for(int t = 0 ; t < THREADS ; ++t) {
+            for(int i = 0 ; i < KEYS ; ++i) {
+                expected["t" + to_string(t) + "-" + to_string(i)] = value_of(t , i) ;
+            }
+        }
+
+        // 同一批里同一个 key 的多次操作，重放以后还是最后一次生效
+        WriteBatch batch ;
+        batch.put("batch" , "1") ;
+        batch.del("t0-1") ;
+        batch.put("batch" , "2") ;
+        batch.put("t0-2" , string(200 , 'x')) ;
+        s = table.write(batch) ;
+        my_assert(s.good() == true, s) ;
+        expected["batch"] = "2" ;
+        expected.erase("t0-1") ;
+        expected["t0-2"] = string(200 , 'x') ;
+        s = table.del("t1-1") ;
+        my_assert(s.good() == true, s) ;
+        expected.erase("t1-1") ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // 第二次打开之前在日志末尾接上半条记录，重放的时候截掉，之后的写接在完整的记录后面
+    for(int round = 0 ; round < 2 ; ++round) {
+        if(round == 1) {
+            ofstream outfile(log_name , ios::binary | ios::app) ;
+            outfile << string("\x10\x00\x00\x00half" , 8) ;
+        }
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.put("round" + to_string(round) , "r") ;
+        my_assert(s.good() == true, s) ;
+        expected["round" + to_string(round)] = "r" ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // dump 成功以后日志清空，换下来的旧日志删掉
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        struct stat info ;
+        my_assert(stat(log_name.data() , &info) == 0 && info.st_size == 0, s) ;
+        my_assert(stat(old_log_name.data() , &info) != 0, s) ;
+        s = table.put("after-dump" , "1") ;
+        my_assert(s.good() == true, s) ;
+        expected["after-dump"] = "1" ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // 关掉日志以后打开，以前留下的日志照样重放，dump 以后删掉
+    options.write_ahead_log = false ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        struct stat info ;
+        my_assert(stat(log_name.data() , &info) != 0, s) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    cleanup() ;
+}
+
+// 增量 dump：只写改过和删掉的 key，open 的时候在数据文件上应用增量文件，攒多了重写数据文件
+void TABLE_INCREMENTAL_DUMP(MemtableType memtable){
+    const string name = "table_INCREMENTAL.txt" ;
+    auto delta_size = [&](size_t index) -> long {
+        struct stat info ;
+        return stat(DeltaFile::name(name , index).data() , &info) == 0 ? info.st_size : -1 ;
+    } ;
+    auto file_size = [](const string& file) -> long {
+        struct stat info ;
+        return stat(file.data() , &info) == 0 ? info.st_size : -1 ;
+    } ;
+    auto cleanup = [&]() {
+        remove(name.data()) ;
+        remove((name + TARGETCODE_FILE_EXT).data()) ;
+        remove((name + VALUE_LOG_FILE_EXT).data()) ;
+        for(size_t i = 1 ; i <= 4 ; ++i) remove(DeltaFile::name(name , i).data()) ;
+    } ;
+    cleanup() ;
+
+    Options options ;
+    options.memtable = memtable ;
+    options.create_if_missing = true ;
+    options.dump_when_close = true ;
+    options.incremental_dump = true ;
+    options.max_delta_files = 3 ;
+    options.value_log_threshold = 64 ;
+
+    map<string , string> expected ;
+    auto check = [&]() {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        string value ;
+        for(auto &kv : expected) {
+            s = table.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second, s) ;
+        }
+        size_t count = 0 ;
+        for(auto it = table.new_iterator() ; it.good() ; it.next()) {
+            ++count ;
+        }
+        my_assert(count == expected.size(), s) ;
+        options.dump_when_close = false ;
+        s = table.close() ;
+        options.dump_when_close = true ;
+        my_assert(s.good() == true, s) ;
+    } ;
+
+    // 第一次 dump 还没有数据文件，写完整的
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        for(int i = 0 ; i < 2000 ; ++i) {
+            string key = "key" + to_string(i) , value = i % 100 == 0 ? string(100 , 'L') : "value" + to_string(i) ;
+            s = table.put(key , value) ;
+            my_assert(s.good() == true, s) ;
+            expected[key] = value ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    const long base_size = file_size(name) ;
+    my_assert(base_size > 0 && delta_size(1) == -1, Status::ok()) ;
+    check() ;
+
+    // 之后每次只改几个 key，数据文件不变，增量文件的大小和改动的 key 数成正比
+    string saved_delta ;
+    for(int round = 1 ; round <= 3 ; ++round) {
+        {
+            Table table(options , name) ;
+            Status s = table.open() ;
+            my_assert(s.good() == true, s) ;
+            for(int i = 0 ; i < 10 ; ++i) {
+                string key = "key" + to_string(round * 10 + i) ;
+                s = table.put(key , "round" + to_string(round)) ;
+                my_assert(s.good() == true, s) ;
+                expected[key] = "round" + to_string(round) ;
+            }
+            WriteBatch batch ;
+            batch.del("key" + to_string(1000 + round)) ;
+            batch.put("new" + to_string(round) , string(200 , 'a' + round)) ;
+            s = table.write(batch) ;
+            my_assert(s.good() == true, s) ;
+            expected.erase("key" + to_string(1000 + round)) ;
+            expected["new" + to_string(round)] = string(200 , 'a' + round) ;
+            s = table.del("key" + to_string(1100 + round)) ;
+            my_assert(s.good() == true, s) ;
+            expected.erase("key" + to_string(1100 + round)) ;
+            s = table.close() ;
+            my_assert(s.good() == true, s) ;
+        }
+        my_assert(file_size(name) == base_size, Status::ok()) ;
+        my_assert(delta_size(round) > 0 && delta_size(round) < base_size / 10, Status::ok()) ;
+        if(round == 1) {
+            ifstream infile(DeltaFile::name(name , 1) , ios::binary) ;
+            saved_delta.assign(istreambuf_iterator<char>(infile) , istreambuf_iterator<char>()) ;
+        }
+        check() ;
+    }
+
+    // 攒够 max_delta_files 个以后重写数据文件，增量文件删掉
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        s = table.put("key0" , "merged") ;
+        my_assert(s.good() == true, s) ;
+        expected["key0"] = "merged" ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    my_assert(delta_size(1) == -1 && delta_size(4) == -1, Status::ok()) ;
+    check() ;
+
+    // 基于旧数据文件的增量文件对不上新的数据文件，不会被应用
+    {
+        ofstream outfile(DeltaFile::name(name , 1) , ios::binary | ios::trunc) ;
+        outfile << saved_delta ;
+    }
+    check() ;
+    cleanup() ;
+}
+
+void TABLE_DUMP_IO(DumpIO io){
+    const string name = "table_DUMP_IO.txt" ;
+    auto exists = [](const string& file) {
+        struct stat info ;
+        return stat(file.data() , &info) == 0 ;
+    } ;
+    remove(name.data()) ;
+    remove((name + TARGETCODE_FILE_EXT).data()) ;
+
+    Options options ;
+    options.create_if_missing = true ;
+    options.dump_when_close = true ;
+    options.dump_io = io ;
+
+    // 数据比 FileWriter 的几个缓冲区加起来还大，要分好几批写
+    map<string , string> expected ;
+    for(int round = 0 ; round < 2 ; ++round) {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        for(int i = 0 ; i < 50000 ; ++i) {
+            string key = "key" + to_string(i) ;
+            // 第二轮删掉一半、改掉一半，新文件比旧文件小，改名以后不能留下旧文件的尾巴
+            if(round == 1 && i % 2 == 0) {
+                s = table.del(key) ;
+                expected.erase(key) ;
+            } else {
+                string value = random_string(100) ;
+                s = table.put(key , value) ;
+                expected[key] = value ;
+            }
+            my_assert(s.good() == true, s) ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+        my_assert(exists(name) && !exists(name + ".tmp") && !exists(name + TARGETCODE_FILE_EXT), s) ;
+
+        Table reopened(options , name) ;
+        s = reopened.open() ;
+        my_assert(s.good() == true, s) ;
+        string value ;
+        for(auto &kv : expected) {
+            s = reopened.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second, s) ;
+        }
+        size_t count = 0 ;
+        for(auto it = reopened.new_iterator() ; it.good() ; it.next()) {
+            ++count ;
+        }
+        my_assert(count == expected.size(), s) ;
+        options.dump_when_close = false ;
+        s = reopened.close() ;
+        options.dump_when_close = true ;
+        my_assert(s.good() == true, s) ;
+    }
+    remove(name.data()) ;
+    remove((name + TARGETCODE_FILE_EXT).data()) ;
+}
+
+void TABLE_BACKGROUND_DUMP(MemtableType memtable){
+    const string name = "table_BACKGROUND.txt" ;
+    auto cleanup = [&]() {
+        remove(name.data()) ;
+        remove((name + TARGETCODE_FILE_EXT).data()) ;
+        remove((name + FILTER_FILE_EXT).data()) ;
+        remove((name + WAL_FILE_EXT).data()) ;
+        remove((name + WAL_OLD_FILE_EXT).data()) ;
+    } ;
+    cleanup() ;
+
+    Options options ;
+    options.memtable = memtable ;
+    options.create_if_missing = true ;
+    options.dump_when_close = false ;
+    options.background_dump = true ;
+    options.write_ahead_log = true ;
+    options.filter_expected_keys = 4096 ;
+
+    map<string , string> expected ;
+    // 读、multi_get、正反两个方向的遍历都和 expected 一样
+    auto check = [&](Table &table) {
+        Status s ;
+        string value ;
+        for(auto &kv : expected) {
+            s = table.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second, s) ;
+        }
+        for(const char *key : {"k1" , "k3" , "missing"}) {
+            if(expected.count(key) == 0) my_assert(table.get(key , &value).code() == Status::NOT_FOUND, s) ;
+        }
+        vector<ByteArray> keys = {"k0" , "k1" , "k2000" , "k5"} ;
+        vector<string> values ;
+        vector<Status> statuses ;
+        s = table.multi_get(keys , &values , &statuses) ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            auto it = expected.find(string(keys[i].data() , keys[i].size())) ;
+            my_assert(it == expected.end() ? statuses[i].code() == Status::NOT_FOUND : values[i] == it->second, statuses[i]) ;
+        }
+        auto forward = expected.begin() ;
+        auto it = table.new_iterator() ;
+        for( ; it.good() ; it.next() , ++forward) {
+            my_assert(forward != expected.end() && it.key() == forward->first && it.value() == forward->second, s) ;
+        }
+        my_assert(forward == expected.end(), s) ;
+        auto backward = expected.rbegin() ;
+        for(it.seek_to_last() ; it.good() ; it.prev() , ++backward) {
+            my_assert(backward != expected.rend() && it.key() == backward->first, s) ;
+        }
+        my_assert(backward == expected.rend(), s) ;
+        // 换方向
+        it.seek("k500") ;
+        it.prev() ;
+        it.next() ;
+        my_assert(it.good() && it.key() == expected.lower_bound("k500")->first, s) ;
+    } ;
+
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        for(int i = 0 ; i < 1000 ; ++i) {
+            s = table.put("k" + to_string(i) , "v0") ;
+            my_assert(s.good() == true, s) ;
+            expected["k" + to_string(i)] = "v0" ;
+        }
+        unique_ptr<Table::Snapshot> snapshot(new Table::Snapshot(table.snapshot())) ;
+
+        // dump 马上返回，后台写文件的时候接着写：写进新的内存表，删除的 key 在冻结的内存表里还有
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        my_assert(table.put("k0" , "new").good() && table.del("k1").good() && table.put("k2000" , "x").good(), s) ;
+        my_assert(table.del("k1").code() == Status::NOT_FOUND, s) ;
+        expected["k0"] = "new" ;
+        expected.erase("k1") ;
+        expected["k2000"] = "x" ;
+        check(table) ;
+
+        // dump 之前的快照看不到之后的写
+        string value ;
+        s = table.get("k1" , &value , snapshot.get()) ;
+        my_assert(s.good() && value == "v0", s) ;
+        s = table.get("k2000" , &value , snapshot.get()) ;
+        my_assert(s.code() == Status::NOT_FOUND, s) ;
+
+        s = table.wait_dump() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.get("k0" , &value , snapshot.get()) ;
+        my_assert(s.good() && value == "v0", s) ;
+        snapshot.reset() ;
+
+        // 第二次 dump 把新内存表合并进 base；之后的写只在日志里
+        my_assert(table.del("k3").good() && table.put("k1" , "again").good(), s) ;
+        expected.erase("k3") ;
+        expected["k1"] = "again" ;
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        WriteBatch batch ;
+        batch.del("k1") ;
+        batch.put("k4" , "late") ;
+        s = table.write(batch) ;
+        my_assert(s.good() == true, s) ;
+        expected.erase("k1") ;
+        expected["k4"] = "late" ;
+        s = table.wait_dump() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    {
+        // 文件里是第二次 dump 时的数据，之后的写从日志里重放回来
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // 一边写一边反复 dump，最后关闭的时候 dump 一次，重新打开以后什么都不少
+    options.dump_when_close = true ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        std::atomic<bool> stop(false) ;
+        std::atomic<int> written(0) ;
+        thread writer([&]() {
+            for(int i = 0 ; !stop ; ++i) {
+                Status ws = table.put("w" + to_string(i % 5000) , to_string(i)) ;
+                my_assert(ws.good() == true, ws) ;
+                if(i % 7 == 0) table.del("w" + to_string((i / 7) % 5000)) ;
+                written = i ;
+            }
+        }) ;
+        for(int round = 0 ; round < 5 ; ++round) {
+            s = table.dump() ;
+            my_assert(s.good() == true, s) ;
+            for(auto &kv : expected) {
+                string value ;
+                s = table.get(kv.first , &value) ;
+                my_assert(s.good() && value == kv.second, s) ;
+            }
+        }
+        while(written < 20000) this_thread::yield() ;
+        stop = true ;
+        writer.join() ;
+        for(auto it = table.new_iterator() ; it.good() ; it.next()) {
+            expected[string(it.key().data() , it.key().size())] = string(it.value().data() , it.value().size()) ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    options.background_dump = false ;
+    options.dump_when_close = false ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // 没有日志、关闭的时候不 dump：后台 dump 失败了的话 close 要返回它的错误，不能把没写出去的数据丢掉
+    options.background_dump = true ;
+    options.write_ahead_log = false ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        s = table.put("after-failed-dump" , "v") ;
+        my_assert(s.good() == true, s) ;
+        expected["after-failed-dump"] = "v" ;
+        // 临时文件的位置被目录占了，dump 写不出去
+        const string tmp_name = name + ".tmp" ;
+        my_assert(mkdir(tmp_name.data() , 0755) == 0, s) ;
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        s = table.close() ;
+        my_assert(s.code() == Status::IO_ERROR, s) ;
+        rmdir(tmp_name.data()) ;
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    cleanup() ;
+}
+
+void TABLE_DATA_FILE(){
+    const string name = "table_DATA_FILE.txt" ;
+    auto exists = [](const string& file) {
+        struct stat info ;
+        return stat(file.data() , &info) == 0 ;
+    } ;
+    auto read_file = [](const string& file) {
+        ifstream in(file , ios::binary) ;
+        return string((istreambuf_iterator<char>(in)) , istreambuf_iterator<char>()) ;
+    } ;
+    auto write_file = [](const string& file , const string& data) {
+        ofstream out(file , ios::binary | ios::trunc) ;
+        out.write(data.data() , data.size()) ;
+    } ;
+    remove(name.data()) ;
+    remove((name + VALUE_LOG_FILE_EXT).data()) ;
+    remove((name + TARGETCODE_FILE_EXT).data()) ;
+
+    Options options ;
+    options.create_if_missing = true ;
+    options.dump_when_close = true ;
+    options.block_size = 1024 ;
+    options.value_log_threshold = 200 ;
+
+    // 相邻的 key 有很长的公共前缀，一部分 value 在 value log 里
+    map<string , string> expected ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        for(int i = 0 ; i < 5000 ; ++i) {
+            char key[32] ;
+            snprintf(key , sizeof(key) , "user:%08d" , i * 2) ;
+            string value = random_string(i % 10 == 0 ? 300 : 20) ;
+            s = table.put(key , value) ;
+            my_assert(s.good() == true, s) ;
+            expected[key] = value ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // 直接用 DataFileReader 读：块的个数、顺序读每个块、二分查找
+    string file = read_file(name) ;
+    {
+        DataFileReader reader ;
+        my_assert(DataFileReader::is_block_format(file.data() , file.size()) && reader.open(file.data() , file.size()) , Status::io_error("open data file")) ;
+        my_assert(reader.entries() == expected.size() && reader.block_count() > 10 , Status::io_error("entries or blocks")) ;
+        auto it = expected.begin() ;
+        for(size_t i = 0 ; i < reader.block_count() ; ++i) {
+            bool ok = reader.read_block(i , [&](const string& key , const string& value) {
+                if(it == expected.end() || key != it->first) return false ;
+                // 大 value 在 value log 里，块里只有引用
+                bool same = it->second.size() > 200 ? value[0] == VALUE_LOG_REF : value == string(1 , INLINE_VALUE) + it->second ;
+                ++it ;
+                return same ;
+            }) ;
+            my_assert(ok , Status::io_error("read block " + to_string(i))) ;
+        }
+        my_assert(it == expected.end() , Status::io_error("missing entries")) ;
+        string value ;
+        for(auto &kv : expected) {
+            Status s = reader.get(kv.first , &value) ;
+            my_assert(s.good() && (kv.second.size() > 200 || value.substr(1) == kv.second) , s) ;
+        }
+        for(const string key : {"a" , "user:" , "user:00000001" , "user:00004999" , "user:99999999" , "z"}) {
+            Status s = reader.get(key , &value) ;
+            my_assert(s.code() == Status::NOT_FOUND , s) ;
+        }
+        // 几个线程分段解码，交出来的顺序和一个一个块读的一样
+        it = expected.begin() ;
+        bool ok = reader.read_blocks(4 , [&](const string& key , const string&) {
+            return it != expected.end() && key == (it++)->first ;
+        }) ;
+        my_assert(ok && it == expected.end() , Status::io_error("read blocks")) ;
+
+        // 改掉第一个数据块里的一个字节，这个块的 crc32c 对不上
+        string corrupted = file ;
+        corrupted[10] ^= 0x40 ;
+        DataFileReader bad ;
+        my_assert(bad.open(corrupted.data() , corrupted.size()) , Status::io_error("open corrupted")) ;
+        Status s = bad.get(expected.begin()->first , &value) ;
+        my_assert(s.code() == Status::IO_ERROR , s) ;
+        my_assert(bad.read_block(0 , [](const string& , const string&) { return true ; }) == false , s) ;
+        my_assert(bad.read_blocks(4 , [](const string& , const string&) { return true ; }) == false , s) ;
+        write_file(name , corrupted) ;
+        Options parallel = options ;
+        parallel.load_threads = 4 ;
+        for(const Options &o : {options , parallel}) {
+            Table table(o , name) ;
+            s = table.open() ;
+            my_assert(s.good() == false , s) ;
+        }
+        // mmap_reads 打开的时候只读索引，读到坏了的块的时候 get 和 multi_get 返回 io_error，不是没有找到
+        {
+            Options mapped = options ;
+            mapped.mmap_reads = true ;
+            mapped.dump_when_close = false ;
+            Table table(mapped , name) ;
+            s = table.open() ;
+            my_assert(s.good() == true , s) ;
+            s = table.get(expected.begin()->first , &value) ;
+            my_assert(s.code() == Status::IO_ERROR , s) ;
+            vector<string> values ;
+            vector<Status> statuses ;
+            s = table.multi_get({ByteArray(expected.rbegin()->first) , ByteArray(expected.begin()->first)} , &values , &statuses) ;
+            my_assert(s.code() == Status::IO_ERROR , s) ;
+            s = table.get(expected.rbegin()->first , &value) ;
+            my_assert(s.good() && value == expected.rbegin()->second , s) ;
+            // 删坏块里的 key 不知道它在不在，当成在，写 tombstone；之后读到的是 tombstone，不是坏块
+            auto second = std::next(expected.begin()) ;
+            s = table.del(expected.begin()->first) ;
+            my_assert(s.good() == true , s) ;
+            WriteBatch batch ;
+            batch.del(second->first) ;
+            s = table.write(batch) ;
+            my_assert(s.good() == true , s) ;
+            s = table.get(expected.begin()->first , &value) ;
+            my_assert(s.code() == Status::NOT_FOUND , s) ;
+            s = table.get(second->first , &value) ;
+            my_assert(s.code() == Status::NOT_FOUND , s) ;
+            // 遍历到坏块提前停下，scan 和迭代器都报 io_error；dump 不能把少了 key 的文件写出去覆盖原来的
+            vector<pair<string , string>> rows ;
+            s = table.scan("" , "" , 0 , &rows) ;
+            my_assert(s.code() == Status::IO_ERROR , s) ;
+            {
+                Table::Iterator it = table.new_iterator() ;
+                while(it.good()) it.next() ;
+                my_assert(it.status().code() == Status::IO_ERROR , it.status()) ;
+            }
+            s = table.dump() ;
+            my_assert(s.code() == Status::IO_ERROR , s) ;
+            my_assert(read_file(name) == corrupted , s) ;
+            s = table.close() ;
+            my_assert(s.good() == true , s) ;
+        }
+        write_file(name , file) ;
+
+        // 多线程加载的表和写进去的一样
+        Table table(parallel , name) ;
+        s = table.open() ;
+        my_assert(s.good() == true , s) ;
+        for(auto &kv : expected) {
+            s = table.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second , s) ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true , s) ;
+    }
+
+    // 以前的格式：entry 一个接一个，编码表在单独的文件里；打开以后再 dump 就换成新格式
+    {
+        HuffmanTree tree ;
+        map<string , string> legacy ;
+        for(int i = 0 ; i < 100 ; ++i) {
+            legacy["old" + to_string(1000 + i)] = random_string(30) ;
+        }
+        for(auto &kv : legacy) {
+            tree.insert_word(kv.first) ;
+            tree.insert_word(kv.second) ;
+        }
+        my_assert(tree.build_huffmanTree() && tree.save_encryptedFile((name + TARGETCODE_FILE_EXT).data()) , Status::io_error("code file")) ;
+        string data ;
+        for(auto &kv : legacy) {
+            tree.encode_string(kv.first , &data) ;
+            data.push_back(INLINE_VALUE) ;
+            tree.encode_string(kv.second , &data) ;
+        }
+        write_file(name , data) ;
+
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        string value ;
+        for(auto &kv : legacy) {
+            s = table.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second , s) ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+        file = read_file(name) ;
+        my_assert(DataFileReader::is_block_format(file.data() , file.size()) && !exists(name + TARGETCODE_FILE_EXT) , s) ;
+
+        Table reopened(options , name) ;
+        s = reopened.open() ;
+        my_assert(s.good() == true, s) ;
+        for(auto &kv : legacy) {
+            s = reopened.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second , s) ;
+        }
+        options.dump_when_close = false ;
+        s = reopened.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    remove(name.data()) ;
+    remove((name + VALUE_LOG_FILE_EXT).data()) ;
+}
+
+void TABLE_MMAP_READS(MemtableType memtable , bool background){
+    const string name = "table_MMAP_READS.txt" ;
+    auto cleanup = [&]() {
+        remove(name.data()) ;
+        remove((name + FILTER_FILE_EXT).data()) ;
+        remove((name + WAL_FILE_EXT).data()) ;
+        remove((name + WAL_OLD_FILE_EXT).data()) ;
+    } ;
+    cleanup() ;
+
+    Options options ;
+    options.memtable = memtable ;
+    options.create_if_missing = true ;
+    options.dump_when_close = true ;
+    options.block_size = 1024 ;
+    options.write_ahead_log = true ;
+    options.filter_expected_keys = 40000 ;
+
+    map<string , string> expected ;
+    auto key_of = [](int i) {
+        char key[32] ;
+        snprintf(key , sizeof(key) , "key%06d" , i) ;
+        return string(key) ;
+    } ;
+    // 读、multi_get、正反两个方向的遍历、seek 都和 expected 一样
+    auto check = [&](Table &table) {
+        Status s ;
+        string value ;
+        for(auto &kv : expected) {
+            s = table.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second, s) ;
+        }
+        vector<ByteArray> keys = {"a" , "key000000" , "key000001" , "key010001" , "key019999" , "key030000" , "z"} ;
+        vector<string> values ;
+        vector<Status> statuses ;
+        s = table.multi_get(keys , &values , &statuses) ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            auto it = expected.find(string(keys[i].data() , keys[i].size())) ;
+            my_assert(it == expected.end() ? statuses[i].code() == Status::NOT_FOUND : values[i] == it->second, statuses[i]) ;
+        }
+        auto forward = expected.begin() ;
+        auto it = table.new_iterator() ;
+        for( ; it.good() ; it.next() , ++forward) {
+            my_assert(forward != expected.end() && it.key() == forward->first && it.value() == forward->second, s) ;
+        }
+        my_assert(forward == expected.end(), s) ;
+        auto backward = expected.rbegin() ;
+        for(it.seek_to_last() ; it.good() ; it.prev() , ++backward) {
+            my_assert(backward != expected.rend() && it.key() == backward->first, s) ;
+        }
+        my_assert(backward == expected.rend(), s) ;
+        for(const string key : {"a" , "key005000" , "key005000x" , "key012345" , "key025000"}) {
+            it.seek(key) ;
+            auto lower = expected.lower_bound(key) ;
+            my_assert(lower == expected.end() ? !it.good() : (it.good() && it.key() == lower->first), s) ;
+        }
+        vector<pair<string , string>> result ;
+        s = table.scan("key001000" , "key001100" , 0 , &result) ;
+        my_assert(s.good() && result.size() == static_cast<size_t>(distance(expected.lower_bound("key001000") , expected.lower_bound("key001100"))), s) ;
+    } ;
+
+    // 先用默认的方式写出一个数据文件
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        for(int i = 0 ; i < 20000 ; ++i) {
+            s = table.put(key_of(i) , "value" + to_string(i)) ;
+            my_assert(s.good() == true, s) ;
+            expected[key_of(i)] = "value" + to_string(i) ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    options.mmap_reads = true ;
+    options.background_dump = background ;
+    // mmap_reads 的时候 dump 总是写完整的数据文件，打开 incremental_dump 也不会写增量文件
+    options.incremental_dump = true ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+
+        // 写进内存表：改文件里的 key、删文件里的 key、加新的 key
+        unique_ptr<Table::Snapshot> snapshot(new Table::Snapshot(table.snapshot())) ;
+        for(int i = 0 ; i < 20000 ; i += 7) {
+            s = table.put(key_of(i) , "updated") ;
+            my_assert(s.good() == true, s) ;
+            expected[key_of(i)] = "updated" ;
+        }
+        for(int i = 1 ; i < 20000 ; i += 5) {
+            s = table.del(key_of(i)) ;
+            my_assert(s.good() == true, s) ;
+            expected.erase(key_of(i)) ;
+        }
+        my_assert(table.del(key_of(1)).code() == Status::NOT_FOUND, s) ;
+        for(int i = 20000 ; i < 21000 ; ++i) {
+            s = table.put(key_of(i) , "new") ;
+            my_assert(s.good() == true, s) ;
+            expected[key_of(i)] = "new" ;
+        }
+        check(table) ;
+        string value ;
+        s = table.get(key_of(1) , &value , snapshot.get()) ;
+        my_assert(s.good() && value == "value1", s) ;
+
+        // dump 以后读新的数据文件，dump 之前的快照还是原来的样子
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        s = table.wait_dump() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.get(key_of(7) , &value , snapshot.get()) ;
+        my_assert(s.good() && value == "value7", s) ;
+        snapshot.reset() ;
+        struct stat delta_info ;
+        my_assert(stat(DeltaFile::name(name , 1).data() , &delta_info) != 0, s) ;
+
+        // dump 以后的写只在内存表和日志里，关闭的时候再 dump 一次
+        for(int i = 2 ; i < 20000 ; i += 11) {
+            s = table.del(key_of(i)) ;
+            expected.erase(key_of(i)) ;
+        }
+        s = table.put("key010001" , "again") ;
+        expected["key010001"] = "again" ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    // 不 dump 就关闭，再打开的时候日志重放进内存表，删除记成 tombstone
+    options.dump_when_close = false ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        for(int i = 3 ; i < 20000 ; i += 13) {
+            s = table.del(key_of(i)) ;
+            expected.erase(key_of(i)) ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    // 整个加载进内存表的方式读出来也一样
+    options.mmap_reads = false ;
+    options.background_dump = false ;
+    options.incremental_dump = false ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    cleanup() ;
+}
+
+void TABLE_LSM(MemtableType memtable , bool background){
+    const string name = "table_LSM.txt" ;
+    // 当前目录下的 run 文件按编号排好，合并多了编号会很大
+    auto run_files = [&]() {
+        map<uint64_t , string> files ;
+        const string prefix = name + RUN_FILE_EXT ;
+        DIR *dir = opendir(".") ;
+        for(dirent *entry = dir != nullptr ? readdir(dir) : nullptr ; entry != nullptr ; entry = readdir(dir)) {
+            string file = entry->d_name ;
+            if(file.compare(0 , prefix.size() , prefix) == 0 && file.find(FILTER_FILE_EXT) == string::npos) {
+                files[stoull(file.substr(prefix.size()))] = file ;
+            }
+        }
+        if(dir != nullptr) {
+            closedir(dir) ;
+        }
+        vector<string> names ;
+        for(auto &kv : files) {
+            names.push_back(kv.second) ;
+        }
+        return names ;
+    } ;
+    auto cleanup = [&]() {
+        remove(name.data()) ;
+        remove((name + FILTER_FILE_EXT).data()) ;
+        remove((name + WAL_FILE_EXT).data()) ;
+        remove((name + WAL_OLD_FILE_EXT).data()) ;
+        for(const string &run_name : run_files()) {
+            remove(run_name.data()) ;
+            remove((run_name + FILTER_FILE_EXT).data()) ;
+        }
+    } ;
+    cleanup() ;
+
+    Options options ;
+    options.memtable = memtable ;
+    options.create_if_missing = true ;
+    options.dump_when_close = true ;
+    options.block_size = 1024 ;
+    options.write_ahead_log = true ;
+
+    map<string , string> expected ;
+    auto key_of = [](int i) {
+        char key[32] ;
+        snprintf(key , sizeof(key) , "key%06d" , i) ;
+        return string(key) ;
+    } ;
+    // 读、multi_get、正反两个方向的遍历、seek 都和 expected 一样
+    auto check = [&](Table &table) {
+        Status s ;
+        string value ;
+        for(auto &kv : expected) {
+            s = table.get(kv.first , &value) ;
+            my_assert(s.good() && value == kv.second, s) ;
+        }
+        for(int i = 1 ; i < 30000 ; i += 5) {
+            if(expected.count(key_of(i)) == 0) {
+                my_assert(table.get(key_of(i) , &value).code() == Status::NOT_FOUND, s) ;
+            }
+        }
+        vector<ByteArray> keys = {"a" , "key000000" , "key000001" , "key010001" , "key019999" , "key030000" , "z"} ;
+        vector<string> values ;
+        vector<Status> statuses ;
+        s = table.multi_get(keys , &values , &statuses) ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            auto it = expected.find(string(keys[i].data() , keys[i].size())) ;
+            my_assert(it == expected.end() ? statuses[i].code() == Status::NOT_FOUND : values[i] == it->second, statuses[i]) ;
+        }
+        auto forward = expected.begin() ;
+        auto it = table.new_iterator() ;
+        for( ; it.good() ; it.next() , ++forward) {
+            my_assert(forward != expected.end() && it.key() == forward->first && it.value() == forward->second, s) ;
+        }
+        my_assert(forward == expected.end(), s) ;
+        auto backward = expected.rbegin() ;
+        for(it.seek_to_last() ; it.good() ; it.prev() , ++backward) {
+            my_assert(backward != expected.rend() && it.key() == backward->first, s) ;
+        }
+        my_assert(backward == expected.rend(), s) ;
+        for(const string key : {"a" , "key005000" , "key005000x" , "key012345" , "key025000"}) {
+            it.seek(key) ;
+            auto lower = expected.lower_bound(key) ;
+            my_assert(lower == expected.end() ? !it.good() : (it.good() && it.key() == lower->first), s) ;
+        }
+        vector<pair<string , string>> result ;
+        s = table.scan("key001000" , "key001100" , 0 , &result) ;
+        my_assert(s.good() && result.size() == static_cast<size_t>(distance(expected.lower_bound("key001000") , expected.lower_bound("key001100"))), s) ;
+    } ;
+    // 读清单，看各层有几个 run；关闭之前等合并完了 L0 的 run 比 l0_compaction_trigger 少，关闭的时候最多再 flush 一个
+    auto check_runs = [&](size_t *l0 , size_t *l1) {
+        ifstream in(name , ios::binary) ;
+        string data((istreambuf_iterator<char>(in)) , istreambuf_iterator<char>()) ;
+        RunSet runs(name , options) ;
+        my_assert(runs.open(data.data() , data.size()) == true, Status::ok()) ;
+        *l0 = runs.run_count(0) ;
+        *l1 = runs.run_count(1) ;
+        my_assert(*l0 <= options.l0_compaction_trigger, Status::ok()) ;
+    } ;
+
+    // 先用默认的方式写出一个数据文件，第一次用 lsm 打开的时候加载进内存表
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        for(int i = 0 ; i < 5000 ; ++i) {
+            s = table.put(key_of(i) , "value" + to_string(i)) ;
+            my_assert(s.good() == true, s) ;
+            expected[key_of(i)] = "value" + to_string(i) ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    options.lsm = true ;
+    options.background_dump = background ;
+    options.write_buffer_size = 256 * 1024 ;
+    options.max_file_size = 64 * 1024 ;
+    options.l0_compaction_trigger = 3 ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+
+        // 写满写缓冲自己 flush 成 run，run 够多了合并
+        for(int i = 5000 ; i < 30000 ; ++i) {
+            s = table.put(key_of(i) , "value" + to_string(i)) ;
+            my_assert(s.good() == true, s) ;
+            expected[key_of(i)] = "value" + to_string(i) ;
+        }
+        unique_ptr<Table::Snapshot> snapshot(new Table::Snapshot(table.snapshot())) ;
+        for(int i = 0 ; i < 30000 ; i += 7) {
+            s = table.put(key_of(i) , "updated") ;
+            my_assert(s.good() == true, s) ;
+            expected[key_of(i)] = "updated" ;
+        }
+        for(int i = 1 ; i < 30000 ; i += 5) {
+            s = table.del(key_of(i)) ;
+            my_assert(s.good() == true, s) ;
+            expected.erase(key_of(i)) ;
+        }
+        my_assert(table.del(key_of(1)).code() == Status::NOT_FOUND, s) ;
+        WriteBatch batch ;
+        for(int i = 30000 ; i < 31000 ; ++i) {
+            batch.put(key_of(i) , "batch") ;
+            expected[key_of(i)] = "batch" ;
+        }
+        s = table.write(batch) ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        // 快照拿着它那时候的 run，合并掉的 run 文件删了也还能读
+        s = table.wait_dump() ;
+        my_assert(s.good() == true, s) ;
+        string value ;
+        s = table.get(key_of(1) , &value , snapshot.get()) ;
+        my_assert(s.good() && value == "value1", s) ;
+        s = table.get(key_of(7) , &value , snapshot.get()) ;
+        my_assert(s.good() && value == "value7", s) ;
+        snapshot.reset() ;
+
+        s = table.dump() ;
+        my_assert(s.good() == true, s) ;
+        s = table.wait_dump() ;
+        my_assert(s.good() == true, s) ;
+        s = table.wait_compaction() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    size_t l0 , l1 ;
+    check_runs(&l0 , &l1) ;
+    my_assert(l1 > 1, Status::ok()) ;
+
+    // 不 dump 就关闭，再打开的时候日志重放进内存表，删除记成 tombstone
+    options.dump_when_close = false ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        for(int i = 3 ; i < 30000 ; i += 13) {
+            s = table.del(key_of(i)) ;
+            expected.erase(key_of(i)) ;
+        }
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    options.dump_when_close = true ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.wait_compaction() ;
+        my_assert(s.good() == true, s) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    check_runs(&l0 , &l1) ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // 分层合并：L1 往下每一层比目标大小大了，就挑一个文件和下一层重叠的文件合并；合并完每一层都不比目标大小大，
+    // 合并的时候读写不停，快照拿着它那时候的 run，合并掉的文件删了也还能读
+    options.max_file_size = 16 * 1024 ;
+    options.max_bytes_for_level_base = 64 * 1024 ;
+    options.level_size_multiplier = 2 ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        unique_ptr<Table::Snapshot> snapshot(new Table::Snapshot(table.snapshot())) ;
+        const map<string , string> before = expected ;
+        // key 打乱了写，每个 run 都和下面每一层重叠
+        for(int i = 0 ; i < 30000 ; ++i) {
+            int k = static_cast<int>(i * 7919LL % 30000) ;
+            if(k % 11 == 0) {
+                s = table.del(key_of(k)) ;
+                my_assert(s.good() || s.code() == Status::NOT_FOUND, s) ;
+                expected.erase(key_of(k)) ;
+            } else {
+                s = table.put(key_of(k) , "level" + to_string(k)) ;
+                my_assert(s.good() == true, s) ;
+                expected[key_of(k)] = "level" + to_string(k) ;
+            }
+        }
+        s = table.wait_dump() ;
+        my_assert(s.good() == true, s) ;
+        s = table.wait_compaction() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        auto old = before.begin() ;
+        for(auto it = table.new_iterator(snapshot.get()) ; it.good() ; it.next() , ++old) {
+            my_assert(old != before.end() && it.key() == old->first && it.value() == old->second, s) ;
+        }
+        my_assert(old == before.end(), s) ;
+        snapshot.reset() ;
+
+        ifstream in(name , ios::binary) ;
+        string data((istreambuf_iterator<char>(in)) , istreambuf_iterator<char>()) ;
+        RunSet runs(name , options) ;
+        my_assert(runs.open(data.data() , data.size()) == true, Status::ok()) ;
+        my_assert(runs.needs_compaction() == false, Status::ok()) ;
+        uint64_t target = options.max_bytes_for_level_base ;
+        int deepest = 0 ;
+        for(int level = 1 ; level < RunSet::LEVELS ; ++level) {
+            if(runs.run_count(level) > 0) {
+                deepest = level ;
+            }
+            my_assert(level == RunSet::LEVELS - 1 || runs.level_size(level) < target, Status::ok()) ;
+            target *= options.level_size_multiplier ;
+        }
+        my_assert(deepest > 2, Status::ok()) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.good() == true, s) ;
+        check(table) ;
+        s = table.close() ;
+        my_assert(s.good() == true, s) ;
+    }
+
+    // L0 的 run 中间一个数据块坏了，合并返回 io_error，不写清单，合并的输入都还在
+    {
+        auto read_manifest = [&]() {
+            ifstream in(name , ios::binary) ;
+            return string((istreambuf_iterator<char>(in)) , istreambuf_iterator<char>()) ;
+        } ;
+        string manifest = read_manifest() ;
+        unique_ptr<RunSet> runs(new RunSet(name , options)) ;
+        my_assert(runs->open(manifest.data() , manifest.size()) == true, Status::ok()) ;
+        for(int round = 0 ; round < 3 ; ++round) {
+            SkipList memtable ;
+            for(int i = round ; i < 30000 ; i += 2) {
+                memtable.put(key_of(i) , string(1 , INLINE_VALUE) + "corrupted") ;
+            }
+            RunSet *next = nullptr ;
+            Status s = runs->flush(&memtable , &next) ;
+            my_assert(s.good() == true, s) ;
+            runs.reset(next) ;
+        }
+        my_assert(runs->run_count(0) >= options.l0_compaction_trigger, Status::ok()) ;
+        runs.reset() ;
+        vector<string> files = run_files() ;
+        // 最后 flush 的 run 编号最大，改掉它中间的一个字节，第一块和最后一块还是好的，打开的时候看不出来
+        {
+            fstream out(files.back() , ios::in | ios::out | ios::binary) ;
+            out.seekg(0 , ios::end) ;
+            streamoff middle = out.tellg() / 2 ;
+            out.seekg(middle) ;
+            char byte = static_cast<char>(out.get()) ^ 0x40 ;
+            out.seekp(middle) ;
+            out.put(byte) ;
+        }
+        manifest = read_manifest() ;
+        runs.reset(new RunSet(name , options)) ;
+        my_assert(runs->open(manifest.data() , manifest.size()) == true, Status::ok()) ;
+        RunSet::Compaction c ;
+        my_assert(runs->pick_compaction(&c) == true && c.level == 0, Status::ok()) ;
+        Status s = runs->compact(&c) ;
+        my_assert(s.code() == Status::IO_ERROR && c.outputs.empty(), s) ;
+        my_assert(read_manifest() == manifest, s) ;
+        for(const string &file : files) {
+            my_assert(ifstream(file).good(), Status::io_error(file)) ;
+        }
+    }
+
+    // 没有打开 lsm 的话打不开
+    options.lsm = false ;
+    {
+        Table table(options , name) ;
+        Status s = table.open() ;
+        my_assert(s.code() == Status::INVALID_OPERATION, s) ;
+    }
+    cleanup() ;
+}
+
 void INVALID_OPERATION(){
     // double open / close
     {
@@ -206,6 +1965,17 @@ void INVALID_OPERATION(){
         my_assert(s.good() == false, s) ; 
     }
 
+    // skiplist_branching 不是不小于 2 的 2 的幂
+    for(int branching : {0 , 1 , 3 , 6 , -4}) {
+        Options options ; 
+        options.create_if_missing = true ; 
+        options.dump_when_close = false ; 
+        options.skiplist_branching = branching ; 
+        Table table(options , RANDOM_NAME) ; 
+        Status s = table.open() ; 
+        my_assert(s.code() == Status::INVALID_OPERATION, s) ; 
+    }
+
     // file is not exists and 
     {
         Options options ; 
@@ -223,11 +1993,65 @@ int main() {
     // // check table put-insert read update delete 
     // TABLE_CRUD() ; 
 
-    // // check some invalid operations 
-    // INVALID_OPERATION() ;
+    // check some invalid operations 
+    INVALID_OPERATION() ;
 
     // check dump table and load table 
-    LOAD_AND_DUMP() ; 
+    LOAD_AND_DUMP(MemtableType::SKIPLIST) ; 
+    LOAD_AND_DUMP(MemtableType::BTREE) ; 
+
+    // check range / prefix scans and iterators, on both memtable engines
+    TABLE_SCAN(MemtableType::SKIPLIST) ;
+    TABLE_SCAN(MemtableType::BTREE) ;
+
+    // check batched get, with and without the hash index
+    TABLE_MULTI_GET(false) ;
+    TABLE_MULTI_GET(true) ;
+
+    // check atomic write batch
+    TABLE_WRITE_BATCH() ;
+
+    // check hash-sharded table
+    SHARDED_TABLE() ;
+
+    // check point-in-time snapshots
+    TABLE_SNAPSHOT(MemtableType::SKIPLIST) ;
+    TABLE_SNAPSHOT(MemtableType::BTREE) ;
+
+    // check negative-lookup filter
+    TABLE_FILTER() ;
+
+    // check keys / values longer than 255 bytes, with and without the value log
+    TABLE_LARGE_VALUE(0) ;
+    TABLE_LARGE_VALUE(1024) ;
+
+    // check crash recovery from the write-ahead log, for each sync mode
+    TABLE_WAL(WalSyncMode::NONE) ;
+    TABLE_WAL(WalSyncMode::PER_BATCH) ;
+    TABLE_WAL(WalSyncMode::INTERVAL) ;
+
+    // check incremental dumps with delta files, on both memtable engines
+    TABLE_INCREMENTAL_DUMP(MemtableType::SKIPLIST) ;
+    TABLE_INCREMENTAL_DUMP(MemtableType::BTREE) ;
+
+    // check the buffered dump writer, with pwritev and with io_uring (falls back to pwritev without it)
+    TABLE_DUMP_IO(DumpIO::PWRITEV) ;
+    TABLE_DUMP_IO(DumpIO::IO_URING) ;
+
+    // check dumps from a frozen memtable on a background thread, on both memtable engines
+    TABLE_BACKGROUND_DUMP(MemtableType::SKIPLIST) ;
+    TABLE_BACKGROUND_DUMP(MemtableType::BTREE) ;
+
+    // check the block-based data file: index, restart points, checksums and the old format
+    TABLE_DATA_FILE() ;
+
+    // check serving reads from the mapped data file with the memtable as a write buffer
+    TABLE_MMAP_READS(MemtableType::SKIPLIST , false) ;
+    TABLE_MMAP_READS(MemtableType::BTREE , true) ;
+
+    // check the LSM mode: flushes to sorted runs, compaction into size-bounded files, merged reads
+    TABLE_LSM(MemtableType::SKIPLIST , false) ;
+    TABLE_LSM(MemtableType::BTREE , true) ;
 
     // Options options ; 
     // options.create_if_missing = true ; 
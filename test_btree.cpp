@@ -0,0 +1,324 @@
+#include "btree.h"
+#include "skiplist.h"
+#include <assert.h>
+#include <thread>
+#include <algorithm>
+#include <random>
+#include <map>
+using namespace table ;
+using namespace std ;
+
+static string make_key(int i) {
+    char key[16] ;
+    snprintf(key , sizeof(key) , "k%07d" , i) ;
+    return key ;
+}
+
+// 两种内存表都要通过的基本语义
+void crud_test(Memtable *memtable) {
+    bool existed = true ;
+    string value ;
+    memtable->put("f" , "f" , &existed) ;
+    assert(existed == false) ;
+    memtable->put("a" , "a") ;
+    memtable->put("z" , "z") ;
+    memtable->put("f" , "ff" , &existed) ;
+    assert(existed == true) ;
+    assert(memtable->get("f" , &value) == true && value == "ff") ;
+    assert(memtable->get("b" , &value) == false) ;
+    assert(memtable->get("a" , nullptr) == true) ;
+
+    assert(memtable->del("a") == true) ;
+    assert(memtable->del("a") == false) ;
+    assert(memtable->del("b") == false) ;
+    assert(memtable->get("a" , &value) == false) ;
+    memtable->put("a" , "again" , &existed) ;
+    assert(existed == false) ;
+
+    auto it = memtable->new_iterator() ;
+    assert(it->good() && it->key() == "a" && it->value() == "again") ;
+    it->next() ;
+    assert(it->good() && it->key() == "f") ;
+    it->next() ;
+    assert(it->good() && it->key() == "z") ;
+    it->next() ;
+    assert(it->good() == false) ;
+    it->seek("b") ;
+    assert(it->good() && it->key() == "f") ;
+    it->prev() ;
+    assert(it->good() && it->key() == "a") ;
+    it->prev() ;
+    assert(it->good() == false) ;
+    it->seek_to_last() ;
+    assert(it->good() && it->key() == "z") ;
+}
+
+// 随机插入删除，和 std::map 对比，节点分裂、合并、借 key 都会走到
+void random_test() {
+    BTree *tree = new BTree() ;
+    map<string , string> expect ;
+    mt19937 rng(20240601) ;
+    const int KEYS = 20000 ;
+    for(int round = 0 ; round < 200000 ; ++round) {
+        string key = make_key(rng() % KEYS) ;
+        int op = rng() % 10 ;
+        if(op < 5) {
+            string value = "v" + to_string(round) ;
+            bool existed ;
+            tree->put(key , value , &existed) ;
+            assert(existed == (expect.count(key) == 1)) ;
+            expect[key] = value ;
+        } else if(op < 8) {
+            assert(tree->del(key) == (expect.erase(key) == 1)) ;
+        } else {
+            string value ;
+            auto found = expect.find(key) ;
+            assert(tree->get(key , &value) == (found != expect.end())) ;
+            assert(found == expect.end() || value == found->second) ;
+        }
+        // 中途把大部分 key 删掉，树会合并节点、变矮
+        if(round == 100000) {
+            for(int i = 0 ; i < KEYS ; ++i) {
+                if(i % 50 != 0) {
+                    string k = make_key(i) ;
+                    assert(tree->del(k) == (expect.erase(k) == 1)) ;
+                }
+            }
+            assert(tree->height() <= 2) ;
+        }
+    }
+    auto it = tree->new_iterator() ;
+    for(auto &kv : expect) {
+        assert(it->good() && it->key() == kv.first && it->value() == kv.second) ;
+        it->next() ;
+    }
+    assert(it->good() == false) ;
+    // 反向遍历
+    it->seek_to_last() ;
+    for(auto kv = expect.rbegin() ; kv != expect.rend() ; ++kv) {
+        assert(it->good() && it->key() == kv->first) ;
+        it->prev() ;
+    }
+    assert(it->good() == false) ;
+
+    // 全删掉以后内存都还给了内存池，再插回去不用再向系统要
+    for(auto &kv : expect) {
+        assert(tree->del(kv.first) == true) ;
+    }
+    assert(tree->height() == 1) ;
+    assert(tree->new_iterator()->good() == false) ;
+    size_t usage = tree->memory_usage() ;
+    for(auto &kv : expect) {
+        tree->put(kv.first , kv.second) ;
+    }
+    assert(tree->memory_usage() == usage) ;
+    delete tree ;
+}
+
+// 迭代器在两步之间树被改过的话按当前 key 重新定位
+void iterator_test() {
+    BTree *tree = new BTree() ;
+    for(int i = 0 ; i < 1000 ; i += 2) {
+        tree->put(make_key(i) , "v") ;
+    }
+    auto it = tree->new_iterator() ;
+    it->seek(make_key(100)) ;
+    assert(it->good() && it->key() == make_key(100)) ;
+    // 把后面的 key 删掉一大片，再在前后插几个
+    for(int i = 102 ; i < 600 ; i += 2) {
+        assert(tree->del(make_key(i)) == true) ;
+    }
+    tree->put(make_key(101) , "new") ;
+    tree->put(make_key(99) , "new") ;
+    assert(it->key() == make_key(100)) ;
+    it->next() ;
+    assert(it->good() && it->key() == make_key(101) && it->value() == "new") ;
+    it->next() ;
+    assert(it->good() && it->key() == make_key(600)) ;
+    // 当前 key 被删掉了也能往前走
+    assert(tree->del(make_key(600)) == true) ;
+    it->prev() ;
+    assert(it->good() && it->key() == make_key(101)) ;
+    it->prev() ;
+    assert(it->good() && it->key() == make_key(100)) ;
+    it->prev() ;
+    assert(it->good() && it->key() == make_key(99)) ;
+    delete tree ;
+}
+
+void builder_test() {
+    BTree *tree = new BTree() ;
+    {
+        auto builder = tree->new_builder() ;
+        for(int i = 0 ; i < 10000 ; ++i) {
+            assert(builder->append(make_key(i) , make_key(i)) == true) ;
+        }
+        assert(builder->append(make_key(5) , "x") == false) ;
+        assert(builder->append(make_key(9999) , "x") == false) ;
+    }
+    // 顺序追加的叶子都是满的，和随机插入同样多的 key 比，占的内存更少
+    BTree *random = new BTree() ;
+    vector<int> order(10000) ;
+    for(int i = 0 ; i < 10000 ; ++i) order[i] = i ;
+    shuffle(order.begin() , order.end() , mt19937(7)) ;
+    for(int i : order) {
+        random->put(make_key(i) , make_key(i)) ;
+    }
+    assert(tree->memory_usage() <= random->memory_usage()) ;
+    {
+        // 已经有数据的话只能接着最大的 key 往后追加
+        auto builder = tree->new_builder() ;
+        assert(builder->append(make_key(0) , "x") == false) ;
+        assert(builder->append(make_key(10000) , "x") == true) ;
+    }
+    string value ;
+    for(int i = 0 ; i <= 10000 ; ++i) {
+        assert(tree->get(make_key(i) , &value) == true) ;
+        assert(value == (i == 10000 ? "x" : make_key(i))) ;
+    }
+    delete random ;
+    delete tree ;
+}
+
+void writer_test() {
+    BTree *tree = new BTree() ;
+    tree->put("b" , "b") ;
+    {
+        auto writer = tree->new_writer() ;
+        assert(writer->upsert("a" , "a") == false) ;
+        assert(writer->upsert("b" , "b2") == true) ;
+        assert(writer->erase("c") == false) ;
+        assert(writer->upsert("c" , "c") == false) ;
+        assert(writer->erase("c") == true) ;
+    }
+    string value ;
+    assert(tree->get("a" , &value) && value == "a") ;
+    assert(tree->get("b" , &value) && value == "b2") ;
+    assert(tree->get("c" , &value) == false) ;
+    delete tree ;
+}
+
+void snapshot_test() {
+    BTree *tree = new BTree() ;
+    tree->put("a" , "a1") ;
+    tree->put("b" , "b1") ;
+    uint64_t snap = tree->acquire_snapshot() ;
+    assert(snap == tree->last_sequence()) ;
+
+    tree->put("a" , "a2") ;
+    assert(tree->del("b") == true) ;
+    tree->put("c" , "c1") ;
+    string value ;
+    assert(tree->get("a" , &value) && value == "a2") ;
+    assert(tree->get("b" , &value) == false) ;
+    assert(tree->get("a" , &value , snap) && value == "a1") ;
+    assert(tree->get("b" , &value , snap) && value == "b1") ;
+    assert(tree->get("c" , &value , snap) == false) ;
+    {
+        auto it = tree->new_iterator(snap) ;
+        assert(it->good() && it->key() == "a" && it->value() == "a1") ;
+        it->next() ;
+        assert(it->good() && it->key() == "b" && it->value() == "b1") ;
+        it->next() ;
+        assert(it->good() == false) ;
+    }
+    vector<ByteArray> keys = {"a" , "b" , "c"} ;
+    vector<string> found(3) ;
+    tree->multi_get(keys.data() , keys.size() , [&](size_t i , const ByteArray& v) {
+        found[i] = string(v.data() , v.size()) ;
+    } , snap) ;
+    assert(found[0] == "a1" && found[1] == "b1" && found[2] == "") ;
+
+    // 快照挡着的时候旧版本都留着，释放以后回收，"b" 也从树里删掉
+    for(int i = 0 ; i < 50000 ; ++i) {
+        tree->put("a" , "value-" + to_string(i)) ;
+    }
+    size_t with_snapshot = tree->memory_usage() ;
+    assert(tree->get("a" , &value , snap) && value == "a1") ;
+    tree->release_snapshot(snap) ;
+    tree->collect_all() ;
+    for(int i = 0 ; i < 50000 ; ++i) {
+        tree->put("a" , "value-" + to_string(i)) ;
+    }
+    assert(tree->memory_usage() == with_snapshot) ;
+    size_t count = 0 ;
+    for(auto it = tree->new_iterator() ; it->good() ; it->next()) ++count ;
+    assert(count == 2) ;
+    delete tree ;
+}
+
+// 多个线程同时写自己的 key，读线程同时遍历和批量查找
+void concurrent_test() {
+    BTree *tree = new BTree() ;
+    const int THREADS = 8 , KEYS = 2000 ;
+    vector<thread> threads ;
+    for(int t = 0 ; t < THREADS ; ++t) {
+        threads.emplace_back([tree , t]() {
+            for(int i = 0 ; i < KEYS ; ++i) {
+                string key = to_string(i * THREADS + t) ;
+                bool existed ;
+                tree->put(key , key , &existed) ;
+                assert(existed == false) ;
+                assert(tree->get(key , nullptr) == true) ;
+            }
+            for(int i = 0 ; i < KEYS ; i += 2) {
+                string key = to_string(i * THREADS + t) ;
+                assert(tree->del(key) == true) ;
+                assert(tree->get(key , nullptr) == false) ;
+            }
+            for(int i = 1 ; i < KEYS ; i += 2) {
+                string key = to_string(i * THREADS + t) ;
+                tree->put(key , "v" + key) ;
+            }
+        }) ;
+    }
+    thread reader([tree]() {
+        for(int round = 0 ; round < 20 ; ++round) {
+            string last ;
+            vector<string> keys ;
+            for(auto iter = tree->new_iterator() ; iter->good() ; iter->next()) {
+                string key(iter->key().data() , iter->key().size()) ;
+                assert(last.empty() || last < key) ;
+                last = key ;
+                keys.push_back(key) ;
+            }
+            vector<ByteArray> arrays(keys.begin() , keys.end()) ;
+            tree->multi_get(arrays.data() , arrays.size() , [](size_t , const ByteArray&) { }) ;
+        }
+    }) ;
+    for(auto &th : threads) th.join() ;
+    reader.join() ;
+
+    size_t count = 0 ;
+    for(auto iter = tree->new_iterator() ; iter->good() ; iter->next()) {
+        int id = stoi(string(iter->key().data() , iter->key().size())) ;
+        assert((id / THREADS) % 2 == 1) ;
+        assert(iter->value() == "v" + to_string(id)) ;
+        ++count ;
+    }
+    assert(count == THREADS * KEYS / 2) ;
+    delete tree ;
+}
+
+int main(){
+    BTree *tree = new BTree() ;
+    crud_test(tree) ;
+    delete tree ;
+    SkipList *skList = new SkipList() ;
+    crud_test(skList) ;
+    delete skList ;
+
+    random_test() ;
+
+    iterator_test() ;
+
+    builder_test() ;
+
+    writer_test() ;
+
+    snapshot_test() ;
+
+    concurrent_test() ;
+
+    return 0 ;
+}
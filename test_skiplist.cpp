@@ -1,6 +1,8 @@
 #include "skiplist.h"
 #include <assert.h>
 #include <thread>
+#include <algorithm>
+#include <map>
 using namespace table ; 
 using namespace std ; 
 
@@ -9,7 +11,7 @@ void insert_test(SkipList *skList) {
     assert(it.good() == true);
     assert(it.key()== "f");
     assert(it.value()== "f");
-    
+
     // insert at the head
     it = skList->insert("a" , "a");
     assert(it.good());
@@ -47,28 +49,669 @@ void update_test(SkipList *skList) {
     assert(it.value() == "b");
 }
 
+void upsert_test(SkipList *skList) {
+    // 不存在就插入
+    auto it = skList->upsert("u", "1");
+    assert(it.good() == true);
+    assert(it.value() == "1");
+
+    // 存在就更新，还是同一个 key
+    it = skList->upsert("u", "22");
+    assert(it.good() == true);
+    assert(it.key() == "u");
+    assert(it.value() == "22");
+    assert(skList->lookup("u").value() == "22");
+
+    // 值不变也算成功
+    it = skList->upsert("u", "22");
+    assert(it.good() == true);
+
+    assert(skList->erase("u") == true);
+    it = skList->upsert("u", "333");
+    assert(it.good() == true);
+    assert(skList->lookup("u").value() == "333");
+    assert(skList->erase("u") == true);
+}
+
 void erase_test(SkipList *skList) {
-     
+
     assert(skList->erase("a") == true) ;
     auto iter = skList->insert("a", "a");
     assert(iter.good() == true);
     assert(skList->erase("a")== true);
 }
 
+// key 的前 8 个字节缓存成了大端序整数，检查短 key、含 '\0' 的 key、前缀相同的长 key 排序是否还是字典序
+void order_test() {
+    SkipList *skList = new SkipList() ; 
+    vector<string> keys = {
+        "abcdefghij" , "abcdefgh" , "abcdefghi" , "a" , string("a\0", 2) , 
+        string("a\0b", 3) , "ab" , "abcdefgg" , "abcdefghz" , "\xff" , "" , "abcdefgh\xff" 
+    } ; 
+    for(auto &key : keys) {
+        assert(skList->insert(key , key).good() == true) ; 
+    }
+    sort(keys.begin() , keys.end()) ; 
+    size_t index = 0 ; 
+    for(auto iter = skList->begin() ; iter.good() ; iter.next() , ++index) {
+        assert(iter.key() == keys[index]) ; 
+        assert(iter.value() == keys[index]) ; 
+    }
+    assert(index == keys.size()) ; 
+    for(auto &key : keys) {
+        assert(skList->lookup(key).good() == true) ; 
+    }
+    assert(skList->lookup(string("abcdefghi\0" , 10)).good() == false) ; 
+    assert(skList->lookup("abcdefg").good() == false) ; 
+    delete skList ; 
+}
+
+// 有序批量加载，加载完还能正常增删改查
+void builder_test() {
+    SkipList *skList = new SkipList() ;
+    vector<string> keys ;
+    for(int i = 0 ; i < 1000 ; ++i) {
+        char buf[16] ;
+        snprintf(buf , sizeof(buf) , "key%06d" , i * 2) ;
+        keys.push_back(buf) ;
+    }
+    {
+        SkipList::Builder builder(skList) ;
+        for(auto &key : keys) {
+            assert(builder.append(key , key) == true) ;
+        }
+        // 重复的、比最后一个小的 key 都不行
+        assert(builder.append(keys.back() , "dup") == false) ;
+        assert(builder.append("key000001" , "small") == false) ;
+        assert(builder.append("key999999" , "last") == true) ;
+        keys.push_back("key999999") ;
+    }
+    size_t index = 0 ;
+    for(auto iter = skList->begin() ; iter.good() ; iter.next() , ++index) {
+        assert(iter.key() == keys[index]) ;
+    }
+    assert(index == keys.size()) ;
+    for(auto &key : keys) {
+        assert(skList->lookup(key).good() == true) ;
+    }
+    assert(skList->insert("key000001" , "1").good() == true) ;
+    assert(skList->erase("key000002") == true) ;
+    assert(skList->lookup("key000001").value() == "1") ;
+    assert(skList->lookup("key000002").good() == false) ;
+    delete skList ;
+}
+
+// seek 定位、正向和反向遍历，删掉的节点会被跳过
+void seek_test() {
+    SkipList *skList = new SkipList() ;
+    for(char c = 'b' ; c <= 'y' ; c += 2) { // b d f ... x
+        assert(skList->insert(string(1 , c) , string(1 , c)).good() == true) ;
+    }
+    assert(skList->erase("f") == true) ;
+
+    {
+    auto it = skList->begin() ;
+    it.seek("c") ;
+    assert(it.good() && it.key() == "d") ;
+    it.seek("d") ;
+    assert(it.good() && it.key() == "d") ;
+    it.next() ;
+    assert(it.good() && it.key() == "h") ;
+    it.prev() ;
+    assert(it.good() && it.key() == "d") ;
+    it.prev() ;
+    assert(it.good() && it.key() == "b") ;
+    it.prev() ;
+    assert(it.good() == false) ;
+    it.seek("z") ;
+    assert(it.good() == false) ;
+
+    it.seek_to_last() ;
+    assert(it.good() && it.key() == "x") ;
+    string reverse ;
+    for( ; it.good() ; it.prev()) {
+        reverse += string(it.key().data() , it.key().size()) ;
+    }
+    assert(reverse == "xvtrpnljhdb") ;
+    it.seek_to_first() ;
+    assert(it.good() && it.key() == "b") ;
+    } // 迭代器要在跳表之前析构
+
+    // 空跳表
+    SkipList *empty = new SkipList() ;
+    {
+    auto e = empty->begin() ;
+    e.seek_to_last() ;
+    assert(e.good() == false) ;
+    e.seek("a") ;
+    assert(e.good() == false) ;
+    }
+    delete empty ;
+    delete skList ;
+}
+
+// 批量查找的结果要和逐个 lookup 一致：有序、乱序、有重复、有不存在的 key、有删掉的 key
+void multi_lookup_test() {
+    SkipList *skList = new SkipList() ;
+    std::mt19937 mt_rand(7) ;
+    vector<string> stored ;
+    for(int i = 0 ; i < 3000 ; ++i) {
+        string key = to_string(mt_rand() % 100000) ;
+        if(skList->insert(key , "v" + key).good()) stored.push_back(key) ;
+    }
+    for(size_t i = 0 ; i < stored.size() ; i += 3) {
+        assert(skList->erase(stored[i]) == true) ;
+    }
+
+    vector<string> batch ;
+    for(int i = 0 ; i < 500 ; ++i) {
+        batch.push_back(i % 2 ? stored[mt_rand() % stored.size()] : to_string(mt_rand() % 100000)) ;
+    }
+    batch.push_back(batch[0]) ;
+    for(int round = 0 ; round < 2 ; ++round) {
+        if(round == 1) std::sort(batch.begin() , batch.end()) ;
+        vector<ByteArray> keys(batch.begin() , batch.end()) ;
+        vector<string> values(keys.size()) ;
+        vector<int> hits(keys.size() , 0) ;
+        skList->multi_lookup(keys.data() , keys.size() , [&](size_t i , const ByteArray& value) {
+            values[i] = string(value.data() , value.size()) ;
+            ++hits[i] ;
+        }) ;
+        for(size_t i = 0 ; i < keys.size() ; ++i) {
+            auto it = skList->lookup(keys[i]) ;
+            assert(hits[i] == (it.good() ? 1 : 0)) ;
+            assert(!it.good() || values[i] == "v" + batch[i]) ;
+        }
+    }
+    skList->multi_lookup(nullptr , 0 , [](size_t , const ByteArray&) { assert(false) ; }) ;
+    delete skList ;
+}
+
+// Writer 按顺序写入的结果要和逐个 upsert/erase 一样，乱序的 key 也要写对
+void writer_test() {
+    SkipList *skList = new SkipList() ;
+    std::map<string , string> expect ;
+    std::mt19937 mt_rand(11) ;
+    for(int i = 0 ; i < 2000 ; i += 2) {
+        string key = to_string(10000 + i) ;
+        skList->insert(key , key) ;
+        expect[key] = key ;
+    }
+    vector<string> batch ;
+    for(int i = 0 ; i < 1500 ; ++i) {
+        batch.push_back(to_string(10000 + mt_rand() % 2200)) ;
+    }
+    for(int round = 0 ; round < 2 ; ++round) {
+        if(round == 1) std::sort(batch.begin() , batch.end()) ;
+        SkipList::Writer writer(skList) ;
+        for(size_t i = 0 ; i < batch.size() ; ++i) {
+            const string &key = batch[i] ;
+            if(i % 3 == 0) {
+                assert(writer.erase(key) == (expect.erase(key) == 1)) ;
+            } else {
+                writer.upsert(key , key + "-" + to_string(round)) ;
+                expect[key] = key + "-" + to_string(round) ;
+            }
+        }
+    }
+    auto it = skList->begin() ;
+    for(auto &kv : expect) {
+        assert(it.good() && it.key() == kv.first && it.value() == kv.second) ;
+        it.next() ;
+    }
+    assert(it.good() == false) ;
+    it = SkipList::Iterator() ;
+    delete skList ;
+}
+
+// 快照只能看到创建之前写完的版本，之后的更新、删除、插入都看不到；快照释放后旧版本会被回收
+void snapshot_test() {
+    SkipList *skList = new SkipList() ;
+    assert(skList->insert("a" , "a1").good() == true) ;
+    assert(skList->insert("b" , "b1").good() == true) ;
+    uint64_t snap = skList->acquire_snapshot() ;
+    assert(snap == skList->last_sequence()) ;
+
+    assert(skList->upsert("a" , "a2").good() == true) ;
+    assert(skList->erase("b") == true) ;
+    assert(skList->insert("c" , "c1").good() == true) ;
+    // 删除以后重新插入，快照里还是原来的值
+    assert(skList->erase("a") == true) ;
+    assert(skList->insert("a" , "a3").good() == true) ;
+
+    assert(skList->lookup("a").value() == "a3") ;
+    assert(skList->lookup("b").good() == false) ;
+    assert(skList->lookup("a" , snap).value() == "a1") ;
+    assert(skList->lookup("b" , snap).value() == "b1") ;
+    assert(skList->lookup("c" , snap).good() == false) ;
+    {
+        auto it = skList->begin(snap) ;
+        assert(it.good() && it.key() == "a" && it.value() == "a1") ;
+        it.next() ;
+        assert(it.good() && it.key() == "b" && it.value() == "b1") ;
+        it.next() ;
+        assert(it.good() == false) ;
+        it.seek_to_last() ;
+        assert(it.good() && it.key() == "b") ;
+        it.prev() ;
+        assert(it.good() && it.key() == "a") ;
+    }
+    vector<ByteArray> keys = {"a" , "b" , "c"} ;
+    vector<string> found(3) ;
+    skList->multi_lookup(keys.data() , keys.size() , [&](size_t i , const ByteArray& value) {
+        found[i] = string(value.data() , value.size()) ;
+    } , snap) ;
+    assert(found[0] == "a1" && found[1] == "b1" && found[2] == "") ;
+
+    // 快照挡着的时候旧版本都留着，释放以后扫一遍就回收掉了，"b" 的 tombstone 节点也被物理删除
+    for(int i = 0 ; i < 50000 ; ++i) {
+        skList->upsert("a" , "value-" + to_string(i)) ;
+    }
+    size_t with_snapshot = skList->memory_usage() ;
+    assert(skList->lookup("a" , snap).value() == "a1") ;
+    skList->release_snapshot(snap) ;
+    skList->collect_all() ;
+    for(int i = 0 ; i < 50000 ; ++i) {
+        skList->upsert("a" , "value-" + to_string(i)) ;
+    }
+    assert(skList->memory_usage() == with_snapshot) ;
+    size_t count = 0 ;
+    for(auto it = skList->begin() ; it.good() ; it.next()) ++count ;
+    assert(count == 2) ;
+    delete skList ;
+
+    // 快照拿着一长串删掉的节点，不带快照的 prev 和 seek_to_last 要跨过它们，不能每跨一个就多一层栈
+    skList = new SkipList() ;
+    const int KEYS = 300000 ;
+    for(int i = 0 ; i < KEYS ; ++i) {
+        char key[16] ;
+        snprintf(key , sizeof(key) , "k%07d" , i) ;
+        skList->insert(key , key) ;
+    }
+    snap = skList->acquire_snapshot() ;
+    for(int i = 1 ; i < KEYS ; ++i) {
+        char key[16] ;
+        snprintf(key , sizeof(key) , "k%07d" , i) ;
+        skList->erase(key) ;
+    }
+    {
+        auto it = skList->begin() ;
+        it.seek_to_last() ;
+        assert(it.good() && it.key() == "k0000000") ;
+        it.prev() ;
+        assert(it.good() == false) ;
+        assert(skList->insert("z" , "z").good() == true) ;
+        it.seek_to_last() ;
+        it.prev() ;
+        assert(it.good() && it.key() == "k0000000") ;
+    }
+    skList->release_snapshot(snap) ;
+    delete skList ;
+}
+
+// 多个线程同时插入、删除、查找，每个线程只改自己的 key，最后检查跳表里剩下的正好是没删的那一半
+void concurrent_test(bool hash_index) {
+    SkipList *skList = new SkipList(hash_index) ; 
+    const int THREADS = 8 , KEYS = 2000 ; 
+    vector<thread> threads ; 
+    for(int t = 0 ; t < THREADS ; ++t) {
+        threads.emplace_back([skList , t]() {
+            for(int i = 0 ; i < KEYS ; ++i) {
+                string key = to_string(i * THREADS + t) ; 
+                assert(skList->insert(key , key).good() == true) ; 
+                assert(skList->lookup(key).good() == true) ; 
+            }
+            for(int i = 0 ; i < KEYS ; i += 2) {
+                string key = to_string(i * THREADS + t) ; 
+                assert(skList->erase(key) == true) ; 
+                assert(skList->lookup(key).good() == false) ; 
+                assert(skList->erase(key) == false) ; 
+            }
+            for(int i = 1 ; i < KEYS ; i += 2) {
+                string key = to_string(i * THREADS + t) ; 
+                assert(skList->update(key , "v" + key).good() == true) ; 
+            }
+        }) ; 
+    }
+    // 读线程在写的同时遍历，key 必须一直是有序的，走到的节点就算刚被删除也不会给出空的 value
+    thread reader([skList]() {
+        for(int round = 0 ; round < 20 ; ++round) {
+            string last ; 
+            for(auto iter = skList->begin() ; iter.good() ; iter.next()) {
+                string key(iter.key().data() , iter.key().size()) ; 
+                assert(last.empty() || last < key) ; 
+                assert(iter.value().size() > 0) ; 
+                last = key ; 
+            }
+        }
+    }) ; 
+    for(auto &th : threads) th.join() ; 
+    reader.join() ; 
+
+    size_t count = 0 ; 
+    for(auto iter = skList->begin() ; iter.good() ; iter.next()) {
+        int id = stoi(string(iter.key().data() , iter.key().size())) ; 
+        assert((id / THREADS) % 2 == 1) ; 
+        assert(iter.value() == "v" + to_string(id)) ; 
+        ++count ; 
+    }
+    assert(count == THREADS * KEYS / 2) ; 
+    delete skList ; 
+}
+
+// 打开哈希索引以后点查走索引，结果要和跳表一样：索引扩容、节点物理删除以后重新插入、快照和批量查找
+void hash_index_test() {
+    SkipList *skList = new SkipList(true) ;
+    const int KEYS = 100000 ;
+    {
+        SkipList::Builder builder(skList) ;
+        for(int i = 0 ; i < KEYS ; i += 2) {
+            char key[16] ;
+            snprintf(key , sizeof(key) , "k%06d" , i) ;
+            assert(builder.append(key , key) == true) ;
+        }
+    }
+    for(int i = 1 ; i < KEYS ; i += 2) {
+        string key = "k" + string(6 - to_string(i).size() , '0') + to_string(i) ;
+        assert(skList->insert(key , key).good() == true) ;
+    }
+    for(int i = 0 ; i < KEYS ; ++i) {
+        string key = "k" + string(6 - to_string(i).size() , '0') + to_string(i) ;
+        auto it = skList->lookup(key) ;
+        assert(it.good() && it.value() == key) ;
+    }
+    assert(skList->lookup("k").good() == false) ;
+    assert(skList->lookup("k1000000").good() == false) ;
+
+    uint64_t snap = skList->acquire_snapshot() ;
+    // 删掉以后节点留着给快照看，释放快照回收以后节点从索引里去掉，再插入的是新节点
+    for(int i = 0 ; i < KEYS ; i += 3) {
+        string key = "k" + string(6 - to_string(i).size() , '0') + to_string(i) ;
+        assert(skList->erase(key) == true) ;
+        assert(skList->lookup(key).good() == false) ;
+        assert(skList->lookup(key , snap).value() == key) ;
+        assert(skList->update(key , "x").good() == false) ;
+    }
+    skList->release_snapshot(snap) ;
+    skList->collect_all() ;
+    for(int i = 0 ; i < KEYS ; i += 6) {
+        string key = "k" + string(6 - to_string(i).size() , '0') + to_string(i) ;
+        assert(skList->insert(key , "again").good() == true) ;
+    }
+    vector<string> keys ;
+    for(int i = 0 ; i < KEYS ; ++i) {
+        keys.push_back("k" + string(6 - to_string(i).size() , '0') + to_string(i)) ;
+    }
+    vector<ByteArray> arrays(keys.begin() , keys.end()) ;
+    vector<string> found(KEYS) ;
+    skList->multi_lookup(arrays.data() , arrays.size() , [&](size_t i , const ByteArray& value) {
+        found[i] = string(value.data() , value.size()) ;
+    }) ;
+    for(int i = 0 ; i < KEYS ; ++i) {
+        string expect = i % 6 == 0 ? "again" : (i % 3 == 0 ? "" : keys[i]) ;
+        assert(found[i] == expect) ;
+        assert(skList->lookup(keys[i]).good() == !expect.empty()) ;
+    }
+    // 有序遍历还是走跳表
+    size_t count = 0 ;
+    string last ;
+    for(auto it = skList->begin() ; it.good() ; it.next() , ++count) {
+        string key(it.key().data() , it.key().size()) ;
+        assert(last < key) ;
+        last = key ;
+    }
+    assert(count == KEYS - KEYS / 3 - 1 + KEYS / 6 + 1) ;
+    delete skList ;
+}
+
+// 同时活着的线程比 EpochManager::MAX_THREADS 多的时候，多出来的线程共用一个槽位，读写和回收都还是对的
+void many_threads_test() {
+    SkipList *skList = new SkipList() ; 
+    const int THREADS = EpochManager::MAX_THREADS + 44 , KEYS = 200 ; 
+    std::atomic<int> started(0) ; 
+    vector<thread> threads ; 
+    for(int t = 0 ; t < THREADS ; ++t) {
+        threads.emplace_back([skList , t , &started]() {
+            // 等所有线程都起来了再写，保证它们同时活着
+            ++started ; 
+            while(started.load() < THREADS) std::this_thread::yield() ; 
+            for(int i = 0 ; i < KEYS ; ++i) {
+                string key = to_string(i * THREADS + t) ; 
+                assert(skList->insert(key , key).good() == true) ; 
+                assert(skList->update(key , "v" + key).good() == true) ; 
+            }
+            for(int i = 0 ; i < KEYS ; i += 2) {
+                assert(skList->erase(to_string(i * THREADS + t)) == true) ; 
+            }
+        }) ; 
+    }
+    for(auto &th : threads) th.join() ; 
+
+    size_t count = 0 ; 
+    for(auto iter = skList->begin() ; iter.good() ; iter.next()) {
+        int id = stoi(string(iter.key().data() , iter.key().size())) ; 
+        assert((id / THREADS) % 2 == 1) ; 
+        assert(iter.value() == "v" + to_string(id)) ; 
+        ++count ; 
+    }
+    assert(count == static_cast<size_t>(THREADS * KEYS / 2)) ; 
+    delete skList ; 
+}
+
+// 删除和更新掉的节点会在没有读者之后回收，反复插入删除内存不会一直涨
+void reclaim_test() {
+    SkipList *skList = new SkipList() ; 
+    for(int i = 0 ; i < 200000 ; ++i) {
+        string key = "key" + to_string(i) ;
+        assert(skList->insert(key , key).good() == true) ; 
+        assert(skList->update(key , key + "-new").good() == true) ;
+        assert(skList->erase(key) == true) ;
+    }
+    assert(skList->memory_usage() < 1024 * 1024) ;
+
+    // 拿着 Iterator 的时候，它指向的节点就算被删除了也还能读
+    assert(skList->insert("a" , "a").good() == true) ;
+    {
+        auto it = skList->lookup("a") ;
+        assert(skList->erase("a") == true) ;
+        for(int i = 0 ; i < 1000 ; ++i) {
+            string key = "b" + to_string(i) ;
+            skList->insert(key , key) ;
+            skList->erase(key) ;
+        }
+        assert(it.key() == "a") ;
+        assert(it.value() == "a") ;
+    }
+    delete skList ; 
+}
+
+// 降序的 uint64_t 比较器，只换比较的方向，存法和默认的一样
+struct DescendingComparator : public KeyComparator<uint64_t> {
+    static int compare(const Stored& stored , const char * , size_t , const Probe& probe) {
+        return (stored < probe) - (stored > probe) ;
+    }
+    static bool less(uint64_t a , uint64_t b)  { return a > b ; }
+} ;
+
+// 整数 key 的跳表：随机增删改查和 std::map 对比，再检查遍历、批量查找、Builder 和 Writer
+template <typename List , typename Key>
+void integer_key_test(bool hash_index , Key step) {
+    List *list = new List(hash_index) ;
+    map<Key , string> expect ;
+    mt19937_64 rng(20240701) ;
+    for(int round = 0 ; round < 100000 ; ++round) {
+        Key key = static_cast<Key>(rng() % 5000) * step ;
+        int op = rng() % 10 ;
+        if(op < 5) {
+            string value = to_string(round) ;
+            bool existed ;
+            list->upsert(key , value , &existed) ;
+            assert(existed == (expect.count(key) == 1)) ;
+            expect[key] = value ;
+        } else if(op < 8) {
+            assert(list->erase(key) == (expect.erase(key) == 1)) ;
+        } else {
+            auto it = list->lookup(key) ;
+            auto found = expect.find(key) ;
+            assert(it.good() == (found != expect.end())) ;
+            assert(found == expect.end() || it.value() == found->second) ;
+        }
+    }
+    {
+    auto it = list->begin() ;
+    for(auto &kv : expect) {
+        assert(it.good() && it.key() == kv.first && it.value() == kv.second) ;
+        it.next() ;
+    }
+    assert(it.good() == false) ;
+    it.seek_to_last() ;
+    assert(it.good() && it.key() == expect.rbegin()->first) ;
+    it.seek(expect.begin()->first + 1) ;
+    assert(it.good() && it.key() == next(expect.begin())->first) ;
+    }
+
+    vector<Key> keys ;
+    for(int i = 0 ; i < 5000 ; ++i) {
+        keys.push_back(static_cast<Key>(i) * step) ;
+    }
+    sort(keys.begin() , keys.end()) ;
+    size_t found = 0 ;
+    list->multi_lookup(keys.data() , keys.size() , [&](size_t i , const ByteArray& value) {
+        assert(value == expect[keys[i]]) ;
+        ++found ;
+    }) ;
+    assert(found == expect.size()) ;
+    {
+        typename List::Writer writer(list) ;
+        for(auto &key : keys) {
+            assert(writer.upsert(key , "w") == (expect.count(key) == 1)) ;
+        }
+    }
+    assert(list->lookup(keys.back()).value() == "w") ;
+    delete list ;
+
+    // 从小到大追加
+    list = new List(hash_index) ;
+    {
+        typename List::Builder builder(list) ;
+        for(auto &key : keys) {
+            assert(builder.append(key , "b") == true) ;
+        }
+        assert(builder.append(keys[0] , "b") == false) ;
+    }
+    for(auto &key : keys) {
+        assert(list->lookup(key).good() == true) ;
+    }
+    delete list ;
+}
+
+void integer_comparator_test() {
+    // 高 64 位不同的 key 要按高位排
+    Uint128SkipList *wide = new Uint128SkipList() ;
+    __uint128_t big = static_cast<__uint128_t>(1) << 64 ;
+    assert(wide->insert(big , "big").good() == true) ;
+    assert(wide->insert(UINT64_MAX , "max").good() == true) ;
+    assert(wide->insert(big + 1 , "big+1").good() == true) ;
+    {
+    auto it = wide->begin() ;
+    assert(it.good() && it.value() == "max") ;
+    it.next() ;
+    assert(it.good() && it.key() == big) ;
+    it.next() ;
+    assert(it.good() && it.key() == big + 1) ;
+    }
+    delete wide ;
+
+    // 自定义比较器和最大层数
+    BasicSkipList<uint64_t , DescendingComparator , 8> *desc = new BasicSkipList<uint64_t , DescendingComparator , 8>() ;
+    for(uint64_t i = 0 ; i < 1000 ; ++i) {
+        assert(desc->insert(i , to_string(i)).good() == true) ;
+    }
+    uint64_t expect = 999 ;
+    for(auto iter = desc->begin() ; iter.good() ; iter.next()) {
+        assert(iter.key() == expect--) ;
+    }
+    assert(expect == UINT64_MAX) ;
+    assert(desc->lookup(500).value() == "500") ;
+    delete desc ;
+}
+
+// 不同的 branching 和最大层数都要查得对；branching 越大每个节点的平均指针数越少，占的内存越少
+void level_test() {
+    size_t last_usage = SIZE_MAX ;
+    for(int branching : {2 , 4 , 16}) {
+        Uint64SkipList *list = new Uint64SkipList(false , branching) ;
+        for(uint64_t i = 0 ; i < 100000 ; ++i) {
+            assert(list->insert(i * 7919 % 100003 , "v").good() == true) ;
+        }
+        for(uint64_t i = 0 ; i < 100000 ; ++i) {
+            assert(list->lookup(i * 7919 % 100003).good() == true) ;
+        }
+        assert(list->lookup(100000 * 7919ULL % 100003).good() == false) ;
+        assert(list->memory_usage() < last_usage) ;
+        last_usage = list->memory_usage() ;
+        delete list ;
+    }
+    // 只有 1 层就是一个有序链表
+    BasicSkipList<uint64_t , KeyComparator<uint64_t> , 1> *flat = new BasicSkipList<uint64_t , KeyComparator<uint64_t> , 1>() ;
+    for(uint64_t i = 0 ; i < 1000 ; ++i) {
+        assert(flat->insert(1000 - i , "v").good() == true) ;
+    }
+    assert(flat->erase(500) == true) ;
+    uint64_t expect = 1 ;
+    for(auto it = flat->begin() ; it.good() ; it.next() , ++expect) {
+        expect += expect == 500 ;
+        assert(it.key() == expect) ;
+    }
+    assert(expect == 1001) ;
+    delete flat ;
+}
 
 int main(){
-    SkipList *skList = new SkipList() ;  
+    SkipList *skList = new SkipList() ; 
     // insert f a z b 
     insert_test(skList) ;
     cout<<skList->serialize()<<endl ;
     // update "a-a" -> "a-b" 
     update_test(skList) ; 
     cout<<skList->serialize()<<endl ;
+    upsert_test(skList) ;
     // erase "a"
     erase_test(skList) ;
     // look result 
     cout<<skList->serialize()<<endl ;
     delete skList ; 
-    
+
+    order_test() ; 
+
+    builder_test() ;
+
+    seek_test() ;
+
+    multi_lookup_test() ;
+
+    writer_test() ;
+
+    snapshot_test() ;
+
+    hash_index_test() ;
+
+    concurrent_test(false) ; 
+
+    concurrent_test(true) ; 
+
+    many_threads_test() ;
+
+    reclaim_test() ;
+
+    integer_key_test<Uint64SkipList , uint64_t>(false , 0x9e3779b97f4a7c15ULL) ;
+    integer_key_test<Uint64SkipList , uint64_t>(true , 1) ;
+    integer_key_test<Uint128SkipList , __uint128_t>(false , static_cast<__uint128_t>(0x9e3779b97f4a7c15ULL) << 40) ;
+    integer_key_test<Uint128SkipList , __uint128_t>(true , 3) ;
+
+    integer_comparator_test() ;
+
+    level_test() ;
+
     return 0 ; 
 }
@@ -0,0 +1,126 @@
+#ifndef TABLE_VALUE_LOG_H
+#define TABLE_VALUE_LOG_H
+
+// 大 value 的日志文件，比 Options::value_log_threshold 大的 value 只在这里存一份
+// 1. 内存表里每个 value 前面有一个类型字节：INLINE_VALUE 后面就是 value 本身，
+//    VALUE_LOG_REF 后面是 value 在日志里的偏移和长度(两个变长整数)，大 value 不占内存表的内存
+// 2. 只追加：用 fetch_add 给每个 value 占一段位置再 pwrite，多个线程可以同时追加，不用加锁
+// 3. dump 的时候数据文件里存的也是引用，value 本身不用每次 dump 都重新写一遍；
+//    被覆盖或者删除的 value 还留在日志里，日志只会变大
+#include <string>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include "byte_array.h"
+
+namespace table {
+
+#define     VALUE_LOG_FILE_EXT      ".vlog"
+
+// 内存表和数据文件里 value 的第一个字节
+enum ValueType : char {
+    INLINE_VALUE = 0 ,
+    VALUE_LOG_REF = 1 ,
+    TOMBSTONE_VALUE = 2 ,   // 只在 LayeredMemtable 的 active 和 LSM 的 L0 run 里，表示更旧的层里的 key 已经删掉了
+} ;
+
+class ValueLog {
+public :
+    ValueLog() : _fd(-1) , _size(0) { }
+    ~ValueLog() { this->close() ; }
+
+    // 打开或者创建日志文件，新的 value 追加在文件末尾
+    bool open(const char *fileName) ;
+    void close() ;
+    bool is_open() const        { return this->_fd != -1 ; }
+
+    // 追加一个 value，返回它的引用：类型字节 + 偏移 + 长度
+    bool append(const ByteArray& value , std::string *ref) ;
+
+    // 按引用读出 value，ref 是 append 返回的引用
+    bool read(const ByteArray& ref , std::string *value) const ;
+
+    // 把追加的 value 刷到磁盘上，数据文件里引用它们之前调用
+    bool sync() const ;
+
+    // Non-copying
+    ValueLog(const ValueLog&) = delete ;
+    ValueLog& operator=(const ValueLog&) = delete ;
+
+private :
+    int _fd ;
+    std::atomic<uint64_t> _size ;
+} ;
+
+bool ValueLog::open(const char *fileName) {
+    this->close() ;
+    this->_fd = ::open(fileName , O_RDWR | O_CREAT , 0644) ;
+    if(this->_fd == -1) {
+        return false ;
+    }
+    struct stat info ;
+    if(fstat(this->_fd , &info) != 0) {
+        this->close() ;
+        return false ;
+    }
+    this->_size.store(info.st_size) ;
+    return true ;
+}
+
+void ValueLog::close() {
+    if(this->_fd != -1) {
+        ::close(this->_fd) ;
+        this->_fd = -1 ;
+    }
+}
+
+bool ValueLog::append(const ByteArray& value , std::string *ref) {
+    uint64_t offset = this->_size.fetch_add(value.size()) ;
+    size_t written = 0 ;
+    while(written < value.size()) {
+        ssize_t n = pwrite(this->_fd , value.data() + written , value.size() - written , offset + written) ;
+        if(n <= 0) {
+            return false ;
+        }
+        written += n ;
+    }
+    char buf[1 + MAX_VARINT_LENGTH * 2] ;
+    buf[0] = VALUE_LOG_REF ;
+    int n = 1 ;
+    n += encode_varint(buf + n , offset) ;
+    n += encode_varint(buf + n , value.size()) ;
+    ref->assign(buf , n) ;
+    return true ;
+}
+
+bool ValueLog::read(const ByteArray& ref , std::string *value) const {
+    if(ref.size() < 3 || ref[0] != VALUE_LOG_REF) {
+        return false ;
+    }
+    const char *p = ref.data() + 1 , *limit = ref.data() + ref.size() ;
+    uint64_t offset , size ;
+    int n = decode_varint(p , limit , &offset) ;
+    if(n == 0 || decode_varint(p + n , limit , &size) == 0) {
+        return false ;
+    }
+    value->resize(size) ;
+    size_t done = 0 ;
+    while(done < size) {
+        ssize_t r = pread(this->_fd , &(*value)[done] , size - done , offset + done) ;
+        if(r <= 0) {
+            return false ;
+        }
+        done += r ;
+    }
+    return true ;
+}
+
+bool ValueLog::sync() const {
+    return this->_fd == -1 || fdatasync(this->_fd) == 0 ;
+}
+
+} // namespace table
+
+#endif
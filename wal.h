@@ -0,0 +1,411 @@
+#ifndef TABLE_WAL_H
+#define TABLE_WAL_H
+
+// 预写日志：put/del/WriteBatch 先追加到 "文件名.wal" 里再写内存表，没来得及 dump 就崩溃的写在下次 open 的时候重放回来
+// 1. 只追加，每条记录带 crc32c 校验：| crc32c(4 字节) | 内容长度(4 字节) | 内容 |，crc 校验的是长度和内容；
+//    崩溃的时候最后一条可能只写了一半，重放到第一条不完整或者校验不对的记录为止，把它和后面的内容截掉
+// 2. 组提交：同时追加的线程排成一队，队头的线程把整队的记录拼在一起 write 一次、按 Options::wal_sync 的要求 fdatasync 一次，
+//    再按日志里的顺序把这一组写进内存表，其他线程等它做完直接返回；日志里的顺序就是内存表里写入的顺序，重放的结果和崩溃前一样
+// 3. dump 的时候先换一个新日志，同时建快照：旧日志里的写都在快照里，新日志里的都不在；dump 成功以后删掉旧日志
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include "byte_array.h"
+#include "options.h"
+#include "value_log.h"
+
+namespace table {
+
+#define     WAL_FILE_EXT        ".wal"
+// dump 的时候换下来的日志，dump 成功以后删掉
+#define     WAL_OLD_FILE_EXT    ".wal.old"
+
+// crc32c(Castagnoli)，按字节查表；crc 是前面一段数据的结果的话，算出来的是两段接在一起的结果
+inline uint32_t crc32c(const char *data , size_t size , uint32_t crc = 0) {
+    struct CrcTable {
+        uint32_t entries[256] ;
+        CrcTable() {
+            for(uint32_t i = 0 ; i < 256 ; ++i) {
+                uint32_t crc = i ;
+                for(int bit = 0 ; bit < 8 ; ++bit) {
+                    crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78 : crc >> 1 ;
+                }
+                this->entries[i] = crc ;
+            }
+        }
+    } ;
+    static const CrcTable table ;
+    crc = ~crc ;
+    for(size_t i = 0 ; i < size ; ++i) {
+        crc = table.entries[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8) ;
+    }
+    return ~crc ;
+}
+
+// 把已经写完的文件刷到磁盘上
+inline bool sync_file(const char *fileName) {
+    int fd = ::open(fileName , O_RDONLY) ;
+    if(fd == -1) {
+        return false ;
+    }
+    bool ok = fsync(fd) == 0 ;
+    ::close(fd) ;
+    return ok ;
+}
+
+class WriteAheadLog {
+public :
+    // 记录内容里每个操作的第一个字节
+    enum OpType : char {
+        WAL_DELETE = 0 ,
+        WAL_PUT = 1 ,
+    } ;
+
+    WriteAheadLog() : _fd(-1) , _size(0) , _mode(WalSyncMode::NONE) , _interval_ms(0) , _value_log(nullptr) ,
+                      _writing(false) , _syncing(false) , _dirty(false) , _stop(false) { }
+    ~WriteAheadLog() { this->close() ; }
+
+    // 打开或者创建日志，新的记录追加在末尾；value_log 不为空的话每次 fdatasync 之前先把它刷下去，记录里引用的大 value 不会丢
+    bool open(const char *fileName , WalSyncMode mode , uint32_t interval_ms , const ValueLog *value_log) ;
+    void close() ;
+
+    // 追加一条记录，按同步模式写到磁盘上以后调用 apply；写失败的话不调用 apply，返回 false
+    // 同时追加的记录一起写，apply 按记录在日志里的顺序依次调用，可能是在别的线程里调用的
+    bool append(const ByteArray& record , const std::function<void()>& apply) ;
+
+    // 等正在写的一组和后台线程正在做的 fdatasync 完成，挡住新的写，调用 callback，再把当前的日志接到 old_name 后面(没有的话改名成 old_name)，换一个空的日志
+    bool rotate(const char *old_name , const std::function<void()>& callback) ;
+
+    // 按顺序把 fileName 里的每条记录交给 handler，handler 返回 false 表示记录的内容不对，停下来返回 false
+    // 文件不存在的话什么也不做；末尾不完整或者校验不对的记录连同后面的内容一起截掉
+    static bool replay(const char *fileName , const std::function<bool(const ByteArray&)>& handler) ;
+
+    // 记录的内容是一串操作，put/del 一个，WriteBatch 按加入的顺序若干个：
+    // | WAL_PUT | varint key 长度 | key | varint value 长度 | value |  或者  | WAL_DELETE | varint key 长度 | key |
+    static void add_put(std::string *record , const ByteArray& key , const ByteArray& value) ;
+    static void add_delete(std::string *record , const ByteArray& key) ;
+    // 从 *p 开始解出一个操作，*p 移到下一个操作；格式不对的话返回 false
+    static bool next_op(const char **p , const char *limit , bool *is_delete , ByteArray *key , ByteArray *value) ;
+
+    // Non-copying
+    WriteAheadLog(const WriteAheadLog&) = delete ;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete ;
+
+private :
+    static const size_t HEADER_SIZE = sizeof(uint32_t) * 2 ;
+    // 一组最多拼这么多字节，前面的线程不用等太多后来的记录
+    static const size_t MAX_GROUP_SIZE = 1 << 20 ;
+
+    struct Writer {
+        const ByteArray *record ;
+        const std::function<void()> *apply ;
+        bool done ;
+        bool ok ;
+    } ;
+
+    bool write_at_end(const std::string& buf) ;
+    bool sync(int fd) const ;
+    // INTERVAL 模式的后台线程，有写过的话每 _interval_ms 毫秒 fdatasync 一次
+    void sync_loop() ;
+
+    int _fd ;
+    uint64_t _size ;
+    std::string _file_name ;
+    WalSyncMode _mode ;
+    uint32_t _interval_ms ;
+    const ValueLog *_value_log ;
+
+    // 下面的都由 _mutex 保护
+    std::mutex _mutex ;
+    std::condition_variable _cv ;
+    std::deque<Writer*> _writers ;
+    // 队头的线程正在写一组记录，这时候不能换日志，后面的线程也不能开始写下一组
+    bool _writing ;
+    // 后台线程在锁外 fdatasync 当前的 fd，这时候不能换日志，不然 fd 可能已经被关掉甚至被别的文件用了
+    bool _syncing ;
+    bool _dirty ;
+    bool _stop ;
+    std::condition_variable _sync_cv ;
+    std::thread _sync_thread ;
+} ;
+
+bool WriteAheadLog::open(const char *fileName , WalSyncMode mode , uint32_t interval_ms , const ValueLog *value_log) {
+    this->close() ;
+    this->_fd = ::open(fileName , O_RDWR | O_CREAT , 0644) ;
+    if(this->_fd == -1) {
+        return false ;
+    }
+    struct stat info ;
+    if(fstat(this->_fd , &info) != 0) {
+        this->close() ;
+        return false ;
+    }
+    this->_size = info.st_size ;
+    this->_file_name = fileName ;
+    this->_mode = mode ;
+    this->_interval_ms = interval_ms > 0 ? interval_ms : 1 ;
+    this->_value_log = value_log ;
+    this->_stop = false ;
+    if(mode == WalSyncMode::INTERVAL) {
+        this->_sync_thread = std::thread(&WriteAheadLog::sync_loop , this) ;
+    }
+    return true ;
+}
+
+void WriteAheadLog::close() {
+    if(this->_sync_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex) ;
+            this->_stop = true ;
+        }
+        this->_sync_cv.notify_all() ;
+        this->_sync_thread.join() ;
+    }
+    if(this->_fd != -1) {
+        // 关闭之前把后台线程还没刷的写刷下去
+        if(this->_mode == WalSyncMode::INTERVAL && this->_dirty) {
+            this->sync(this->_fd) ;
+            this->_dirty = false ;
+        }
+        ::close(this->_fd) ;
+        this->_fd = -1 ;
+    }
+}
+
+bool WriteAheadLog::append(const ByteArray& record , const std::function<void()>& apply) {
+    Writer self{&record , &apply , false , false} ;
+    std::unique_lock<std::mutex> lock(this->_mutex) ;
+    this->_writers.push_back(&self) ;
+    while(!self.done && (this->_writing || this->_writers.front() != &self)) {
+        this->_cv.wait(lock) ;
+    }
+    if(self.done) {
+        return self.ok ;
+    }
+
+    // 排到了队头，把后面排着的记录一起写；队列在写的时候还会变长，先把这一组拷出来
+    this->_writing = true ;
+    std::vector<Writer*> group ;
+    std::string buf ;
+    for(Writer *writer : this->_writers) {
+        const ByteArray& data = *writer->record ;
+        if(!group.empty() && buf.size() + HEADER_SIZE + data.size() > MAX_GROUP_SIZE) {
+            break ;
+        }
+        uint32_t header[2] ;
+        header[1] = static_cast<uint32_t>(data.size()) ;
+        header[0] = crc32c(data.data() , data.size() , crc32c(reinterpret_cast<const char*>(&header[1]) , sizeof(uint32_t))) ;
+        buf.append(reinterpret_cast<const char*>(header) , sizeof(header)) ;
+        buf.append(data.data() , data.size()) ;
+        group.push_back(writer) ;
+    }
+    int fd = this->_fd ;
+    lock.unlock() ;
+
+    bool ok = this->write_at_end(buf) && (this->_mode != WalSyncMode::PER_BATCH || this->sync(fd)) ;
+    if(ok) {
+        for(Writer *writer : group) {
+            (*writer->apply)() ;
+        }
+    }
+
+    lock.lock() ;
+    for(size_t i = 0 ; i < group.size() ; ++i) {
+        this->_writers.front()->ok = ok ;
+        this->_writers.front()->done = true ;
+        this->_writers.pop_front() ;
+    }
+    this->_dirty = this->_dirty || ok ;
+    this->_writing = false ;
+    this->_cv.notify_all() ;
+    return ok ;
+}
+
+bool WriteAheadLog::write_at_end(const std::string& buf) {
+    size_t written = 0 ;
+    while(written < buf.size()) {
+        ssize_t n = pwrite(this->_fd , buf.data() + written , buf.size() - written , this->_size + written) ;
+        if(n <= 0) {
+            // 写了一半的记录截掉，后面的记录还能接着写在正确的位置上
+            if(ftruncate(this->_fd , this->_size) != 0) { }
+            return false ;
+        }
+        written += n ;
+    }
+    this->_size += written ;
+    return true ;
+}
+
+bool WriteAheadLog::sync(int fd) const {
+    if(this->_value_log != nullptr && this->_value_log->sync() == false) {
+        return false ;
+    }
+    return fdatasync(fd) == 0 ;
+}
+
+void WriteAheadLog::sync_loop() {
+    std::unique_lock<std::mutex> lock(this->_mutex) ;
+    while(!this->_stop) {
+        this->_sync_cv.wait_for(lock , std::chrono::milliseconds(this->_interval_ms)) ;
+        if(this->_dirty) {
+            this->_dirty = false ;
+            this->_syncing = true ;
+            int fd = this->_fd ;
+            lock.unlock() ;
+            this->sync(fd) ;
+            lock.lock() ;
+            this->_syncing = false ;
+            this->_cv.notify_all() ;
+        }
+    }
+}
+
+bool WriteAheadLog::rotate(const char *old_name , const std::function<void()>& callback) {
+    std::unique_lock<std::mutex> lock(this->_mutex) ;
+    while(this->_writing || this->_syncing) {
+        this->_cv.wait(lock) ;
+    }
+    callback() ;
+
+    // 上一次 dump 失败留下的旧日志还在的话，把当前日志接到它后面，两份都要等这次 dump 成功才能删
+    struct stat info ;
+    if(stat(old_name , &info) == 0) {
+        int old_fd = ::open(old_name , O_WRONLY | O_APPEND) ;
+        if(old_fd == -1) {
+            return false ;
+        }
+        std::string buf(64 * 1024 , 0) ;
+        uint64_t offset = 0 ;
+        bool ok = true ;
+        while(ok && offset < this->_size) {
+            ssize_t n = pread(this->_fd , &buf[0] , std::min<uint64_t>(buf.size() , this->_size - offset) , offset) ;
+            ok = n > 0 && ::write(old_fd , buf.data() , n) == n ;
+            offset += n > 0 ? n : 0 ;
+        }
+        ok = ok && fdatasync(old_fd) == 0 ;
+        ::close(old_fd) ;
+        if(!ok || ftruncate(this->_fd , 0) != 0) {
+            return false ;
+        }
+        this->_size = 0 ;
+        return true ;
+    }
+
+    if(rename(this->_file_name.data() , old_name) != 0) {
+        return false ;
+    }
+    int fd = ::open(this->_file_name.data() , O_RDWR | O_CREAT | O_TRUNC , 0644) ;
+    if(fd == -1) {
+        // 新日志建不出来就接着往旧日志里写，旧日志改回原来的名字
+        if(rename(old_name , this->_file_name.data()) != 0) { }
+        return false ;
+    }
+    // 换下来的日志还有没刷的写，dump 完删掉之前都要能重放
+    this->sync(this->_fd) ;
+    ::close(this->_fd) ;
+    this->_fd = fd ;
+    this->_size = 0 ;
+    this->_dirty = false ;
+    return true ;
+}
+
+bool WriteAheadLog::replay(const char *fileName , const std::function<bool(const ByteArray&)>& handler) {
+    int fd = ::open(fileName , O_RDWR) ;
+    if(fd == -1) {
+        return errno == ENOENT ;
+    }
+    struct stat info ;
+    if(fstat(fd , &info) != 0) {
+        ::close(fd) ;
+        return false ;
+    }
+    if(info.st_size == 0) {
+        ::close(fd) ;
+        return true ;
+    }
+    char *data = reinterpret_cast<char*>(mmap(nullptr , info.st_size , PROT_READ , MAP_PRIVATE , fd , 0)) ;
+    if(data == MAP_FAILED) {
+        ::close(fd) ;
+        return false ;
+    }
+    const uint64_t size = info.st_size ;
+    uint64_t offset = 0 ;
+    bool ok = true ;
+    while(offset + HEADER_SIZE <= size) {
+        uint32_t crc , length ;
+        memcpy(&crc , data + offset , sizeof(uint32_t)) ;
+        memcpy(&length , data + offset + sizeof(uint32_t) , sizeof(uint32_t)) ;
+        if(length > size - offset - HEADER_SIZE ||
+           crc32c(data + offset + sizeof(uint32_t) , sizeof(uint32_t) + length) != crc) {
+            break ;
+        }
+        if(handler(ByteArray(data + offset + HEADER_SIZE , length)) == false) {
+            ok = false ;
+            break ;
+        }
+        offset += HEADER_SIZE + length ;
+    }
+    munmap(data , info.st_size) ;
+    if(ok && offset < size && ftruncate(fd , offset) != 0) {
+        ok = false ;
+    }
+    ::close(fd) ;
+    return ok ;
+}
+
+void WriteAheadLog::add_put(std::string *record , const ByteArray& key , const ByteArray& value) {
+    char buf[1 + MAX_VARINT_LENGTH] ;
+    buf[0] = WAL_PUT ;
+    record->append(buf , 1 + encode_varint(buf + 1 , key.size())) ;
+    record->append(key.data() , key.size()) ;
+    record->append(buf , encode_varint(buf , value.size())) ;
+    record->append(value.data() , value.size()) ;
+}
+
+void WriteAheadLog::add_delete(std::string *record , const ByteArray& key) {
+    char buf[1 + MAX_VARINT_LENGTH] ;
+    buf[0] = WAL_DELETE ;
+    record->append(buf , 1 + encode_varint(buf + 1 , key.size())) ;
+    record->append(key.data() , key.size()) ;
+}
+
+bool WriteAheadLog::next_op(const char **p , const char *limit , bool *is_delete , ByteArray *key , ByteArray *value) {
+    const char *cur = *p ;
+    if(cur >= limit || (*cur != WAL_PUT && *cur != WAL_DELETE)) {
+        return false ;
+    }
+    *is_delete = *cur++ == WAL_DELETE ;
+    uint64_t size ;
+    int n = decode_varint(cur , limit , &size) ;
+    if(n == 0 || size > static_cast<uint64_t>(limit - cur - n)) {
+        return false ;
+    }
+    *key = ByteArray(cur + n , size) ;
+    cur += n + size ;
+    if(!*is_delete) {
+        n = decode_varint(cur , limit , &size) ;
+        if(n == 0 || size > static_cast<uint64_t>(limit - cur - n)) {
+            return false ;
+        }
+        *value = ByteArray(cur + n , size) ;
+        cur += n + size ;
+    }
+    *p = cur ;
+    return true ;
+}
+
+} // namespace table
+
+#endif
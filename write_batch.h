@@ -0,0 +1,61 @@
+#ifndef TABLE_WRITE_BATCH_H
+#define TABLE_WRITE_BATCH_H
+
+// 一批 put/del，用 Table::write 一次写进表里
+// 1. 写之前按 key 排好序，跳表的 Writer 每个 key 都从上一个 key 的前驱开始找，不用每次从头节点开始
+// 2. 同一个 key 在批里出现多次的时候，排序是稳定的，按加入的顺序写，最后一次操作生效
+// 3. 整批写完之前其他线程的 get/multi_get/scan 看不到其中任何一条
+#include <string>
+#include <vector>
+#include "byte_array.h"
+
+namespace table {
+
+class WriteBatch {
+public :
+    WriteBatch() { }
+
+    // 把 key 设置成 value
+    void put(const ByteArray& key , const ByteArray& value) ;
+
+    // 删除 key，key 不存在的话什么也不做
+    void del(const ByteArray& key) ;
+
+    // 清空，可以接着用来攒下一批
+    void clear() ;
+
+    // 批里有多少条操作
+    size_t count() const ;
+
+private :
+    friend class Table ;
+    friend class ShardedTable ;
+
+    struct Record {
+        bool is_delete ;
+        std::string key ;
+        std::string value ;
+    } ;
+
+    std::vector<Record> _records ;
+} ;
+
+void WriteBatch::put(const ByteArray& key , const ByteArray& value) {
+    this->_records.push_back({false , std::string(key.data() , key.size()) , std::string(value.data() , value.size())}) ;
+}
+
+void WriteBatch::del(const ByteArray& key) {
+    this->_records.push_back({true , std::string(key.data() , key.size()) , std::string()}) ;
+}
+
+void WriteBatch::clear() {
+    this->_records.clear() ;
+}
+
+size_t WriteBatch::count() const {
+    return this->_records.size() ;
+}
+
+} // namespace table
+
+#endif